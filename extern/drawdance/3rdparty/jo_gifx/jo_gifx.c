@@ -345,19 +345,26 @@ jo_gifx_t *jo_gifx_start(jo_gifx_write_fn write_fn, void *user, uint16_t width,
     return gif;
 }
 
-bool jo_gifx_frame(jo_gifx_write_fn write_fn, void *user, jo_gifx_t *gif,
-                   uint32_t *rgba, uint16_t delayCsec)
+struct jo_gifx_frame_t {
+    unsigned char palette[0x300];
+    uint16_t width, height;
+    int numColors;
+    unsigned char pixels[];
+};
+
+// Quantizes the given pixels into the palette and the first width * height
+// bytes of pixels, the rest of which is scratch space for dithering.
+static void jo_gifx_quantize_pixels(uint32_t *rgba, uint16_t width,
+                                    uint16_t height, int numColors,
+                                    unsigned char *palette,
+                                    unsigned char *pixels)
 {
-    uint16_t width = gif->width;
-    uint16_t height = gif->height;
     size_t size = (size_t)width * (size_t)height;
+    jo_gifx_quantize(rgba, size * 4, 1, palette, numColors);
 
-    unsigned char *palette = gif->palette;
-    jo_gifx_quantize(rgba, size * 4, 1, palette, gif->numColors);
-
-    unsigned char *indexedPixels = gif->pixels;
+    unsigned char *indexedPixels = pixels;
     {
-        unsigned char *ditheredPixels = gif->pixels + size;
+        unsigned char *ditheredPixels = pixels + size;
         for (size_t i = 0; i < size; ++i) {
             uint32_t color = rgba[i];
             ditheredPixels[i * 4 + 0] = (color >> 16) & 0xff;
@@ -371,7 +378,7 @@ bool jo_gifx_frame(jo_gifx_write_fn write_fn, void *user, jo_gifx_t *gif,
                           ditheredPixels[k + 2]};
             int bestd = 0x7FFFFFFF, best = -1;
             // TODO: exhaustive search. do something better.
-            for (int i = 0; i < gif->numColors; ++i) {
+            for (int i = 0; i < numColors; ++i) {
                 int bb = palette[i * 3 + 0] - rgb[0];
                 int gg = palette[i * 3 + 1] - rgb[1];
                 int rr = palette[i * 3 + 2] - rgb[2];
@@ -418,6 +425,16 @@ bool jo_gifx_frame(jo_gifx_write_fn write_fn, void *user, jo_gifx_t *gif,
             }
         }
     }
+}
+
+static bool jo_gifx_write_pixels(jo_gifx_write_fn write_fn, void *user,
+                                 jo_gifx_t *gif, const unsigned char *palette,
+                                 unsigned char *indexedPixels,
+                                 uint16_t delayCsec)
+{
+    uint16_t width = gif->width;
+    uint16_t height = gif->height;
+    size_t size = (size_t)width * (size_t)height;
     if (gif->frame == 0) {
         // Global Color Table
         write_fn(user, palette, 3 * (1 << (gif->palSize + 1)));
@@ -464,6 +481,45 @@ bool jo_gifx_frame(jo_gifx_write_fn write_fn, void *user, jo_gifx_t *gif,
     return ok;
 }
 
+bool jo_gifx_frame(jo_gifx_write_fn write_fn, void *user, jo_gifx_t *gif,
+                   uint32_t *rgba, uint16_t delayCsec)
+{
+    jo_gifx_quantize_pixels(rgba, gif->width, gif->height, gif->numColors,
+                            gif->palette, gif->pixels);
+    return jo_gifx_write_pixels(write_fn, user, gif, gif->palette, gif->pixels,
+                                delayCsec);
+}
+
+jo_gifx_frame_t *jo_gifx_frame_new(const jo_gifx_t *gif)
+{
+    size_t size = (size_t)gif->width * (size_t)gif->height;
+    jo_gifx_frame_t *frame = calloc(1, sizeof(*frame) + size * 5);
+    if (frame) {
+        frame->width = gif->width;
+        frame->height = gif->height;
+        frame->numColors = gif->numColors;
+    }
+    return frame;
+}
+
+void jo_gifx_frame_free(jo_gifx_frame_t *frame)
+{
+    free(frame);
+}
+
+void jo_gifx_frame_quantize(jo_gifx_frame_t *frame, uint32_t *rgba)
+{
+    jo_gifx_quantize_pixels(rgba, frame->width, frame->height,
+                            frame->numColors, frame->palette, frame->pixels);
+}
+
+bool jo_gifx_frame_write(jo_gifx_write_fn write_fn, void *user, jo_gifx_t *gif,
+                         jo_gifx_frame_t *frame, uint16_t delayCsec)
+{
+    return jo_gifx_write_pixels(write_fn, user, gif, frame->palette,
+                                frame->pixels, delayCsec);
+}
+
 bool jo_gifx_end(jo_gifx_write_fn write_fn, void *user, jo_gifx_t *gif)
 {
     free(gif);
@@ -36,6 +36,7 @@
 #include <stdint.h>
 
 typedef struct jo_gifx_t jo_gifx_t;
+typedef struct jo_gifx_frame_t jo_gifx_frame_t;
 typedef bool (*jo_gifx_write_fn)(void *user, const void *buffer, size_t size);
 
 // Allocate handle, write header. Width and height are the image dimensions,
@@ -51,6 +52,21 @@ jo_gifx_t *jo_gifx_start(jo_gifx_write_fn write_fn, void *user, uint16_t width,
 bool jo_gifx_frame(jo_gifx_write_fn write_fn, void *user, jo_gifx_t *gif,
                    uint32_t *rgba, uint16_t delayCsec);
 
+// The functions below split up jo_gifx_frame so that the expensive quantization
+// can run on multiple threads. Allocating and quantizing a frame only reads the
+// handle, so it's fine to do that on any thread. Writing must happen in order
+// and on only one thread at a time, since it uses the handle's LZW tables.
+// Returns NULL if allocation fails.
+jo_gifx_frame_t *jo_gifx_frame_new(const jo_gifx_t *gif);
+
+void jo_gifx_frame_free(jo_gifx_frame_t *frame);
+
+void jo_gifx_frame_quantize(jo_gifx_frame_t *frame, uint32_t *rgba);
+
+// A quantized frame can be written multiple times, e.g. with different delays.
+bool jo_gifx_frame_write(jo_gifx_write_fn write_fn, void *user, jo_gifx_t *gif,
+                         jo_gifx_frame_t *frame, uint16_t delayCsec);
+
 // Frees the handle, writes trailer and returns if that worked. The handle
 // *always* gets freed, even if writing the trailer failed.
 bool jo_gifx_end(jo_gifx_write_fn write_fn, void *user, jo_gifx_t *gif);
@@ -49,6 +49,14 @@ typedef void *volatile DP_AtomicPtr;
 #    define DP_atomic_ptr_set(X, VALUE) \
         ((void)InterlockedExchangePointer((X), (VALUE)))
 #    define DP_atomic_ptr_xch(X, VALUE) InterlockedExchangePointer((X), (VALUE))
+#    define DP_atomic_ptr_get(X) \
+        InterlockedCompareExchangePointer((X), NULL, NULL)
+
+DP_INLINE bool DP_atomic_ptr_compare_exchange(DP_AtomicPtr *x, void *expected,
+                                              void *desired)
+{
+    return InterlockedCompareExchangePointer(x, desired, expected) == expected;
+}
 
 #else
 #    include <stdatomic.h>
@@ -76,6 +84,13 @@ typedef _Atomic(void *) DP_AtomicPtr;
 #    define DP_ATOMIC_PTR_INIT(X)       X
 #    define DP_atomic_ptr_set(X, VALUE) atomic_store((X), (VALUE))
 #    define DP_atomic_ptr_xch(X, VALUE) atomic_exchange((X), (VALUE))
+#    define DP_atomic_ptr_get(X)        atomic_load((X))
+
+DP_INLINE bool DP_atomic_ptr_compare_exchange(DP_AtomicPtr *x, void *expected,
+                                              void *desired)
+{
+    return atomic_compare_exchange_strong(x, &expected, desired);
+}
 
 #endif
 
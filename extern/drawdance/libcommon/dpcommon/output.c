@@ -285,6 +285,23 @@ DP_Output *DP_file_output_new_from_path(const char *path)
 #endif
 }
 
+DP_Output *DP_file_output_update_new_from_path(const char *path)
+{
+    DP_ASSERT(path);
+#ifdef DP_QT_IO
+    return DP_qfile_output_update_new_from_path(path, DP_output_new);
+#else
+    FILE *fp = fopen(path, "r+b");
+    if (fp) {
+        return DP_file_output_new(fp, true);
+    }
+    else {
+        DP_error_set("Can't open '%s': %s", path, strerror(errno));
+        return NULL;
+    }
+#endif
+}
+
 DP_Output *DP_file_output_save_new_from_path(const char *path)
 {
     DP_ASSERT(path);
@@ -66,6 +66,10 @@ DP_Output *DP_file_output_new(FILE *fp, bool close);
 
 DP_Output *DP_file_output_new_from_path(const char *path);
 
+// Opens an existing file for writing without truncating it, positioned at the
+// start. Used to append to files in place, seek to where you want to write.
+DP_Output *DP_file_output_update_new_from_path(const char *path);
+
 // With Qt file IO turned on, this writes to a temporary file and then renames
 // it if there were no errors. Otherwise, this just opens the file normally.
 // If Qt can't manage to create a temporary file, it will fall back to writing
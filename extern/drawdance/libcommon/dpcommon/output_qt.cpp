@@ -112,11 +112,12 @@ static const DP_OutputMethods *qfile_output_init(void *internal, void *arg)
     return &qfile_output_methods;
 }
 
-extern "C" DP_Output *DP_qfile_output_new_from_path(const char *path,
-                                                    DP_OutputQtNewFn new_fn)
+static DP_Output *qfile_output_new(const char *path,
+                                   QIODevice::OpenMode open_mode,
+                                   DP_OutputQtNewFn new_fn)
 {
     QFile *file = new QFile{QString::fromUtf8(path)};
-    if (file->open(QIODevice::WriteOnly)) {
+    if (file->open(open_mode)) {
         return new_fn(qfile_output_init, file, sizeof(DP_QFileOutputState));
     }
     else {
@@ -127,6 +128,20 @@ extern "C" DP_Output *DP_qfile_output_new_from_path(const char *path,
     }
 }
 
+extern "C" DP_Output *DP_qfile_output_new_from_path(const char *path,
+                                                    DP_OutputQtNewFn new_fn)
+{
+    return qfile_output_new(path, QIODevice::WriteOnly, new_fn);
+}
+
+extern "C" DP_Output *
+DP_qfile_output_update_new_from_path(const char *path, DP_OutputQtNewFn new_fn)
+{
+    // Opening for reading too is what keeps QFile from truncating the file.
+    return qfile_output_new(path, QIODevice::ReadWrite | QIODevice::ExistingOnly,
+                            new_fn);
+}
+
 
 struct DP_QSaveFileOutputState {
     QSaveFile *sf;
@@ -12,6 +12,9 @@ typedef DP_Output *(*DP_OutputQtNewFn)(DP_OutputInitFn init, void *arg,
 DP_Output *DP_qfile_output_new_from_path(const char *path,
                                          DP_OutputQtNewFn new_fn);
 
+DP_Output *DP_qfile_output_update_new_from_path(const char *path,
+                                                DP_OutputQtNewFn new_fn);
+
 DP_Output *DP_qsavefile_output_new_from_path(const char *path,
                                              DP_OutputQtNewFn new_fn);
 
@@ -40,6 +40,12 @@ typedef unsigned long long DP_ThreadId;
 #    define DP_THREAD_ID_FMT "llu"
 #endif
 
+#ifdef _MSC_VER
+#    define DP_THREAD_LOCAL __declspec(thread)
+#else
+#    define DP_THREAD_LOCAL __thread
+#endif
+
 typedef struct DP_Mutex DP_Mutex;
 typedef struct DP_Semaphore DP_Semaphore;
 typedef struct DP_Thread DP_Thread;
@@ -187,15 +187,9 @@ void DP_thread_free_join(DP_Thread *thread)
     }
 }
 
-#ifdef _MSC_VER
-#    define THREAD_LOCAL __declspec(thread)
-#else
-#    define THREAD_LOCAL __thread
-#endif
-
-static THREAD_LOCAL unsigned int error_state_count = 0;
-static THREAD_LOCAL size_t error_state_buffer_size = 0;
-static THREAD_LOCAL char *error_state_buffer = NULL;
+static DP_THREAD_LOCAL unsigned int error_state_count = 0;
+static DP_THREAD_LOCAL size_t error_state_buffer_size = 0;
+static DP_THREAD_LOCAL char *error_state_buffer = NULL;
 
 static void free_error_state(void)
 {
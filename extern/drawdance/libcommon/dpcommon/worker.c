@@ -41,6 +41,8 @@ struct DP_WorkerParams {
     int thread_index;
 };
 
+static DP_THREAD_LOCAL bool on_worker_thread;
+
 
 static bool shift_worker_element(DP_Mutex *queue_mutex, DP_Queue *queue,
                                  size_t element_size, void *out_element)
@@ -61,6 +63,7 @@ static void run_worker_thread(void *data)
     DP_Worker *worker = params->worker;
     int thread_index = params->thread_index;
     DP_free(params);
+    on_worker_thread = true;
 
     size_t element_size = worker->element_size;
     DP_WorkerJobFn job_fn = worker->job_fn;
@@ -160,3 +163,8 @@ void DP_worker_push(DP_Worker *worker, void *element)
     DP_MUTEX_MUST_UNLOCK(queue_mutex);
     DP_SEMAPHORE_MUST_POST(worker->sem);
 }
+
+bool DP_worker_on_thread(void)
+{
+    return on_worker_thread;
+}
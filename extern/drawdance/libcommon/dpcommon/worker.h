@@ -37,5 +37,9 @@ int DP_worker_thread_count(DP_Worker *worker);
 
 void DP_worker_push(DP_Worker *worker, void *element);
 
+// Whether the calling thread is running jobs for some worker. Code that could
+// spin up a worker of its own should stay serial in that case instead.
+bool DP_worker_on_thread(void);
+
 
 #endif
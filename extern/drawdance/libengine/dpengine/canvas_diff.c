@@ -24,20 +24,33 @@
 #include "tile.h"
 #include <dpcommon/common.h>
 #include <dpcommon/conversions.h>
+#ifdef _MSC_VER
+#    include <intrin.h>
+#endif
 
 
+// Tile changes are a bitset with one bit per tile. On top of that sits a
+// summary bitset with one bit per word of the former, set if that word has any
+// bits in it. Iterating over changes only visits the words that the summary
+// says are non-empty, so a small change on a huge canvas doesn't require
+// scanning everything on every tick.
+#define WORD_BITS 32
+
 struct DP_CanvasDiff {
     int count;
     int xtiles, ytiles;
-    int tile_changes_reserved;
-    bool *tile_changes;
+    int word_count;
+    int summary_count;
+    int words_reserved;
+    uint32_t *tile_changes;
+    uint32_t *word_changes;
     bool layer_props_changed;
 };
 
 DP_CanvasDiff *DP_canvas_diff_new(void)
 {
     DP_CanvasDiff *diff = DP_malloc(sizeof(*diff));
-    *diff = (DP_CanvasDiff){0, 0, 0, 0, NULL, false};
+    *diff = (DP_CanvasDiff){0, 0, 0, 0, 0, 0, NULL, NULL, false};
     return diff;
 }
 
@@ -50,6 +63,66 @@ void DP_canvas_diff_free(DP_CanvasDiff *diff)
 }
 
 
+static int word_count_for(int bit_count)
+{
+    return (bit_count + WORD_BITS - 1) / WORD_BITS;
+}
+
+static int lowest_bit(uint32_t x)
+{
+    DP_ASSERT(x != 0);
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, x);
+    return (int)index;
+#else
+    return __builtin_ctz(x);
+#endif
+}
+
+// Mask of the bits in word w that correspond to tile indexes [start, end).
+static uint32_t range_mask(int w, int start, int end)
+{
+    int word_start = w * WORD_BITS;
+    int lo = DP_max_int(start - word_start, 0);
+    int hi = DP_min_int(end - word_start, WORD_BITS);
+    if (lo < hi) {
+        uint32_t upper = hi == WORD_BITS ? UINT32_MAX : (1u << hi) - 1u;
+        return upper & ~((1u << lo) - 1u);
+    }
+    else {
+        return 0;
+    }
+}
+
+static void set_word_bits(DP_CanvasDiff *diff, int w, uint32_t bits)
+{
+    if (bits != 0) {
+        diff->tile_changes[w] |= bits;
+        diff->word_changes[w / WORD_BITS] |= 1u << (w % WORD_BITS);
+    }
+}
+
+static void clear_word_bits(DP_CanvasDiff *diff, int w, uint32_t bits)
+{
+    uint32_t word = diff->tile_changes[w] & ~bits;
+    diff->tile_changes[w] = word;
+    if (word == 0) {
+        diff->word_changes[w / WORD_BITS] &= ~(1u << (w % WORD_BITS));
+    }
+}
+
+static void mark_range(DP_CanvasDiff *diff, int start, int end)
+{
+    if (start < end) {
+        int last = (end - 1) / WORD_BITS;
+        for (int w = start / WORD_BITS; w <= last; ++w) {
+            set_word_bits(diff, w, range_mask(w, start, end));
+        }
+    }
+}
+
+
 void DP_canvas_diff_begin(DP_CanvasDiff *diff, int old_width, int old_height,
                           int current_width, int current_height,
                           bool layer_props_changed)
@@ -62,45 +135,124 @@ void DP_canvas_diff_begin(DP_CanvasDiff *diff, int old_width, int old_height,
     int xtiles = DP_tile_size_round_up(current_width);
     int ytiles = DP_tile_size_round_up(current_height);
     int count = xtiles * ytiles;
+    int word_count = word_count_for(count);
+    int summary_count = word_count_for(word_count);
     diff->count = count;
     diff->xtiles = xtiles;
     diff->ytiles = ytiles;
-    if (diff->tile_changes_reserved < count) {
-        diff->tile_changes_reserved = count;
-        size_t size = DP_int_to_size(count) * sizeof(*diff->tile_changes);
-        diff->tile_changes = DP_realloc(diff->tile_changes, size);
+    diff->word_count = word_count;
+    diff->summary_count = summary_count;
+    // The summary lives in the same allocation, right after the tile bits.
+    int words_reserved = diff->words_reserved;
+    bool reallocated = words_reserved < word_count;
+    if (reallocated) {
+        words_reserved = word_count;
+        diff->words_reserved = words_reserved;
+        size_t total = DP_int_to_size(words_reserved + summary_count);
+        diff->tile_changes =
+            DP_realloc(diff->tile_changes, total * sizeof(uint32_t));
+        diff->word_changes = diff->tile_changes + words_reserved;
     }
-    if (old_width != current_width || old_height != current_height) {
-        bool *tile_changes = diff->tile_changes;
-        for (int i = 0; i < count; ++i) {
-            tile_changes[i] = true;
-        }
+    bool resized = old_width != current_width || old_height != current_height;
+    if ((reallocated || resized) && diff->tile_changes) {
+        // Clear everything first, a smaller size would otherwise leave stale
+        // bits behind beyond the end of the current tile count.
+        size_t total =
+            DP_int_to_size(words_reserved + word_count_for(words_reserved));
+        memset(diff->tile_changes, 0, total * sizeof(uint32_t));
+        mark_range(diff, 0, count);
     }
     diff->layer_props_changed = layer_props_changed;
 }
 
+static void check(DP_CanvasDiff *diff, DP_CanvasDiffCheckRangeFn range_fn,
+                  DP_CanvasDiffCheckFn fn, void *data)
+{
+    int count = diff->count;
+    int word_count = diff->word_count;
+    for (int w = 0; w < word_count; ++w) {
+        uint32_t unchecked = ~diff->tile_changes[w] & range_mask(w, 0, count);
+        int start = w * WORD_BITS;
+        if (unchecked != 0
+            && (!range_fn
+                || range_fn(data, start,
+                            DP_min_int(start + WORD_BITS, count)))) {
+            uint32_t bits = 0;
+            do {
+                int b = lowest_bit(unchecked);
+                unchecked &= unchecked - 1u;
+                if (fn(data, start + b)) {
+                    bits |= 1u << b;
+                }
+            } while (unchecked != 0);
+            set_word_bits(diff, w, bits);
+        }
+    }
+}
+
 void DP_canvas_diff_check(DP_CanvasDiff *diff, DP_CanvasDiffCheckFn fn,
                           void *data)
 {
     DP_ASSERT(diff);
     DP_ASSERT(fn);
-    int count = diff->count;
-    bool *tile_changes = diff->tile_changes;
-    for (int i = 0; i < count; ++i) {
-        bool *tile_change = &tile_changes[i];
-        if (!*tile_change && fn(data, i)) {
-            *tile_change = true;
-        }
-    }
+    check(diff, NULL, fn, data);
+}
+
+void DP_canvas_diff_check_ranges(DP_CanvasDiff *diff,
+                                 DP_CanvasDiffCheckRangeFn range_fn,
+                                 DP_CanvasDiffCheckFn fn, void *data)
+{
+    DP_ASSERT(diff);
+    DP_ASSERT(range_fn);
+    DP_ASSERT(fn);
+    check(diff, range_fn, fn, data);
 }
 
 void DP_canvas_diff_check_all(DP_CanvasDiff *diff)
 {
     DP_ASSERT(diff);
-    int count = diff->count;
-    bool *tile_changes = diff->tile_changes;
-    for (int i = 0; i < count; ++i) {
-        tile_changes[i] = true;
+    mark_range(diff, 0, diff->count);
+}
+
+void DP_canvas_diff_check_tile_bounds(DP_CanvasDiff *diff, int tile_left,
+                                      int tile_top, int tile_right,
+                                      int tile_bottom)
+{
+    DP_ASSERT(diff);
+    int xtiles = diff->xtiles;
+    int left = DP_max_int(0, tile_left);
+    int top = DP_max_int(0, tile_top);
+    int right = DP_min_int(xtiles - 1, tile_right);
+    int bottom = DP_min_int(diff->ytiles - 1, tile_bottom);
+    for (int y = top; y <= bottom; ++y) {
+        mark_range(diff, y * xtiles + left, y * xtiles + right + 1);
+    }
+}
+
+static void each_index(DP_CanvasDiff *diff, bool reset,
+                       DP_CanvasDiffEachIndexFn fn, void *data)
+{
+    uint32_t *tile_changes = diff->tile_changes;
+    uint32_t *word_changes = diff->word_changes;
+    int summary_count = diff->summary_count;
+    for (int s = 0; s < summary_count; ++s) {
+        uint32_t summary = word_changes[s];
+        while (summary != 0) {
+            int w = s * WORD_BITS + lowest_bit(summary);
+            summary &= summary - 1u;
+            uint32_t word = tile_changes[w];
+            if (reset) {
+                tile_changes[w] = 0;
+            }
+            while (word != 0) {
+                int i = w * WORD_BITS + lowest_bit(word);
+                word &= word - 1u;
+                fn(data, i);
+            }
+        }
+        if (reset) {
+            word_changes[s] = 0;
+        }
     }
 }
 
@@ -109,13 +261,7 @@ void DP_canvas_diff_each_index(DP_CanvasDiff *diff, DP_CanvasDiffEachIndexFn fn,
 {
     DP_ASSERT(diff);
     DP_ASSERT(fn);
-    int count = diff->count;
-    bool *tile_changes = diff->tile_changes;
-    for (int i = 0; i < count; ++i) {
-        if (tile_changes[i]) {
-            fn(data, i);
-        }
-    }
+    each_index(diff, false, fn, data);
 }
 
 void DP_canvas_diff_each_index_reset(DP_CanvasDiff *diff,
@@ -123,14 +269,20 @@ void DP_canvas_diff_each_index_reset(DP_CanvasDiff *diff,
 {
     DP_ASSERT(diff);
     DP_ASSERT(fn);
-    int count = diff->count;
-    bool *tile_changes = diff->tile_changes;
-    for (int i = 0; i < count; ++i) {
-        if (tile_changes[i]) {
-            fn(data, i);
-            tile_changes[i] = false;
-        }
-    }
+    each_index(diff, true, fn, data);
+}
+
+struct DP_CanvasDiffEachPosParams {
+    int xtiles;
+    DP_CanvasDiffEachPosFn fn;
+    void *data;
+};
+
+static void each_index_to_pos(void *user, int tile_index)
+{
+    struct DP_CanvasDiffEachPosParams *params = user;
+    int xtiles = params->xtiles;
+    params->fn(params->data, tile_index % xtiles, tile_index / xtiles);
 }
 
 void DP_canvas_diff_each_pos(DP_CanvasDiff *diff, DP_CanvasDiffEachPosFn fn,
@@ -138,17 +290,8 @@ void DP_canvas_diff_each_pos(DP_CanvasDiff *diff, DP_CanvasDiffEachPosFn fn,
 {
     DP_ASSERT(diff);
     DP_ASSERT(fn);
-    int xtiles = diff->xtiles;
-    int ytiles = diff->ytiles;
-    bool *tile_changes = diff->tile_changes;
-    for (int y = 0; y < ytiles; ++y) {
-        for (int x = 0; x < xtiles; ++x) {
-            int i = y * xtiles + x;
-            if (tile_changes[i]) {
-                fn(data, x, y);
-            }
-        }
-    }
+    struct DP_CanvasDiffEachPosParams params = {diff->xtiles, fn, data};
+    each_index(diff, false, each_index_to_pos, &params);
 }
 
 void DP_canvas_diff_each_pos_reset(DP_CanvasDiff *diff,
@@ -156,18 +299,8 @@ void DP_canvas_diff_each_pos_reset(DP_CanvasDiff *diff,
 {
     DP_ASSERT(diff);
     DP_ASSERT(fn);
-    int xtiles = diff->xtiles;
-    int ytiles = diff->ytiles;
-    bool *tile_changes = diff->tile_changes;
-    for (int y = 0; y < ytiles; ++y) {
-        for (int x = 0; x < xtiles; ++x) {
-            int i = y * xtiles + x;
-            if (tile_changes[i]) {
-                fn(data, x, y);
-                tile_changes[i] = false;
-            }
-        }
-    }
+    struct DP_CanvasDiffEachPosParams params = {diff->xtiles, fn, data};
+    each_index(diff, true, each_index_to_pos, &params);
 }
 
 void DP_canvas_diff_each_pos_tile_bounds_reset(DP_CanvasDiff *diff,
@@ -183,13 +316,20 @@ void DP_canvas_diff_each_pos_tile_bounds_reset(DP_CanvasDiff *diff,
     int top = DP_max_int(0, tile_top);
     int right = DP_min_int(xtiles - 1, tile_right);
     int bottom = DP_min_int(diff->ytiles - 1, tile_bottom);
-    bool *tile_changes = diff->tile_changes;
-    for (int y = top; y <= bottom; ++y) {
-        for (int x = left; x <= right; ++x) {
-            int i = y * xtiles + x;
-            if (tile_changes[i]) {
-                fn(data, x, y);
-                tile_changes[i] = false;
+    uint32_t *tile_changes = diff->tile_changes;
+    for (int y = top; y <= bottom && left <= right; ++y) {
+        int start = y * xtiles + left;
+        int end = y * xtiles + right + 1;
+        int last = (end - 1) / WORD_BITS;
+        for (int w = start / WORD_BITS; w <= last; ++w) {
+            uint32_t bits = tile_changes[w] & range_mask(w, start, end);
+            if (bits != 0) {
+                clear_word_bits(diff, w, bits);
+                do {
+                    int i = w * WORD_BITS + lowest_bit(bits);
+                    bits &= bits - 1u;
+                    fn(data, i - y * xtiles, y);
+                } while (bits != 0);
             }
         }
     }
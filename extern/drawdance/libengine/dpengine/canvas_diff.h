@@ -26,6 +26,9 @@
 
 typedef struct DP_CanvasDiff DP_CanvasDiff;
 typedef bool (*DP_CanvasDiffCheckFn)(void *data, int tile_index);
+// Called with a range of tile indexes [start, end) before checking them. Return
+// false if nothing in that range can have changed to skip them entirely.
+typedef bool (*DP_CanvasDiffCheckRangeFn)(void *data, int start, int end);
 typedef void (*DP_CanvasDiffEachIndexFn)(void *data, int tile_index);
 typedef void (*DP_CanvasDiffEachPosFn)(void *data, int tile_x, int tile_y);
 
@@ -40,8 +43,16 @@ void DP_canvas_diff_begin(DP_CanvasDiff *diff, int old_width, int old_height,
 void DP_canvas_diff_check(DP_CanvasDiff *diff, DP_CanvasDiffCheckFn fn,
                           void *data);
 
+void DP_canvas_diff_check_ranges(DP_CanvasDiff *diff,
+                                 DP_CanvasDiffCheckRangeFn range_fn,
+                                 DP_CanvasDiffCheckFn fn, void *data);
+
 void DP_canvas_diff_check_all(DP_CanvasDiff *diff);
 
+void DP_canvas_diff_check_tile_bounds(DP_CanvasDiff *diff, int tile_left,
+                                      int tile_top, int tile_right,
+                                      int tile_bottom);
+
 void DP_canvas_diff_each_index(DP_CanvasDiff *diff, DP_CanvasDiffEachIndexFn fn,
                                void *data);
 
@@ -41,6 +41,14 @@
 #define INITIAL_CAPACITY              1024
 #define EXPAND_CAPACITY(OLD_CAPACITY) ((OLD_CAPACITY)*2)
 
+// History entries are stored in fixed-size, refcounted chunks so that
+// snapshots can share them instead of copying every entry. Must be a power of
+// two so that finding the chunk for an index is cheap.
+#define CHUNK_SHIFT            8
+#define CHUNK_SIZE             (1 << CHUNK_SHIFT)
+#define CHUNK_MASK             (CHUNK_SIZE - 1)
+#define INITIAL_CHUNK_CAPACITY 8
+
 #define MAX_FALLBEHIND 10000
 
 // We want to batch draw dabs commands when replaying messages, since they're so
@@ -59,6 +67,14 @@ typedef struct DP_Cursor {
     int x, y;
 } DP_Cursor;
 
+// Slots with a null message are empty, either because they haven't been
+// filled yet or because they got truncated away. A chunk owns a reference to
+// the message and state of each of its non-empty slots.
+typedef struct DP_CanvasHistoryChunk {
+    DP_Atomic refcount;
+    DP_CanvasHistoryEntry entries[CHUNK_SIZE];
+} DP_CanvasHistoryChunk;
+
 struct DP_CanvasHistory {
     DP_Mutex *mutex;
     DP_CanvasState *current_state;
@@ -76,9 +92,11 @@ struct DP_CanvasHistory {
     } cursors;
     int undo_depth_limit;
     int offset;
-    int capacity;
     int used;
-    DP_CanvasHistoryEntry *entries;
+    // Index of the first entry inside of the first chunk.
+    int start;
+    int chunk_capacity;
+    DP_CanvasHistoryChunk **chunks;
     DP_AffectedIndirectAreas aia;
     bool mark_command_done;
     struct {
@@ -110,7 +128,8 @@ struct DP_CanvasHistorySnapshot {
         int undo_depth_limit;
         int offset;
         int count;
-        DP_CanvasHistoryEntry *entries;
+        int start;
+        DP_CanvasHistoryChunk **chunks;
     } history;
     struct {
         int start;
@@ -121,6 +140,99 @@ struct DP_CanvasHistorySnapshot {
 };
 
 
+static DP_CanvasHistoryChunk *chunk_new(void)
+{
+    DP_CanvasHistoryChunk *chunk = DP_malloc(sizeof(*chunk));
+    DP_atomic_set(&chunk->refcount, 1);
+    for (int i = 0; i < CHUNK_SIZE; ++i) {
+        chunk->entries[i] = (DP_CanvasHistoryEntry){DP_UNDO_DONE, NULL, NULL};
+    }
+    return chunk;
+}
+
+static DP_CanvasHistoryChunk *chunk_copy(DP_CanvasHistoryChunk *chunk)
+{
+    DP_CanvasHistoryChunk *copy = DP_malloc(sizeof(*copy));
+    DP_atomic_set(&copy->refcount, 1);
+    for (int i = 0; i < CHUNK_SIZE; ++i) {
+        DP_CanvasHistoryEntry *entry = &chunk->entries[i];
+        DP_Message *msg = entry->msg;
+        copy->entries[i] =
+            msg ? (DP_CanvasHistoryEntry){entry->undo, DP_message_incref(msg),
+                                          DP_canvas_state_incref_nullable(
+                                              entry->state)}
+                : (DP_CanvasHistoryEntry){DP_UNDO_DONE, NULL, NULL};
+    }
+    return copy;
+}
+
+static DP_CanvasHistoryChunk *chunk_incref(DP_CanvasHistoryChunk *chunk)
+{
+    DP_ASSERT(DP_atomic_get(&chunk->refcount) > 0);
+    DP_atomic_inc(&chunk->refcount);
+    return chunk;
+}
+
+static void chunk_decref(DP_CanvasHistoryChunk *chunk)
+{
+    DP_ASSERT(DP_atomic_get(&chunk->refcount) > 0);
+    if (DP_atomic_dec(&chunk->refcount)) {
+        for (int i = 0; i < CHUNK_SIZE; ++i) {
+            DP_CanvasHistoryEntry *entry = &chunk->entries[i];
+            if (entry->msg) {
+                DP_message_decref(entry->msg);
+                DP_canvas_state_decref_nullable(entry->state);
+            }
+        }
+        DP_free(chunk);
+    }
+}
+
+static int chunk_count_for(int start, int used)
+{
+    return (start + used + CHUNK_MASK) >> CHUNK_SHIFT;
+}
+
+static DP_CanvasHistoryEntry *chunks_entry_at(DP_CanvasHistoryChunk **chunks,
+                                              int start, int index)
+{
+    int i = start + index;
+    return &chunks[i >> CHUNK_SHIFT]->entries[i & CHUNK_MASK];
+}
+
+// Only for reading, use entry_at_mut to modify entries.
+static DP_CanvasHistoryEntry *entry_at(DP_CanvasHistory *ch, int index)
+{
+    DP_ASSERT(index >= 0);
+    DP_ASSERT(index < ch->used);
+    return chunks_entry_at(ch->chunks, ch->start, index);
+}
+
+// The chunk may be shared with snapshots, in which case it gets copied first.
+static DP_CanvasHistoryChunk *chunk_at_mut(DP_CanvasHistory *ch,
+                                           int chunk_index)
+{
+    DP_CanvasHistoryChunk *chunk = ch->chunks[chunk_index];
+    if (DP_atomic_get(&chunk->refcount) != 1) {
+        DP_CanvasHistoryChunk *copy = chunk_copy(chunk);
+        chunk_decref(chunk);
+        ch->chunks[chunk_index] = copy;
+        return copy;
+    }
+    else {
+        return chunk;
+    }
+}
+
+static DP_CanvasHistoryEntry *entry_at_mut(DP_CanvasHistory *ch, int index)
+{
+    DP_ASSERT(index >= 0);
+    DP_ASSERT(index < ch->used);
+    int i = ch->start + index;
+    return &chunk_at_mut(ch, i >> CHUNK_SHIFT)->entries[i & CHUNK_MASK];
+}
+
+
 // History debug is very noisy, only enable it when requested.
 #if defined(NDEBUG) || !defined(DRAWDANCE_HISTORY_DEBUG)
 #    define HISTORY_DEBUG(...) /* nothing */
@@ -146,10 +258,10 @@ static const char *get_undo_name(DP_Undo undo)
 static void dump_history(DP_CanvasHistory *ch)
 {
     HISTORY_DEBUG("--- begin canvas history dump ---");
-    HISTORY_DEBUG("history %d used, %d capacity, %d offset", ch->used,
-                  ch->capacity, ch->offset);
+    HISTORY_DEBUG("history %d used, %d start, %d chunks, %d offset", ch->used,
+                  ch->start, chunk_count_for(ch->start, ch->used), ch->offset);
     for (int i = 0; i < ch->used; ++i) {
-        DP_CanvasHistoryEntry *entry = &ch->entries[i];
+        DP_CanvasHistoryEntry *entry = entry_at(ch, i);
         DP_Message *msg = entry->msg;
         HISTORY_DEBUG(
             "    H[%d] %s %s user %u state %p", i, get_undo_name(entry->undo),
@@ -422,10 +534,37 @@ static void call_save_point_fn(DP_CanvasHistory *ch, DP_CanvasState *cs,
     }
 }
 
+static DP_CanvasHistoryEntry *append_entry(DP_CanvasHistory *ch)
+{
+    int i = ch->start + ch->used;
+    int chunk_index = i >> CHUNK_SHIFT;
+    int chunk_count = chunk_count_for(ch->start, ch->used);
+    DP_CanvasHistoryChunk *chunk;
+    if (chunk_index == chunk_count) {
+        int old_capacity = ch->chunk_capacity;
+        if (chunk_count == old_capacity) {
+            int new_capacity = EXPAND_CAPACITY(old_capacity);
+            size_t new_size =
+                sizeof(*ch->chunks) * DP_int_to_size(new_capacity);
+            HISTORY_DEBUG("Resize history chunk capacity to %d", new_capacity);
+            ch->chunks = DP_realloc(ch->chunks, new_size);
+            ch->chunk_capacity = new_capacity;
+        }
+        chunk = chunk_new();
+        ch->chunks[chunk_index] = chunk;
+    }
+    else {
+        chunk = chunk_at_mut(ch, chunk_index);
+    }
+    ch->used += 1;
+    return &chunk->entries[i & CHUNK_MASK];
+}
+
 static void set_initial_entry(DP_CanvasHistory *ch, DP_CanvasState *cs)
 {
     HISTORY_DEBUG("Set initial history entry");
-    ch->entries[0] = (DP_CanvasHistoryEntry){
+    DP_ASSERT(ch->used == 0);
+    *append_entry(ch) = (DP_CanvasHistoryEntry){
         DP_UNDO_DONE, DP_msg_undo_point_new(0), DP_canvas_state_incref(cs)};
     call_save_point_fn(ch, cs, false);
 }
@@ -457,11 +596,10 @@ static void validate_history(DP_UNUSED DP_CanvasHistory *ch)
 {
     dump_history(ch);
 #ifndef NDEBUG
-    DP_CanvasHistoryEntry *entries = ch->entries;
     int used = ch->used;
     bool have_save_point = false;
     for (int i = 0; i < used; ++i) {
-        DP_CanvasHistoryEntry *entry = &entries[i];
+        DP_CanvasHistoryEntry *entry = entry_at(ch, i);
         DP_ASSERT(entry->undo == DP_UNDO_DONE || entry->undo == DP_UNDO_UNDONE
                   || entry->undo == DP_UNDO_GONE);
         DP_Message *msg = entry->msg;
@@ -505,7 +643,7 @@ DP_CanvasHistory *DP_canvas_history_new_inc(
     DP_CanvasHistory *ch = DP_malloc(sizeof(*ch));
     DP_CanvasState *cs =
         cs_or_null ? DP_canvas_state_incref(cs_or_null) : DP_canvas_state_new();
-    size_t entries_size = sizeof(*ch->entries) * INITIAL_CAPACITY;
+    size_t chunks_size = sizeof(*ch->chunks) * INITIAL_CHUNK_CAPACITY;
 
     *ch = (DP_CanvasHistory){
         mutex,
@@ -513,9 +651,10 @@ DP_CanvasHistory *DP_canvas_history_new_inc(
         {0},
         DP_UNDO_DEPTH_DEFAULT,
         0,
-        INITIAL_CAPACITY,
-        1,
-        DP_malloc(entries_size),
+        0,
+        0,
+        INITIAL_CHUNK_CAPACITY,
+        DP_malloc(chunks_size),
         {0},
         true,
         {0, 0, DP_QUEUE_NULL},
@@ -542,6 +681,7 @@ static void dispose_entry(DP_CanvasHistoryEntry *entry)
 {
     DP_message_decref(entry->msg);
     DP_canvas_state_decref_nullable(entry->state);
+    *entry = (DP_CanvasHistoryEntry){DP_UNDO_DONE, NULL, NULL};
 }
 
 static void truncate_history(DP_CanvasHistory *ch, int until)
@@ -549,14 +689,28 @@ static void truncate_history(DP_CanvasHistory *ch, int until)
     HISTORY_DEBUG("Truncate history until %d", until);
     DP_ASSERT(until <= ch->used);
     DP_ASSERT(!have_local_fork(ch) || ch->fork.start >= ch->offset + until);
-    DP_CanvasHistoryEntry *entries = ch->entries;
-    for (int i = 0; i < until; ++i) {
-        dispose_entry(&entries[i]);
+    int chunk_count = chunk_count_for(ch->start, ch->used);
+    int end = ch->start + until;
+    // Chunks that are entirely truncated are just released, they don't need
+    // to be copied even if they're shared with a snapshot.
+    int released = end >> CHUNK_SHIFT;
+    for (int i = 0; i < released; ++i) {
+        chunk_decref(ch->chunks[i]);
+    }
+
+    int remaining = end & CHUNK_MASK;
+    if (remaining != 0) {
+        DP_CanvasHistoryChunk *chunk = chunk_at_mut(ch, released);
+        for (int i = released == 0 ? ch->start : 0; i < remaining; ++i) {
+            dispose_entry(&chunk->entries[i]);
+        }
     }
+
+    size_t size = sizeof(*ch->chunks) * DP_int_to_size(chunk_count - released);
+    memmove(ch->chunks, ch->chunks + released, size);
+    ch->start = remaining;
     ch->used -= until;
     ch->offset += until;
-    size_t size = sizeof(*entries) * DP_int_to_size(ch->used);
-    memmove(entries, entries + until, size);
 }
 
 void DP_canvas_history_free(DP_CanvasHistory *ch)
@@ -565,7 +719,11 @@ void DP_canvas_history_free(DP_CanvasHistory *ch)
         clear_fork_entries(ch);
         DP_queue_dispose(&ch->fork.queue);
         truncate_history(ch, ch->used);
-        DP_free(ch->entries);
+        int chunk_count = chunk_count_for(ch->start, ch->used);
+        for (int i = 0; i < chunk_count; ++i) {
+            chunk_decref(ch->chunks[i]);
+        }
+        DP_free(ch->chunks);
         DP_canvas_state_decref(ch->current_state);
         DP_mutex_free(ch->mutex);
         DP_free(ch->dump.buffer);
@@ -691,7 +849,6 @@ static void reset_to_state_noinc(DP_CanvasHistory *ch, DP_CanvasState *cs)
     truncate_history(ch, ch->used);
     DP_affected_indirect_areas_clear(&ch->aia);
     set_initial_entry(ch, cs);
-    ch->used = 1;
     ch->offset = 0;
     ch->mark_command_done = true;
     validate_history(ch);
@@ -763,7 +920,7 @@ void DP_canvas_history_undo_depth_limit_set(DP_CanvasHistory *ch,
 static int find_save_point_index(DP_CanvasHistory *ch)
 {
     for (int i = ch->used - 1; i >= 0; --i) {
-        DP_CanvasHistoryEntry *entry = &ch->entries[i];
+        DP_CanvasHistoryEntry *entry = entry_at(ch, i);
         if (is_valid_save_point_entry(entry)) {
             return i;
         }
@@ -780,7 +937,7 @@ static void make_save_point(DP_CanvasHistory *ch, int index,
     DP_ASSERT(index < ch->used);
     // Save points based on local fork state are invalid.
     DP_ASSERT(!have_local_fork(ch));
-    DP_CanvasHistoryEntry *entry = &ch->entries[index];
+    DP_CanvasHistoryEntry *entry = entry_at(ch, index);
     // This must actually be a valid spot for a save point.
     DP_ASSERT(is_valid_save_point_entry(entry));
     // There might already be a save point here, don't create one again.
@@ -788,7 +945,7 @@ static void make_save_point(DP_CanvasHistory *ch, int index,
         HISTORY_DEBUG("Create %s save point at %d",
                       snapshot_requested ? "requested" : "regular", index);
         DP_CanvasState *cs = ch->current_state;
-        entry->state = DP_canvas_state_incref(cs);
+        entry_at_mut(ch, index)->state = DP_canvas_state_incref(cs);
         call_save_point_fn(ch, cs, snapshot_requested);
     }
 }
@@ -824,27 +981,13 @@ static bool handle_internal(DP_CanvasHistory *ch, DP_MsgInternal *mi)
 }
 
 
-static void ensure_append_capacity(DP_CanvasHistory *ch)
-{
-    int old_capacity = ch->capacity;
-    if (ch->used == old_capacity) {
-        int new_capacity = EXPAND_CAPACITY(old_capacity);
-        size_t new_size = sizeof(*ch->entries) * DP_int_to_size(new_capacity);
-        HISTORY_DEBUG("Resize history capacity to %d entries", ch->capacity);
-        ch->entries = DP_realloc(ch->entries, new_size);
-        ch->capacity = new_capacity;
-    }
-}
-
 static int append_to_history_noinc(DP_CanvasHistory *ch, DP_Message *msg,
                                    DP_Undo undo)
 {
     DP_ASSERT(DP_message_type(msg) != DP_MSG_UNDO);
-    ensure_append_capacity(ch);
     int index = ch->used;
     HISTORY_DEBUG("Append history entry %d", index);
-    ch->entries[index] = (DP_CanvasHistoryEntry){undo, msg, NULL};
-    ch->used = index + 1;
+    *append_entry(ch) = (DP_CanvasHistoryEntry){undo, msg, NULL};
     return index;
 }
 
@@ -859,13 +1002,12 @@ static int append_to_history_inc(DP_CanvasHistory *ch, DP_Message *msg,
 static int mark_undone_actions_gone(DP_CanvasHistory *ch, int index,
                                     int *out_depth)
 {
-    unsigned int context_id = DP_message_context_id(ch->entries[index].msg);
-    DP_CanvasHistoryEntry *entries = ch->entries;
+    unsigned int context_id = DP_message_context_id(entry_at(ch, index)->msg);
     int i = index - 1;
     int depth = 1;
     int undo_depth_limit = ch->undo_depth_limit;
     for (; i >= 0 && depth < undo_depth_limit; --i) {
-        DP_CanvasHistoryEntry *entry = &entries[i];
+        DP_CanvasHistoryEntry *entry = entry_at(ch, i);
         if (is_undo_point_entry(entry)) {
             ++depth;
         }
@@ -877,6 +1019,7 @@ static int mark_undone_actions_gone(DP_CanvasHistory *ch, int index,
                 break; // Everything beyond this point is already gone.
             }
             else if (undo == DP_UNDO_UNDONE) {
+                entry = entry_at_mut(ch, i);
                 entry->undo = DP_UNDO_GONE;
                 // Undone undo points still have a state for redo purposes.
                 DP_CanvasState *cs = entry->state;
@@ -893,10 +1036,9 @@ static int mark_undone_actions_gone(DP_CanvasHistory *ch, int index,
 
 static void truncate_unreachable(DP_CanvasHistory *ch, int i, int depth)
 {
-    DP_CanvasHistoryEntry *entries = ch->entries;
     int undo_depth_limit = ch->undo_depth_limit;
     for (; i >= 0 && depth < undo_depth_limit; --i) {
-        if (is_undo_point_entry(&entries[i])) {
+        if (is_undo_point_entry(entry_at(ch, i))) {
             ++depth;
         }
     }
@@ -908,7 +1050,7 @@ static void truncate_unreachable(DP_CanvasHistory *ch, int i, int depth)
         }
     }
     // There must be a save point at or before the furthest undo point.
-    while (i > 0 && !entries[i].state) {
+    while (i > 0 && !entry_at(ch, i)->state) {
         --i;
     }
     // If we went to zero, everything is reachable.
@@ -994,9 +1136,8 @@ replay_drawing_command(DP_CanvasHistory *ch, DP_CanvasState *cs,
 
 static int search_save_point_index(DP_CanvasHistory *ch, int target_index)
 {
-    DP_CanvasHistoryEntry *entries = ch->entries;
     for (int i = target_index; i >= 0; --i) {
-        DP_CanvasHistoryEntry *entry = &entries[i];
+        DP_CanvasHistoryEntry *entry = entry_at(ch, i);
         if (entry->state) {
             DP_ASSERT(is_valid_save_point_entry(entry));
             return i;
@@ -1023,12 +1164,11 @@ static void replay_from_inc(DP_CanvasHistory *ch, DP_DrawContext *dc,
                             int start_index, DP_CanvasState *start_cs)
 {
     DP_ASSERT(start_cs);
-    DP_CanvasHistoryEntry *entries = ch->entries;
     DP_CanvasState *cs = DP_canvas_state_incref(start_cs);
 
     int used = ch->used;
     for (int i = start_index + 1; i < used; ++i) {
-        DP_CanvasHistoryEntry *entry = &entries[i];
+        DP_CanvasHistoryEntry *entry = entry_at(ch, i);
         DP_Undo undo = entry->undo;
         if (undo != DP_UNDO_GONE) {
             DP_Message *msg = entry->msg;
@@ -1039,6 +1179,7 @@ static void replay_from_inc(DP_CanvasHistory *ch, DP_DrawContext *dc,
                 if (ch->replay.used != 0) {
                     cs = flush_replay_buffer(ch, cs, dc);
                 }
+                entry = entry_at_mut(ch, i);
                 DP_canvas_state_decref_nullable(entry->state);
                 entry->state = DP_canvas_state_incref(cs);
             }
@@ -1069,7 +1210,7 @@ static bool search_and_replay_from(DP_CanvasHistory *ch, DP_DrawContext *dc,
     int start_index = search_save_point_index(ch, target_index);
     HISTORY_DEBUG("Replay from target %d, start %d", target_index, start_index);
     if (start_index >= 0) {
-        replay_from_inc(ch, dc, start_index, ch->entries[start_index].state);
+        replay_from_inc(ch, dc, start_index, entry_at(ch, start_index)->state);
         return true;
     }
     else {
@@ -1110,12 +1251,11 @@ static bool is_done_entry_by(DP_CanvasHistoryEntry *entry,
 static int find_first_undo_point(DP_CanvasHistory *ch, unsigned int context_id,
                                  int *out_depth)
 {
-    DP_CanvasHistoryEntry *entries = ch->entries;
     int i;
     int depth = 0;
     int undo_depth_limit = ch->undo_depth_limit;
     for (i = ch->used - 1; i >= 0 && depth <= undo_depth_limit; --i) {
-        DP_CanvasHistoryEntry *entry = &entries[i];
+        DP_CanvasHistoryEntry *entry = entry_at(ch, i);
         if (is_undo_point_entry(entry)) {
             ++depth;
             if (is_done_entry_by(entry, context_id)) {
@@ -1130,22 +1270,20 @@ static int find_first_undo_point(DP_CanvasHistory *ch, unsigned int context_id,
 static void mark_entries_undone(DP_CanvasHistory *ch, unsigned int context_id,
                                 int undo_start)
 {
-    DP_CanvasHistoryEntry *entries = ch->entries;
     int used = ch->used;
     for (int i = undo_start; i < used; ++i) {
-        DP_CanvasHistoryEntry *entry = &entries[i];
+        DP_CanvasHistoryEntry *entry = entry_at(ch, i);
         if (is_done_entry_by(entry, context_id)) {
+            entry = entry_at_mut(ch, i);
             entry->undo = DP_UNDO_UNDONE;
         }
         // Clear out any states that were left behind by local fork starts, they
         // happen too frequently to update them all on every undo/redo. Instead
         // only undo points get to keep their states and get updated.
-        if (!is_undo_point_entry(entry)) {
-            DP_CanvasState *cs = entry->state;
-            if (cs) {
-                DP_canvas_state_decref_nullable(cs);
-                entry->state = NULL;
-            }
+        if (!is_undo_point_entry(entry) && entry->state) {
+            entry = entry_at_mut(ch, i);
+            DP_canvas_state_decref(entry->state);
+            entry->state = NULL;
         }
     }
 }
@@ -1176,12 +1314,11 @@ static bool undo(DP_CanvasHistory *ch, DP_DrawContext *dc,
 static int find_oldest_redo_point(DP_CanvasHistory *ch, unsigned int context_id,
                                   int *out_depth)
 {
-    DP_CanvasHistoryEntry *entries = ch->entries;
     int redo_start = -1;
     int depth = 0;
     int undo_depth_limit = ch->undo_depth_limit;
     for (int i = ch->used - 1; i >= 0 && depth <= undo_depth_limit; --i) {
-        DP_CanvasHistoryEntry *entry = &entries[i];
+        DP_CanvasHistoryEntry *entry = entry_at(ch, i);
         if (is_undo_point_entry(entry)) {
             ++depth;
             if (DP_message_context_id(entry->msg) == context_id) {
@@ -1202,18 +1339,17 @@ static int find_oldest_redo_point(DP_CanvasHistory *ch, unsigned int context_id,
 static void mark_entries_redone(DP_CanvasHistory *ch, unsigned int context_id,
                                 int redo_start)
 {
-    DP_CanvasHistoryEntry *entries = ch->entries;
-    entries[redo_start].undo = DP_UNDO_DONE;
+    entry_at_mut(ch, redo_start)->undo = DP_UNDO_DONE;
     int used = ch->used;
     for (int i = redo_start + 1; i < used; ++i) {
-        DP_CanvasHistoryEntry *entry = &entries[i];
+        DP_CanvasHistoryEntry *entry = entry_at(ch, i);
         if (DP_message_context_id(entry->msg) == context_id) {
             DP_Undo undo = entry->undo;
             if (is_undo_point_entry(entry) && undo != DP_UNDO_GONE) {
                 break;
             }
             else if (undo == DP_UNDO_UNDONE) {
-                entry->undo = DP_UNDO_DONE;
+                entry_at_mut(ch, i)->undo = DP_UNDO_DONE;
             }
         }
     }
@@ -1554,7 +1690,7 @@ void DP_canvas_history_handle_local_multidab_dec(DP_CanvasHistory *ch,
 }
 
 
-static int find_first_reachable_state_index(DP_CanvasHistoryEntry *entries,
+static int find_first_reachable_state_index(DP_CanvasHistory *ch,
                                             int entries_used,
                                             int undo_depth_limit,
                                             DP_CanvasState **out_cs)
@@ -1562,16 +1698,16 @@ static int find_first_reachable_state_index(DP_CanvasHistoryEntry *entries,
     int start = entries_used - 1;
     int depth = 0;
     for (; start > 0 && depth < undo_depth_limit; --start) {
-        if (is_undo_point_entry(&entries[start])) {
+        if (is_undo_point_entry(entry_at(ch, start))) {
             ++depth;
         }
     }
     // There must be a save point at or before the furthest undo point.
-    while (start > 0 && !entries[start].state) {
+    while (start > 0 && !entry_at(ch, start)->state) {
         --start;
     }
 
-    DP_CanvasHistoryEntry *entry = &entries[start];
+    DP_CanvasHistoryEntry *entry = entry_at(ch, start);
     DP_ASSERT(entry->state);
     *out_cs = entry->state;
     // If the starting point is not an undo point, the command inside the entry
@@ -1587,12 +1723,11 @@ bool DP_canvas_history_reset_image_new(
     DP_ASSERT(accept_state);
     DP_ASSERT(accept_message);
 
-    DP_CanvasHistoryEntry *entries = ch->entries;
     int entries_used = ch->used;
     int undo_depth_limit = ch->undo_depth_limit;
 
     DP_CanvasState *cs;
-    int start = find_first_reachable_state_index(entries, entries_used,
+    int start = find_first_reachable_state_index(ch, entries_used,
                                                  undo_depth_limit, &cs);
     if (!accept_state(user, cs)) {
         return false;
@@ -1604,7 +1739,7 @@ bool DP_canvas_history_reset_image_new(
     }
 
     for (int i = start; i < entries_used; ++i) {
-        DP_CanvasHistoryEntry *entry = &entries[i];
+        DP_CanvasHistoryEntry *entry = entry_at(ch, i);
         switch (entry->undo) {
         case DP_UNDO_UNDONE:
             // If this is an undone entry, prefix it with an undo by user 0.
@@ -1675,18 +1810,19 @@ DP_Recorder *DP_canvas_history_recorder_new(
 }
 
 
-static DP_CanvasHistoryEntry *snapshot_history(DP_CanvasHistory *ch)
+// Shares all the chunks with the history, which will copy any chunk that it
+// modifies afterwards. So this only costs a pointer per chunk here.
+static DP_CanvasHistoryChunk **snapshot_history(DP_CanvasHistory *ch)
 {
-    int count = ch->used;
-    DP_CanvasHistoryEntry *entries =
-        count == 0 ? NULL : DP_malloc(sizeof(*entries) * DP_int_to_size(count));
-    for (int i = 0; i < count; ++i) {
-        DP_CanvasHistoryEntry *entry = &ch->entries[i];
-        entries[i] = (DP_CanvasHistoryEntry){
-            entry->undo, DP_message_incref(entry->msg),
-            DP_canvas_state_incref_nullable(entry->state)};
+    int chunk_count = chunk_count_for(ch->start, ch->used);
+    DP_CanvasHistoryChunk **chunks =
+        chunk_count == 0
+            ? NULL
+            : DP_malloc(sizeof(*chunks) * DP_int_to_size(chunk_count));
+    for (int i = 0; i < chunk_count; ++i) {
+        chunks[i] = chunk_incref(ch->chunks[i]);
     }
-    return entries;
+    return chunks;
 }
 
 static DP_ForkEntry *snapshot_fork(DP_CanvasHistory *ch)
@@ -1706,7 +1842,8 @@ DP_CanvasHistorySnapshot *DP_canvas_history_snapshot_new(DP_CanvasHistory *ch)
     DP_CanvasHistorySnapshot *chs = DP_malloc(sizeof(*chs));
     *chs = (DP_CanvasHistorySnapshot){
         DP_ATOMIC_INIT(1),
-        {ch->undo_depth_limit, ch->offset, ch->used, snapshot_history(ch)},
+        {ch->undo_depth_limit, ch->offset, ch->used, ch->start,
+         snapshot_history(ch)},
         {ch->fork.start, ch->fork.fallbehind,
          DP_size_to_int(ch->fork.queue.used), snapshot_fork(ch)}};
     return chs;
@@ -1737,13 +1874,12 @@ void DP_canvas_history_snapshot_decref(DP_CanvasHistorySnapshot *chs)
             DP_message_decref(chs->fork.entries[i].msg);
         }
         DP_free(chs->fork.entries);
-        int history_count = chs->history.count;
-        for (int i = 0; i < history_count; ++i) {
-            DP_CanvasHistoryEntry *entry = &chs->history.entries[i];
-            DP_canvas_state_decref_nullable(entry->state);
-            DP_message_decref(entry->msg);
+        int chunk_count =
+            chunk_count_for(chs->history.start, chs->history.count);
+        for (int i = 0; i < chunk_count; ++i) {
+            chunk_decref(chs->history.chunks[i]);
         }
-        DP_free(chs->history.entries);
+        DP_free(chs->history.chunks);
         DP_free(chs);
     }
 }
@@ -1793,7 +1929,7 @@ DP_canvas_history_snapshot_history_entry_at(DP_CanvasHistorySnapshot *chs,
     DP_ASSERT(DP_atomic_get(&chs->refcount) > 0);
     DP_ASSERT(index >= 0);
     DP_ASSERT(index < chs->history.count);
-    return &chs->history.entries[index];
+    return chunks_entry_at(chs->history.chunks, chs->history.start, index);
 }
 
 int DP_canvas_history_snapshot_fork_start(DP_CanvasHistorySnapshot *chs)
@@ -44,6 +44,8 @@
 #include <dpcommon/conversions.h>
 #include <dpcommon/geom.h>
 #include <dpcommon/perf.h>
+#include <dpcommon/threading.h>
+#include <dpcommon/worker.h>
 #include <dpmsg/blend_mode.h>
 #include <dpmsg/message.h>
 #include <limits.h>
@@ -1149,7 +1151,16 @@ static bool is_pickable(DP_LayerProps *lp)
         && DP_layer_props_blend_mode(lp) != DP_BLEND_MODE_ERASE;
 }
 
-static int pick_layer(DP_LayerList *ll, DP_LayerPropsList *lpl, int x, int y)
+// Groups keep an index of which tiles any of their layers cover, which lets
+// picking skip over empty groups without descending into them.
+static int get_pick_tile_index(DP_CanvasState *cs, int x, int y)
+{
+    return (y / DP_TILE_SIZE) * DP_tile_count_round(cs->width)
+         + x / DP_TILE_SIZE;
+}
+
+static int pick_layer(DP_LayerList *ll, DP_LayerPropsList *lpl, int x, int y,
+                      int tile_index)
 {
     int count = DP_layer_list_count(ll);
     DP_ASSERT(count == DP_layer_props_list_count(lpl));
@@ -1159,19 +1170,23 @@ static int pick_layer(DP_LayerList *ll, DP_LayerPropsList *lpl, int x, int y)
             DP_LayerListEntry *lle = DP_layer_list_at_noinc(ll, i);
             if (DP_layer_list_entry_is_group(lle)) {
                 DP_LayerGroup *lg = DP_layer_list_entry_group_noinc(lle);
-                DP_LayerList *child_ll = DP_layer_group_children_noinc(lg);
-                DP_LayerPropsList *child_lpl =
-                    DP_layer_props_children_noinc(lp);
-                int layer_id = pick_layer(child_ll, child_lpl, x, y);
-                if (layer_id != -1) {
-                    return layer_id;
+                if (DP_layer_group_tile_covered(lg, tile_index)) {
+                    DP_LayerList *child_ll = DP_layer_group_children_noinc(lg);
+                    DP_LayerPropsList *child_lpl =
+                        DP_layer_props_children_noinc(lp);
+                    int layer_id =
+                        pick_layer(child_ll, child_lpl, x, y, tile_index);
+                    if (layer_id != -1) {
+                        return layer_id;
+                    }
                 }
             }
             else {
                 DP_LayerContent *lc = DP_layer_list_entry_content_noinc(lle);
                 if (DP_layer_content_pixel_at(lc, x, y).a != 0
                     || pick_layer(DP_layer_content_sub_contents_noinc(lc),
-                                  DP_layer_content_sub_props_noinc(lc), x, y)
+                                  DP_layer_content_sub_props_noinc(lc), x, y,
+                                  tile_index)
                            != -1) {
                     return DP_layer_props_id(lp);
                 }
@@ -1186,11 +1201,13 @@ int DP_canvas_state_pick_layer(DP_CanvasState *cs, int x, int y)
     DP_ASSERT(cs);
     DP_ASSERT(DP_atomic_get(&cs->refcount) > 0);
     bool in_bounds = x >= 0 && y >= 0 && x < cs->width && y < cs->height;
-    return in_bounds ? pick_layer(cs->layers, cs->layer_props, x, y) : -1;
+    return in_bounds ? pick_layer(cs->layers, cs->layer_props, x, y,
+                                  get_pick_tile_index(cs, x, y))
+                     : -1;
 }
 
 static unsigned int pick_context_id(DP_LayerList *ll, DP_LayerPropsList *lpl,
-                                    int x, int y)
+                                    int x, int y, int tile_index)
 {
     int count = DP_layer_list_count(ll);
     DP_ASSERT(count == DP_layer_props_list_count(lpl));
@@ -1200,20 +1217,23 @@ static unsigned int pick_context_id(DP_LayerList *ll, DP_LayerPropsList *lpl,
             DP_LayerListEntry *lle = DP_layer_list_at_noinc(ll, i);
             if (DP_layer_list_entry_is_group(lle)) {
                 DP_LayerGroup *lg = DP_layer_list_entry_group_noinc(lle);
-                DP_LayerList *child_ll = DP_layer_group_children_noinc(lg);
-                DP_LayerPropsList *child_lpl =
-                    DP_layer_props_children_noinc(lp);
-                unsigned int context_id =
-                    pick_context_id(child_ll, child_lpl, x, y);
-                if (context_id != 0) {
-                    return context_id;
+                if (DP_layer_group_tile_covered(lg, tile_index)) {
+                    DP_LayerList *child_ll = DP_layer_group_children_noinc(lg);
+                    DP_LayerPropsList *child_lpl =
+                        DP_layer_props_children_noinc(lp);
+                    unsigned int context_id =
+                        pick_context_id(child_ll, child_lpl, x, y, tile_index);
+                    if (context_id != 0) {
+                        return context_id;
+                    }
                 }
             }
             else {
                 DP_LayerContent *lc = DP_layer_list_entry_content_noinc(lle);
                 unsigned int sub_context_id =
                     pick_context_id(DP_layer_content_sub_contents_noinc(lc),
-                                    DP_layer_content_sub_props_noinc(lc), x, y);
+                                    DP_layer_content_sub_props_noinc(lc), x, y,
+                                    tile_index);
                 if (sub_context_id != 0) {
                     return sub_context_id;
                 }
@@ -1237,7 +1257,9 @@ unsigned int DP_canvas_state_pick_context_id(DP_CanvasState *cs, int x, int y)
     DP_ASSERT(cs);
     DP_ASSERT(DP_atomic_get(&cs->refcount) > 0);
     bool in_bounds = x >= 0 && y >= 0 && x < cs->width && y < cs->height;
-    return in_bounds ? pick_context_id(cs->layers, cs->layer_props, x, y) : 0;
+    return in_bounds ? pick_context_id(cs->layers, cs->layer_props, x, y,
+                                       get_pick_tile_index(cs, x, y))
+                     : 0;
 }
 
 
@@ -1262,10 +1284,10 @@ DP_TransientLayerContent *DP_canvas_state_to_flat_layer(DP_CanvasState *cs,
     return tlc;
 }
 
-static void init_flattening_tile(DP_TransientTile *tt, DP_Tile *background_tile)
+static void init_flattening_tile(DP_TransientTile *tt, DP_Tile *tile_or_null)
 {
-    if (background_tile) {
-        memcpy(DP_transient_tile_pixels(tt), DP_tile_pixels(background_tile),
+    if (tile_or_null) {
+        memcpy(DP_transient_tile_pixels(tt), DP_tile_pixels(tile_or_null),
                DP_TILE_BYTES);
     }
     else {
@@ -1276,17 +1298,115 @@ static void init_flattening_tile(DP_TransientTile *tt, DP_Tile *background_tile)
 static void flattening_tile_to_image(DP_TransientTile *tt, DP_Image *img,
                                      DP_TileIterator *ti)
 {
+    // Tiles map to disjoint parts of the image, so this can safely run on
+    // multiple threads at once.
     DP_TileIntoDstIterator tidi = DP_tile_into_dst_iterator_make(ti);
-    while (DP_tile_into_dst_iterator_next(&tidi)) {
-        DP_image_pixel_at_set(img, tidi.dst_x, tidi.dst_y,
-                              DP_pixel15_to_8(DP_transient_tile_pixel_at(
-                                  tt, tidi.tile_x, tidi.tile_y)));
+    int tile_x = DP_rect_left(tidi.tile_bounds);
+    int tile_y = DP_rect_top(tidi.tile_bounds);
+    int dst_x = DP_rect_left(tidi.dst_bounds);
+    int dst_y = DP_rect_top(tidi.dst_bounds);
+    int count = DP_rect_width(tidi.tile_bounds);
+    int height = DP_rect_height(tidi.tile_bounds);
+    int img_width = DP_image_width(img);
+    DP_Pixel15 *src = DP_transient_tile_pixels(tt);
+    DP_Pixel8 *dst = DP_image_pixels(img);
+    for (int y = 0; y < height; ++y) {
+        DP_pixels15_to_8(dst + (dst_y + y) * img_width + dst_x,
+                         src + (tile_y + y) * DP_TILE_SIZE + tile_x, count);
     }
 }
 
-DP_Image *DP_canvas_state_to_flat_image(DP_CanvasState *cs, unsigned int flags,
-                                        const DP_Rect *area_or_null,
-                                        const DP_ViewModeFilter *vmf_or_null)
+// Flattening images with fewer tiles than this isn't worth spinning up threads.
+#define FLAT_IMAGE_PARALLEL_MIN_TILES 16
+
+typedef struct DP_FlatImageContext {
+    DP_LayerList *ll;
+    DP_LayerPropsList *lpl;
+    DP_Tile *background_tile;
+    DP_Tile **base_tiles;
+    int start;
+    int wt;
+    bool include_sublayers;
+    const DP_ViewModeFilter *vmf;
+    DP_Image *img;
+    DP_TransientTile **tts;
+} DP_FlatImageContext;
+
+struct DP_FlatImageJobParams {
+    DP_FlatImageContext *c;
+    DP_TileIterator ti;
+};
+
+static void flatten_tile_to_image(DP_FlatImageContext *c, DP_TransientTile *tt,
+                                  DP_TileIterator *ti)
+{
+    int i = ti->row * c->wt + ti->col;
+    init_flattening_tile(tt, c->base_tiles ? c->base_tiles[i]
+                                           : c->background_tile);
+    DP_layer_list_flatten_tile_range_to(
+        c->ll, c->lpl, c->start, DP_layer_list_count(c->ll), i, tt, DP_BIT15,
+        c->include_sublayers, c->vmf);
+    flattening_tile_to_image(tt, c->img, ti);
+}
+
+static void flat_image_job(void *element, int thread_index)
+{
+    struct DP_FlatImageJobParams *params = element;
+    DP_FlatImageContext *c = params->c;
+    flatten_tile_to_image(c, c->tts[thread_index], &params->ti);
+}
+
+static int get_flat_image_thread_count(bool parallel, DP_TileIterator *ti)
+{
+    // Inside of a worker job, the other threads already have work to do.
+    if (parallel && !DP_worker_on_thread()) {
+        int tile_count = DP_rect_width(ti->tile_area)
+                       * DP_rect_height(ti->tile_area);
+        if (tile_count >= FLAT_IMAGE_PARALLEL_MIN_TILES) {
+            return DP_min_int(DP_thread_cpu_count(), tile_count);
+        }
+    }
+    return 1;
+}
+
+static void render_flat_image(DP_FlatImageContext *c, DP_TileIterator ti,
+                              bool parallel)
+{
+    int thread_count = get_flat_image_thread_count(parallel, &ti);
+    if (thread_count > 1) {
+        DP_TransientTile **tts =
+            DP_malloc(sizeof(*tts) * DP_int_to_size(thread_count));
+        for (int i = 0; i < thread_count; ++i) {
+            tts[i] = DP_transient_tile_new_blank(0);
+        }
+        c->tts = tts;
+        DP_Worker *worker =
+            DP_worker_new(1024, sizeof(struct DP_FlatImageJobParams),
+                          thread_count, flat_image_job);
+        while (DP_tile_iterator_next(&ti)) {
+            struct DP_FlatImageJobParams params = {c, ti};
+            DP_worker_push(worker, &params);
+        }
+        DP_worker_free_join(worker);
+        for (int i = 0; i < thread_count; ++i) {
+            DP_transient_tile_decref(tts[i]);
+        }
+        DP_free(tts);
+        c->tts = NULL;
+    }
+    else {
+        DP_TransientTile *tt = DP_transient_tile_new_blank(0);
+        while (DP_tile_iterator_next(&ti)) {
+            flatten_tile_to_image(c, tt, &ti);
+        }
+        DP_transient_tile_decref(tt);
+    }
+}
+
+static DP_Image *to_flat_image(DP_CanvasState *cs, unsigned int flags,
+                               const DP_Rect *area_or_null,
+                               const DP_ViewModeFilter *vmf_or_null,
+                               bool parallel)
 {
     DP_ASSERT(cs);
     DP_ASSERT(DP_atomic_get(&cs->refcount) > 0);
@@ -1298,29 +1418,153 @@ DP_Image *DP_canvas_state_to_flat_image(DP_CanvasState *cs, unsigned int flags,
         return NULL;
     }
 
-    DP_Tile *background_tile = get_flat_background_tile_or_null(cs, flags);
-    DP_LayerList *ll = cs->layers;
-    DP_LayerPropsList *lpl = cs->layer_props;
-    int wt = DP_tile_count_round(cs->width);
-    bool include_sublayers = flags & DP_FLAT_IMAGE_INCLUDE_SUBLAYERS;
     DP_ViewModeFilter vmf =
         vmf_or_null ? *vmf_or_null : DP_view_mode_filter_make_default();
-
     DP_Image *img = DP_image_new(DP_rect_width(area), DP_rect_height(area));
-    DP_TransientTile *tt = DP_transient_tile_new_blank(0);
-    DP_TileIterator ti = DP_tile_iterator_make(cs->width, cs->height, area);
-    while (DP_tile_iterator_next(&ti)) {
-        init_flattening_tile(tt, background_tile);
-        int i = ti.row * wt + ti.col;
-        DP_layer_list_flatten_tile_to(ll, lpl, i, tt, DP_BIT15,
-                                      include_sublayers, &vmf);
-        flattening_tile_to_image(tt, img, &ti);
+    DP_FlatImageContext c = {cs->layers,
+                             cs->layer_props,
+                             get_flat_background_tile_or_null(cs, flags),
+                             NULL,
+                             0,
+                             DP_tile_count_round(cs->width),
+                             flags & DP_FLAT_IMAGE_INCLUDE_SUBLAYERS,
+                             &vmf,
+                             img,
+                             NULL};
+    render_flat_image(&c, DP_tile_iterator_make(cs->width, cs->height, area),
+                      parallel);
+    return img;
+}
+
+DP_Image *DP_canvas_state_to_flat_image(DP_CanvasState *cs, unsigned int flags,
+                                        const DP_Rect *area_or_null,
+                                        const DP_ViewModeFilter *vmf_or_null)
+{
+    return to_flat_image(cs, flags, area_or_null, vmf_or_null, false);
+}
+
+DP_Image *DP_canvas_state_to_flat_image_parallel(
+    DP_CanvasState *cs, unsigned int flags, const DP_Rect *area_or_null,
+    const DP_ViewModeFilter *vmf_or_null)
+{
+    return to_flat_image(cs, flags, area_or_null, vmf_or_null, true);
+}
+
+
+struct DP_FlatImageBase {
+    DP_CanvasState *cs;
+    unsigned int flags;
+    int start;
+    DP_Tile **tiles;
+};
+
+static int count_agreeing_bottom_layers(DP_CanvasState *cs, int vmf_count,
+                                        const DP_ViewModeFilter *vmfs)
+{
+    DP_LayerPropsList *lpl = cs->layer_props;
+    int count = DP_layer_props_list_count(lpl);
+    for (int i = 0; i < count; ++i) {
+        DP_LayerProps *lp = DP_layer_props_list_at_noinc(lpl, i);
+        if (!DP_view_mode_filters_agree(vmfs, vmf_count, lp)) {
+            return i;
+        }
+    }
+    return count;
+}
+
+DP_FlatImageBase *
+DP_canvas_state_flat_image_base_new(DP_CanvasState *cs, unsigned int flags,
+                                    int vmf_count,
+                                    const DP_ViewModeFilter *vmfs)
+{
+    DP_ASSERT(cs);
+    DP_ASSERT(DP_atomic_get(&cs->refcount) > 0);
+    DP_ASSERT(vmf_count > 0);
+    DP_ASSERT(vmfs);
+    int start = count_agreeing_bottom_layers(cs, vmf_count, vmfs);
+    DP_Tile **tiles;
+    if (start == 0) {
+        tiles = NULL;
+    }
+    else {
+        // The filters all agree on these layers, so it doesn't matter which
+        // one of them we use to flatten them.
+        DP_Tile *background_tile = get_flat_background_tile_or_null(cs, flags);
+        bool include_sublayers = flags & DP_FLAT_IMAGE_INCLUDE_SUBLAYERS;
+        int tile_count = DP_tile_total_round(cs->width, cs->height);
+        tiles = DP_malloc(sizeof(*tiles) * DP_int_to_size(tile_count));
+        for (int i = 0; i < tile_count; ++i) {
+            DP_TransientTile *tt =
+                background_tile ? DP_transient_tile_new(background_tile, 0)
+                                : NULL;
+            tt = DP_layer_list_flatten_tile_range_to(
+                cs->layers, cs->layer_props, 0, start, i, tt, DP_BIT15,
+                include_sublayers, &vmfs[0]);
+            tiles[i] = tt ? DP_transient_tile_persist(tt) : NULL;
+        }
+    }
+
+    DP_FlatImageBase *fib = DP_malloc(sizeof(*fib));
+    *fib = (DP_FlatImageBase){DP_canvas_state_incref(cs), flags, start, tiles};
+    return fib;
+}
+
+void DP_flat_image_base_free(DP_FlatImageBase *fib)
+{
+    if (fib) {
+        DP_Tile **tiles = fib->tiles;
+        if (tiles) {
+            DP_CanvasState *cs = fib->cs;
+            int tile_count = DP_tile_total_round(cs->width, cs->height);
+            for (int i = 0; i < tile_count; ++i) {
+                DP_tile_decref_nullable(tiles[i]);
+            }
+            DP_free(tiles);
+        }
+        DP_canvas_state_decref(fib->cs);
+        DP_free(fib);
     }
-    DP_transient_tile_decref(tt);
+}
 
+static DP_Image *flat_image_base_to_image(DP_FlatImageBase *fib,
+                                          const DP_ViewModeFilter *vmf,
+                                          bool parallel)
+{
+    DP_ASSERT(fib);
+    DP_ASSERT(vmf);
+    DP_CanvasState *cs = fib->cs;
+    unsigned int flags = fib->flags;
+    DP_Image *img = DP_image_new(cs->width, cs->height);
+    DP_FlatImageContext c = {cs->layers,
+                             cs->layer_props,
+                             get_flat_background_tile_or_null(cs, flags),
+                             fib->tiles,
+                             fib->start,
+                             DP_tile_count_round(cs->width),
+                             flags & DP_FLAT_IMAGE_INCLUDE_SUBLAYERS,
+                             vmf,
+                             img,
+                             NULL};
+    render_flat_image(
+        &c,
+        DP_tile_iterator_make(cs->width, cs->height,
+                              DP_rect_make(0, 0, cs->width, cs->height)),
+        parallel);
     return img;
 }
 
+DP_Image *DP_flat_image_base_to_image(DP_FlatImageBase *fib,
+                                      const DP_ViewModeFilter *vmf)
+{
+    return flat_image_base_to_image(fib, vmf, false);
+}
+
+DP_Image *DP_flat_image_base_to_image_parallel(DP_FlatImageBase *fib,
+                                               const DP_ViewModeFilter *vmf)
+{
+    return flat_image_base_to_image(fib, vmf, true);
+}
+
 DP_TransientTile *
 DP_canvas_state_flatten_tile(DP_CanvasState *cs, int tile_index,
                              unsigned int flags,
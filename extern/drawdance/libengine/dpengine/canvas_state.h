@@ -47,6 +47,7 @@ typedef struct DP_ViewModeFilter DP_ViewModeFilter;
     (DP_FLAT_IMAGE_RENDER_FLAGS & ~DP_FLAT_IMAGE_INCLUDE_BACKGROUND)
 
 typedef struct DP_CanvasState DP_CanvasState;
+typedef struct DP_FlatImageBase DP_FlatImageBase;
 
 typedef struct DP_UserCursor {
     unsigned int context_id;
@@ -158,6 +159,32 @@ DP_Image *DP_canvas_state_to_flat_image(DP_CanvasState *cs, unsigned int flags,
                                         const DP_Rect *area_or_null,
                                         const DP_ViewModeFilter *vmf_or_null);
 
+// Same as above, but flattens the tiles on a pool of worker threads if the
+// image is big enough. When called from a job that's already running on some
+// other worker, it flattens serially instead of oversubscribing the CPU.
+DP_Image *DP_canvas_state_to_flat_image_parallel(
+    DP_CanvasState *cs, unsigned int flags, const DP_Rect *area_or_null,
+    const DP_ViewModeFilter *vmf_or_null);
+
+// Flattens the bottom layers that all of the given view mode filters show or
+// hide alike, e.g. a static background below the layers of each animation
+// frame. Turning that base into images then only composites the layers above.
+// The filters must stay valid for as long as the base is used.
+DP_FlatImageBase *
+DP_canvas_state_flat_image_base_new(DP_CanvasState *cs, unsigned int flags,
+                                    int vmf_count,
+                                    const DP_ViewModeFilter *vmfs);
+
+void DP_flat_image_base_free(DP_FlatImageBase *fib);
+
+// The given filter must be one of the ones the base was created with. The
+// parallel version stays serial inside of worker jobs, same as above.
+DP_Image *DP_flat_image_base_to_image(DP_FlatImageBase *fib,
+                                      const DP_ViewModeFilter *vmf);
+
+DP_Image *DP_flat_image_base_to_image_parallel(DP_FlatImageBase *fib,
+                                               const DP_ViewModeFilter *vmf);
+
 DP_TransientTile *
 DP_canvas_state_flatten_tile(DP_CanvasState *cs, int tile_index,
                              unsigned int flags,
@@ -108,44 +108,106 @@ static void free_deflate_z_stream(z_stream *stream)
     }
 }
 
-size_t DP_compress_deflate(const unsigned char *in, size_t in_size,
-                           unsigned char *(*get_output_buffer)(size_t, void *),
-                           void *user)
+static bool init_deflate_z_stream(z_stream *stream, int level)
 {
-    z_stream stream = {0};
-    stream.zalloc = malloc_z;
-    stream.zfree = free_z;
-
-    int ret = deflateInit(&stream, 9);
-    if (ret != Z_OK) {
-        DP_error_set("Deflate init error %d: %s", ret, get_z_error(&stream));
-        return 0;
+    *stream = (z_stream){0};
+    stream->zalloc = malloc_z;
+    stream->zfree = free_z;
+    int ret = deflateInit(stream, level);
+    if (ret == Z_OK) {
+        return true;
+    }
+    else {
+        DP_error_set("Deflate init error %d: %s", ret, get_z_error(stream));
+        return false;
     }
+}
 
-    unsigned long bound = deflateBound(&stream, DP_size_to_ulong(in_size));
+static size_t deflate_with(z_stream *stream, const unsigned char *in,
+                           size_t in_size,
+                           unsigned char *(*get_output_buffer)(size_t, void *),
+                           void *user)
+{
+    unsigned long bound = deflateBound(stream, DP_size_to_ulong(in_size));
     size_t out_size = bound + 4;
 
     unsigned char *out = get_output_buffer(out_size, user);
     if (!out) {
-        free_deflate_z_stream(&stream);
         return 0; // The function should have already set the error message.
     }
 
     DP_write_bigendian_uint32(DP_size_to_uint32(in_size), out);
 
-    stream.avail_out = DP_ulong_to_uint(bound);
-    stream.next_out = out + 4;
-    stream.avail_in = DP_size_to_uint(in_size);
-    stream.next_in = (z_const unsigned char *)in;
-    ret = deflate(&stream, Z_FINISH);
+    stream->avail_out = DP_ulong_to_uint(bound);
+    stream->next_out = out + 4;
+    stream->avail_in = DP_size_to_uint(in_size);
+    stream->next_in = (z_const unsigned char *)in;
+    int ret = deflate(stream, Z_FINISH);
     if (ret != Z_STREAM_END) {
         DP_error_set("Deflate compression error %d: %s", ret,
-                     get_z_error(&stream));
-        free_deflate_z_stream(&stream);
+                     get_z_error(stream));
         return 0;
     }
 
-    size_t out_used = out_size - stream.avail_out;
+    return out_size - stream->avail_out;
+}
+
+size_t DP_compress_deflate(const unsigned char *in, size_t in_size,
+                           unsigned char *(*get_output_buffer)(size_t, void *),
+                           void *user)
+{
+    z_stream stream;
+    if (!init_deflate_z_stream(&stream, DP_COMPRESS_LEVEL_DEFAULT)) {
+        return 0;
+    }
+    size_t out_used =
+        deflate_with(&stream, in, in_size, get_output_buffer, user);
     free_deflate_z_stream(&stream);
     return out_used;
 }
+
+
+struct DP_Deflater {
+    z_stream stream;
+    bool needs_reset;
+};
+
+DP_Deflater *DP_deflater_new(int level)
+{
+    DP_Deflater *deflater = DP_malloc(sizeof(*deflater));
+    if (init_deflate_z_stream(&deflater->stream, level)) {
+        deflater->needs_reset = false;
+        return deflater;
+    }
+    else {
+        DP_free(deflater);
+        return NULL;
+    }
+}
+
+void DP_deflater_free(DP_Deflater *deflater)
+{
+    if (deflater) {
+        free_deflate_z_stream(&deflater->stream);
+        DP_free(deflater);
+    }
+}
+
+size_t DP_deflater_deflate(DP_Deflater *deflater, const unsigned char *in,
+                           size_t in_size,
+                           unsigned char *(*get_output_buffer)(size_t, void *),
+                           void *user)
+{
+    DP_ASSERT(deflater);
+    z_stream *stream = &deflater->stream;
+    if (deflater->needs_reset) {
+        int ret = deflateReset(stream);
+        if (ret != Z_OK) {
+            DP_error_set("Deflate reset error %d: %s", ret,
+                         get_z_error(stream));
+            return 0;
+        }
+    }
+    deflater->needs_reset = true;
+    return deflate_with(stream, in, in_size, get_output_buffer, user);
+}
@@ -23,6 +23,16 @@
 #define DPENGINE_COMPRESS_H
 #include <dpcommon/common.h>
 
+// Compression level used for everything that goes over the network or into
+// files that other clients may read. Changing this doesn't break anything, but
+// makes the output bigger.
+#define DP_COMPRESS_LEVEL_DEFAULT 9
+// Several times faster than the default level at the cost of somewhat bigger
+// output. Meant for local stuff like recording indexes.
+#define DP_COMPRESS_LEVEL_FAST 1
+
+typedef struct DP_Deflater DP_Deflater;
+
 
 bool DP_compress_inflate(const unsigned char *in, size_t in_size,
                          unsigned char *(*get_output_buffer)(size_t, void *),
@@ -33,4 +43,17 @@ size_t DP_compress_deflate(const unsigned char *in, size_t in_size,
                            void *user);
 
 
+// Keeps the zlib stream around between compressions, since setting up a new
+// one for every tile is a significant part of the cost. The output is the same
+// as DP_compress_deflate at the same level. Not thread-safe, use one per thread.
+DP_Deflater *DP_deflater_new(int level);
+
+void DP_deflater_free(DP_Deflater *deflater);
+
+size_t DP_deflater_deflate(DP_Deflater *deflater, const unsigned char *in,
+                           size_t in_size,
+                           unsigned char *(*get_output_buffer)(size_t, void *),
+                           void *user);
+
+
 #endif
@@ -31,9 +31,12 @@
 #include "layer_content.h"
 #include "layer_routes.h"
 #include "pixels.h"
+#include "tile.h"
 #include <dpcommon/common.h>
 #include <dpcommon/conversions.h>
 #include <dpcommon/queue.h>
+#include <dpcommon/threading.h>
+#include <dpcommon/worker.h>
 #include <limits.h>
 #include <math.h>
 #include <helpers.h> // M_PI
@@ -44,9 +47,18 @@
 // interactive techniques. pp. 276–283.
 // See https://en.wikipedia.org/wiki/Flood_fill#Span_Filling
 
+// The fill buffer holds one of these states for each pixel. Pixels start out
+// as unchecked and get their color compared a whole tile at a time the first
+// time the fill touches that tile.
+#define FILL_NO_MATCH 0
+#define FILL_MATCH    1
+#define FILL_FILLED   2
+
 typedef struct DP_FillContext {
     unsigned char *buffer;
+    unsigned char *tiles_checked;
     int width, height;
+    int xtiles;
     DP_LayerContent *lc;
     DP_UPixelFloat reference_color;
     double tolerance_squared;
@@ -78,39 +90,62 @@ static unsigned char *buffer_at(DP_FillContext *c, int x, int y)
     return &c->buffer[y * c->width + x];
 }
 
-static bool is_blank(DP_FillContext *c, int x, int y)
+static bool is_filled(DP_FillContext *c, int x, int y)
 {
-    return *buffer_at(c, x, y) == 0;
+    return *buffer_at(c, x, y) == FILL_FILLED;
 }
 
-static DP_UPixelFloat get_color_at(DP_LayerContent *lc, int x, int y)
+static void check_tile(DP_FillContext *c, int tile_x, int tile_y)
 {
-    return DP_upixel15_to_float(
-        DP_pixel15_unpremultiply(DP_layer_content_pixel_at(lc, x, y)));
+    int x0 = tile_x * DP_TILE_SIZE;
+    int y0 = tile_y * DP_TILE_SIZE;
+    int w = DP_min_int(DP_TILE_SIZE, c->width - x0);
+    int h = DP_min_int(DP_TILE_SIZE, c->height - y0);
+    DP_Tile *t = DP_layer_content_tile_at_noinc(c->lc, tile_x, tile_y);
+
+    DP_Pixel15 pixel;
+    if (DP_tile_same_pixel(t, &pixel)) {
+        unsigned char state =
+            DP_pixel15_color_match(pixel, c->reference_color,
+                                   c->tolerance_squared)
+                ? FILL_MATCH
+                : FILL_NO_MATCH;
+        for (int y = 0; y < h; ++y) {
+            memset(buffer_at(c, x0, y0 + y), state, DP_int_to_size(w));
+        }
+    }
+    else {
+        const DP_Pixel15 *pixels = DP_tile_pixels(t);
+        for (int y = 0; y < h; ++y) {
+            DP_pixels15_color_match(buffer_at(c, x0, y0 + y),
+                                    &pixels[y * DP_TILE_SIZE], w,
+                                    c->reference_color, c->tolerance_squared);
+        }
+    }
 }
 
 static bool should_fill(DP_FillContext *c, int x, int y)
 {
-    DP_UPixelFloat color = get_color_at(c->lc, x, y);
-    // TODO: we could use better functions for color distance than this.
-    DP_UPixelFloat reference_color = c->reference_color;
-    double b = color.b - reference_color.b;
-    double g = color.g - reference_color.g;
-    double r = color.r - reference_color.r;
-    double a = color.a - reference_color.a;
-    return b * b + g * g + r * r + a * a <= c->tolerance_squared;
+    int tile_x = x / DP_TILE_SIZE;
+    int tile_y = y / DP_TILE_SIZE;
+    unsigned char *checked = &c->tiles_checked[tile_y * c->xtiles + tile_x];
+    if (!*checked) {
+        check_tile(c, tile_x, tile_y);
+        *checked = 1;
+    }
+    return *buffer_at(c, x, y) == FILL_MATCH;
 }
 
 static bool inside(DP_FillContext *c, int x, int y)
 {
     return x >= 0 && x < c->width && y >= 0 && y < c->height
-        && is_blank(c, x, y) && should_fill(c, x, y);
+        && should_fill(c, x, y);
 }
 
 static bool set_pixel(DP_FillContext *c, int x, int y)
 {
     if (--c->pixels_left > 0) {
-        *buffer_at(c, x, y) = 1;
+        *buffer_at(c, x, y) = FILL_FILLED;
         if (x < c->min_x) {
             c->min_x = x;
         }
@@ -170,6 +205,86 @@ static bool fill(DP_FillContext *c, int x0, int y0)
     return true;
 }
 
+// The expansion and feathering passes split the mask into bands of this many
+// rows and process them in parallel. Masks with fewer pixels than the minimum
+// aren't worth the threads and are done in one go instead.
+#define MASK_BAND_HEIGHT         32
+#define MASK_PARALLEL_MIN_PIXELS (256 * 256)
+
+typedef struct DP_FillMaskContext DP_FillMaskContext;
+
+typedef void (*DP_FillMaskPassFn)(DP_FillMaskContext *mc, int start, int end);
+
+struct DP_FillMaskContext {
+    DP_FillContext *c;
+    float *mask;
+    float *tmp;
+    int expand, feather_radius;
+    int expand_min_x, expand_min_y;
+    int img_width, img_height;
+    unsigned char *expansion_kernel;
+    float *gaussian_kernel;
+    DP_Worker *worker;
+    DP_Semaphore *bands_done_sem;
+};
+
+struct DP_FillMaskJobParams {
+    DP_FillMaskContext *mc;
+    DP_FillMaskPassFn fn;
+    int start, end;
+};
+
+static void run_mask_job(void *element, DP_UNUSED int thread_index)
+{
+    struct DP_FillMaskJobParams *params = element;
+    DP_FillMaskContext *mc = params->mc;
+    params->fn(mc, params->start, params->end);
+    DP_SEMAPHORE_MUST_POST(mc->bands_done_sem);
+}
+
+// Sets up one worker that all passes of this fill share.
+static void init_mask_worker(DP_FillMaskContext *mc)
+{
+    int height = mc->img_height;
+    int band_count = (height + MASK_BAND_HEIGHT - 1) / MASK_BAND_HEIGHT;
+    int thread_count = DP_min_int(DP_thread_cpu_count(), band_count);
+    size_t pixels = DP_int_to_size(mc->img_width) * DP_int_to_size(height);
+    if (thread_count > 1 && pixels >= MASK_PARALLEL_MIN_PIXELS) {
+        mc->bands_done_sem = DP_semaphore_new(0);
+        mc->worker = mc->bands_done_sem
+                       ? DP_worker_new(DP_int_to_size(band_count),
+                                       sizeof(struct DP_FillMaskJobParams),
+                                       thread_count, run_mask_job)
+                       : NULL;
+    }
+}
+
+static void dispose_mask_worker(DP_FillMaskContext *mc)
+{
+    DP_worker_free_join(mc->worker);
+    DP_semaphore_free(mc->bands_done_sem);
+}
+
+// Runs a pass over the whole mask, which is finished when this returns.
+static void run_mask_pass(DP_FillMaskContext *mc, DP_FillMaskPassFn fn)
+{
+    int height = mc->img_height;
+    DP_Worker *worker = mc->worker;
+    if (worker) {
+        int band_count = 0;
+        for (int start = 0; start < height; start += MASK_BAND_HEIGHT) {
+            struct DP_FillMaskJobParams params = {
+                mc, fn, start, DP_min_int(start + MASK_BAND_HEIGHT, height)};
+            DP_worker_push(worker, &params);
+            ++band_count;
+        }
+        DP_SEMAPHORE_MUST_WAIT_N(mc->bands_done_sem, band_count);
+    }
+    else {
+        fn(mc, 0, height);
+    }
+}
+
 static int get_kernel_diameter(int radius)
 {
     return radius * 2 + 1;
@@ -190,27 +305,66 @@ static unsigned char *generate_expansion_kernel(int expand)
     return kernel;
 }
 
-static void apply_expansion_kernel(float *mask, int mask_width,
-                                   unsigned char *kernel, int width, int height,
-                                   int expand, int feather_radius,
-                                   int expand_min_x, int expand_min_y, int x0,
-                                   int y0)
+static void apply_expansion_kernel(DP_FillMaskContext *mc, int top, int bottom,
+                                   int x0, int y0)
 {
+    int expand = mc->expand;
     int start_x0 = x0 - expand;
     int start_y0 = y0 - expand;
     int start_x = DP_max_int(start_x0, 0);
-    int start_y = DP_max_int(start_y0, 0);
-    int end_x = DP_min_int(x0 + expand, width - 1);
-    int end_y = DP_min_int(y0 + expand, height - 1);
+    int start_y = DP_max_int(start_y0, top);
+    int end_x = DP_min_int(x0 + expand, mc->c->width - 1);
+    int end_y = DP_min_int(y0 + expand, bottom);
     int diameter = get_kernel_diameter(expand);
+    int feather_radius = mc->feather_radius;
     for (int y = start_y; y <= end_y; ++y) {
         for (int x = start_x; x <= end_x; ++x) {
             int kernel_x = x - start_x0;
             int kernel_y = y - start_y0;
-            if (kernel[kernel_y * diameter + kernel_x]) {
-                int mx = x - expand_min_x + feather_radius;
-                int my = y - expand_min_y + feather_radius;
-                mask[my * mask_width + mx] = 1.0f;
+            if (mc->expansion_kernel[kernel_y * diameter + kernel_x]) {
+                int mx = x - mc->expand_min_x + feather_radius;
+                int my = y - mc->expand_min_y + feather_radius;
+                mc->mask[my * mc->img_width + mx] = 1.0f;
+            }
+        }
+    }
+}
+
+static void fill_mask_pass(DP_FillMaskContext *mc, int start, int end)
+{
+    DP_FillContext *c = mc->c;
+    int expand = mc->expand;
+    int feather_radius = mc->feather_radius;
+    int offset_y = mc->expand_min_y - feather_radius;
+    // Canvas rows covered by this band of the mask.
+    int top = DP_max_int(start + offset_y, mc->expand_min_y);
+    int bottom = DP_min_int(end - 1 + offset_y, c->height - 1);
+    if (top > bottom) {
+        return; // This band only contains feathering space.
+    }
+
+    if (expand == 0) {
+        int min_x = c->min_x, max_x = c->max_x;
+        int end_y = DP_min_int(bottom, c->max_y);
+        for (int y = DP_max_int(top, c->min_y); y <= end_y; ++y) {
+            float *dst = &mc->mask[(y - offset_y) * mc->img_width
+                                   + feather_radius - min_x];
+            for (int x = min_x; x <= max_x; ++x) {
+                if (is_filled(c, x, y)) {
+                    dst[x] = 1.0f;
+                }
+            }
+        }
+    }
+    else {
+        // Filled pixels up to the expansion radius outside of this band can
+        // stamp into it, but only the rows inside of it are written to.
+        int end_y = DP_min_int(bottom + expand, c->max_y);
+        for (int y = DP_max_int(top - expand, c->min_y); y <= end_y; ++y) {
+            for (int x = c->min_x; x <= c->max_x; ++x) {
+                if (is_filled(c, x, y)) {
+                    apply_expansion_kernel(mc, top, bottom, x, y);
+                }
             }
         }
     }
@@ -268,24 +422,43 @@ static void blur_vertically(float *dst, const float *src, int x0, int y0,
     dst[y0 * width + x0] = result;
 }
 
-static void feather_mask(float *mask, float *tmp, int width, int height,
-                         int radius)
+static void blur_horizontally_pass(DP_FillMaskContext *mc, int start, int end)
 {
-    // This is a classic two-pass gaussian blur. We create a one-dimensional
-    // gaussian kernel, then blur once horizontally to a temporary buffer and
-    // then vertically back into the original image.
-    float *kernel = generate_gaussian_kernel(radius);
-    for (int y = 0; y < height; ++y) {
+    int width = mc->img_width;
+    for (int y = start; y < end; ++y) {
         for (int x = 0; x < width; ++x) {
-            blur_horizontally(tmp, mask, x, y, width, kernel, radius);
+            blur_horizontally(mc->tmp, mc->mask, x, y, width,
+                              mc->gaussian_kernel, mc->feather_radius);
         }
     }
-    for (int y = 0; y < height; ++y) {
+}
+
+static void blur_vertically_pass(DP_FillMaskContext *mc, int start, int end)
+{
+    int width = mc->img_width;
+    for (int y = start; y < end; ++y) {
         for (int x = 0; x < width; ++x) {
-            blur_vertically(mask, tmp, x, y, width, height, kernel, radius);
+            blur_vertically(mc->mask, mc->tmp, x, y, width, mc->img_height,
+                            mc->gaussian_kernel, mc->feather_radius);
         }
     }
-    DP_free(kernel);
+}
+
+static void feather_mask(DP_FillMaskContext *mc)
+{
+    // This is a classic two-pass gaussian blur. We create a one-dimensional
+    // gaussian kernel, then blur once horizontally to a temporary buffer and
+    // then vertically back into the original image. Each pass has to finish
+    // completely before the next one starts, since the vertical pass reads
+    // across bands.
+    size_t mask_size =
+        DP_int_to_size(mc->img_width) * DP_int_to_size(mc->img_height);
+    mc->tmp = DP_malloc(mask_size * sizeof(*mc->tmp));
+    mc->gaussian_kernel = generate_gaussian_kernel(mc->feather_radius);
+    run_mask_pass(mc, blur_horizontally_pass);
+    run_mask_pass(mc, blur_vertically_pass);
+    DP_free(mc->gaussian_kernel);
+    DP_free(mc->tmp);
 }
 
 static float *make_mask(DP_FillContext *c, int expand, int feather_radius,
@@ -301,44 +474,37 @@ static float *make_mask(DP_FillContext *c, int expand, int feather_radius,
     int img_width = expand_max_x - expand_min_x + feather_radius * 2 + 1;
     int img_height = expand_max_y - expand_min_y + feather_radius * 2 + 1;
     size_t mask_size = DP_int_to_size(img_width) * DP_int_to_size(img_height);
-    float *mask = DP_malloc_zeroed(mask_size * sizeof(*mask));
 
-    if (expand == 0) {
-        for (int y = min_y; y <= max_y; ++y) {
-            for (int x = min_x; x <= max_x; ++x) {
-                if (!is_blank(c, x, y)) {
-                    int mx = x - min_x + feather_radius;
-                    int my = y - min_y + feather_radius;
-                    mask[my * img_width + mx] = 1.0f;
-                }
-            }
-        }
-    }
-    else {
-        unsigned char *kernel = generate_expansion_kernel(expand);
-        for (int y = min_y; y <= max_y; ++y) {
-            for (int x = min_x; x <= max_x; ++x) {
-                if (!is_blank(c, x, y)) {
-                    apply_expansion_kernel(mask, img_width, kernel, c->width,
-                                           c->height, expand, feather_radius,
-                                           expand_min_x, expand_min_y, x, y);
-                }
-            }
-        }
-        DP_free(kernel);
-    }
+    DP_FillMaskContext mc = {
+        c,
+        DP_malloc_zeroed(mask_size * sizeof(*mc.mask)),
+        NULL,
+        expand,
+        feather_radius,
+        expand_min_x,
+        expand_min_y,
+        img_width,
+        img_height,
+        expand == 0 ? NULL : generate_expansion_kernel(expand),
+        NULL,
+        NULL,
+        NULL,
+    };
+
+    init_mask_worker(&mc);
+    run_mask_pass(&mc, fill_mask_pass);
+    DP_free(mc.expansion_kernel);
 
     if (feather_radius != 0) {
-        float *tmp = DP_malloc(mask_size * sizeof(*mask));
-        feather_mask(mask, tmp, img_width, img_height, feather_radius);
-        DP_free(tmp);
+        feather_mask(&mc);
     }
+    dispose_mask_worker(&mc);
 
     *out_img_x = expand_min_x - feather_radius;
     *out_img_y = expand_min_y - feather_radius;
     *out_img_width = img_width;
     *out_img_height = img_height;
-    return mask;
+    return mc.mask;
 }
 
 DP_Image *mask_to_image(const float *mask, int img_width, int img_height,
@@ -395,13 +561,19 @@ DP_FloodFillResult DP_flood_fill(DP_CanvasState *cs, int x, int y,
 
     size_t buffer_size = DP_int_to_size(width) * DP_int_to_size(height);
     unsigned char *buffer = DP_malloc_zeroed(buffer_size);
+    DP_TileCounts tile_counts = DP_tile_counts_round(width, height);
+    unsigned char *tiles_checked = DP_malloc_zeroed(
+        DP_int_to_size(tile_counts.x) * DP_int_to_size(tile_counts.y));
 
     DP_FillContext c = {
         buffer,
+        tiles_checked,
         width,
         height,
+        tile_counts.x,
         lc,
-        get_color_at(lc, x, y),
+        DP_upixel15_to_float(
+            DP_pixel15_unpremultiply(DP_layer_content_pixel_at(lc, x, y))),
         tolerance * tolerance,
         INT_MAX,
         INT_MAX,
@@ -414,6 +586,7 @@ DP_FloodFillResult DP_flood_fill(DP_CanvasState *cs, int x, int y,
     DP_queue_init(&c.queue, 1024, sizeof(DP_FillSeed));
     bool fill_done = fill(&c, x, y);
     DP_queue_dispose(&c.queue);
+    DP_free(tiles_checked);
     DP_layer_content_decref(lc);
     if (!fill_done) {
         DP_error_set("Flood fill: size limit %d exceeded", size_limit);
@@ -186,6 +186,19 @@ static bool diff_tile(void *data, int tile_index)
     return a->elements[tile_index].tile != b->elements[tile_index].tile;
 }
 
+// Tiles are compared by pointer, so whole ranges of them can be compared at
+// once, which is a lot faster than going through them one by one.
+static bool diff_tile_range(void *data, int start, int end)
+{
+    DP_ASSERT(data);
+    DP_ASSERT(start >= 0);
+    DP_ASSERT(start < end);
+    DP_LayerContent *a = ((DP_LayerContent **)data)[0];
+    DP_LayerContent *b = ((DP_LayerContent **)data)[1];
+    size_t size = DP_int_to_size(end - start) * sizeof(*a->elements);
+    return memcmp(&a->elements[start], &b->elements[start], size) != 0;
+}
+
 static bool diff_tile_both_censored(void *data, int tile_index)
 {
     DP_ASSERT(data);
@@ -210,15 +223,20 @@ static void layer_content_diff(DP_LayerContent *lc, bool censored,
     DP_ASSERT(DP_atomic_get(&prev_lc->refcount) > 0);
     DP_ASSERT(lc->width == prev_lc->width);   // Different sizes could be
     DP_ASSERT(lc->height == prev_lc->height); // supported, but aren't yet.
+    if (lc == prev_lc && censored == prev_censored) {
+        return; // Same content, sublayers included, so nothing can differ.
+    }
+
     if (!censored && !prev_censored) {
-        DP_canvas_diff_check(diff, diff_tile,
-                             (DP_LayerContent *[]){lc, prev_lc});
+        DP_canvas_diff_check_ranges(diff, diff_tile_range, diff_tile,
+                                    (DP_LayerContent *[]){lc, prev_lc});
         DP_layer_list_diff(lc->sub.contents, lc->sub.props,
                            prev_lc->sub.contents, prev_lc->sub.props, diff);
     }
     else if (censored && prev_censored) {
-        DP_canvas_diff_check(diff, diff_tile_both_censored,
-                             (DP_LayerContent *[]){lc, prev_lc});
+        DP_canvas_diff_check_ranges(diff, diff_tile_range,
+                                    diff_tile_both_censored,
+                                    (DP_LayerContent *[]){lc, prev_lc});
         DP_layer_list_diff(lc->sub.contents, lc->sub.props,
                            prev_lc->sub.contents, prev_lc->sub.props, diff);
     }
@@ -308,6 +326,15 @@ DP_Tile *DP_layer_content_tile_at_noinc(DP_LayerContent *lc, int x, int y)
     return lc->elements[y * DP_tile_count_round(lc->width) + x].tile;
 }
 
+DP_Tile *DP_layer_content_tile_at_index_noinc(DP_LayerContent *lc, int index)
+{
+    DP_ASSERT(lc);
+    DP_ASSERT(DP_atomic_get(&lc->refcount) > 0);
+    DP_ASSERT(index >= 0);
+    DP_ASSERT(index < DP_tile_total_round(lc->width, lc->height));
+    return lc->elements[index].tile;
+}
+
 DP_Pixel15 DP_layer_content_pixel_at(DP_LayerContent *lc, int x, int y)
 {
     DP_ASSERT(lc);
@@ -1391,6 +1418,12 @@ static bool can_blend_blank_pixel(int blend_mode, uint16_t opacity,
 #define DP_BIT15_1024 DP_BIT15_256, DP_BIT15_256, DP_BIT15_256, DP_BIT15_256
 #define DP_BIT15_4096 DP_BIT15_1024, DP_BIT15_1024, DP_BIT15_1024, DP_BIT15_1024
 
+static bool is_fill_replacement(int blend_mode, DP_UPixel15 pixel)
+{
+    return blend_mode == DP_BLEND_MODE_REPLACE
+        || (blend_mode == DP_BLEND_MODE_NORMAL && pixel.a == DP_BIT15);
+}
+
 static void fill_rect(DP_TransientLayerContent *tlc, unsigned int context_id,
                       int blend_mode, int left, int top, int right, int bottom,
                       DP_UPixel15 pixel)
@@ -1398,6 +1431,10 @@ static void fill_rect(DP_TransientLayerContent *tlc, unsigned int context_id,
     const uint16_t *mask = DP_tile_opaque_mask();
     uint16_t opacity = pixel.a;
     bool blend_blank = can_blend_blank_pixel(blend_mode, opacity, pixel);
+    // Tiles that get covered entirely by a replacing fill all end up with the
+    // same single color, so they can share one solid tile.
+    bool is_replacement = is_fill_replacement(blend_mode, pixel);
+    DP_Tile *solid_tile = NULL;
 
     int tx_min = left / DP_TILE_SIZE;
     int tx_max = (right - 1) / DP_TILE_SIZE;
@@ -1415,6 +1452,22 @@ static void fill_rect(DP_TransientLayerContent *tlc, unsigned int context_id,
             int h = DP_min_int((ty + 1) * DP_TILE_SIZE, bottom) - cy - y;
             int i = ty * xtiles + tx;
 
+            if (is_replacement && w == DP_TILE_SIZE && h == DP_TILE_SIZE) {
+                DP_tile_decref_nullable(tlc->elements[i].tile);
+                // Erased tiles would get dropped when persisting anyway.
+                if (pixel.a == 0) {
+                    tlc->elements[i].tile = NULL;
+                }
+                else if (solid_tile) {
+                    tlc->elements[i].tile = DP_tile_incref(solid_tile);
+                }
+                else {
+                    solid_tile = DP_tile_new_from_upixel15(context_id, pixel);
+                    tlc->elements[i].tile = solid_tile;
+                }
+                continue;
+            }
+
             DP_TransientTile *tt;
             if (tlc->elements[i].tile) {
                 tt = get_or_create_transient_tile(tlc, context_id, i);
@@ -1436,10 +1489,7 @@ static void fill_entirely(DP_TransientLayerContent *tld,
                           unsigned int context_id, int blend_mode,
                           DP_UPixel15 pixel)
 {
-    bool is_replacement =
-        blend_mode == DP_BLEND_MODE_REPLACE
-        || (blend_mode == DP_BLEND_MODE_NORMAL && pixel.a == DP_BIT15);
-    if (is_replacement) {
+    if (is_fill_replacement(blend_mode, pixel)) {
         DP_Tile *tile = DP_tile_new_from_upixel15(context_id, pixel);
         int tile_count = DP_tile_total_round(tld->width, tld->height);
         DP_tile_incref_by(tile, tile_count - 1);
@@ -79,6 +79,8 @@ int DP_layer_content_height(DP_LayerContent *lc);
 
 DP_Tile *DP_layer_content_tile_at_noinc(DP_LayerContent *lc, int x, int y);
 
+DP_Tile *DP_layer_content_tile_at_index_noinc(DP_LayerContent *lc, int index);
+
 DP_Pixel15 DP_layer_content_pixel_at(DP_LayerContent *lc, int x, int y);
 
 DP_UPixel15 DP_layer_content_sample_color_at(DP_LayerContent *lc,
@@ -30,6 +30,7 @@
 #include <dpcommon/common.h>
 #include <dpcommon/conversions.h>
 #include <dpcommon/geom.h>
+#include <dpcommon/threading.h>
 #include <dpmsg/blend_mode.h>
 
 
@@ -40,6 +41,8 @@ struct DP_LayerGroup {
     const bool transient;
     const int width, height;
     DP_LayerList *const children;
+    DP_AtomicPtr coverage;
+    DP_AtomicPtr flattened;
 };
 
 struct DP_TransientLayerGroup {
@@ -50,6 +53,8 @@ struct DP_TransientLayerGroup {
         DP_LayerList *children;
         DP_TransientLayerList *transient_children;
     };
+    DP_AtomicPtr coverage;
+    DP_AtomicPtr flattened;
 };
 
 #else
@@ -62,10 +67,227 @@ struct DP_LayerGroup {
         DP_LayerList *children;
         DP_TransientLayerList *transient_children;
     };
+    DP_AtomicPtr coverage;
+    DP_AtomicPtr flattened;
 };
 
 #endif
 
+// Flattened tiles of an isolated group, kept around so that flattening the
+// canvas doesn't have to recomposite groups whose contents didn't change. The
+// children are fixed by the group itself, so the props are the only key.
+//
+// A tile only gets cached the second time it's flattened, so that groups that
+// get replaced on every change, like the one being drawn in, don't fill up the
+// cache with tiles that no one is going to look at again. When there's too
+// many tiles, the ones of the least recently used cache get dropped, so groups
+// that are only kept alive by the undo history don't hang onto them forever.
+//
+// A cache lives as long as its group. Flattening a tile only touches the cache
+// itself: the users count keeps its tiles from being cleared out while they're
+// being looked at and the last used stamp only gets written when it changes.
+// The lock is only needed to add and remove caches and to evict tiles.
+typedef struct DP_LayerGroupFlattened {
+    DP_Atomic users; // Negative while the tiles are being cleared.
+    DP_Atomic last_used;
+    DP_Atomic cached_tiles;
+    struct DP_LayerGroupFlattened *prev, *next;
+    DP_LayerPropsList *lpl;
+    bool include_sublayers;
+    int tile_count;
+    DP_AtomicPtr tiles[];
+} DP_LayerGroupFlattened;
+
+// Default upper bound on flattened tiles cached across all groups, 64 MiB.
+#define FLATTENED_DEFAULT_MAX_TILES 2048
+
+// Stands in for tiles that flattened to nothing.
+static char flattened_blank_tile;
+// Stands in for tiles that have been flattened once, but aren't cached yet.
+static char flattened_seen_tile;
+
+// Guards the list of all caches.
+DP_ATOMIC_DECLARE_STATIC_SPIN_LOCK(flattened_lock);
+static DP_LayerGroupFlattened *flattened_first;
+
+// Ticks whenever a cache gets created or evicted from, so caches that haven't
+// been used since then have an older stamp than the ones that have.
+static DP_Atomic flattened_clock;
+static DP_Atomic flattened_tile_total;
+static DP_Atomic flattened_max_tiles =
+    DP_ATOMIC_INIT(FLATTENED_DEFAULT_MAX_TILES);
+static DP_THREAD_LOCAL int flattened_hits;
+
+static bool is_flattened_tile(void *tile)
+{
+    return tile && tile != &flattened_blank_tile
+        && tile != &flattened_seen_tile;
+}
+
+static bool flattened_enter(DP_LayerGroupFlattened *lgf)
+{
+    while (true) {
+        int users = DP_atomic_get(&lgf->users);
+        if (users < 0) {
+            return false;
+        }
+        else if (DP_atomic_compare_exchange(&lgf->users, users, users + 1)) {
+            return true;
+        }
+    }
+}
+
+static void flattened_leave_nullable(DP_LayerGroupFlattened *lgf_or_null)
+{
+    if (lgf_or_null) {
+        DP_atomic_add(&lgf_or_null->users, -1);
+    }
+}
+
+static void flattened_touch(DP_LayerGroupFlattened *lgf)
+{
+    int now = DP_atomic_get(&flattened_clock);
+    if (DP_atomic_get(&lgf->last_used) != now) {
+        DP_atomic_set(&lgf->last_used, now);
+    }
+}
+
+// Must only be called when no one else can be using the cache.
+static void flattened_clear_tiles(DP_LayerGroupFlattened *lgf)
+{
+    int cleared = 0;
+    for (int i = 0; i < lgf->tile_count; ++i) {
+        void *tile = DP_atomic_ptr_xch(&lgf->tiles[i], NULL);
+        if (is_flattened_tile(tile)) {
+            ++cleared;
+            DP_tile_decref(tile);
+        }
+    }
+    DP_atomic_add(&lgf->cached_tiles, -cleared);
+    DP_atomic_add(&flattened_tile_total, -cleared);
+}
+
+static bool flattened_clear_if_unused(DP_LayerGroupFlattened *lgf)
+{
+    if (DP_atomic_compare_exchange(&lgf->users, 0, -1)) {
+        flattened_clear_tiles(lgf);
+        return true;
+    }
+    else {
+        return false;
+    }
+}
+
+static void flattened_release_cleared(DP_LayerGroupFlattened *lgf)
+{
+    DP_atomic_set(&lgf->users, 0);
+}
+
+static DP_LayerGroupFlattened *flattened_new(int tile_count,
+                                             DP_LayerPropsList *lpl,
+                                             bool include_sublayers)
+{
+    DP_LayerGroupFlattened *lgf = DP_malloc_zeroed(DP_FLEX_SIZEOF(
+        DP_LayerGroupFlattened, tiles, DP_int_to_size(tile_count)));
+    lgf->lpl = DP_layer_props_list_incref(lpl);
+    lgf->include_sublayers = include_sublayers;
+    lgf->tile_count = tile_count;
+    return lgf;
+}
+
+static void flattened_free(DP_LayerGroupFlattened *lgf)
+{
+    flattened_clear_tiles(lgf);
+    DP_layer_props_list_decref(lgf->lpl);
+    DP_free(lgf);
+}
+
+static void flattened_register(DP_LayerGroupFlattened *lgf)
+{
+    DP_atomic_lock(&flattened_lock);
+    lgf->next = flattened_first;
+    if (flattened_first) {
+        flattened_first->prev = lgf;
+    }
+    flattened_first = lgf;
+    DP_atomic_unlock(&flattened_lock);
+    DP_atomic_inc(&flattened_clock);
+    flattened_touch(lgf);
+}
+
+static void dispose_flattened(DP_LayerGroup *lg)
+{
+    DP_LayerGroupFlattened *lgf = DP_atomic_ptr_get(&lg->flattened);
+    if (lgf) {
+        DP_atomic_lock(&flattened_lock);
+        if (lgf->prev) {
+            lgf->prev->next = lgf->next;
+        }
+        else {
+            flattened_first = lgf->next;
+        }
+        if (lgf->next) {
+            lgf->next->prev = lgf->prev;
+        }
+        DP_atomic_unlock(&flattened_lock);
+        flattened_free(lgf);
+    }
+}
+
+// Makes room for another tile if the limit has been reached by clearing out
+// the least recently used cache other than the one asking. If that one is
+// being used by another thread right now, nothing gets cleared.
+static bool flattened_reserve(DP_LayerGroupFlattened *self)
+{
+    int max_tiles = DP_atomic_get(&flattened_max_tiles);
+    if (DP_atomic_get(&flattened_tile_total) < max_tiles) {
+        return true;
+    }
+
+    DP_atomic_lock(&flattened_lock);
+    DP_LayerGroupFlattened *victim = NULL;
+    for (DP_LayerGroupFlattened *lgf = flattened_first; lgf; lgf = lgf->next) {
+        if (lgf != self && DP_atomic_get(&lgf->cached_tiles) > 0
+            && (!victim
+                || DP_atomic_get(&lgf->last_used)
+                       < DP_atomic_get(&victim->last_used))) {
+            victim = lgf;
+        }
+    }
+    bool evicted = victim && flattened_clear_if_unused(victim);
+    if (evicted) {
+        flattened_release_cleared(victim);
+    }
+    DP_atomic_unlock(&flattened_lock);
+
+    if (evicted) {
+        DP_atomic_inc(&flattened_clock);
+        return DP_atomic_get(&flattened_tile_total) < max_tiles;
+    }
+    else {
+        return false;
+    }
+}
+
+DP_LayerGroupCacheStats DP_layer_group_cache_stats(void)
+{
+    int groups = 0;
+    DP_atomic_lock(&flattened_lock);
+    for (DP_LayerGroupFlattened *lgf = flattened_first; lgf; lgf = lgf->next) {
+        if (DP_atomic_get(&lgf->cached_tiles) > 0) {
+            ++groups;
+        }
+    }
+    DP_atomic_unlock(&flattened_lock);
+    return (DP_LayerGroupCacheStats){DP_atomic_get(&flattened_tile_total),
+                                     groups, flattened_hits};
+}
+
+void DP_layer_group_cache_limit_set(int max_tiles)
+{
+    DP_ASSERT(max_tiles >= 0);
+    DP_atomic_set(&flattened_max_tiles, max_tiles);
+}
 
 DP_LayerGroup *DP_layer_group_incref(DP_LayerGroup *lg)
 {
@@ -86,6 +308,8 @@ void DP_layer_group_decref(DP_LayerGroup *lg)
     DP_ASSERT(DP_atomic_get(&lg->refcount) > 0);
     if (DP_atomic_dec(&lg->refcount)) {
         DP_layer_list_decref(lg->children);
+        DP_free(DP_atomic_ptr_get(&lg->coverage));
+        dispose_flattened(lg);
         DP_free(lg);
     }
 }
@@ -149,6 +373,60 @@ void DP_layer_group_diff(DP_LayerGroup *lg, DP_LayerProps *lp,
     }
 }
 
+static const bool *get_coverage(DP_LayerGroup *lg);
+
+static void mark_layer_list_coverage(DP_LayerList *ll, int tile_count,
+                                     bool *coverage)
+{
+    int count = DP_layer_list_count(ll);
+    for (int i = 0; i < count; ++i) {
+        DP_LayerListEntry *lle = DP_layer_list_at_noinc(ll, i);
+        if (DP_layer_list_entry_is_group(lle)) {
+            const bool *child_coverage =
+                get_coverage(DP_layer_list_entry_group_noinc(lle));
+            for (int j = 0; j < tile_count; ++j) {
+                coverage[j] = coverage[j] || child_coverage[j];
+            }
+        }
+        else {
+            DP_LayerContent *lc = DP_layer_list_entry_content_noinc(lle);
+            for (int j = 0; j < tile_count; ++j) {
+                coverage[j] = coverage[j]
+                           || DP_layer_content_tile_at_index_noinc(lc, j);
+            }
+            mark_layer_list_coverage(DP_layer_content_sub_contents_noinc(lc),
+                                     tile_count, coverage);
+        }
+    }
+}
+
+static const bool *get_coverage(DP_LayerGroup *lg)
+{
+    DP_ASSERT(!lg->transient);
+    bool *coverage = DP_atomic_ptr_get(&lg->coverage);
+    if (!coverage) {
+        int tile_count = DP_tile_total_round(lg->width, lg->height);
+        coverage = DP_malloc_zeroed(sizeof(*coverage)
+                                    * DP_int_to_size(tile_count));
+        mark_layer_list_coverage(lg->children, tile_count, coverage);
+        // Some other thread may have beaten us to it, use theirs instead.
+        if (!DP_atomic_ptr_compare_exchange(&lg->coverage, NULL, coverage)) {
+            DP_free(coverage);
+            coverage = DP_atomic_ptr_get(&lg->coverage);
+        }
+    }
+    return coverage;
+}
+
+bool DP_layer_group_tile_covered(DP_LayerGroup *lg, int tile_index)
+{
+    DP_ASSERT(lg);
+    DP_ASSERT(DP_atomic_get(&lg->refcount) > 0);
+    DP_ASSERT(tile_index >= 0);
+    DP_ASSERT(tile_index < DP_tile_total_round(lg->width, lg->height));
+    return get_coverage(lg)[tile_index];
+}
+
 void DP_layer_group_diff_mark(DP_LayerGroup *lg, DP_CanvasDiff *diff)
 {
     DP_ASSERT(lg);
@@ -310,6 +588,111 @@ void DP_layer_group_merge_to_flat_image(DP_LayerGroup *lg, DP_LayerProps *lp,
     }
 }
 
+static bool flattened_matches(DP_LayerGroupFlattened *lgf,
+                              DP_LayerPropsList *lpl, bool include_sublayers)
+{
+    return lgf && lgf->lpl == lpl
+        && lgf->include_sublayers == include_sublayers;
+}
+
+// Returns the group's flattened tile cache for the given props, which the
+// caller must leave again when it's done with it. Returns NULL if the result
+// can't be cached because the group or its props are transient, a view mode
+// applies to its children or the cache is being cleared.
+static DP_LayerGroupFlattened *get_flattened(DP_LayerGroup *lg,
+                                             DP_LayerPropsList *lpl,
+                                             bool include_sublayers,
+                                             const DP_ViewModeFilter *child_vmf)
+{
+    DP_ViewModeFilter normal_vmf = DP_view_mode_filter_make_default();
+    if (lg->transient || DP_layer_props_list_transient(lpl)
+        || !DP_view_mode_filter_equal(child_vmf, &normal_vmf)) {
+        return NULL;
+    }
+
+    DP_LayerGroupFlattened *lgf = DP_atomic_ptr_get(&lg->flattened);
+    if (!lgf) {
+        DP_LayerGroupFlattened *new_lgf = flattened_new(
+            DP_tile_total_round(lg->width, lg->height), lpl, include_sublayers);
+        // Some other thread may have gotten here first, use theirs instead.
+        if (DP_atomic_ptr_compare_exchange(&lg->flattened, NULL, new_lgf)) {
+            flattened_register(new_lgf);
+            lgf = new_lgf;
+        }
+        else {
+            flattened_free(new_lgf);
+            lgf = DP_atomic_ptr_get(&lg->flattened);
+        }
+    }
+
+    if (!flattened_enter(lgf)) {
+        return NULL;
+    }
+    else if (flattened_matches(lgf, lpl, include_sublayers)) {
+        flattened_touch(lgf);
+        return lgf;
+    }
+
+    // The props changed, e.g. because a layer in the group got hidden. Start
+    // over with the new ones, unless some other thread is using the cache.
+    flattened_leave_nullable(lgf);
+    if (flattened_clear_if_unused(lgf)) {
+        DP_layer_props_list_decref(lgf->lpl);
+        lgf->lpl = DP_layer_props_list_incref(lpl);
+        lgf->include_sublayers = include_sublayers;
+        flattened_release_cleared(lgf);
+    }
+    return NULL;
+}
+
+// Returns a new reference to the flattened tile, or NULL if it's blank.
+static DP_Tile *flatten_isolated_tile(DP_LayerGroup *lg, DP_LayerPropsList *lpl,
+                                      int tile_index, bool include_sublayers,
+                                      const DP_ViewModeFilter *child_vmf,
+                                      DP_LayerGroupFlattened *lgf_or_null)
+{
+    void *cached = NULL;
+    if (lgf_or_null) {
+        cached = DP_atomic_ptr_get(&lgf_or_null->tiles[tile_index]);
+        if (cached == &flattened_blank_tile) {
+            ++flattened_hits;
+            return NULL;
+        }
+        else if (is_flattened_tile(cached)) {
+            ++flattened_hits;
+            return DP_tile_incref(cached);
+        }
+    }
+
+    DP_TransientTile *gtt =
+        DP_layer_list_flatten_tile_to(lg->children, lpl, tile_index, NULL,
+                                      DP_BIT15, include_sublayers, child_vmf);
+    DP_Tile *t = gtt ? DP_transient_tile_persist(gtt) : NULL;
+
+    if (lgf_or_null) {
+        DP_AtomicPtr *slot = &lgf_or_null->tiles[tile_index];
+        if (!cached) {
+            DP_atomic_ptr_compare_exchange(slot, NULL, &flattened_seen_tile);
+        }
+        else if (!t) {
+            DP_atomic_ptr_compare_exchange(slot, &flattened_seen_tile,
+                                           &flattened_blank_tile);
+        }
+        else if (flattened_reserve(lgf_or_null)) {
+            if (DP_atomic_ptr_compare_exchange(slot, &flattened_seen_tile,
+                                               DP_tile_incref(t))) {
+                DP_atomic_inc(&lgf_or_null->cached_tiles);
+                DP_atomic_inc(&flattened_tile_total);
+            }
+            else {
+                DP_tile_decref(t);
+            }
+        }
+    }
+
+    return t;
+}
+
 DP_TransientTile *
 DP_layer_group_flatten_tile_to(DP_LayerGroup *lg, DP_LayerProps *lp,
                                int tile_index, DP_TransientTile *tt_or_null,
@@ -338,14 +721,16 @@ DP_layer_group_flatten_tile_to(DP_LayerGroup *lg, DP_LayerProps *lp,
     if (DP_layer_props_isolated(lp)) {
         // Flatten the group into a temporary layer with full opacity, then
         // merge the result with the group's blend mode and opacity.
-        DP_TransientTile *gtt = DP_layer_list_flatten_tile_to(
-            lg->children, lpl, tile_index, NULL, DP_BIT15, include_sublayers,
-            &vmfr.child_vmf);
-        if (gtt) {
+        DP_LayerGroupFlattened *lgf =
+            get_flattened(lg, lpl, include_sublayers, &vmfr.child_vmf);
+        DP_Tile *t = flatten_isolated_tile(lg, lpl, tile_index,
+                                           include_sublayers, &vmfr.child_vmf,
+                                           lgf);
+        flattened_leave_nullable(lgf);
+        if (t) {
             DP_TransientTile *tt = DP_transient_tile_merge_nullable(
-                tt_or_null, (DP_Tile *)gtt, opacity,
-                DP_layer_props_blend_mode(lp));
-            DP_transient_tile_decref(gtt);
+                tt_or_null, t, opacity, DP_layer_props_blend_mode(lp));
+            DP_tile_decref(t);
             return tt;
         }
         else {
@@ -365,8 +750,9 @@ DP_layer_group_flatten_tile_to(DP_LayerGroup *lg, DP_LayerProps *lp,
 static DP_TransientLayerGroup *alloc_layer_group(int width, int height)
 {
     DP_TransientLayerGroup *tlg = DP_malloc(sizeof(*tlg));
-    *tlg = (DP_TransientLayerGroup){
-        DP_ATOMIC_INIT(1), true, width, height, {NULL}};
+    *tlg = (DP_TransientLayerGroup){DP_ATOMIC_INIT(1), true, width, height,
+                                    {NULL}, DP_ATOMIC_PTR_INIT(NULL),
+                                    DP_ATOMIC_PTR_INIT(NULL)};
     return tlg;
 }
 
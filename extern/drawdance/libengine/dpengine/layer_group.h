@@ -45,6 +45,20 @@ typedef struct DP_LayerProps DP_LayerProps;
 typedef struct DP_Tile DP_TransientTile;
 #endif
 
+typedef struct DP_LayerGroupCacheStats {
+    int tiles;  // Flattened tiles currently cached across all groups.
+    int groups; // Groups that currently have tiles cached.
+    int hits;   // Tiles this thread took from a cache instead of flattening.
+} DP_LayerGroupCacheStats;
+
+
+DP_LayerGroupCacheStats DP_layer_group_cache_stats(void);
+
+// Limits how many flattened tiles of isolated groups get cached in total. When
+// the limit is reached, the tiles of the least recently used groups are
+// dropped to make room.
+void DP_layer_group_cache_limit_set(int max_tiles);
+
 
 DP_LayerGroup *DP_layer_group_incref(DP_LayerGroup *lg);
 
@@ -64,6 +78,12 @@ void DP_layer_group_diff(DP_LayerGroup *lg, DP_LayerProps *lp,
 
 void DP_layer_group_diff_mark(DP_LayerGroup *lg, DP_CanvasDiff *diff);
 
+// Checks if any layer inside of the group, including sublayers, has a tile at
+// the given index. The first call builds an index of this for all tiles, which
+// sticks around for as long as the group does and is shared by every canvas
+// state that contains it. Only valid on persistent groups.
+bool DP_layer_group_tile_covered(DP_LayerGroup *lg, int tile_index);
+
 int DP_layer_group_width(DP_LayerGroup *lg);
 
 int DP_layer_group_height(DP_LayerGroup *lg);
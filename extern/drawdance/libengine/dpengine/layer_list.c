@@ -296,6 +296,33 @@ void DP_layer_list_diff_mark(DP_LayerList *ll, DP_CanvasDiff *diff)
     mark_layers(ll, diff, 0, ll->count);
 }
 
+int DP_layer_list_first_difference(DP_LayerList *ll, DP_LayerPropsList *lpl,
+                                   DP_LayerList *prev_ll,
+                                   DP_LayerPropsList *prev_lpl)
+{
+    DP_ASSERT(ll);
+    DP_ASSERT(DP_atomic_get(&ll->refcount) > 0);
+    DP_ASSERT(lpl);
+    DP_ASSERT(prev_ll);
+    DP_ASSERT(DP_atomic_get(&prev_ll->refcount) > 0);
+    DP_ASSERT(prev_lpl);
+    int count = DP_min_int(ll->count, prev_ll->count);
+    if (ll != prev_ll || lpl != prev_lpl) {
+        for (int i = 0; i < count; ++i) {
+            DP_LayerListEntry *lle = &ll->elements[i];
+            DP_LayerListEntry *prev_lle = &prev_ll->elements[i];
+            bool entry_changed = lle->is_group != prev_lle->is_group
+                              || lle->content != prev_lle->content;
+            if (entry_changed
+                || DP_layer_props_list_at_noinc(lpl, i)
+                       != DP_layer_props_list_at_noinc(prev_lpl, i)) {
+                return i;
+            }
+        }
+    }
+    return count;
+}
+
 
 int DP_layer_list_count(DP_LayerList *ll)
 {
@@ -401,16 +428,28 @@ DP_layer_list_flatten_tile_to(DP_LayerList *ll, DP_LayerPropsList *lpl,
                               int tile_index, DP_TransientTile *tt_or_null,
                               uint16_t parent_opacity, bool include_sublayers,
                               const DP_ViewModeFilter *vmf)
+{
+    DP_ASSERT(ll);
+    return DP_layer_list_flatten_tile_range_to(
+        ll, lpl, 0, ll->count, tile_index, tt_or_null, parent_opacity,
+        include_sublayers, vmf);
+}
+
+DP_TransientTile *DP_layer_list_flatten_tile_range_to(
+    DP_LayerList *ll, DP_LayerPropsList *lpl, int start, int end,
+    int tile_index, DP_TransientTile *tt_or_null, uint16_t parent_opacity,
+    bool include_sublayers, const DP_ViewModeFilter *vmf)
 {
     DP_ASSERT(ll);
     DP_ASSERT(DP_atomic_get(&ll->refcount) > 0);
     DP_ASSERT(lpl);
     DP_ASSERT(DP_layer_props_list_refcount(lpl) > 0);
     DP_ASSERT(ll->count == DP_layer_props_list_count(lpl));
+    DP_ASSERT(start >= 0);
+    DP_ASSERT(end <= ll->count);
     DP_ASSERT(vmf);
-    int count = ll->count;
     DP_TransientTile *tt = tt_or_null;
-    for (int i = 0; i < count; ++i) {
+    for (int i = start; i < end; ++i) {
         DP_LayerProps *lp = DP_layer_props_list_at_noinc(lpl, i);
         DP_LayerListEntry *lle = &ll->elements[i];
         if (lle->is_group) {
@@ -633,6 +672,24 @@ void DP_transient_layer_list_set_content_inc(DP_TransientLayerList *tll,
 }
 
 
+void DP_transient_layer_list_replace_content_inc(DP_TransientLayerList *tll,
+                                                 DP_LayerContent *lc,
+                                                 int index)
+{
+    DP_ASSERT(tll);
+    DP_ASSERT(DP_atomic_get(&tll->refcount) > 0);
+    DP_ASSERT(tll->transient);
+    DP_ASSERT(lc);
+    DP_ASSERT(index >= 0);
+    DP_ASSERT(index < tll->count);
+    DP_LayerListEntry *lle = &tll->elements[index];
+    DP_ASSERT(!lle->is_group);
+    DP_layer_content_incref(lc);
+    layer_list_entry_decref(lle);
+    lle->content = lc;
+}
+
+
 void DP_transient_layer_list_set_group_noinc(DP_TransientLayerList *tll,
                                              DP_LayerGroup *lg, int index)
 {
@@ -83,6 +83,13 @@ void DP_layer_list_diff(DP_LayerList *ll, DP_LayerPropsList *lpl,
 
 void DP_layer_list_diff_mark(DP_LayerList *ll, DP_CanvasDiff *diff);
 
+// Returns the index of the bottommost layer that differs between the two
+// lists by identity of its content or props. If none of them differ, returns
+// the count of the shorter list.
+int DP_layer_list_first_difference(DP_LayerList *ll, DP_LayerPropsList *lpl,
+                                   DP_LayerList *prev_ll,
+                                   DP_LayerPropsList *prev_lpl);
+
 int DP_layer_list_count(DP_LayerList *ll);
 
 DP_LayerListEntry *DP_layer_list_at_noinc(DP_LayerList *ll, int index);
@@ -107,6 +114,13 @@ DP_layer_list_flatten_tile_to(DP_LayerList *ll, DP_LayerPropsList *lpl,
                               uint16_t parent_opacity, bool include_sublayers,
                               const DP_ViewModeFilter *vmf);
 
+// Like DP_layer_list_flatten_tile_to, but only flattens the layers from index
+// start (inclusive) to index end (exclusive).
+DP_TransientTile *DP_layer_list_flatten_tile_range_to(
+    DP_LayerList *ll, DP_LayerPropsList *lpl, int start, int end,
+    int tile_index, DP_TransientTile *tt_or_null, uint16_t parent_opacity,
+    bool include_sublayers, const DP_ViewModeFilter *vmf);
+
 
 DP_TransientLayerList *DP_transient_layer_list_new_init(int reserve);
 
@@ -150,6 +164,11 @@ void DP_transient_layer_list_set_content_noinc(DP_TransientLayerList *tll,
 void DP_transient_layer_list_set_content_inc(DP_TransientLayerList *tll,
                                              DP_LayerContent *lc, int index);
 
+// Replaces the layer content at the given index, releasing the old one.
+void DP_transient_layer_list_replace_content_inc(DP_TransientLayerList *tll,
+                                                 DP_LayerContent *lc,
+                                                 int index);
+
 void DP_transient_layer_list_set_group_noinc(DP_TransientLayerList *tll,
                                              DP_LayerGroup *lg, int index);
 
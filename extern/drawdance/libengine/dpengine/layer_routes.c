@@ -524,14 +524,10 @@ void DP_layer_routes_entry_children(DP_LayerRoutesEntry *lre,
 }
 
 
-DP_TransientLayerContent *
-DP_layer_routes_entry_indexes_transient_content(int index_count, int *indexes,
-                                                DP_TransientCanvasState *tcs)
+static DP_TransientLayerList *
+get_parent_transient_layers(int index_count, int *indexes,
+                            DP_TransientCanvasState *tcs)
 {
-    DP_ASSERT(index_count > 0);
-    DP_ASSERT(indexes);
-    DP_ASSERT(tcs);
-
     int group_indexes_count = index_count - 1;
     DP_TransientLayerList *tll =
         DP_transient_canvas_state_transient_layers(tcs, 0);
@@ -543,7 +539,19 @@ DP_layer_routes_entry_indexes_transient_content(int index_count, int *indexes,
         tll = DP_transient_layer_group_transient_children(tlg, 0);
     }
 
-    int last_index = indexes[group_indexes_count];
+    return tll;
+}
+
+DP_TransientLayerContent *
+DP_layer_routes_entry_indexes_transient_content(int index_count, int *indexes,
+                                                DP_TransientCanvasState *tcs)
+{
+    DP_ASSERT(index_count > 0);
+    DP_ASSERT(indexes);
+    DP_ASSERT(tcs);
+    DP_TransientLayerList *tll =
+        get_parent_transient_layers(index_count, indexes, tcs);
+    int last_index = indexes[index_count - 1];
     return DP_transient_layer_list_transient_content_at_noinc(tll, last_index);
 }
 
@@ -557,6 +565,20 @@ DP_layer_routes_entry_transient_content(DP_LayerRoutesEntry *lre,
                                                            lre->indexes, tcs);
 }
 
+void DP_layer_routes_entry_transient_content_replace_inc(
+    DP_LayerRoutesEntry *lre, DP_TransientCanvasState *tcs, DP_LayerContent *lc)
+{
+    DP_ASSERT(lre);
+    DP_ASSERT(!lre->is_group);
+    DP_ASSERT(tcs);
+    DP_ASSERT(lc);
+    int index_count = lre->index_count;
+    DP_TransientLayerList *tll =
+        get_parent_transient_layers(index_count, lre->indexes, tcs);
+    int last_index = lre->indexes[index_count - 1];
+    DP_transient_layer_list_replace_content_inc(tll, lc, last_index);
+}
+
 
 DP_TransientLayerProps *
 DP_layer_routes_entry_indexes_transient_props(int index_count, int *indexes,
@@ -109,6 +109,10 @@ DP_TransientLayerContent *
 DP_layer_routes_entry_transient_content(DP_LayerRoutesEntry *lre,
                                         DP_TransientCanvasState *tcs);
 
+void DP_layer_routes_entry_transient_content_replace_inc(
+    DP_LayerRoutesEntry *lre, DP_TransientCanvasState *tcs,
+    DP_LayerContent *lc);
+
 DP_TransientLayerProps *
 DP_layer_routes_entry_indexes_transient_props(int index_count, int *indexes,
                                               DP_TransientCanvasState *tcs);
@@ -289,9 +289,9 @@ DP_Message *DP_local_state_msg_background_tile_new(DP_DrawContext *dc,
 {
     if (tile_or_null) {
         DP_ASSERT(dc);
-        size_t size =
-            DP_tile_compress(tile_or_null, DP_draw_context_tile8_buffer(dc),
-                             get_compression_buffer, dc);
+        size_t size = DP_tile_compress(tile_or_null, NULL,
+                                       DP_draw_context_tile8_buffer(dc),
+                                       get_compression_buffer, dc);
         if (size == 0) {
             return NULL;
         }
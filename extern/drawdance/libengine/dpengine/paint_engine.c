@@ -79,6 +79,9 @@ typedef enum DP_PaintEnginePreviewType {
 #define RECORDER_STARTED   1
 #define RECORDER_STOPPED   2
 
+// Maximum number of tiles in the flattened-below cache, 32 KiB each.
+#define BELOW_CACHE_MAX_TILES 1024
+
 #define PLAYBACK_STEP_MESSAGES    0
 #define PLAYBACK_STEP_UNDO_POINTS 1
 #define PLAYBACK_STEP_MSECS       2
@@ -128,6 +131,11 @@ typedef struct DP_PaintEngineTransformPreview {
 typedef struct DP_PaintEngineDabsPreview {
     DP_PaintEnginePreview parent;
     int layer_id;
+    struct {
+        DP_LayerContent *base_lc;
+        DP_LayerContent *lc;
+        int offset_x, offset_y;
+    } cache;
     int count;
     DP_Message *messages[];
 } DP_PaintEngineDabsPreview;
@@ -151,6 +159,29 @@ typedef struct DP_PaintEngineCursorChange {
     };
 } DP_PaintEngineCursorChange;
 
+typedef struct DP_PaintEngineBelowCacheEntry {
+    DP_Tile *tile;
+    unsigned int last_used;
+} DP_PaintEngineBelowCacheEntry;
+
+// Caches the background and the bottommost layers of the canvas flattened into
+// one tile, for tiles that get re-rendered often. When someone is drawing on a
+// layer, only that layer and the ones above it need to be blended on top of
+// the cached tile instead of flattening the whole layer stack every time.
+typedef struct DP_PaintEngineBelowCache {
+    DP_LayerList *ll;
+    DP_LayerPropsList *lpl;
+    DP_Tile *background;
+    int split;
+    int last_changed;
+    int tile_total;
+    unsigned int pass;
+    DP_Mutex *mutex;
+    int count;
+    int *indexes;
+    DP_PaintEngineBelowCacheEntry *entries;
+} DP_PaintEngineBelowCache;
+
 struct DP_PaintEngine {
     DP_AclState *acls;
     DP_CanvasHistory *ch;
@@ -176,10 +207,17 @@ struct DP_PaintEngine {
     DP_PaintEnginePreview *previews[DP_PAINT_ENGINE_PREVIEW_COUNT];
     DP_AtomicPtr next_previews[DP_PAINT_ENGINE_PREVIEW_COUNT];
     DP_DrawContext *preview_dc;
+    // Inbox that other threads push messages into, guarded by the queue mutex.
+    // The paint thread swaps out the whole thing in one go and then works
+    // through its own queues below without taking any locks per message.
     DP_Queue local_queue;
     DP_Queue remote_queue;
     DP_Semaphore *queue_sem;
     DP_Mutex *queue_mutex;
+    DP_Atomic local_pending;
+    bool paint_waiting;
+    DP_Queue paint_local_queue;
+    DP_Queue paint_remote_queue;
     DP_Atomic running;
     DP_Atomic catchup;
     DP_Atomic default_layer_id;
@@ -211,6 +249,7 @@ struct DP_PaintEngine {
         DP_Semaphore *tiles_done_sem;
         int tiles_waiting;
         DP_PaintEngineRenderBuffer *buffers;
+        DP_PaintEngineBelowCache below;
     } render;
 };
 
@@ -228,11 +267,39 @@ struct DP_PaintEngineRenderJobParams {
 };
 
 
+// Must be called with the queue mutex held after pushing to the inbox. Only
+// wakes up the paint thread if it's actually asleep, so pushing a bunch of
+// messages in a row doesn't ping-pong between the threads for each of them.
+static void notify_pushed(DP_PaintEngine *pe, bool local)
+{
+    if (local) {
+        DP_atomic_set(&pe->local_pending, true);
+    }
+    if (pe->paint_waiting) {
+        pe->paint_waiting = false;
+        DP_SEMAPHORE_MUST_POST(pe->queue_sem);
+    }
+}
+
+static void swap_queues(DP_Queue *a, DP_Queue *b)
+{
+    DP_Queue tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+static void move_messages(DP_Queue *dst, DP_Queue *src)
+{
+    DP_Message *msg;
+    while ((msg = DP_message_queue_shift(src)) != NULL) {
+        DP_message_queue_push_noinc(dst, msg);
+    }
+}
+
 static void push_cleanup_message(void *user, DP_Message *msg)
 {
     DP_PaintEngine *pe = user;
-    DP_message_queue_push_noinc(&pe->remote_queue, msg);
-    DP_SEMAPHORE_MUST_POST(pe->queue_sem);
+    DP_message_queue_push_noinc(&pe->paint_remote_queue, msg);
 }
 
 static void free_preview(DP_PaintEnginePreview *preview)
@@ -355,12 +422,14 @@ static void handle_internal(DP_PaintEngine *pe, DP_DrawContext *dc,
         DP_atomic_set(&pe->catchup, DP_msg_internal_catchup_progress(mi));
         break;
     case DP_MSG_INTERNAL_TYPE_CLEANUP:
+        // Pull in what's left in the inbox so that pending remote messages
+        // stay in front of the cleanup and local messages end up behind it.
         DP_MUTEX_MUST_LOCK(pe->queue_mutex);
+        move_messages(&pe->paint_remote_queue, &pe->remote_queue);
         DP_canvas_history_cleanup(pe->ch, dc, push_cleanup_message, pe);
-        while (pe->local_queue.used != 0) {
-            DP_message_queue_push_noinc(
-                &pe->remote_queue, DP_message_queue_shift(&pe->local_queue));
-        }
+        move_messages(&pe->paint_remote_queue, &pe->paint_local_queue);
+        move_messages(&pe->paint_remote_queue, &pe->local_queue);
+        DP_atomic_set(&pe->local_pending, false);
         DP_MUTEX_MUST_UNLOCK(pe->queue_mutex);
         break;
     case DP_MSG_INTERNAL_TYPE_PREVIEW:
@@ -419,13 +488,23 @@ static void handle_internal(DP_PaintEngine *pe, DP_DrawContext *dc,
 static bool shift_first_message(DP_PaintEngine *pe, DP_Message **msgs)
 {
     // Local queue takes priority, we want our own strokes to be responsive.
-    DP_Message *msg = DP_message_queue_shift(&pe->local_queue);
+    // So if we ran out of local messages, check if the inbox got any new ones
+    // instead of waiting until we worked through all the remote messages.
+    DP_Queue *local_queue = &pe->paint_local_queue;
+    if (local_queue->used == 0 && DP_atomic_get(&pe->local_pending)) {
+        DP_MUTEX_MUST_LOCK(pe->queue_mutex);
+        swap_queues(local_queue, &pe->local_queue);
+        DP_atomic_set(&pe->local_pending, false);
+        DP_MUTEX_MUST_UNLOCK(pe->queue_mutex);
+    }
+
+    DP_Message *msg = DP_message_queue_shift(local_queue);
     if (msg) {
         msgs[0] = msg;
         return true;
     }
     else {
-        msgs[0] = DP_message_queue_shift(&pe->remote_queue);
+        msgs[0] = DP_message_queue_shift(&pe->paint_remote_queue);
         return false;
     }
 }
@@ -492,7 +571,7 @@ static int shift_more_draw_dabs_messages(DP_PaintEngine *pe, bool local,
 {
     int count = 1;
     int total_dabs_area = initial_dabs_area;
-    DP_Queue *queue = local ? &pe->local_queue : &pe->remote_queue;
+    DP_Queue *queue = local ? &pe->paint_local_queue : &pe->paint_remote_queue;
 
     DP_Message *msg;
     while (count < MAX_MULTIDAB_MESSAGES
@@ -508,12 +587,6 @@ static int shift_more_draw_dabs_messages(DP_PaintEngine *pe, bool local,
         }
     }
 
-    if (count > 1) {
-        int n = count - 1;
-        DP_ASSERT(DP_semaphore_value(pe->queue_sem) >= n);
-        DP_SEMAPHORE_MUST_WAIT_N(pe->queue_sem, n);
-    }
-
     return count;
 }
 
@@ -572,16 +645,17 @@ static void handle_multidab(DP_PaintEngine *pe, DP_DrawContext *dc, bool local,
     }
 }
 
-static void handle_message(DP_PaintEngine *pe, DP_DrawContext *dc,
+static bool handle_message(DP_PaintEngine *pe, DP_DrawContext *dc,
                            DP_Message **msgs)
 {
-    DP_MUTEX_MUST_LOCK(pe->queue_mutex);
     bool local = shift_first_message(pe, msgs);
     DP_Message *first = msgs[0];
+    if (!first) {
+        return false;
+    }
+
     DP_MessageType type = DP_message_type(first);
     int count = maybe_shift_more_messages(pe, local, type, msgs);
-    DP_MUTEX_MUST_UNLOCK(pe->queue_mutex);
-
     DP_ASSERT(count > 0);
     DP_ASSERT(count <= MAX_MULTIDAB_MESSAGES);
     if (count == 1) {
@@ -590,21 +664,49 @@ static void handle_message(DP_PaintEngine *pe, DP_DrawContext *dc,
     else {
         handle_multidab(pe, dc, local, count, msgs);
     }
+    return true;
+}
+
+// Swaps the entire inbox into the paint thread's own queues, which must have
+// been worked through entirely. If there's nothing in there, sleeps until
+// another thread pushes something. Returns false when shutting down, in which
+// case the queues may still have messages in them that the engine disposes.
+static bool receive_messages(DP_PaintEngine *pe)
+{
+    if (!DP_atomic_get(&pe->running)) {
+        return false;
+    }
+
+    DP_ASSERT(pe->paint_local_queue.used == 0);
+    DP_ASSERT(pe->paint_remote_queue.used == 0);
+    while (true) {
+        DP_MUTEX_MUST_LOCK(pe->queue_mutex);
+        swap_queues(&pe->paint_local_queue, &pe->local_queue);
+        swap_queues(&pe->paint_remote_queue, &pe->remote_queue);
+        DP_atomic_set(&pe->local_pending, false);
+        bool empty = pe->paint_local_queue.used == 0
+                  && pe->paint_remote_queue.used == 0;
+        pe->paint_waiting = empty;
+        DP_MUTEX_MUST_UNLOCK(pe->queue_mutex);
+
+        if (!DP_atomic_get(&pe->running)) {
+            return false;
+        }
+        else if (!empty) {
+            return true;
+        }
+        DP_SEMAPHORE_MUST_WAIT(pe->queue_sem);
+    }
 }
 
 static void run_paint_engine(void *user)
 {
     DP_PaintEngine *pe = user;
     DP_DrawContext *dc = pe->paint_dc;
-    DP_Semaphore *sem = pe->queue_sem;
     DP_Message **msgs = DP_malloc(sizeof(*msgs) * MAX_MULTIDAB_MESSAGES);
-    while (true) {
-        DP_SEMAPHORE_MUST_WAIT(sem);
-        if (DP_atomic_get(&pe->running)) {
-            handle_message(pe, dc, msgs);
-        }
-        else {
-            break;
+    while (receive_messages(pe)) {
+        while (DP_atomic_get(&pe->running) && handle_message(pe, dc, msgs)) {
+            // Keep going until we've worked through everything we received.
         }
     }
     DP_free(msgs);
@@ -634,10 +736,181 @@ static void flatten_onion_skin(DP_TransientTile *tt, DP_CanvasState *cs,
     }
 }
 
+static void below_cache_init(DP_PaintEngineBelowCache *bc)
+{
+    bc->ll = NULL;
+    bc->lpl = NULL;
+    bc->background = NULL;
+    bc->split = 0;
+    bc->last_changed = -1;
+    bc->tile_total = 0;
+    bc->pass = 0;
+    bc->mutex = DP_mutex_new();
+    bc->count = 0;
+    bc->indexes = DP_malloc(sizeof(*bc->indexes) * BELOW_CACHE_MAX_TILES);
+    bc->entries = NULL;
+}
+
+static void below_cache_clear(DP_PaintEngineBelowCache *bc)
+{
+    int count = bc->count;
+    for (int i = 0; i < count; ++i) {
+        DP_PaintEngineBelowCacheEntry *entry = &bc->entries[bc->indexes[i]];
+        DP_tile_decref(entry->tile);
+        entry->tile = NULL;
+    }
+    bc->count = 0;
+}
+
+static void below_cache_dispose(DP_PaintEngineBelowCache *bc)
+{
+    below_cache_clear(bc);
+    DP_free(bc->entries);
+    DP_free(bc->indexes);
+    DP_mutex_free(bc->mutex);
+    DP_tile_decref_nullable(bc->background);
+    DP_layer_props_list_decref_nullable(bc->lpl);
+    DP_layer_list_decref_nullable(bc->ll);
+}
+
+// Called before rendering, while no render jobs are running. Figures out the
+// bottommost layer that changed since the last render. If that's below the
+// cached layers, the cache is stale and gets cleared. If changes keep
+// happening further up, the split is moved up to there.
+static void below_cache_update(DP_PaintEngine *pe)
+{
+    DP_PaintEngineBelowCache *bc = &pe->render.below;
+    DP_CanvasState *cs = pe->view_cs;
+    DP_LayerList *ll = DP_canvas_state_layers_noinc(cs);
+    DP_LayerPropsList *lpl = DP_canvas_state_layer_props_noinc(cs);
+    DP_Tile *background = DP_canvas_state_background_tile_noinc(cs);
+    int tile_total = DP_tile_total_round(DP_canvas_state_width(cs),
+                                         DP_canvas_state_height(cs));
+
+    if (tile_total != bc->tile_total) {
+        below_cache_clear(bc);
+        DP_free(bc->entries);
+        size_t size = sizeof(*bc->entries) * DP_int_to_size(tile_total);
+        bc->entries = DP_malloc(size);
+        memset(bc->entries, 0, size);
+        bc->tile_total = tile_total;
+        bc->split = 0;
+    }
+
+    int changed;
+    if (pe->local_view.view_mode != DP_VIEW_MODE_NORMAL || !bc->ll
+        || background != bc->background) {
+        changed = 0;
+    }
+    else {
+        changed = DP_layer_list_first_difference(ll, lpl, bc->ll, bc->lpl);
+    }
+
+    int count = DP_layer_list_count(ll);
+    if (changed < bc->split) {
+        below_cache_clear(bc);
+        bc->split = changed;
+    }
+    else if (changed < count && changed > bc->split
+             && changed == bc->last_changed) {
+        below_cache_clear(bc);
+        bc->split = changed;
+    }
+
+    if (changed < count) {
+        bc->last_changed = changed;
+    }
+
+    if (ll != bc->ll) {
+        DP_layer_list_decref_nullable(bc->ll);
+        bc->ll = DP_layer_list_incref(ll);
+    }
+    if (lpl != bc->lpl) {
+        DP_layer_props_list_decref_nullable(bc->lpl);
+        bc->lpl = DP_layer_props_list_incref(lpl);
+    }
+    if (background != bc->background) {
+        DP_tile_decref_nullable(bc->background);
+        bc->background = DP_tile_incref_nullable(background);
+    }
+
+    ++bc->pass;
+}
+
+// Called after rendering, while no render jobs are running. If the cache is
+// getting full, tiles that weren't used in this render pass are evicted.
+static void below_cache_trim(DP_PaintEngineBelowCache *bc)
+{
+    if (bc->count > BELOW_CACHE_MAX_TILES / 4 * 3) {
+        int keep = 0;
+        int count = bc->count;
+        for (int i = 0; i < count; ++i) {
+            int tile_index = bc->indexes[i];
+            DP_PaintEngineBelowCacheEntry *entry = &bc->entries[tile_index];
+            if (entry->last_used == bc->pass
+                || count - (i - keep) <= BELOW_CACHE_MAX_TILES / 2) {
+                bc->indexes[keep++] = tile_index;
+            }
+            else {
+                DP_tile_decref(entry->tile);
+                entry->tile = NULL;
+            }
+        }
+        bc->count = keep;
+    }
+}
+
+// Called from render jobs, which run in parallel, but never on the same tile.
+// Returns a new reference to the flattened-below tile, caching it if there's
+// room for it.
+static DP_Tile *below_cache_get(DP_PaintEngineBelowCache *bc, int tile_index)
+{
+    DP_PaintEngineBelowCacheEntry *entry = &bc->entries[tile_index];
+    if (entry->tile) {
+        entry->last_used = bc->pass;
+        return DP_tile_incref(entry->tile);
+    }
+
+    DP_ViewModeFilter vmf = DP_view_mode_filter_make_default();
+    DP_TransientTile *tt = DP_transient_tile_new_nullable(bc->background, 0);
+    DP_layer_list_flatten_tile_range_to(bc->ll, bc->lpl, 0, bc->split,
+                                        tile_index, tt, DP_BIT15, true, &vmf);
+    DP_Tile *t = DP_transient_tile_persist(tt);
+
+    DP_MUTEX_MUST_LOCK(bc->mutex);
+    if (bc->count < BELOW_CACHE_MAX_TILES) {
+        bc->indexes[bc->count++] = tile_index;
+        entry->tile = DP_tile_incref(t);
+        entry->last_used = bc->pass;
+    }
+    DP_MUTEX_MUST_UNLOCK(bc->mutex);
+    return t;
+}
+
 static DP_TransientTile *flatten_tile(DP_PaintEngine *pe, bool needs_checkers,
                                       int tile_index)
 {
     DP_CanvasState *cs = pe->view_cs;
+    DP_LayerList *ll = DP_canvas_state_layers_noinc(cs);
+    DP_PaintEngineBelowCache *bc = &pe->render.below;
+    int split = bc->split;
+    if (split > 0) {
+        DP_Tile *below = below_cache_get(bc, tile_index);
+        DP_TransientTile *tt = DP_transient_tile_new(below, 0);
+        DP_tile_decref(below);
+        DP_ViewModeFilter vmf = DP_view_mode_filter_make_default();
+        DP_layer_list_flatten_tile_range_to(
+            ll, DP_canvas_state_layer_props_noinc(cs), split,
+            DP_layer_list_count(ll), tile_index, tt, DP_BIT15, true, &vmf);
+        if (needs_checkers) {
+            DP_transient_tile_merge(tt, pe->checker, DP_BIT15,
+                                    DP_BLEND_MODE_BEHIND);
+        }
+        DP_transient_layer_content_transient_tile_set_noinc(pe->tlc, tt,
+                                                            tile_index);
+        return tt;
+    }
+
     DP_TransientTile *tt = DP_transient_tile_new_nullable(
         DP_canvas_state_background_tile_noinc(cs), 0);
 
@@ -662,8 +935,7 @@ static DP_TransientTile *flatten_tile(DP_PaintEngine *pe, bool needs_checkers,
 
     DP_ViewModeFilter vmf = DP_view_mode_filter_make(
         vm, cs, pe->local_view.active_layer_id, active_frame_index);
-    DP_layer_list_flatten_tile_to(DP_canvas_state_layers_noinc(cs),
-                                  DP_canvas_state_layer_props_noinc(cs),
+    DP_layer_list_flatten_tile_to(ll, DP_canvas_state_layer_props_noinc(cs),
                                   tile_index, tt, DP_BIT15, true, &vmf);
 
     if (needs_checkers) {
@@ -776,6 +1048,10 @@ DP_PaintEngine *DP_paint_engine_new_inc(
     DP_message_queue_init(&pe->remote_queue, INITIAL_QUEUE_CAPACITY);
     pe->queue_sem = DP_semaphore_new(0);
     pe->queue_mutex = DP_mutex_new();
+    DP_atomic_set(&pe->local_pending, false);
+    pe->paint_waiting = false;
+    DP_message_queue_init(&pe->paint_local_queue, INITIAL_QUEUE_CAPACITY);
+    DP_message_queue_init(&pe->paint_remote_queue, INITIAL_QUEUE_CAPACITY);
     DP_atomic_set(&pe->running, true);
     DP_atomic_set(&pe->catchup, -1);
     DP_atomic_set(&pe->default_layer_id, -1);
@@ -805,6 +1081,7 @@ DP_PaintEngine *DP_paint_engine_new_inc(
     pe->render.tiles_waiting = 0;
     pe->render.buffers = DP_malloc_simd(sizeof(DP_PaintEngineRenderBuffer)
                                         * DP_int_to_size(render_thread_count));
+    below_cache_init(&pe->render.below);
     return pe;
 }
 
@@ -816,6 +1093,7 @@ void DP_paint_engine_free_join(DP_PaintEngine *pe)
         DP_semaphore_free(pe->render.tiles_done_sem);
         DP_free_simd(pe->render.buffers);
         DP_worker_free_join(pe->render.worker);
+        below_cache_dispose(&pe->render.below);
         DP_SEMAPHORE_MUST_POST(pe->queue_sem);
         DP_thread_free_join(pe->paint_thread);
         DP_player_free(pe->playback.player);
@@ -824,6 +1102,13 @@ void DP_paint_engine_free_join(DP_PaintEngine *pe)
         DP_mutex_free(pe->queue_mutex);
         DP_semaphore_free(pe->queue_sem);
         DP_message_queue_dispose(&pe->remote_queue);
+        // The paint thread may have stopped partway through its queues. A
+        // cleanup also moves local messages into the remote one, so both may
+        // contain internal messages that need to be disposed of properly.
+        move_messages(&pe->local_queue, &pe->paint_remote_queue);
+        move_messages(&pe->local_queue, &pe->paint_local_queue);
+        DP_message_queue_dispose(&pe->paint_remote_queue);
+        DP_message_queue_dispose(&pe->paint_local_queue);
         DP_Message *msg;
         while ((msg = DP_message_queue_shift(&pe->local_queue)) != NULL) {
             if (DP_message_type(msg) == DP_MSG_INTERNAL) {
@@ -998,7 +1283,7 @@ static bool start_recording(DP_PaintEngine *pe, DP_RecorderType type,
     DP_MUTEX_MUST_LOCK(pe->queue_mutex);
     DP_message_queue_push_noinc(&pe->remote_queue,
                                 DP_msg_internal_recorder_start_new(0));
-    DP_SEMAPHORE_MUST_POST(pe->queue_sem);
+    notify_pushed(pe, false);
     DP_MUTEX_MUST_UNLOCK(pe->queue_mutex);
     // The paint thread will post to this semaphore when it reaches our
     // recorder start message.
@@ -1405,7 +1690,7 @@ DP_paint_engine_playback_play(DP_PaintEngine *pe, long long msecs,
 }
 
 bool DP_paint_engine_playback_index_build(
-    DP_PaintEngine *pe, DP_DrawContext *dc,
+    DP_PaintEngine *pe, DP_DrawContext *dc, bool incremental,
     DP_PlayerIndexShouldSnapshotFn should_snapshot_fn,
     DP_PlayerIndexProgressFn progress_fn, void *user)
 {
@@ -1413,8 +1698,8 @@ bool DP_paint_engine_playback_index_build(
     DP_ASSERT(dc);
     DP_Player *player = pe->playback.player;
     if (player) {
-        return DP_player_index_build(player, dc, should_snapshot_fn,
-                                     progress_fn, user);
+        return DP_player_index_build(player, dc, incremental,
+                                     should_snapshot_fn, progress_fn, user);
     }
     else {
         DP_error_set("No player set");
@@ -1461,6 +1746,19 @@ size_t DP_paint_engine_playback_index_entry_count(DP_PaintEngine *pe)
     }
 }
 
+bool DP_paint_engine_playback_index_outdated(DP_PaintEngine *pe)
+{
+    DP_ASSERT(pe);
+    DP_Player *player = pe->playback.player;
+    if (player) {
+        return DP_player_index_outdated(player);
+    }
+    else {
+        DP_error_set("No player set");
+        return false;
+    }
+}
+
 DP_Image *DP_paint_engine_playback_index_thumbnail_at(DP_PaintEngine *pe,
                                                       size_t index,
                                                       bool *out_error)
@@ -1780,11 +2078,12 @@ static bool should_push_message_local(DP_UNUSED DP_PaintEngine *pe,
     return is_pushable_type(type);
 }
 
-static int push_messages(DP_PaintEngine *pe, DP_Queue *queue,
-                         bool override_acls, int count, DP_Message **msgs,
+static int push_messages(DP_PaintEngine *pe, bool local, bool override_acls,
+                         int count, DP_Message **msgs,
                          bool (*should_push)(DP_PaintEngine *, DP_Message *,
                                              bool))
 {
+    DP_Queue *queue = local ? &pe->local_queue : &pe->remote_queue;
     DP_MUTEX_MUST_LOCK(pe->queue_mutex);
     // First message is the one that triggered the call to this function,
     // push it unconditionally. Then keep checking the rest again.
@@ -1797,7 +2096,7 @@ static int push_messages(DP_PaintEngine *pe, DP_Queue *queue,
             ++pushed;
         }
     }
-    DP_SEMAPHORE_MUST_POST_N(pe->queue_sem, pushed);
+    notify_pushed(pe, local);
     DP_MUTEX_MUST_UNLOCK(pe->queue_mutex);
     return pushed;
 }
@@ -1825,9 +2124,8 @@ int DP_paint_engine_handle_inc(DP_PaintEngine *pe, bool local,
     for (int i = 0; i < count; ++i) {
         if (should_push(pe, msgs[i], override_acls)) {
             DP_PERF_BEGIN(push, "handle:push");
-            pushed =
-                push_messages(pe, local ? &pe->local_queue : &pe->remote_queue,
-                              override_acls, count - i, msgs + i, should_push);
+            pushed = push_messages(pe, local, override_acls, count - i,
+                                   msgs + i, should_push);
             DP_PERF_END(push);
             break;
         }
@@ -2275,6 +2573,15 @@ void DP_paint_engine_tick(
         undo_depth_limit_set(user, undo_depth_limit);
     }
 
+    if (DP_perf_is_open()) {
+        DP_TileMemoryStats tms = DP_tile_memory_stats();
+        DP_PERF_BEGIN_DETAIL(tiles, "tick:tiles",
+                             "live=%d,cached=%d,peak=%d,cross_frees=%lld",
+                             tms.live, tms.cached, tms.peak,
+                             tms.cross_thread_frees);
+        DP_PERF_END(tiles);
+    }
+
     DP_PERF_END(fn);
 }
 
@@ -2339,8 +2646,10 @@ void DP_paint_engine_render_everything(DP_PaintEngine *pe,
     DP_PERF_BEGIN(fn, "render:everything");
     struct DP_PaintEngineRenderParams params =
         make_render_params(pe, render_tile, user);
+    below_cache_update(pe);
     DP_canvas_diff_each_pos_reset(pe->diff, render_pos, &params);
     wait_for_render(pe);
+    below_cache_trim(&pe->render.below);
     DP_PERF_END(fn);
 }
 
@@ -2355,13 +2664,24 @@ void DP_paint_engine_render_tile_bounds(DP_PaintEngine *pe, int tile_left,
     DP_PERF_BEGIN(fn, "render:tile_bounds");
     struct DP_PaintEngineRenderParams params =
         make_render_params(pe, render_tile, user);
+    below_cache_update(pe);
     DP_canvas_diff_each_pos_tile_bounds_reset(pe->diff, tile_left, tile_top,
                                               tile_right, tile_bottom,
                                               render_pos, &params);
     wait_for_render(pe);
+    below_cache_trim(&pe->render.below);
     DP_PERF_END(fn);
 }
 
+void DP_paint_engine_invalidate_tile_bounds(DP_PaintEngine *pe, int tile_left,
+                                            int tile_top, int tile_right,
+                                            int tile_bottom)
+{
+    DP_ASSERT(pe);
+    DP_canvas_diff_check_tile_bounds(pe->diff, tile_left, tile_top, tile_right,
+                                     tile_bottom);
+}
+
 
 static void sync_preview(DP_PaintEngine *pe, int type,
                          DP_PaintEnginePreview *preview)
@@ -2372,7 +2692,7 @@ static void sync_preview(DP_PaintEngine *pe, int type,
     DP_Message *msg = DP_msg_internal_preview_new(0, type, preview);
     DP_MUTEX_MUST_LOCK(pe->queue_mutex);
     DP_message_queue_push_noinc(&pe->local_queue, msg);
-    DP_SEMAPHORE_MUST_POST(pe->queue_sem);
+    notify_pushed(pe, true);
     DP_MUTEX_MUST_UNLOCK(pe->queue_mutex);
 }
 
@@ -2644,22 +2964,10 @@ void DP_paint_engine_preview_transform_clear(DP_PaintEngine *pe)
 }
 
 
-static DP_CanvasState *dabs_preview_render(DP_PaintEnginePreview *preview,
-                                           DP_CanvasState *cs,
-                                           DP_DrawContext *dc, int offset_x,
-                                           int offset_y)
+static void draw_dabs_preview(DP_PaintEngineDabsPreview *pedp,
+                              DP_DrawContext *dc, int offset_x, int offset_y,
+                              DP_TransientLayerContent *tlc)
 {
-    DP_PaintEngineDabsPreview *pedp = (DP_PaintEngineDabsPreview *)preview;
-    int layer_id = pedp->layer_id;
-    DP_LayerRoutes *lr = DP_canvas_state_layer_routes_noinc(cs);
-    DP_LayerRoutesEntry *lre = DP_layer_routes_search(lr, layer_id);
-    if (!lre || DP_layer_routes_entry_is_group(lre)) {
-        return cs;
-    }
-
-    DP_TransientCanvasState *tcs = get_or_make_transient_canvas_state(cs);
-    DP_TransientLayerContent *tlc =
-        DP_layer_routes_entry_transient_content(lre, tcs);
     DP_TransientLayerContent *sub_tlc = NULL;
 
     int count = pedp->count;
@@ -2731,13 +3039,68 @@ static DP_CanvasState *dabs_preview_render(DP_PaintEnginePreview *preview,
         params.origin_y += offset_y;
         DP_paint_draw_dabs(dc, &params, params.indirect ? sub_tlc : tlc);
     }
+}
+
+static DP_LayerContent *
+get_dabs_preview_content(DP_PaintEngineDabsPreview *pedp, DP_DrawContext *dc,
+                         DP_LayerContent *base_lc, int offset_x, int offset_y)
+{
+    bool needs_render = pedp->cache.base_lc != base_lc
+                     || pedp->cache.offset_x != offset_x
+                     || pedp->cache.offset_y != offset_y;
+    if (needs_render) {
+        DP_layer_content_decref_nullable(pedp->cache.lc);
+        DP_layer_content_decref_nullable(pedp->cache.base_lc);
+        DP_TransientLayerContent *tlc = DP_transient_layer_content_new(base_lc);
+        draw_dabs_preview(pedp, dc, offset_x, offset_y, tlc);
+        pedp->cache.base_lc = DP_layer_content_incref(base_lc);
+        pedp->cache.offset_x = offset_x;
+        pedp->cache.offset_y = offset_y;
+        return pedp->cache.lc = DP_transient_layer_content_persist(tlc);
+    }
+    else {
+        return pedp->cache.lc;
+    }
+}
+
+static DP_CanvasState *dabs_preview_render(DP_PaintEnginePreview *preview,
+                                           DP_CanvasState *cs,
+                                           DP_DrawContext *dc, int offset_x,
+                                           int offset_y)
+{
+    DP_PaintEngineDabsPreview *pedp = (DP_PaintEngineDabsPreview *)preview;
+    int layer_id = pedp->layer_id;
+    DP_LayerRoutes *lr = DP_canvas_state_layer_routes_noinc(cs);
+    DP_LayerRoutesEntry *lre = DP_layer_routes_search(lr, layer_id);
+    if (!lre || DP_layer_routes_entry_is_group(lre)) {
+        return cs;
+    }
 
+    // The canvas state holds a reference to the layer content, so it survives
+    // the canvas state potentially getting replaced by a transient one below.
+    DP_LayerContent *base_lc = DP_layer_routes_entry_content(lre, cs);
+    DP_TransientCanvasState *tcs = get_or_make_transient_canvas_state(cs);
+    if (DP_layer_content_transient(base_lc)) {
+        // Another preview already drew on this layer, can't cache that.
+        DP_TransientLayerContent *tlc =
+            DP_layer_routes_entry_transient_content(lre, tcs);
+        draw_dabs_preview(pedp, dc, offset_x, offset_y, tlc);
+    }
+    else {
+        // Only re-render the dabs if the layer underneath them changed, which
+        // means that history changes to other layers don't cost anything.
+        DP_layer_routes_entry_transient_content_replace_inc(
+            lre, tcs,
+            get_dabs_preview_content(pedp, dc, base_lc, offset_x, offset_y));
+    }
     return (DP_CanvasState *)tcs;
 }
 
 static void dabs_preview_dispose(DP_PaintEnginePreview *preview)
 {
     DP_PaintEngineDabsPreview *pedp = (DP_PaintEngineDabsPreview *)preview;
+    DP_layer_content_decref_nullable(pedp->cache.lc);
+    DP_layer_content_decref_nullable(pedp->cache.base_lc);
     int count = pedp->count;
     for (int i = 0; i < count; ++i) {
         DP_message_decref(pedp->messages[i]);
@@ -2752,6 +3115,10 @@ void DP_paint_engine_preview_dabs_inc(DP_PaintEngine *pe, int layer_id,
         DP_PaintEngineDabsPreview *pedp = DP_malloc(DP_FLEX_SIZEOF(
             DP_PaintEngineDabsPreview, messages, DP_int_to_size(count)));
         pedp->layer_id = layer_id;
+        pedp->cache.base_lc = NULL;
+        pedp->cache.lc = NULL;
+        pedp->cache.offset_x = 0;
+        pedp->cache.offset_y = 0;
         pedp->count = count;
         for (int i = 0; i < count; ++i) {
             pedp->messages[i] = DP_message_incref(messages[i]);
@@ -152,7 +152,7 @@ DP_paint_engine_playback_play(DP_PaintEngine *pe, long long msecs,
                               void *user);
 
 bool DP_paint_engine_playback_index_build(
-    DP_PaintEngine *pe, DP_DrawContext *dc,
+    DP_PaintEngine *pe, DP_DrawContext *dc, bool incremental,
     DP_PlayerIndexShouldSnapshotFn should_snapshot_fn,
     DP_PlayerIndexProgressFn progress_fn, void *user);
 
@@ -162,6 +162,8 @@ unsigned int DP_paint_engine_playback_index_message_count(DP_PaintEngine *pe);
 
 size_t DP_paint_engine_playback_index_entry_count(DP_PaintEngine *pe);
 
+bool DP_paint_engine_playback_index_outdated(DP_PaintEngine *pe);
+
 DP_Image *DP_paint_engine_playback_index_thumbnail_at(DP_PaintEngine *pe,
                                                       size_t index,
                                                       bool *out_error);
@@ -220,6 +222,12 @@ void DP_paint_engine_render_tile_bounds(DP_PaintEngine *pe, int tile_left,
                                         DP_PaintEngineRenderTileFn render_tile,
                                         void *user);
 
+// Marks the given tiles as changed, so that they get passed to the render
+// callback again. For when the caller dropped them from its own cache.
+void DP_paint_engine_invalidate_tile_bounds(DP_PaintEngine *pe, int tile_left,
+                                            int tile_top, int tile_right,
+                                            int tile_bottom);
+
 void DP_paint_engine_preview_cut(DP_PaintEngine *pe, int layer_id, int x, int y,
                                  int width, int height,
                                  const DP_Pixel8 *mask_or_null);
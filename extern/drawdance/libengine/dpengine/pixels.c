@@ -2102,3 +2102,188 @@ void DP_posterize_mask(DP_Pixel15 *dst, int posterize_num, const uint16_t *mask,
         *dst = from_ubgra(posterize(p, o, DP_pixel15_unpremultiply(*dst)));
     });
 }
+
+
+static bool color_match(DP_UPixelFloat color, DP_UPixelFloat reference,
+                        double tolerance_squared)
+{
+    // TODO: we could use better functions for color distance than this.
+    double b = color.b - reference.b;
+    double g = color.g - reference.g;
+    double r = color.r - reference.r;
+    double a = color.a - reference.a;
+    return b * b + g * g + r * r + a * a <= tolerance_squared;
+}
+
+bool DP_pixel15_color_match(DP_Pixel15 pixel, DP_UPixelFloat reference,
+                            double tolerance_squared)
+{
+    return color_match(DP_upixel15_to_float(DP_pixel15_unpremultiply(pixel)),
+                       reference, tolerance_squared);
+}
+
+static void color_match_pixels(unsigned char *out, const DP_Pixel15 *src,
+                               int count, DP_UPixelFloat reference,
+                               double tolerance_squared)
+{
+    for (int i = 0; i < count; ++i) {
+        out[i] = DP_pixel15_color_match(src[i], reference, tolerance_squared);
+    }
+}
+
+#ifdef DP_CPU_X64
+DP_TARGET_BEGIN("sse4.2")
+// Same as DP_pixel15_unpremultiply followed by DP_channel15_to_float. The
+// quotient is computed in double precision, which is exact enough that
+// truncating it gives the same result as the fixed point division.
+static __m128 unpremultiply_channel_sse42(__m128i channel, __m128i alpha)
+{
+    __m128d one = _mm_set1_pd(1.0);
+    __m128d bit15 = _mm_set1_pd(BIT15_DOUBLE);
+    __m128i channel_hi = _mm_shuffle_epi32(channel, _MM_SHUFFLE(3, 2, 3, 2));
+    __m128i alpha_hi = _mm_shuffle_epi32(alpha, _MM_SHUFFLE(3, 2, 3, 2));
+    __m128d lo = _mm_round_pd(
+        _mm_div_pd(_mm_mul_pd(_mm_cvtepi32_pd(channel), bit15),
+                   _mm_max_pd(_mm_cvtepi32_pd(alpha), one)),
+        _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+    __m128d hi = _mm_round_pd(
+        _mm_div_pd(_mm_mul_pd(_mm_cvtepi32_pd(channel_hi), bit15),
+                   _mm_max_pd(_mm_cvtepi32_pd(alpha_hi), one)),
+        _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+    __m128 result = _mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi));
+    // Zero alpha unpremultiplies to zero.
+    __m128 nonzero =
+        _mm_castsi128_ps(_mm_cmpgt_epi32(alpha, _mm_setzero_si128()));
+    return _mm_mul_ps(_mm_and_ps(result, nonzero),
+                      _mm_set1_ps(1.0f / BIT15_FLOAT));
+}
+
+static void color_match_pixels_sse42(unsigned char *out, const DP_Pixel15 *src,
+                                     int count, DP_UPixelFloat reference,
+                                     double tolerance_squared)
+{
+    DP_ASSERT(count % 4 == 0);
+    __m128 ref_b = _mm_set1_ps(reference.b);
+    __m128 ref_g = _mm_set1_ps(reference.g);
+    __m128 ref_r = _mm_set1_ps(reference.r);
+    __m128 ref_a = _mm_set1_ps(reference.a);
+    __m128d tolerance = _mm_set1_pd(tolerance_squared);
+    for (int i = 0; i < count; i += 4) {
+        __m128i blue, green, red, alpha;
+        load_unaligned_sse42(&src[i], &blue, &green, &red, &alpha);
+
+        // The differences are taken in single precision and squared in
+        // double precision, just like the scalar version does it.
+        __m128 b = _mm_sub_ps(unpremultiply_channel_sse42(blue, alpha), ref_b);
+        __m128 g =
+            _mm_sub_ps(unpremultiply_channel_sse42(green, alpha), ref_g);
+        __m128 r = _mm_sub_ps(unpremultiply_channel_sse42(red, alpha), ref_r);
+        __m128 a = _mm_sub_ps(
+            _mm_mul_ps(_mm_cvtepi32_ps(alpha), _mm_set1_ps(1.0f / BIT15_FLOAT)),
+            ref_a);
+
+        int bits = 0;
+        for (int half = 0; half < 2; ++half) {
+            __m128d b2 = _mm_cvtps_pd(b);
+            __m128d g2 = _mm_cvtps_pd(g);
+            __m128d r2 = _mm_cvtps_pd(r);
+            __m128d a2 = _mm_cvtps_pd(a);
+            __m128d distance = _mm_add_pd(
+                _mm_add_pd(_mm_add_pd(_mm_mul_pd(b2, b2), _mm_mul_pd(g2, g2)),
+                           _mm_mul_pd(r2, r2)),
+                _mm_mul_pd(a2, a2));
+            bits |= _mm_movemask_pd(_mm_cmple_pd(distance, tolerance))
+                 << (half * 2);
+            b = _mm_movehl_ps(b, b);
+            g = _mm_movehl_ps(g, g);
+            r = _mm_movehl_ps(r, r);
+            a = _mm_movehl_ps(a, a);
+        }
+        for (int j = 0; j < 4; ++j) {
+            out[i + j] = (bits >> j) & 1;
+        }
+    }
+}
+DP_TARGET_END
+
+DP_TARGET_BEGIN("avx2")
+// See unpremultiply_channel_sse42, this does the same for 4 pixels at once.
+static __m128 unpremultiply_channel_avx2(__m128i channel, __m128i alpha)
+{
+    __m256d quotient = _mm256_round_pd(
+        _mm256_div_pd(_mm256_mul_pd(_mm256_cvtepi32_pd(channel),
+                                    _mm256_set1_pd(BIT15_DOUBLE)),
+                      _mm256_max_pd(_mm256_cvtepi32_pd(alpha),
+                                    _mm256_set1_pd(1.0))),
+        _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+    __m128 nonzero =
+        _mm_castsi128_ps(_mm_cmpgt_epi32(alpha, _mm_setzero_si128()));
+    return _mm_mul_ps(_mm_and_ps(_mm256_cvtpd_ps(quotient), nonzero),
+                      _mm_set1_ps(1.0f / BIT15_FLOAT));
+}
+
+static void color_match_pixels_avx2(unsigned char *out, const DP_Pixel15 *src,
+                                    int count, DP_UPixelFloat reference,
+                                    double tolerance_squared)
+{
+    DP_ASSERT(count % 4 == 0);
+    __m128 ref_b = _mm_set1_ps(reference.b);
+    __m128 ref_g = _mm_set1_ps(reference.g);
+    __m128 ref_r = _mm_set1_ps(reference.r);
+    __m128 ref_a = _mm_set1_ps(reference.a);
+    __m256d tolerance = _mm256_set1_pd(tolerance_squared);
+    for (int i = 0; i < count; i += 4) {
+        __m128i blue, green, red, alpha;
+        load_unaligned_sse42(&src[i], &blue, &green, &red, &alpha);
+
+        __m256d b = _mm256_cvtps_pd(
+            _mm_sub_ps(unpremultiply_channel_avx2(blue, alpha), ref_b));
+        __m256d g = _mm256_cvtps_pd(
+            _mm_sub_ps(unpremultiply_channel_avx2(green, alpha), ref_g));
+        __m256d r = _mm256_cvtps_pd(
+            _mm_sub_ps(unpremultiply_channel_avx2(red, alpha), ref_r));
+        __m256d a = _mm256_cvtps_pd(_mm_sub_ps(
+            _mm_mul_ps(_mm_cvtepi32_ps(alpha), _mm_set1_ps(1.0f / BIT15_FLOAT)),
+            ref_a));
+
+        __m256d distance = _mm256_add_pd(
+            _mm256_add_pd(
+                _mm256_add_pd(_mm256_mul_pd(b, b), _mm256_mul_pd(g, g)),
+                _mm256_mul_pd(r, r)),
+            _mm256_mul_pd(a, a));
+        int bits =
+            _mm256_movemask_pd(_mm256_cmp_pd(distance, tolerance, _CMP_LE_OQ));
+        for (int j = 0; j < 4; ++j) {
+            out[i + j] = (bits >> j) & 1;
+        }
+    }
+    _mm256_zeroupper();
+}
+DP_TARGET_END
+#endif
+
+void DP_pixels15_color_match(unsigned char *out, const DP_Pixel15 *src,
+                             int count, DP_UPixelFloat reference,
+                             double tolerance_squared)
+{
+    DP_ASSERT(count <= 0 || out);
+    DP_ASSERT(count <= 0 || src);
+#ifdef DP_CPU_X64
+    int simd_count = count - count % 4;
+    if (DP_cpu_support >= DP_CPU_SUPPORT_AVX2) {
+        color_match_pixels_avx2(out, src, simd_count, reference,
+                                tolerance_squared);
+        out += simd_count;
+        src += simd_count;
+        count -= simd_count;
+    }
+    else if (DP_cpu_support >= DP_CPU_SUPPORT_SSE42) {
+        color_match_pixels_sse42(out, src, simd_count, reference,
+                                 tolerance_squared);
+        out += simd_count;
+        src += simd_count;
+        count -= simd_count;
+    }
+#endif
+    color_match_pixels(out, src, count, reference, tolerance_squared);
+}
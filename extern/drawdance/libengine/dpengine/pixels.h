@@ -109,6 +109,17 @@ DP_UPixel15 DP_pixel15_unpremultiply(DP_Pixel15 pixel);
 DP_Pixel8 DP_pixel8_premultiply(DP_UPixel8 pixel);
 DP_Pixel15 DP_pixel15_premultiply(DP_UPixel15 pixel);
 
+// Checks if the squared distance of the unpremultiplied pixel to the reference
+// color is within the given tolerance, used for flood filling.
+bool DP_pixel15_color_match(DP_Pixel15 pixel, DP_UPixelFloat reference,
+                            double tolerance_squared);
+
+// Same as above, but for a row of pixels. Writes 1 for each matching pixel and
+// 0 for each non-matching one into out, using SIMD where available.
+void DP_pixels15_color_match(unsigned char *out, const DP_Pixel15 *src,
+                             int count, DP_UPixelFloat reference,
+                             double tolerance_squared);
+
 
 DP_INLINE DP_Pixel15 DP_pixel15_zero(void)
 {
@@ -23,6 +23,7 @@
 #include "annotation.h"
 #include "annotation_list.h"
 #include "canvas_history.h"
+#include "compress.h"
 #include "document_metadata.h"
 #include "draw_context.h"
 #include "dump_reader.h"
@@ -44,7 +45,9 @@
 #include <dpcommon/input.h>
 #include <dpcommon/output.h>
 #include <dpcommon/perf.h>
+#include <dpcommon/threading.h>
 #include <dpcommon/vector.h>
+#include <dpcommon/worker.h>
 #include <dpmsg/acl.h>
 #include <dpmsg/binary_reader.h>
 #include <dpmsg/blend_mode.h>
@@ -59,10 +62,18 @@
 #define INDEX_EXTENSION       "dpidx"
 #define INDEX_MAGIC           "DPIDX"
 #define INDEX_MAGIC_LENGTH    6
-#define INDEX_VERSION         11
+#define INDEX_VERSION         12
 #define INDEX_VERSION_LENGTH  2
-#define INDEX_HEADER_LENGTH   (INDEX_MAGIC_LENGTH + INDEX_VERSION_LENGTH + 12)
+#define INDEX_HEADER_LENGTH   (INDEX_MAGIC_LENGTH + INDEX_VERSION_LENGTH + 24)
 #define INITAL_ENTRY_CAPACITY 64
+#define ENTRY_SIZE            (sizeof(uint32_t) + sizeof(uint64_t) * (size_t)3)
+
+// Index progress gets reported at least every this many messages, so that
+// cancellation doesn't have to wait for the next full percent.
+#define INDEX_PROGRESS_INTERVAL 1000
+// Maximum number of thumbnails being rendered in the background at once.
+// Each one keeps a canvas state alive, so this limits the memory use.
+#define INDEX_MAX_PENDING_THUMBNAILS_PER_THREAD 2
 
 static_assert(INDEX_MAGIC_LENGTH < sizeof(DP_OutputBinaryEntry),
               "index header fits into output binary entry");
@@ -71,6 +82,8 @@ static_assert(INDEX_MAGIC_LENGTH < sizeof(DP_OutputBinaryEntry),
 typedef struct DP_PlayerIndex {
     DP_BufferedInput input;
     unsigned int message_count;
+    size_t entries_offset;
+    size_t recording_offset;
     DP_PlayerIndexEntry *entries;
     size_t entry_count;
 } DP_PlayerIndex;
@@ -93,6 +106,9 @@ struct DP_Player {
     bool input_error;
     bool end;
     DP_PlayerIndex index;
+    // Playback and index building churn through lots of messages that mostly
+    // get handled once and then thrown away, so they're allocated in bulk.
+    DP_MessageArena *arena;
 };
 
 struct DP_PlayerIndexEntrySnapshot {
@@ -107,7 +123,7 @@ static void player_index_dispose(DP_PlayerIndex *pi)
     DP_ASSERT(pi);
     DP_free(pi->entries);
     DP_buffered_input_dispose(&pi->input);
-    *pi = (DP_PlayerIndex){DP_BUFFERD_INPUT_NULL, 0, NULL, 0};
+    *pi = (DP_PlayerIndex){DP_BUFFERD_INPUT_NULL, 0, 0, 0, NULL, 0};
 }
 
 
@@ -260,7 +276,8 @@ static DP_Player *make_player(DP_PlayerType type, char *recording_path,
                           compatible,
                           false,
                           false,
-                          {DP_BUFFERD_INPUT_NULL, 0, NULL, 0}};
+                          {DP_BUFFERD_INPUT_NULL, 0, 0, 0, NULL, 0},
+                          DP_message_arena_new()};
     return player;
 }
 
@@ -341,7 +358,8 @@ static DP_Player *new_debug_dump_player(DP_Input *input)
                           true,
                           false,
                           false,
-                          {DP_BUFFERD_INPUT_NULL, 0, NULL, 0}};
+                          {DP_BUFFERD_INPUT_NULL, 0, 0, 0, NULL, 0},
+                          DP_message_arena_new()};
     return player;
 }
 
@@ -423,6 +441,7 @@ void DP_player_free(DP_Player *player)
         default:
             break;
         }
+        DP_message_arena_free(player->arena);
         DP_free(player->index_path);
         DP_free(player->recording_path);
         DP_free(player);
@@ -630,7 +649,10 @@ DP_PlayerResult DP_player_step(DP_Player *player, DP_Message **out_msg)
         return DP_PLAYER_RECORDING_END;
     }
     else {
-        return step_valid_message(player, out_msg);
+        DP_MessageArena *prev_arena = DP_message_arena_activate(player->arena);
+        DP_PlayerResult result = step_valid_message(player, out_msg);
+        DP_message_arena_activate(prev_arena);
+        return result;
     }
 }
 
@@ -790,6 +812,23 @@ typedef struct DP_BuildIndexMaps {
     } timeline;
 } DP_BuildIndexMaps;
 
+// Tiles that weren't in the previous snapshot get compressed in parallel before
+// a snapshot is written, so that writing them is just copying the result.
+typedef struct DP_BuildIndexCompressedTile {
+    DP_Tile *t;
+    unsigned char *buffer;
+    size_t size;
+    UT_hash_handle hh;
+} DP_BuildIndexCompressedTile;
+
+// Thumbnails are rendered and encoded in the background and then written to
+// the index whenever they're done, since they can go anywhere in the file.
+typedef struct DP_BuildIndexThumbnail {
+    size_t entry_index;
+    void *buffer;
+    size_t size;
+} DP_BuildIndexThumbnail;
+
 typedef struct DP_BuildIndexEntryContext {
     DP_Output *output;
     DP_AclState *acls;
@@ -797,15 +836,16 @@ typedef struct DP_BuildIndexEntryContext {
     DP_CanvasHistory *ch;
     DP_CanvasState *cs;
     DP_DrawContext *dc;
+    DP_Deflater *deflater;
     DP_BuildIndexMaps current;
     DP_BuildIndexMaps *last;
+    DP_BuildIndexCompressedTile *compressed_tiles;
     int message_count;
     struct {
         size_t history;
         size_t layers;
         size_t background_tile;
         size_t snapshot;
-        size_t thumbnail;
     } offset;
     struct {
         unsigned char *buffer;
@@ -820,14 +860,45 @@ typedef struct DP_BuildIndexContext {
     DP_LocalState *local_state;
     DP_CanvasHistory *ch;
     DP_DrawContext *dc;
+    DP_Deflater *deflater;
     long long message_count;
+    long long last_entry_message_index;
+    size_t recording_offset;
+    size_t append_offset;
     DP_Vector entries;
     DP_BuildIndexMaps last;
+    struct {
+        DP_Worker *worker;
+        int thread_count;
+        DP_DrawContext **dcs;
+        DP_Deflater **deflaters;
+        DP_Semaphore *tiles_done_sem;
+        DP_Semaphore *thumbnails_sem;
+        DP_Mutex *thumbnails_mutex;
+        DP_Vector thumbnails;
+    } jobs;
     DP_PlayerIndexShouldSnapshotFn should_snapshot_fn;
     DP_PlayerIndexProgressFn progress_fn;
     void *user;
 } DP_BuildIndexContext;
 
+typedef enum DP_BuildIndexJobType {
+    DP_BUILD_INDEX_JOB_TILE,
+    DP_BUILD_INDEX_JOB_THUMBNAIL,
+} DP_BuildIndexJobType;
+
+struct DP_BuildIndexJob {
+    DP_BuildIndexContext *c;
+    DP_BuildIndexJobType type;
+    union {
+        DP_BuildIndexCompressedTile *tile;
+        struct {
+            DP_CanvasState *cs;
+            size_t entry_index;
+        } thumbnail;
+    };
+};
+
 struct DP_BuildIndexLayerProps {
     uint16_t layer_id;
     uint16_t title_length;
@@ -848,7 +919,7 @@ static bool write_index_header(DP_BuildIndexContext *c)
     return DP_OUTPUT_WRITE_LITTLEENDIAN(
         c->output, DP_OUTPUT_BYTES(INDEX_MAGIC, INDEX_MAGIC_LENGTH),
         DP_OUTPUT_UINT16(INDEX_VERSION), DP_OUTPUT_UINT32(0),
-        DP_OUTPUT_UINT64(0));
+        DP_OUTPUT_UINT64(0), DP_OUTPUT_UINT32(0), DP_OUTPUT_UINT64(0));
 }
 
 unsigned char *get_message_buffer(void *user, size_t length)
@@ -963,10 +1034,27 @@ static unsigned char *get_compression_buffer(size_t size, void *user)
 
 static size_t write_index_tile(DP_BuildIndexEntryContext *e, DP_Tile *t)
 {
-    size_t size = DP_tile_compress(t, DP_draw_context_tile8_buffer(e->dc),
-                                   get_compression_buffer, e->dc);
-    if (size == 0) {
-        return 0;
+    DP_BuildIndexCompressedTile *ct;
+    HASH_FIND_PTR(e->compressed_tiles, &t, ct);
+
+    unsigned char *buffer;
+    size_t size;
+    if (ct) {
+        buffer = ct->buffer;
+        size = ct->size;
+        if (size == 0) {
+            DP_error_set("Error compressing index tile");
+            return 0;
+        }
+    }
+    else {
+        size = DP_tile_compress(t, e->deflater,
+                                DP_draw_context_tile8_buffer(e->dc),
+                                get_compression_buffer, e->dc);
+        if (size == 0) {
+            return 0;
+        }
+        buffer = DP_draw_context_pool(e->dc);
     }
 
     bool error;
@@ -975,7 +1063,6 @@ static size_t write_index_tile(DP_BuildIndexEntryContext *e, DP_Tile *t)
         return 0;
     }
 
-    unsigned char *buffer = DP_draw_context_pool(e->dc);
     DP_write_littleendian_uint16(DP_size_to_uint16(size), buffer);
     if (!DP_output_write(e->output, buffer, size + sizeof(uint16_t))) {
         return 0;
@@ -1443,34 +1530,152 @@ static bool write_index_canvas_state(DP_BuildIndexEntryContext *e)
     return true;
 }
 
-static bool write_index_snapshot(DP_BuildIndexEntryContext *e)
+static void compress_index_tile(DP_BuildIndexContext *c,
+                                DP_BuildIndexEntryContext *e, DP_Tile *t,
+                                int *in_out_count)
 {
-    bool ok = write_index_history(e) && write_index_layers(e)
-           && write_index_annotations(e) && write_index_background_tile(e)
-           && write_index_timeline(e) && write_index_metadata(e)
-           && write_index_canvas_state(e);
-    DP_free(e->annotation.buffer);
-    return ok;
+    if (t && !search_tile(e->last->tiles, t)) {
+        DP_BuildIndexCompressedTile *ct;
+        HASH_FIND_PTR(e->compressed_tiles, &t, ct);
+        if (!ct) {
+            // The canvas state holds the tile for the whole snapshot, so no
+            // need to take a reference to it.
+            ct = DP_malloc(sizeof(*ct));
+            ct->t = t;
+            ct->buffer = NULL;
+            ct->size = 0;
+            HASH_ADD_PTR(e->compressed_tiles, t, ct);
+            struct DP_BuildIndexJob job = {
+                c, DP_BUILD_INDEX_JOB_TILE, {.tile = ct}};
+            DP_worker_push(c->jobs.worker, &job);
+            ++*in_out_count;
+        }
+    }
 }
 
-static bool write_index_thumbnail(DP_BuildIndexEntryContext *e)
+static bool is_existing_layer(DP_BuildIndexEntryContext *e,
+                              DP_BuildIndexLayerKey *key)
 {
-    DP_Output *output = e->output;
-    bool error;
-    size_t thumbnail_offset = DP_output_tell(output, &error);
-    if (error) {
-        return false;
+    DP_BuildIndexLayerMap *entry;
+    HASH_FIND(hh, e->last->layers, key, sizeof(*key), entry);
+    return entry;
+}
+
+static void compress_index_layer_content_tiles(DP_BuildIndexContext *c,
+                                               DP_BuildIndexEntryContext *e,
+                                               DP_LayerContent *lc,
+                                               int *in_out_count)
+{
+    DP_LayerPropsList *sub_lpl = DP_layer_content_sub_props_noinc(lc);
+    DP_LayerList *sub_ll = DP_layer_content_sub_contents_noinc(lc);
+    int sub_count = DP_layer_props_list_count(sub_lpl);
+    for (int i = 0; i < sub_count; ++i) {
+        if (is_relevant_sublayer(DP_layer_props_list_at_noinc(sub_lpl, i))) {
+            compress_index_layer_content_tiles(
+                c, e, DP_layer_list_content_at_noinc(sub_ll, i), in_out_count);
+        }
+    }
+
+    DP_TileCounts tile_counts = DP_tile_counts_round(
+        DP_layer_content_width(lc), DP_layer_content_height(lc));
+    for (int y = 0; y < tile_counts.y; ++y) {
+        for (int x = 0; x < tile_counts.x; ++x) {
+            compress_index_tile(c, e, DP_layer_content_tile_at_noinc(lc, x, y),
+                                in_out_count);
+        }
+    }
+}
+
+static void compress_index_layer_list_tiles(DP_BuildIndexContext *c,
+                                            DP_BuildIndexEntryContext *e,
+                                            DP_LayerList *ll,
+                                            DP_LayerPropsList *lpl,
+                                            int *in_out_count)
+{
+    int count = DP_layer_list_count(ll);
+    for (int i = 0; i < count; ++i) {
+        DP_LayerListEntry *lle = DP_layer_list_at_noinc(ll, i);
+        DP_LayerProps *lp = DP_layer_props_list_at_noinc(lpl, i);
+        DP_BuildIndexLayerKey key;
+        memset(&key, 0, sizeof(key));
+        key.lp = lp;
+        DP_LayerPropsList *child_lpl = DP_layer_props_children_noinc(lp);
+        if (child_lpl) {
+            DP_LayerGroup *lg = DP_layer_list_entry_group_noinc(lle);
+            key.lg = lg;
+            if (!is_existing_layer(e, &key)) {
+                compress_index_layer_list_tiles(
+                    c, e, DP_layer_group_children_noinc(lg), child_lpl,
+                    in_out_count);
+            }
+        }
+        else {
+            DP_LayerContent *lc = DP_layer_list_entry_content_noinc(lle);
+            key.lc = lc;
+            if (!is_existing_layer(e, &key)) {
+                compress_index_layer_content_tiles(c, e, lc, in_out_count);
+            }
+        }
     }
+}
 
-    DP_Image *img = DP_canvas_state_to_flat_image(
-        e->cs, DP_FLAT_IMAGE_RENDER_FLAGS, NULL, NULL);
+// Compresses all tiles that weren't part of the last snapshot in parallel,
+// writing the snapshot afterwards picks up the results.
+static void compress_index_tiles(DP_BuildIndexContext *c,
+                                 DP_BuildIndexEntryContext *e)
+{
+    DP_PERF_BEGIN(fn, "index_build:compress_tiles");
+    DP_CanvasState *cs = e->cs;
+    int count = 0;
+    compress_index_layer_list_tiles(c, e, DP_canvas_state_layers_noinc(cs),
+                                    DP_canvas_state_layer_props_noinc(cs),
+                                    &count);
+    compress_index_tile(c, e, DP_canvas_state_background_tile_noinc(cs),
+                        &count);
+    if (count != 0) {
+        DP_SEMAPHORE_MUST_WAIT_N(c->jobs.tiles_done_sem, count);
+    }
+    DP_PERF_END(fn);
+}
+
+static void dispose_compressed_tiles(DP_BuildIndexEntryContext *e)
+{
+    DP_BuildIndexCompressedTile *ct, *tmp;
+    HASH_ITER(hh, e->compressed_tiles, ct, tmp) {
+        HASH_DEL(e->compressed_tiles, ct);
+        DP_free(ct->buffer);
+        DP_free(ct);
+    }
+}
+
+static bool write_index_snapshot(DP_BuildIndexContext *c,
+                                 DP_BuildIndexEntryContext *e)
+{
+    bool ok = write_index_history(e);
+    if (ok) {
+        compress_index_tiles(c, e);
+        ok = write_index_layers(e)
+          && write_index_annotations(e) && write_index_background_tile(e)
+          && write_index_timeline(e) && write_index_metadata(e)
+          && write_index_canvas_state(e);
+    }
+    dispose_compressed_tiles(e);
+    DP_free(e->annotation.buffer);
+    return ok;
+}
+
+static void *render_index_thumbnail(DP_CanvasState *cs, DP_DrawContext *dc,
+                                    size_t *out_size)
+{
+    DP_Image *img =
+        DP_canvas_state_to_flat_image(cs, DP_FLAT_IMAGE_RENDER_FLAGS, NULL, NULL);
     if (!img) {
         DP_warn("Error creating index thumbnail: %s", DP_error());
-        return true; // Keep going without a thumbnail.
+        return NULL;
     }
 
     DP_Image *thumb;
-    if (DP_image_thumbnail(img, e->dc, 256, 256, &thumb)) {
+    if (DP_image_thumbnail(img, dc, 256, 256, &thumb)) {
         if (thumb) {
             DP_image_free(img);
         }
@@ -1481,39 +1686,126 @@ static bool write_index_thumbnail(DP_BuildIndexEntryContext *e)
     else {
         DP_image_free(img);
         DP_warn("Error scaling index thumbnail: %s", DP_error());
-        return true; // Keep going without a thumbnail.
+        return NULL;
     }
 
-    if (!DP_OUTPUT_WRITE_LITTLEENDIAN(output, DP_OUTPUT_UINT32(0))) {
-        return false;
+    void **buffer_ptr;
+    size_t *size_ptr;
+    DP_Output *output = DP_mem_output_new(1024, false, &buffer_ptr, &size_ptr);
+    bool ok = DP_image_write_png(thumb, output);
+    DP_image_free(thumb);
+    void *buffer = *buffer_ptr;
+    size_t size = *size_ptr;
+    DP_output_free(output);
+
+    if (ok) {
+        *out_size = size;
+        return buffer;
     }
+    else {
+        DP_warn("Error encoding index thumbnail: %s", DP_error());
+        DP_free(buffer);
+        return NULL;
+    }
+}
 
-    bool write_ok = DP_image_write_png(thumb, output);
-    DP_image_free(thumb);
-    if (!write_ok) {
-        return false;
+static unsigned char *get_compressed_tile_buffer(size_t size, void *user)
+{
+    DP_BuildIndexCompressedTile *ct = user;
+    ct->buffer = DP_realloc(ct->buffer, sizeof(uint16_t) + size);
+    return ct->buffer + sizeof(uint16_t);
+}
+
+static void run_index_job(void *element, int thread_index)
+{
+    struct DP_BuildIndexJob *job = element;
+    DP_BuildIndexContext *c = job->c;
+    DP_DrawContext *dc = c->jobs.dcs[thread_index];
+    switch (job->type) {
+    case DP_BUILD_INDEX_JOB_TILE: {
+        DP_BuildIndexCompressedTile *ct = job->tile;
+        ct->size = DP_tile_compress(
+            ct->t, c->jobs.deflaters[thread_index],
+            DP_draw_context_tile8_buffer(dc), get_compressed_tile_buffer, ct);
+        DP_SEMAPHORE_MUST_POST(c->jobs.tiles_done_sem);
+        break;
+    }
+    case DP_BUILD_INDEX_JOB_THUMBNAIL: {
+        DP_CanvasState *cs = job->thumbnail.cs;
+        size_t size;
+        void *buffer = render_index_thumbnail(cs, dc, &size);
+        DP_canvas_state_decref(cs);
+        if (buffer) {
+            DP_BuildIndexThumbnail bit = {job->thumbnail.entry_index, buffer,
+                                          size};
+            DP_MUTEX_MUST_LOCK(c->jobs.thumbnails_mutex);
+            DP_VECTOR_PUSH_TYPE(&c->jobs.thumbnails, DP_BuildIndexThumbnail,
+                                bit);
+            DP_MUTEX_MUST_UNLOCK(c->jobs.thumbnails_mutex);
+        }
+        DP_SEMAPHORE_MUST_POST(c->jobs.thumbnails_sem);
+        break;
     }
+    default:
+        DP_UNREACHABLE();
+    }
+}
 
-    size_t end_offset = DP_output_tell(output, &error);
+static void push_index_thumbnail(DP_BuildIndexContext *c, DP_CanvasState *cs,
+                                 size_t entry_index)
+{
+    // Wait for a free slot so that the pending thumbnails don't pile up.
+    DP_SEMAPHORE_MUST_WAIT(c->jobs.thumbnails_sem);
+    struct DP_BuildIndexJob job = {
+        c,
+        DP_BUILD_INDEX_JOB_THUMBNAIL,
+        {.thumbnail = {DP_canvas_state_incref(cs), entry_index}}};
+    DP_worker_push(c->jobs.worker, &job);
+}
+
+static bool write_index_thumbnail(DP_BuildIndexContext *c,
+                                  DP_BuildIndexThumbnail *bit)
+{
+    DP_Output *output = c->output;
+    bool error;
+    size_t thumbnail_offset = DP_output_tell(output, &error);
     if (error) {
         return false;
     }
 
-    if (!DP_output_seek(output, thumbnail_offset)) {
-        return false;
+    bool ok = DP_OUTPUT_WRITE_LITTLEENDIAN(
+                  output, DP_OUTPUT_UINT32(DP_size_to_uint32(bit->size)))
+           && DP_output_write(output, bit->buffer, bit->size);
+    if (ok) {
+        DP_VECTOR_AT_TYPE(&c->entries, DP_PlayerIndexEntry, bit->entry_index)
+            .thumbnail_offset = thumbnail_offset;
     }
+    return ok;
+}
 
-    size_t size = end_offset - thumbnail_offset - 4;
-    if (!DP_OUTPUT_WRITE_LITTLEENDIAN(output, DP_OUTPUT_UINT32(size))) {
-        return false;
+static void dispose_index_thumbnails(DP_Vector *thumbnails)
+{
+    size_t count = thumbnails->used;
+    for (size_t i = 0; i < count; ++i) {
+        DP_free(DP_VECTOR_AT_TYPE(thumbnails, DP_BuildIndexThumbnail, i).buffer);
     }
+    thumbnails->used = 0;
+}
 
-    if (!DP_output_seek(output, end_offset)) {
-        return false;
+// Writes the thumbnails that got finished in the background so far.
+static bool write_index_thumbnails(DP_BuildIndexContext *c)
+{
+    DP_Vector *thumbnails = &c->jobs.thumbnails;
+    DP_MUTEX_MUST_LOCK(c->jobs.thumbnails_mutex);
+    bool ok = true;
+    size_t count = thumbnails->used;
+    for (size_t i = 0; ok && i < count; ++i) {
+        ok = write_index_thumbnail(
+            c, &DP_VECTOR_AT_TYPE(thumbnails, DP_BuildIndexThumbnail, i));
     }
-
-    e->offset.thumbnail = thumbnail_offset;
-    return true;
+    dispose_index_thumbnails(thumbnails);
+    DP_MUTEX_MUST_UNLOCK(c->jobs.thumbnails_mutex);
+    return ok;
 }
 
 static void dispose_index_maps(DP_BuildIndexMaps *maps)
@@ -1558,66 +1850,77 @@ static bool make_index_entry(DP_BuildIndexContext *c, long long message_index,
                                    c->ch,
                                    NULL,
                                    c->dc,
+                                   c->deflater,
                                    {NULL, NULL, NULL, {NULL, 0}, {NULL, 0}},
                                    &c->last,
+                                   NULL,
                                    0,
-                                   {0, 0, 0, 0, 0},
+                                   {0, 0, 0, 0},
                                    {NULL, 0}};
-    bool ok = write_index_snapshot(&e) && write_index_thumbnail(&e);
-    if (!ok) {
+    if (!write_index_snapshot(c, &e)) {
         dispose_index_maps(&e.current);
         return false;
     }
 
+    // The thumbnail offset gets filled in when it's done rendering.
+    size_t entry_index = c->entries.used;
     DP_PlayerIndexEntry entry = {message_index, message_offset,
-                                 e.offset.snapshot, e.offset.thumbnail};
+                                 e.offset.snapshot, 0};
     DP_VECTOR_PUSH_TYPE(&c->entries, DP_PlayerIndexEntry, entry);
+    push_index_thumbnail(c, e.cs, entry_index);
 
     dispose_index_maps(&c->last);
     c->last = e.current;
 
-    return true;
+    return write_index_thumbnails(c);
+}
+
+// Returns true if the message was a command that got put into the history.
+static bool handle_index_message(DP_BuildIndexContext *c, DP_Message *msg)
+{
+    bool filtered =
+        DP_acl_state_handle(c->acls, msg, false) & DP_ACL_STATE_FILTERED_BIT;
+    if (filtered) {
+        DP_debug("ACL filtered recorded %s message from user %u",
+                 DP_message_type_enum_name_unprefixed(DP_message_type(msg)),
+                 DP_message_context_id(msg));
+        return false;
+    }
+
+    DP_local_state_handle(c->local_state, c->dc, msg);
+    if (DP_message_type_command(DP_message_type(msg))) {
+        if (!DP_canvas_history_handle(c->ch, c->dc, msg)) {
+            DP_warn("Error handling message in index: %s", DP_error());
+        }
+        return true;
+    }
+    else {
+        return false;
+    }
 }
 
 static bool write_index_messages(DP_BuildIndexContext *c)
 {
     DP_Player *player = c->player;
-    DP_AclState *acls = c->acls;
-    DP_LocalState *ls = c->local_state;
-    DP_CanvasHistory *ch = c->ch;
-    DP_DrawContext *dc = c->dc;
     int last_percent = 0;
-    long long last_written_message_index = 0;
+    int messages_since_progress = 0;
+    long long last_written_message_index = c->last_entry_message_index;
+    c->recording_offset = DP_player_tell(player);
 
     while (true) {
         size_t message_offset = DP_player_tell(player);
         DP_Message *msg;
         DP_PlayerResult result = DP_player_step(player, &msg);
         if (result == DP_PLAYER_SUCCESS) {
-            bool filtered = DP_acl_state_handle(acls, msg, false)
-                          & DP_ACL_STATE_FILTERED_BIT;
-            if (filtered) {
-                DP_debug(
-                    "ACL filtered recorded %s message from user %u",
-                    DP_message_type_enum_name_unprefixed(DP_message_type(msg)),
-                    DP_message_context_id(msg));
-            }
-            else {
-                DP_local_state_handle(ls, dc, msg);
-                if (DP_message_type_command(DP_message_type(msg))) {
-                    if (!DP_canvas_history_handle(ch, dc, msg)) {
-                        DP_warn("Error handling message in index: %s",
-                                DP_error());
-                    }
-
-                    long long message_index = c->message_count++;
-                    if (c->should_snapshot_fn(c->user)) {
-                        if (!make_index_entry(c, message_index,
-                                              message_offset)) {
-                            return false;
-                        }
-                        last_written_message_index = message_index;
+            c->recording_offset = DP_player_tell(player);
+            if (handle_index_message(c, msg)) {
+                long long message_index = c->message_count++;
+                if (c->should_snapshot_fn(c->user)) {
+                    if (!make_index_entry(c, message_index, message_offset)) {
+                        DP_message_decref(msg);
+                        return false;
                     }
+                    last_written_message_index = message_index;
                 }
             }
             DP_message_decref(msg);
@@ -1625,26 +1928,38 @@ static bool write_index_messages(DP_BuildIndexContext *c)
             if (c->progress_fn) {
                 double progress = DP_player_progress(player);
                 int percent = DP_double_to_int(progress * 100.0 + 0.5);
-                if (percent > last_percent) {
-                    last_percent = percent;
-                    c->progress_fn(c->user, percent);
+                if (percent > last_percent
+                    || ++messages_since_progress >= INDEX_PROGRESS_INTERVAL) {
+                    last_percent = DP_max_int(percent, last_percent);
+                    messages_since_progress = 0;
+                    if (!c->progress_fn(c->user, last_percent,
+                                        c->message_count)) {
+                        DP_error_set("Index building cancelled");
+                        return false;
+                    }
                 }
             }
         }
         else if (result == DP_PLAYER_ERROR_PARSE) {
+            c->recording_offset = DP_player_tell(player);
             DP_warn("Can't index message: %s", DP_error());
         }
         else if (result == DP_PLAYER_RECORDING_END) {
             break;
         }
         else {
-            return false; // Input error, bail out.
+            // A recording that's still being written may end in the middle
+            // of a message. Stop before it, the next incremental index build
+            // picks up from there.
+            DP_warn("Stopping index at offset %zu: %s", message_offset,
+                    DP_error());
+            break;
         }
     }
 
     long long message_index = c->message_count - 1;
     if (message_index >= 0 && message_index != last_written_message_index) {
-        return make_index_entry(c, message_index, DP_player_tell(player));
+        return make_index_entry(c, message_index, c->recording_offset);
     }
     else {
         return true;
@@ -1682,18 +1997,251 @@ static bool write_index_finish(DP_BuildIndexContext *c)
         return false;
     }
 
-    return DP_OUTPUT_WRITE_LITTLEENDIAN(output,
-                                        DP_OUTPUT_UINT32(c->message_count),
-                                        DP_OUTPUT_UINT64(entries_offset));
+    // Everything else is written by now, so if this last step gets cut off,
+    // an index being appended to remains valid in its previous state.
+    return DP_OUTPUT_WRITE_LITTLEENDIAN(
+        output, DP_OUTPUT_UINT32(c->message_count),
+        DP_OUTPUT_UINT64(entries_offset), DP_OUTPUT_UINT32(count),
+        DP_OUTPUT_UINT64(c->recording_offset));
+}
+
+static bool write_remaining_index_thumbnails(DP_BuildIndexContext *c)
+{
+    DP_worker_free_join(c->jobs.worker);
+    c->jobs.worker = NULL;
+    return write_index_thumbnails(c);
+}
+
+static bool write_index_start(DP_BuildIndexContext *c)
+{
+    size_t append_offset = c->append_offset;
+    if (append_offset == 0) {
+        return write_index_header(c);
+    }
+    else {
+        // Appending to an existing index. Its old entries stay where they are
+        // until the header gets pointed to the new ones at the very end.
+        return DP_output_seek(c->output, append_offset);
+    }
 }
 
 static bool write_index(DP_BuildIndexContext *c)
 {
-    return write_index_header(c) && write_index_messages(c)
-        && write_index_finish(c) && DP_output_flush(c->output);
+    return write_index_start(c) && write_index_messages(c)
+        && write_remaining_index_thumbnails(c) && write_index_finish(c)
+        && DP_output_flush(c->output);
+}
+
+static bool init_index_jobs(DP_BuildIndexContext *c)
+{
+    int thread_count = DP_max_int(1, DP_thread_cpu_count());
+    c->jobs.thread_count = thread_count;
+    c->jobs.dcs = DP_malloc(sizeof(*c->jobs.dcs) * DP_int_to_size(thread_count));
+    c->jobs.deflaters =
+        DP_malloc(sizeof(*c->jobs.deflaters) * DP_int_to_size(thread_count));
+    // The index is only read locally, so favor speed over size. If a deflater
+    // fails to initialize, tile compression falls back to the default path.
+    c->deflater = DP_deflater_new(DP_COMPRESS_LEVEL_FAST);
+    for (int i = 0; i < thread_count; ++i) {
+        c->jobs.dcs[i] = DP_draw_context_new();
+        c->jobs.deflaters[i] = DP_deflater_new(DP_COMPRESS_LEVEL_FAST);
+    }
+    c->jobs.tiles_done_sem = DP_semaphore_new(0);
+    c->jobs.thumbnails_sem = DP_semaphore_new(DP_int_to_uint(
+        thread_count * INDEX_MAX_PENDING_THUMBNAILS_PER_THREAD));
+    c->jobs.thumbnails_mutex = DP_mutex_new();
+    DP_VECTOR_INIT_TYPE(&c->jobs.thumbnails, DP_BuildIndexThumbnail,
+                        DP_int_to_size(thread_count)
+                            * INDEX_MAX_PENDING_THUMBNAILS_PER_THREAD);
+    c->jobs.worker = DP_worker_new(1024, sizeof(struct DP_BuildIndexJob),
+                                   thread_count, run_index_job);
+    return c->jobs.tiles_done_sem && c->jobs.thumbnails_sem
+        && c->jobs.thumbnails_mutex && c->jobs.worker;
+}
+
+static void dispose_index_jobs(DP_BuildIndexContext *c)
+{
+    DP_worker_free_join(c->jobs.worker);
+    dispose_index_thumbnails(&c->jobs.thumbnails);
+    DP_vector_dispose(&c->jobs.thumbnails);
+    DP_mutex_free(c->jobs.thumbnails_mutex);
+    DP_semaphore_free(c->jobs.thumbnails_sem);
+    DP_semaphore_free(c->jobs.tiles_done_sem);
+    for (int i = 0; i < c->jobs.thread_count; ++i) {
+        DP_deflater_free(c->jobs.deflaters[i]);
+        DP_draw_context_free(c->jobs.dcs[i]);
+    }
+    DP_free(c->jobs.deflaters);
+    DP_free(c->jobs.dcs);
+    DP_deflater_free(c->deflater);
+}
+
+static bool get_recording_length(const char *recording_path,
+                                 size_t *out_length)
+{
+    DP_Input *input = DP_file_input_new_from_path(recording_path);
+    if (!input) {
+        return false;
+    }
+
+    bool error;
+    size_t length = DP_input_length(input, &error);
+    DP_input_free(input);
+    if (error) {
+        return false;
+    }
+    else {
+        *out_length = length;
+        return true;
+    }
+}
+
+static bool skip_resumed_message(DP_Player *player)
+{
+    DP_Message *msg;
+    if (DP_player_step(player, &msg) == DP_PLAYER_SUCCESS) {
+        DP_message_decref(msg);
+        return true;
+    }
+    else {
+        DP_error_set("Can't step past last indexed message");
+        return false;
+    }
+}
+
+// A snapshot holds the canvas state at the oldest undo point that's still
+// within the undo depth limit, followed by every history entry after it, with
+// undone ones marked as such. Replaying that gives us a history that any undo
+// or redo in the appended part of the recording can reach back into, the same
+// as if we had indexed it from the beginning. Without the undo depth message
+// that comes before those entries, the snapshot isn't one we can resume from.
+static bool index_snapshot_has_undo_history(
+    DP_PlayerIndexEntrySnapshot *snapshot)
+{
+    int count = DP_player_index_entry_snapshot_message_count(snapshot);
+    for (int i = 0; i < count; ++i) {
+        DP_Message *msg =
+            DP_player_index_entry_snapshot_message_at_inc(snapshot, i);
+        bool is_undo_depth = msg && DP_message_type(msg) == DP_MSG_UNDO_DEPTH;
+        DP_message_decref_nullable(msg);
+        if (is_undo_depth) {
+            return true;
+        }
+    }
+    DP_error_set("Index snapshot has no undo history to resume from");
+    return false;
+}
+
+// Puts the canvas history, ACLs and local state into the same state they were
+// in when the snapshot was written, the same way seeking during playback does.
+static void restore_index_snapshot(DP_BuildIndexContext *c,
+                                   DP_PlayerIndexEntrySnapshot *snapshot)
+{
+    DP_canvas_history_reset_to_state_noinc(
+        c->ch, DP_player_index_entry_snapshot_canvas_state_inc(snapshot));
+    int count = DP_player_index_entry_snapshot_message_count(snapshot);
+    for (int i = 0; i < count; ++i) {
+        DP_Message *msg =
+            DP_player_index_entry_snapshot_message_at_inc(snapshot, i);
+        if (msg) {
+            // The player filters these out, so handle them directly.
+            if (DP_message_type(msg) == DP_MSG_UNDO_DEPTH) {
+                DP_MsgUndoDepth *mud = DP_message_internal(msg);
+                DP_canvas_history_undo_depth_limit_set(
+                    c->ch, DP_msg_undo_depth_depth(mud));
+            }
+            else {
+                handle_index_message(c, msg);
+            }
+            DP_message_decref(msg);
+        }
+    }
+}
+
+static bool resume_index_from_last_entry(DP_BuildIndexContext *c)
+{
+    DP_Player *player = c->player;
+    DP_PlayerIndex *pi = &player->index;
+    size_t entry_count = pi->entry_count;
+    if (entry_count == 0) {
+        DP_error_set("Index has no entries to resume from");
+        return false;
+    }
+
+    size_t recording_offset = pi->recording_offset;
+    size_t recording_length;
+    if (!get_recording_length(player->recording_path, &recording_length)) {
+        return false;
+    }
+    else if (recording_length < recording_offset) {
+        DP_error_set("Recording length %zu is less than indexed offset %zu",
+                     recording_length, recording_offset);
+        return false;
+    }
+
+    DP_PlayerIndexEntry last = pi->entries[entry_count - 1];
+    DP_PlayerIndexEntrySnapshot *snapshot =
+        DP_player_index_entry_load(player, c->dc, last);
+    if (!snapshot) {
+        return false;
+    }
+
+    // The last entry either sits at the end of the indexed part of the
+    // recording or it points at the message it took the snapshot after, in
+    // which case we have to skip over that one.
+    bool ok = index_snapshot_has_undo_history(snapshot)
+           && DP_player_seek(player, last.message_index, last.message_offset)
+           && (last.message_offset == recording_offset
+               || skip_resumed_message(player));
+    if (ok) {
+        restore_index_snapshot(c, snapshot);
+        for (size_t i = 0; i < entry_count; ++i) {
+            DP_VECTOR_PUSH_TYPE(&c->entries, DP_PlayerIndexEntry,
+                                pi->entries[i]);
+        }
+        c->message_count = last.message_index + 1;
+        c->last_entry_message_index = last.message_index;
+        c->append_offset = pi->entries_offset + entry_count * ENTRY_SIZE;
+    }
+
+    DP_player_index_entry_snapshot_free(snapshot);
+    return ok;
+}
+
+static bool resume_index(DP_BuildIndexContext *c)
+{
+    DP_Player *player = c->player;
+    if (!DP_player_index_load(player)) {
+        return false;
+    }
+    bool ok = resume_index_from_last_entry(c);
+    // Close the index input again, it's about to get written to.
+    player_index_dispose(&player->index);
+    return ok;
+}
+
+static bool open_index_output(DP_BuildIndexContext *c, bool incremental)
+{
+    DP_Player *player = c->player;
+    const char *path = player->index_path;
+    if (incremental) {
+        if (resume_index(c)) {
+            DP_debug("Resuming index at message %lld", c->message_count);
+            c->output = DP_file_output_update_new_from_path(path);
+            return c->output;
+        }
+
+        DP_debug("Can't resume index, building from scratch: %s", DP_error());
+        if (!DP_player_rewind(player)) {
+            return false;
+        }
+    }
+    c->output = DP_file_output_save_new_from_path(path);
+    return c->output;
 }
 
 bool DP_player_index_build(DP_Player *player, DP_DrawContext *dc,
+                           bool incremental,
                            DP_PlayerIndexShouldSnapshotFn should_snapshot_fn,
                            DP_PlayerIndexProgressFn progress_fn, void *user)
 {
@@ -1722,37 +2270,40 @@ bool DP_player_index_build(DP_Player *player, DP_DrawContext *dc,
         return false;
     }
 
-    const char *path = index_player->index_path;
-    DP_Output *output = DP_file_output_save_new_from_path(path);
-    if (!output) {
-        DP_player_free(index_player);
-        return false;
-    }
-
-    DP_PERF_BEGIN_DETAIL(fn, "index_build", "path=%s", path);
+    DP_PERF_BEGIN_DETAIL(fn, "index_build", "path=%s incremental=%d",
+                         index_player->index_path, (int)incremental);
     DP_AclState *acls = DP_acl_state_new();
     DP_LocalState *ls = DP_local_state_new(NULL, NULL, NULL, NULL);
     DP_CanvasHistory *ch = DP_canvas_history_new(NULL, NULL, false, NULL);
     DP_BuildIndexContext c = {index_player,
-                              output,
+                              NULL,
                               acls,
                               ls,
                               ch,
                               dc,
+                              NULL,
+                              0,
+                              0,
+                              0,
                               0,
                               DP_VECTOR_NULL,
                               {NULL, NULL, NULL, {NULL, 0}, {NULL, 0}},
+                              {NULL, 0, NULL, NULL, NULL, NULL, NULL,
+                               DP_VECTOR_NULL},
                               should_snapshot_fn,
                               progress_fn,
                               user};
     DP_VECTOR_INIT_TYPE(&c.entries, DP_PlayerIndexEntry, INITAL_ENTRY_CAPACITY);
-    bool ok = write_index(&c);
+    bool ok = open_index_output(&c, incremental) && init_index_jobs(&c)
+           && write_index(&c);
+    // Joins the worker first, the jobs may still be using everything else.
+    dispose_index_jobs(&c);
     dispose_index_maps(&c.last);
     DP_vector_dispose(&c.entries);
     DP_canvas_history_free(ch);
     DP_local_state_free(ls);
     DP_acl_state_free(acls);
-    DP_output_free(output);
+    DP_output_free(c.output);
     DP_player_free(index_player);
     DP_PERF_END(fn);
     return ok;
@@ -1763,6 +2314,8 @@ typedef struct DP_ReadIndexContext {
     DP_BufferedInput input;
     unsigned int message_count;
     size_t index_offset;
+    unsigned int entry_count;
+    size_t recording_offset;
     DP_Vector entries;
 } DP_ReadIndexContext;
 
@@ -1842,21 +2395,24 @@ static bool read_index_header(DP_ReadIndexContext *c)
 {
     DP_BufferedInput *input = &c->input;
     return check_index_magic(c) && check_index_version(c)
-        && READ_INDEX(input, uint32, c->message_count) && read_index_offset(c);
+        && READ_INDEX(input, uint32, c->message_count) && read_index_offset(c)
+        && READ_INDEX(input, uint32, c->entry_count)
+        && READ_INDEX_SIZE(input, c->recording_offset);
 }
 
-#define ENTRY_SIZE (sizeof(uint32_t) + sizeof(uint64_t) * (size_t)3)
-
 static bool read_index_entries(DP_ReadIndexContext *c)
 {
     if (!DP_buffered_input_seek(&c->input, c->index_offset)) {
         return false;
     }
 
+    unsigned int entry_count = c->entry_count;
     DP_VECTOR_INIT_TYPE(&c->entries, DP_PlayerIndexEntry,
-                        INITAL_ENTRY_CAPACITY);
+                        DP_max_size(INITAL_ENTRY_CAPACITY, entry_count));
 
-    while (true) {
+    // There may be leftovers of an interrupted append after the entries, so
+    // only read as many as the header says there are.
+    for (unsigned int i = 0; i < entry_count; ++i) {
         bool error;
         size_t read = DP_buffered_input_read(&c->input, ENTRY_SIZE, &error);
         if (error) {
@@ -1875,16 +2431,13 @@ static bool read_index_entries(DP_ReadIndexContext *c)
                      entry.snapshot_offset, entry.thumbnail_offset);
             DP_VECTOR_PUSH_TYPE(&c->entries, DP_PlayerIndexEntry, entry);
         }
-        else if (read == 0) {
-            DP_debug("Reached end of index entries");
-            return true;
-        }
         else {
             DP_error_set("Expected index entry of %zu bytes, but got %zu",
                          ENTRY_SIZE, read);
             return false;
         }
     }
+    return true;
 }
 
 bool DP_player_index_load(DP_Player *player)
@@ -1907,14 +2460,18 @@ bool DP_player_index_load(DP_Player *player)
     }
 
     DP_PERF_BEGIN_DETAIL(fn, "index_load", "path=%s", path);
-    DP_ReadIndexContext c = {DP_buffered_input_init(input), 0, 0,
+    DP_ReadIndexContext c = {DP_buffered_input_init(input), 0, 0, 0, 0,
                              DP_VECTOR_NULL};
 
     bool ok = read_index_header(&c) && read_index_entries(&c);
     if (ok) {
         player_index_dispose(&player->index);
-        player->index = (DP_PlayerIndex){c.input, c.message_count,
-                                         c.entries.elements, c.entries.used};
+        player->index = (DP_PlayerIndex){c.input,
+                                         c.message_count,
+                                         c.index_offset,
+                                         c.recording_offset,
+                                         c.entries.elements,
+                                         c.entries.used};
     }
     else {
         DP_vector_dispose(&c.entries);
@@ -2542,6 +3099,23 @@ size_t DP_player_index_entry_count(DP_Player *player)
     return check_index(player) ? player->index.entry_count : 0;
 }
 
+bool DP_player_index_outdated(DP_Player *player)
+{
+    DP_ASSERT(player);
+    if (!check_index(player)) {
+        return false;
+    }
+
+    size_t recording_length;
+    if (get_recording_length(player->recording_path, &recording_length)) {
+        return recording_length > player->index.recording_offset;
+    }
+    else {
+        DP_warn("Can't check if index is outdated: %s", DP_error());
+        return false;
+    }
+}
+
 DP_PlayerIndexEntry DP_player_index_entry_search(DP_Player *player,
                                                  long long position, bool after)
 {
@@ -60,7 +60,11 @@ typedef struct DP_PlayerIndexEntry {
 typedef struct DP_PlayerIndexEntrySnapshot DP_PlayerIndexEntrySnapshot;
 
 typedef bool (*DP_PlayerIndexShouldSnapshotFn)(void *user);
-typedef void (*DP_PlayerIndexProgressFn)(void *user, int percent);
+// Called whenever the percentage changes and every so often in between. The
+// message count is the number of messages indexed so far, for figuring out the
+// throughput. Return false to cancel building the index.
+typedef bool (*DP_PlayerIndexProgressFn)(void *user, int percent,
+                                         long long message_count);
 
 
 DP_Player *DP_player_new(DP_PlayerType type, const char *path_or_null,
@@ -93,7 +97,11 @@ bool DP_player_rewind(DP_Player *player);
 bool DP_player_seek_dump(DP_Player *player, long long position);
 
 
+// With incremental set, tries to resume from the last entry of an existing
+// index and append to it, falling back to building it from scratch if that
+// doesn't work. Useful for recordings that are still being written to.
 bool DP_player_index_build(DP_Player *player, DP_DrawContext *dc,
+                           bool incremental,
                            DP_PlayerIndexShouldSnapshotFn should_snapshot_fn,
                            DP_PlayerIndexProgressFn progress_fn, void *user);
 
@@ -104,6 +112,9 @@ unsigned int DP_player_index_message_count(DP_Player *player);
 
 size_t DP_player_index_entry_count(DP_Player *player);
 
+// Whether the recording has grown past what the loaded index covers.
+bool DP_player_index_outdated(DP_Player *player);
+
 DP_PlayerIndexEntry
 DP_player_index_entry_search(DP_Player *player, long long position, bool after);
 
@@ -43,6 +43,7 @@
 #include <dpcommon/output.h>
 #include <dpcommon/perf.h>
 #include <dpcommon/threading.h>
+#include <dpcommon/vector.h>
 #include <dpcommon/worker.h>
 #include <dpmsg/blend_mode.h>
 #include <ctype.h>
@@ -161,8 +162,7 @@ static bool ora_store_mimetype(DP_ZipWriter *zw)
                                   false, false);
 }
 
-static bool ora_store_png(DP_SaveOraContext *c, DP_Image *img_or_null,
-                          const char *name)
+static void *encode_png(DP_Image *img_or_null, size_t *out_size)
 {
     void **buffer_ptr;
     size_t *size_ptr;
@@ -173,32 +173,47 @@ static bool ora_store_png(DP_SaveOraContext *c, DP_Image *img_or_null,
                 : DP_image_png_write(output, 1, 1, (DP_Pixel8[]){{0}});
 
     void *buffer = *buffer_ptr;
-    size_t size = *size_ptr;
+    *out_size = *size_ptr;
     DP_output_free(output);
 
     if (ok) {
-        return DP_zip_writer_add_file(c->zw, name, buffer, size, false, true);
+        return buffer;
     }
     else {
         DP_free(buffer);
-        return false;
+        return NULL;
     }
 }
 
-static bool ora_store_layer(DP_SaveOraContext *c, DP_LayerContent *lc,
-                            DP_SaveOraLayer *sol)
+static bool ora_store_png(DP_SaveOraContext *c, DP_Image *img_or_null,
+                          const char *name)
 {
-    DP_Image *img_or_null =
-        DP_layer_content_to_image_cropped(lc, &sol->offset_x, &sol->offset_y);
-    const char *name =
-        save_ora_context_format(c, "data/layer-%04x.png", sol->layer_id);
-    bool ok = ora_store_png(c, img_or_null, name);
-    DP_image_free(img_or_null);
-    return ok;
+    size_t size;
+    void *buffer = encode_png(img_or_null, &size);
+    // PNGs are already compressed, deflating them again is a waste of time.
+    return buffer
+        && DP_zip_writer_add_file(c->zw, name, buffer, size, false, true);
 }
 
-static bool ora_store_layers(DP_SaveOraContext *c, int *next_index,
-                             DP_LayerList *ll, DP_LayerPropsList *lpl)
+
+// Layers are encoded to PNG on a worker pool, but the zip writer isn't thread-
+// safe and we want the archive in a stable order, so the calling thread writes
+// them out one after another as they finish. To keep memory bounded, only this
+// many layers per thread are encoded ahead of the one being written.
+#define ORA_LAYER_JOBS_IN_FLIGHT_PER_THREAD 2
+
+typedef struct DP_SaveOraLayerJob {
+    DP_LayerContent *lc;
+    DP_SaveOraLayer *sol;
+    DP_Semaphore *done_sem;
+    DP_Atomic done;
+    void *buffer;
+    size_t size;
+} DP_SaveOraLayerJob;
+
+static void ora_collect_layer_jobs(DP_SaveOraContext *c, int *next_index,
+                                   DP_LayerList *ll, DP_LayerPropsList *lpl,
+                                   DP_Vector *jobs)
 {
     int count = DP_layer_list_count(ll);
     DP_ASSERT(DP_layer_props_list_count(lpl) == count);
@@ -212,20 +227,125 @@ static bool ora_store_layers(DP_SaveOraContext *c, int *next_index,
             DP_LayerGroup *lg = DP_layer_list_entry_group_noinc(lle);
             DP_LayerList *child_ll = DP_layer_group_children_noinc(lg);
             DP_LayerPropsList *child_lpl = DP_layer_props_children_noinc(lp);
-            if (!ora_store_layers(c, next_index, child_ll, child_lpl)) {
-                return false;
-            }
+            ora_collect_layer_jobs(c, next_index, child_ll, child_lpl, jobs);
         }
         else {
-            DP_LayerContent *lc = DP_layer_list_entry_content_noinc(lle);
-            if (!ora_store_layer(c, lc, sol)) {
-                return false;
-            }
+            DP_SaveOraLayerJob job = {DP_layer_list_entry_content_noinc(lle),
+                                      sol,
+                                      NULL,
+                                      DP_ATOMIC_INIT(0),
+                                      NULL,
+                                      0};
+            DP_VECTOR_PUSH_TYPE(jobs, DP_SaveOraLayerJob, job);
+        }
+    }
+}
+
+static void ora_encode_layer_job(void *element, DP_UNUSED int thread_index)
+{
+    DP_SaveOraLayerJob *job = *(DP_SaveOraLayerJob **)element;
+    DP_SaveOraLayer *sol = job->sol;
+    DP_Image *img_or_null = DP_layer_content_to_image_cropped(
+        job->lc, &sol->offset_x, &sol->offset_y);
+    job->buffer = encode_png(img_or_null, &job->size);
+    DP_image_free(img_or_null);
+    if (job->done_sem) {
+        DP_atomic_set(&job->done, 1);
+        DP_SEMAPHORE_MUST_POST(job->done_sem);
+    }
+}
+
+static bool ora_write_layer_job(DP_SaveOraContext *c, DP_SaveOraLayerJob *job)
+{
+    void *buffer = job->buffer;
+    job->buffer = NULL;
+    const char *name =
+        save_ora_context_format(c, "data/layer-%04x.png", job->sol->layer_id);
+    return buffer
+        && DP_zip_writer_add_file(c->zw, name, buffer, job->size, false, true);
+}
+
+static void ora_wait_for_layer_job(DP_SaveOraLayerJob *job)
+{
+    // Jobs finish out of order, so every post might be for some other job.
+    while (!DP_atomic_get(&job->done)) {
+        DP_SEMAPHORE_MUST_WAIT(job->done_sem);
+    }
+}
+
+static bool ora_store_layers_serial(DP_SaveOraContext *c, DP_Vector *jobs)
+{
+    size_t count = jobs->used;
+    for (size_t i = 0; i < count; ++i) {
+        DP_SaveOraLayerJob *job = DP_vector_at(jobs, sizeof(*job), i);
+        ora_encode_layer_job(&job, 0);
+        if (!ora_write_layer_job(c, job)) {
+            return false;
         }
     }
     return true;
 }
 
+static bool ora_store_layers_parallel(DP_SaveOraContext *c, DP_Vector *jobs,
+                                      int thread_count)
+{
+    size_t count = jobs->used;
+    size_t in_flight = DP_int_to_size(thread_count)
+                     * ORA_LAYER_JOBS_IN_FLIGHT_PER_THREAD;
+    DP_Semaphore *done_sem = DP_semaphore_new(0);
+    DP_Worker *worker =
+        done_sem ? DP_worker_new(in_flight, sizeof(DP_SaveOraLayerJob *),
+                                 thread_count, ora_encode_layer_job)
+                 : NULL;
+    if (!worker) {
+        DP_warn("Error creating ORA layer worker: %s", DP_error());
+        DP_semaphore_free(done_sem);
+        return ora_store_layers_serial(c, jobs);
+    }
+
+    size_t pushed = 0;
+    bool ok = true;
+    for (size_t i = 0; i < count; ++i) {
+        for (; pushed < count && pushed < i + in_flight; ++pushed) {
+            DP_SaveOraLayerJob *job = DP_vector_at(jobs, sizeof(*job), pushed);
+            job->done_sem = done_sem;
+            DP_worker_push(worker, &job);
+        }
+        DP_SaveOraLayerJob *job = DP_vector_at(jobs, sizeof(*job), i);
+        ora_wait_for_layer_job(job);
+        if (!ora_write_layer_job(c, job)) {
+            ok = false;
+            break;
+        }
+    }
+
+    // On error, let the pushed jobs finish and clean up after them.
+    DP_worker_free_join(worker);
+    DP_semaphore_free(done_sem);
+    for (size_t i = 0; i < pushed; ++i) {
+        DP_SaveOraLayerJob *job = DP_vector_at(jobs, sizeof(*job), i);
+        DP_free(job->buffer);
+    }
+    return ok;
+}
+
+static bool ora_store_layers(DP_SaveOraContext *c, DP_CanvasState *cs)
+{
+    DP_Vector jobs;
+    DP_VECTOR_INIT_TYPE(&jobs, DP_SaveOraLayerJob, 64);
+    int next_index = 0;
+    ora_collect_layer_jobs(c, &next_index, DP_canvas_state_layers_noinc(cs),
+                           DP_canvas_state_layer_props_noinc(cs), &jobs);
+
+    int thread_count =
+        DP_min_int(DP_thread_cpu_count(), DP_size_to_int(jobs.used));
+    bool ok = thread_count > 1
+                ? ora_store_layers_parallel(c, &jobs, thread_count)
+                : ora_store_layers_serial(c, &jobs);
+    DP_vector_dispose(&jobs);
+    return ok;
+}
+
 static bool ora_store_background(DP_SaveOraContext *c, DP_CanvasState *cs)
 {
     DP_Tile *t = DP_canvas_state_background_tile_noinc(cs);
@@ -271,7 +391,7 @@ static bool ora_store_background(DP_SaveOraContext *c, DP_CanvasState *cs)
 static bool ora_store_merged(DP_SaveOraContext *c, DP_CanvasState *cs,
                              DP_DrawContext *dc)
 {
-    DP_Image *img = DP_canvas_state_to_flat_image(
+    DP_Image *img = DP_canvas_state_to_flat_image_parallel(
         cs, DP_FLAT_IMAGE_RENDER_FLAGS, NULL, NULL);
     if (!img) {
         return false;
@@ -548,12 +668,8 @@ static DP_SaveResult save_ora(DP_CanvasState *cs, const char *path,
     }
 
     DP_SaveOraContext c = {zw, NULL, {0, NULL}};
-    int next_index = 0;
-    bool content_ok =
-        ora_store_layers(&c, &next_index, DP_canvas_state_layers_noinc(cs),
-                         DP_canvas_state_layer_props_noinc(cs))
-        && ora_store_background(&c, cs) && ora_store_merged(&c, cs, dc)
-        && ora_store_xml(&c, cs);
+    bool content_ok = ora_store_layers(&c, cs) && ora_store_background(&c, cs)
+                   && ora_store_merged(&c, cs, dc) && ora_store_xml(&c, cs);
     save_ora_context_dispose(&c);
     if (!content_ok) {
         DP_warn("Save '%s': %s", path, DP_error());
@@ -599,7 +715,7 @@ static DP_SaveResult save_flat_image(DP_CanvasState *cs, const char *path,
                                                               DP_Output *),
                                      DP_ViewModeFilter vmf)
 {
-    DP_Image *img = DP_canvas_state_to_flat_image(
+    DP_Image *img = DP_canvas_state_to_flat_image_parallel(
         cs, DP_FLAT_IMAGE_RENDER_FLAGS, NULL, &vmf);
     if (!img) {
         DP_warn("Save: %s", DP_error());
@@ -712,8 +828,21 @@ static const char *get_path_separator(const char *path)
     return PREFERRED_PATH_SEPARATOR;
 }
 
+static DP_ViewModeFilter *make_frame_filters(DP_CanvasState *cs,
+                                             int frame_count)
+{
+    DP_ViewModeFilter *vmfs =
+        DP_malloc(sizeof(*vmfs) * DP_int_to_size(frame_count));
+    for (int i = 0; i < frame_count; ++i) {
+        vmfs[i] = DP_view_mode_filter_make_frame(cs, i);
+    }
+    return vmfs;
+}
+
 struct DP_SaveFrameContext {
-    DP_CanvasState *cs;
+    DP_FlatImageBase *fib;
+    const DP_ViewModeFilter *vmfs;
+    const int *next_duplicates;
     int frame_count;
     const char *path;
     const char *separator;
@@ -738,15 +867,27 @@ static void set_error_result(struct DP_SaveFrameContext *c,
     }
 }
 
-static void save_frame(struct DP_SaveFrameContext *c, int frame_index)
+static DP_SaveResult write_frame(struct DP_SaveFrameContext *c,
+                                 int frame_index, const void *buffer,
+                                 size_t size)
 {
-    DP_CanvasState *cs = c->cs;
     char *path =
         DP_format("%s%sframe-%03d.png", c->path, c->separator, frame_index + 1);
-    DP_SaveResult result = save_flat_image(
-        cs, path, save_png, DP_view_mode_filter_make_frame(cs, frame_index));
-    set_error_result(c, result);
+    DP_Output *output = DP_file_output_save_new_from_path(path);
     DP_free(path);
+    if (!output) {
+        DP_warn("Save: %s", DP_error());
+        return DP_SAVE_RESULT_OPEN_ERROR;
+    }
+
+    bool write_ok = DP_output_write(output, buffer, size);
+    if (DP_output_free(output) && write_ok) {
+        return DP_SAVE_RESULT_SUCCESS;
+    }
+    else {
+        DP_warn("Save frame: %s", DP_error());
+        return DP_SAVE_RESULT_WRITE_ERROR;
+    }
 }
 
 static void report_progress(struct DP_SaveFrameContext *c)
@@ -765,13 +906,67 @@ static void report_progress(struct DP_SaveFrameContext *c)
     }
 }
 
+static void save_frame(struct DP_SaveFrameContext *c, int frame_index)
+{
+    // The worker already keeps every core busy, so flatten on this thread.
+    DP_Image *img = DP_flat_image_base_to_image(c->fib, &c->vmfs[frame_index]);
+    size_t size;
+    void *buffer = encode_png(img, &size);
+    DP_image_free(img);
+    if (!buffer) {
+        DP_warn("Save PNG: %s", DP_error());
+        set_error_result(c, DP_SAVE_RESULT_WRITE_ERROR);
+        return;
+    }
+
+    // Frames that look the same get the same PNG written, no need to render
+    // and encode those all over again.
+    for (int i = frame_index;
+         i != -1 && DP_atomic_get(&c->result) == DP_SAVE_RESULT_SUCCESS;
+         i = c->next_duplicates[i]) {
+        set_error_result(c, write_frame(c, i, buffer, size));
+        report_progress(c);
+    }
+    DP_free(buffer);
+}
+
 static void save_frame_job(void *element, DP_UNUSED int thread_index)
 {
     struct DP_SaveFrameJobParams *params = element;
     struct DP_SaveFrameContext *c = params->c;
     if (DP_atomic_get(&c->result) == DP_SAVE_RESULT_SUCCESS) {
         save_frame(c, params->frame_index);
-        report_progress(c);
+    }
+}
+
+#define FRAME_NOT_YET_SEEN (-2)
+
+// Links up each frame with the next one that has the same layers visible, or
+// -1 if there's none after it. Only the first frame of each chain gets a job,
+// which is pushed only after its chain has been completely linked up.
+static void push_frame_jobs(DP_Worker *worker, struct DP_SaveFrameContext *c,
+                            int *next_duplicates)
+{
+    const DP_ViewModeFilter *vmfs = c->vmfs;
+    int frame_count = c->frame_count;
+    for (int i = 0; i < frame_count; ++i) {
+        next_duplicates[i] = FRAME_NOT_YET_SEEN;
+    }
+    for (int i = 0; i < frame_count; ++i) {
+        if (next_duplicates[i] == FRAME_NOT_YET_SEEN) {
+            int prev = i;
+            for (int j = i + 1; j < frame_count; ++j) {
+                if (next_duplicates[j] == FRAME_NOT_YET_SEEN
+                    && DP_view_mode_filter_equal(&vmfs[i], &vmfs[j])) {
+                    next_duplicates[prev] = j;
+                    next_duplicates[j] = -1;
+                    prev = j;
+                }
+            }
+            next_duplicates[prev] = -1;
+            struct DP_SaveFrameJobParams params = {c, i};
+            DP_worker_push(worker, &params);
+        }
     }
 }
 
@@ -803,8 +998,16 @@ save_animation_frames(DP_CanvasState *cs, const char *path,
         return DP_SAVE_RESULT_INTERNAL_ERROR;
     }
 
+    DP_ViewModeFilter *vmfs = make_frame_filters(cs, frame_count);
+    DP_FlatImageBase *fib = DP_canvas_state_flat_image_base_new(
+        cs, DP_FLAT_IMAGE_RENDER_FLAGS, frame_count, vmfs);
+    int *next_duplicates =
+        DP_malloc(sizeof(*next_duplicates) * DP_int_to_size(frame_count));
+
     struct DP_SaveFrameContext c = {
-        cs,
+        fib,
+        vmfs,
+        next_duplicates,
         frame_count,
         path,
         get_path_separator(path),
@@ -815,12 +1018,12 @@ save_animation_frames(DP_CanvasState *cs, const char *path,
         0,
     };
 
-    for (int i = 0; i < frame_count; ++i) {
-        struct DP_SaveFrameJobParams params = {&c, i};
-        DP_worker_push(worker, &params);
-    }
+    push_frame_jobs(worker, &c, next_duplicates);
 
     DP_worker_free_join(worker);
+    DP_free(next_duplicates);
+    DP_flat_image_base_free(fib);
+    DP_free(vmfs);
     DP_mutex_free(progress_mutex);
     return (DP_SaveResult)DP_atomic_get(&c.result);
 }
@@ -866,6 +1069,219 @@ static bool report_gif_progress(DP_SaveAnimationProgressFn progress_fn,
     return !progress_fn || progress_fn(user, part / total);
 }
 
+// GIF frames are flattened and quantized on a worker pool, while the calling
+// thread LZW-compresses and writes them out in order as they finish. Each frame
+// in flight holds a copy of the whole canvas, so only this many per thread are
+// processed ahead of the one being written.
+#define GIF_FRAME_JOBS_IN_FLIGHT_PER_THREAD 2
+
+typedef struct DP_SaveGifContext {
+    DP_CanvasState *cs;
+    DP_Output *output;
+    jo_gifx_t *gif;
+    DP_SaveAnimationProgressFn progress_fn;
+    void *user;
+    int frame_count;
+    DP_ViewModeFilter *vmfs;
+    DP_FlatImageBase *fib;
+    int *delays;
+    DP_Semaphore *done_sem;
+} DP_SaveGifContext;
+
+typedef struct DP_SaveGifFrameJob {
+    DP_SaveGifContext *c;
+    int frame_index;
+    int end_frame;
+    int delay_offset;
+    int delay_count;
+    DP_Atomic done;
+    jo_gifx_frame_t *frame;
+} DP_SaveGifFrameJob;
+
+// Runs of identical frames are rendered once and merged into a single GIF frame
+// with a longer delay. If that delay doesn't fit, the frame gets written again.
+static int collect_gif_frame_jobs(DP_SaveGifContext *c,
+                                  DP_SaveGifFrameJob *jobs)
+{
+    double centiseconds_per_frame = get_gif_centiseconds_per_frame(c->cs);
+    double delay_frac = 0.0;
+    int job_count = 0;
+    int delay_count = 0;
+    int frame_count = c->frame_count;
+    for (int i = 0; i < frame_count; ++i) {
+        double delay_floored = floor(centiseconds_per_frame + delay_frac);
+        delay_frac = centiseconds_per_frame - delay_floored;
+        int frame_delay = DP_double_to_int(delay_floored);
+
+        bool same =
+            i != 0 && DP_view_mode_filter_equal(&c->vmfs[i - 1], &c->vmfs[i]);
+        if (same) {
+            DP_SaveGifFrameJob *job = &jobs[job_count - 1];
+            job->end_frame = i + 1;
+            int *last_delay = &c->delays[delay_count - 1];
+            if (*last_delay + frame_delay <= UINT16_MAX) {
+                *last_delay += frame_delay;
+            }
+            else {
+                c->delays[delay_count++] = frame_delay;
+                ++job->delay_count;
+            }
+        }
+        else {
+            jobs[job_count++] = (DP_SaveGifFrameJob){
+                c, i, i + 1, delay_count, 1, DP_ATOMIC_INIT(0), NULL};
+            c->delays[delay_count++] = frame_delay;
+        }
+    }
+    return job_count;
+}
+
+static void gif_frame_job(void *element, DP_UNUSED int thread_index)
+{
+    DP_SaveGifFrameJob *job = *(DP_SaveGifFrameJob **)element;
+    DP_SaveGifContext *c = job->c;
+    const DP_ViewModeFilter *vmf = &c->vmfs[job->frame_index];
+    // On a worker, the other threads are busy with frames of their own.
+    DP_Image *img = c->done_sem
+                      ? DP_flat_image_base_to_image(c->fib, vmf)
+                      : DP_flat_image_base_to_image_parallel(c->fib, vmf);
+    jo_gifx_frame_t *frame = jo_gifx_frame_new(c->gif);
+    if (frame) {
+        jo_gifx_frame_quantize(frame, (uint32_t *)DP_image_pixels(img));
+    }
+    DP_image_free(img);
+    job->frame = frame;
+    if (c->done_sem) {
+        DP_atomic_set(&job->done, 1);
+        DP_SEMAPHORE_MUST_POST(c->done_sem);
+    }
+}
+
+static DP_SaveResult write_gif_frame_job(DP_SaveGifContext *c,
+                                         DP_SaveGifFrameJob *job)
+{
+    jo_gifx_frame_t *frame = job->frame;
+    job->frame = NULL;
+    if (!frame) {
+        DP_warn("Error allocating GIF frame");
+        return DP_SAVE_RESULT_INTERNAL_ERROR;
+    }
+
+    bool ok = true;
+    int end = job->delay_offset + job->delay_count;
+    for (int i = job->delay_offset; ok && i < end; ++i) {
+        ok = jo_gifx_frame_write(write_gif, c->output, c->gif, frame,
+                                 DP_int_to_uint16(c->delays[i]));
+    }
+    jo_gifx_frame_free(frame);
+
+    if (!ok) {
+        return DP_SAVE_RESULT_WRITE_ERROR;
+    }
+    else if (!report_gif_progress(c->progress_fn, c->user, job->end_frame,
+                                  c->frame_count)) {
+        return DP_SAVE_RESULT_CANCEL;
+    }
+    else {
+        return DP_SAVE_RESULT_SUCCESS;
+    }
+}
+
+static void wait_for_gif_frame_job(DP_SaveGifContext *c,
+                                   DP_SaveGifFrameJob *job)
+{
+    // Jobs finish out of order, so every post might be for some other job.
+    while (!DP_atomic_get(&job->done)) {
+        DP_SEMAPHORE_MUST_WAIT(c->done_sem);
+    }
+}
+
+static DP_SaveResult write_gif_frames_serial(DP_SaveGifContext *c,
+                                             DP_SaveGifFrameJob *jobs,
+                                             int job_count)
+{
+    for (int i = 0; i < job_count; ++i) {
+        DP_SaveGifFrameJob *job = &jobs[i];
+        gif_frame_job(&job, 0);
+        DP_SaveResult result = write_gif_frame_job(c, job);
+        if (result != DP_SAVE_RESULT_SUCCESS) {
+            return result;
+        }
+    }
+    return DP_SAVE_RESULT_SUCCESS;
+}
+
+static DP_SaveResult write_gif_frames_parallel(DP_SaveGifContext *c,
+                                               DP_SaveGifFrameJob *jobs,
+                                               int job_count, int thread_count)
+{
+    int in_flight = thread_count * GIF_FRAME_JOBS_IN_FLIGHT_PER_THREAD;
+    DP_Semaphore *done_sem = DP_semaphore_new(0);
+    DP_Worker *worker =
+        done_sem ? DP_worker_new(DP_int_to_size(in_flight),
+                                 sizeof(DP_SaveGifFrameJob *), thread_count,
+                                 gif_frame_job)
+                 : NULL;
+    if (!worker) {
+        DP_warn("Error creating GIF frame worker: %s", DP_error());
+        DP_semaphore_free(done_sem);
+        return write_gif_frames_serial(c, jobs, job_count);
+    }
+
+    c->done_sem = done_sem;
+    int pushed = 0;
+    DP_SaveResult result = DP_SAVE_RESULT_SUCCESS;
+    for (int i = 0; i < job_count; ++i) {
+        for (; pushed < job_count && pushed < i + in_flight; ++pushed) {
+            DP_SaveGifFrameJob *job = &jobs[pushed];
+            DP_worker_push(worker, &job);
+        }
+        DP_SaveGifFrameJob *job = &jobs[i];
+        wait_for_gif_frame_job(c, job);
+        result = write_gif_frame_job(c, job);
+        if (result != DP_SAVE_RESULT_SUCCESS) {
+            break;
+        }
+    }
+
+    // On error or cancel, let the pushed jobs finish and clean up after them.
+    DP_worker_free_join(worker);
+    DP_semaphore_free(done_sem);
+    c->done_sem = NULL;
+    for (int i = 0; i < pushed; ++i) {
+        jo_gifx_frame_free(jobs[i].frame);
+    }
+    return result;
+}
+
+static DP_SaveResult write_gif_frames(DP_CanvasState *cs, DP_Output *output,
+                                      jo_gifx_t *gif,
+                                      DP_SaveAnimationProgressFn progress_fn,
+                                      void *user, int frame_count)
+{
+    DP_ViewModeFilter *vmfs = make_frame_filters(cs, frame_count);
+    DP_FlatImageBase *fib = DP_canvas_state_flat_image_base_new(
+        cs, DP_FLAT_IMAGE_RENDER_FLAGS, frame_count, vmfs);
+    int *delays = DP_malloc(sizeof(*delays) * DP_int_to_size(frame_count));
+    DP_SaveGifContext c = {cs,          output, gif, progress_fn, user,
+                           frame_count, vmfs,   fib, delays,      NULL};
+
+    DP_SaveGifFrameJob *jobs =
+        DP_malloc(sizeof(*jobs) * DP_int_to_size(frame_count));
+    int job_count = collect_gif_frame_jobs(&c, jobs);
+    int thread_count = DP_min_int(DP_thread_cpu_count(), job_count);
+    DP_SaveResult result =
+        thread_count > 1
+            ? write_gif_frames_parallel(&c, jobs, job_count, thread_count)
+            : write_gif_frames_serial(&c, jobs, job_count);
+
+    DP_free(jobs);
+    DP_free(delays);
+    DP_flat_image_base_free(fib);
+    DP_free(vmfs);
+    return result;
+}
+
 static DP_SaveResult save_animation_gif(DP_CanvasState *cs, const char *path,
                                         DP_SaveAnimationProgressFn progress_fn,
                                         void *user, int frame_count)
@@ -894,28 +1310,13 @@ static DP_SaveResult save_animation_gif(DP_CanvasState *cs, const char *path,
         return DP_SAVE_RESULT_CANCEL;
     }
 
-    double centiseconds_per_frame = get_gif_centiseconds_per_frame(cs);
-    double delay_frac = 0.0;
-    for (int i = 0; i < frame_count; ++i) {
-        DP_ViewModeFilter vmf = DP_view_mode_filter_make_frame(cs, i);
-        DP_Image *img = DP_canvas_state_to_flat_image(
-            cs, DP_FLAT_IMAGE_RENDER_FLAGS, NULL, &vmf);
-        double delay_floored = floor(centiseconds_per_frame + delay_frac);
-        delay_frac = centiseconds_per_frame - delay_floored;
-        bool frame_ok = jo_gifx_frame(write_gif, output, gif,
-                                      (uint32_t *)DP_image_pixels(img),
-                                      DP_double_to_uint16(delay_floored));
-        DP_image_free(img);
-        if (!frame_ok) {
-            jo_gifx_abort(gif);
-            DP_output_free(output);
-            return DP_SAVE_RESULT_WRITE_ERROR;
-        }
-
-        if (!report_gif_progress(progress_fn, user, i + 1, frame_count)) {
+    if (frame_count != 0) {
+        DP_SaveResult result =
+            write_gif_frames(cs, output, gif, progress_fn, user, frame_count);
+        if (result != DP_SAVE_RESULT_SUCCESS) {
             jo_gifx_abort(gif);
             DP_output_free(output);
-            return DP_SAVE_RESULT_CANCEL;
+            return result;
         }
     }
 
@@ -19,6 +19,7 @@
 #include "annotation_list.h"
 #include "canvas_history.h"
 #include "canvas_state.h"
+#include "compress.h"
 #include "document_metadata.h"
 #include "frame.h"
 #include "layer_content.h"
@@ -219,6 +220,7 @@ struct DP_ResetImageContext {
     void (*push_message)(void *, DP_Message *);
     void *push_message_user;
     DP_Pixel8 *pixel_buffer;
+    DP_Deflater *deflater;
     size_t capacity;
     void *output_buffer;
 };
@@ -248,8 +250,9 @@ static size_t reset_image_maybe_compress_tile(struct DP_ResetImageContext *c,
                                               DP_Tile *tile_or_null)
 {
     if (tile_or_null) {
-        size_t size = DP_tile_compress(tile_or_null, c->pixel_buffer,
-                                       reset_image_get_output_buffer, c);
+        size_t size =
+            DP_tile_compress(tile_or_null, c->deflater, c->pixel_buffer,
+                             reset_image_get_output_buffer, c);
         if (size == 0) {
             DP_warn("Reset image: error tile: %s", DP_error());
         }
@@ -505,11 +508,18 @@ void DP_reset_image_build(DP_CanvasState *cs, unsigned int context_id,
                           void (*push_message)(void *, DP_Message *),
                           void *user)
 {
+    // The deflater may fail to initialize, in which case the tiles just get
+    // compressed with a fresh stream each time instead.
     struct DP_ResetImageContext c = {
-        context_id, push_message,
-        user,       DP_malloc(sizeof(*c.pixel_buffer) * DP_TILE_LENGTH),
-        0,          NULL};
+        context_id,
+        push_message,
+        user,
+        DP_malloc(sizeof(*c.pixel_buffer) * DP_TILE_LENGTH),
+        DP_deflater_new(DP_COMPRESS_LEVEL_DEFAULT),
+        0,
+        NULL};
     canvas_state_to_reset_image(&c, cs);
     DP_free(c.output_buffer);
+    DP_deflater_free(c.deflater);
     DP_free(c.pixel_buffer);
 }
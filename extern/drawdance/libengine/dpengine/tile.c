@@ -47,7 +47,9 @@ struct DP_Tile {
     DP_Atomic refcount;
     const bool transient;
     const bool maybe_blank;
+    const bool solid;
     const unsigned int context_id;
+    const int cache_index;
 };
 
 struct DP_TransientTile {
@@ -55,7 +57,9 @@ struct DP_TransientTile {
     DP_Atomic refcount;
     bool transient;
     bool maybe_blank;
+    bool solid;
     unsigned int context_id;
+    int cache_index;
 };
 
 #else
@@ -65,7 +69,9 @@ struct DP_Tile {
     DP_Atomic refcount;
     bool transient;
     bool maybe_blank;
+    bool solid;
     unsigned int context_id;
+    int cache_index;
 };
 
 #endif
@@ -86,11 +92,32 @@ const uint16_t *DP_tile_opaque_mask(void)
     return opaque_mask;
 }
 
+// Tiles get allocated and freed constantly from many threads at once, so each
+// thread gets a small cache in front of the shared pool. Cache slots are handed
+// out to threads round-robin rather than being truly thread-local, so that the
+// tiles of a thread that exits don't get lost. With lots of threads, a slot may
+// end up shared, hence the spin lock on it. Refilling and returning tiles to
+// the shared pool happens in batches to keep the traffic on its mutex down.
+#define TILE_CACHE_COUNT    32
+#define TILE_CACHE_CAPACITY 16
+#define TILE_CACHE_BATCH    8
+
+typedef struct DP_TileCache {
+    DP_Atomic lock;
+    int count;
+    int live;
+    long long cross_thread_frees;
+    void *tiles[TILE_CACHE_CAPACITY];
+} DP_TileCache;
+
 static DP_MemoryPool tile_memory_pool;
 static DP_Mutex *tile_memory_pool_lock = NULL;
+static int tile_memory_pool_taken;
+static int tile_memory_pool_peak;
+static DP_TileCache tile_caches[TILE_CACHE_COUNT];
+static DP_Atomic next_tile_cache_index;
 
-static void *alloc_tile(bool transient, bool maybe_blank,
-                        unsigned int context_id)
+static void init_tile_memory_pool(void)
 {
     DP_ATOMIC_DECLARE_STATIC_SPIN_LOCK(tile_memory_pool_spinlock);
     if (!tile_memory_pool_lock) {
@@ -101,19 +128,107 @@ static void *alloc_tile(bool transient, bool maybe_blank,
         }
         DP_atomic_unlock(&tile_memory_pool_spinlock);
     }
+}
 
+static int get_tile_cache_index(void)
+{
+    // Zero means that this thread hasn't been assigned a slot yet.
+    static DP_THREAD_LOCAL int index_plus_one;
+    if (index_plus_one == 0) {
+        // Racing threads may get the same slot, which just shares it.
+        unsigned int next = (unsigned int)DP_atomic_get(&next_tile_cache_index);
+        DP_atomic_inc(&next_tile_cache_index);
+        index_plus_one = (int)(next % TILE_CACHE_COUNT) + 1;
+    }
+    return index_plus_one - 1;
+}
+
+static void refill_tile_cache(DP_TileCache *cache)
+{
     DP_MUTEX_MUST_LOCK(tile_memory_pool_lock);
-    DP_TransientTile *tt = DP_memory_pool_alloc_el(&tile_memory_pool);
+    for (int i = 0; i < TILE_CACHE_BATCH; ++i) {
+        cache->tiles[cache->count++] =
+            DP_memory_pool_alloc_el(&tile_memory_pool);
+    }
+    tile_memory_pool_taken += TILE_CACHE_BATCH;
+    if (tile_memory_pool_taken > tile_memory_pool_peak) {
+        tile_memory_pool_peak = tile_memory_pool_taken;
+    }
+    DP_MUTEX_MUST_UNLOCK(tile_memory_pool_lock);
+}
+
+static void drain_tile_cache(DP_TileCache *cache)
+{
+    DP_MUTEX_MUST_LOCK(tile_memory_pool_lock);
+    for (int i = 0; i < TILE_CACHE_BATCH; ++i) {
+        DP_memory_pool_free_el(&tile_memory_pool, cache->tiles[--cache->count]);
+    }
+    tile_memory_pool_taken -= TILE_CACHE_BATCH;
     DP_MUTEX_MUST_UNLOCK(tile_memory_pool_lock);
+}
+
+static void *alloc_tile(bool transient, bool maybe_blank,
+                        unsigned int context_id)
+{
+    init_tile_memory_pool();
+
+    int cache_index = get_tile_cache_index();
+    DP_TileCache *cache = &tile_caches[cache_index];
+    DP_atomic_lock(&cache->lock);
+    if (cache->count == 0) {
+        refill_tile_cache(cache);
+    }
+    DP_TransientTile *tt = cache->tiles[--cache->count];
+    ++cache->live;
+    DP_atomic_unlock(&cache->lock);
 
     DP_atomic_set(&tt->refcount, 1);
     tt->transient = transient;
     tt->maybe_blank = maybe_blank;
+    tt->solid = false;
     tt->context_id = context_id;
+    tt->cache_index = cache_index;
 
     return tt;
 }
 
+static void free_tile(DP_Tile *tile)
+{
+    int cache_index = get_tile_cache_index();
+    DP_TileCache *cache = &tile_caches[cache_index];
+    DP_atomic_lock(&cache->lock);
+    if (cache->count == TILE_CACHE_CAPACITY) {
+        drain_tile_cache(cache);
+    }
+    cache->tiles[cache->count++] = tile;
+    --cache->live;
+    if (tile->cache_index != cache_index) {
+        ++cache->cross_thread_frees;
+    }
+    DP_atomic_unlock(&cache->lock);
+}
+
+DP_TileMemoryStats DP_tile_memory_stats(void)
+{
+    DP_TileMemoryStats stats = {0, 0, 0, 0};
+    for (int i = 0; i < TILE_CACHE_COUNT; ++i) {
+        DP_TileCache *cache = &tile_caches[i];
+        DP_atomic_lock(&cache->lock);
+        stats.live += cache->live;
+        stats.cached += cache->count;
+        stats.cross_thread_frees += cache->cross_thread_frees;
+        DP_atomic_unlock(&cache->lock);
+    }
+
+    if (tile_memory_pool_lock) {
+        DP_MUTEX_MUST_LOCK(tile_memory_pool_lock);
+        stats.peak = tile_memory_pool_peak;
+        DP_MUTEX_MUST_UNLOCK(tile_memory_pool_lock);
+    }
+
+    return stats;
+}
+
 
 DP_Tile *DP_tile_new(unsigned int context_id)
 {
@@ -126,6 +241,11 @@ DP_Tile *DP_tile_new_from_pixel15(unsigned int context_id, DP_Pixel15 pixel)
     for (int i = 0; i < DP_TILE_LENGTH; ++i) {
         tt->pixels[i] = pixel;
     }
+    // Remember that this tile is a single color so that checking for that
+    // doesn't require looking at every pixel. Tiles are immutable once they're
+    // persisted and drawing always happens on a transient copy, so this can't
+    // become stale.
+    tt->solid = true;
     return (DP_Tile *)tt;
 }
 
@@ -275,9 +395,7 @@ void DP_tile_decref(DP_Tile *tile)
     DP_ASSERT(tile);
     DP_ASSERT(DP_atomic_get(&tile->refcount) > 0);
     if (DP_atomic_dec(&tile->refcount)) {
-        DP_MUTEX_MUST_LOCK(tile_memory_pool_lock);
-        DP_memory_pool_free_el(&tile_memory_pool, tile);
-        DP_MUTEX_MUST_UNLOCK(tile_memory_pool_lock);
+        free_tile(tile);
     }
 }
 
@@ -328,16 +446,29 @@ DP_Pixel15 DP_tile_pixel_at(DP_Tile *tile, int x, int y)
     return tile->pixels[y * DP_TILE_SIZE + x];
 }
 
+static bool pixel15_equal(DP_Pixel15 a, DP_Pixel15 b)
+{
+    return a.b == b.b && a.g == b.g && a.r == b.r && a.a == b.a;
+}
+
 bool DP_tile_blank(DP_Tile *tile)
 {
-    static const DP_Pixel15 blank_pixels[DP_TILE_LENGTH] = {0};
-    return memcmp(tile->pixels, blank_pixels, DP_TILE_BYTES) == 0;
+    if (tile->solid) {
+        return pixel15_equal(tile->pixels[0], DP_pixel15_zero());
+    }
+    else {
+        static const DP_Pixel15 blank_pixels[DP_TILE_LENGTH] = {0};
+        return memcmp(tile->pixels, blank_pixels, DP_TILE_BYTES) == 0;
+    }
 }
 
 bool DP_tile_opaque(DP_Tile *tile_or_null)
 {
     if (tile_or_null) {
         DP_Pixel15 *pixels = tile_or_null->pixels;
+        if (tile_or_null->solid) {
+            return pixels[0].a >= DP_BIT15;
+        }
         for (int i = 1; i < DP_TILE_LENGTH; ++i) {
             if (pixels[i].a < DP_BIT15) {
                 return false;
@@ -356,11 +487,11 @@ bool DP_tile_same_pixel(DP_Tile *tile_or_null, DP_Pixel15 *out_pixel)
     if (tile_or_null) {
         DP_Pixel15 *pixels = tile_or_null->pixels;
         pixel = pixels[0];
-        for (int i = 1; i < DP_TILE_LENGTH; ++i) {
-            DP_Pixel15 q = pixels[i];
-            if (pixel.b != q.b || pixel.g != q.g || pixel.r != q.r
-                || pixel.a != q.a) {
-                return false;
+        if (!tile_or_null->solid) {
+            for (int i = 1; i < DP_TILE_LENGTH; ++i) {
+                if (!pixel15_equal(pixel, pixels[i])) {
+                    return false;
+                }
             }
         }
     }
@@ -375,17 +506,52 @@ bool DP_tile_same_pixel(DP_Tile *tile_or_null, DP_Pixel15 *out_pixel)
 }
 
 
-size_t DP_tile_compress(DP_Tile *tile, DP_Pixel8 *pixel_buffer,
+// A single-color tile can be sent as just its color, which is what
+// DP_tile_new_from_compressed turns back into a solid tile. That only works if
+// the color survives the round trip through 8 bit unpremultiplied exactly.
+static bool solid_tile_to_bgra(DP_Tile *tile, uint32_t *out_bgra)
+{
+    DP_Pixel15 pixel = tile->pixels[0];
+    DP_UPixel8 up8 = DP_upixel_float_to_8(
+        DP_upixel15_to_float(DP_pixel15_unpremultiply(pixel)));
+    if (pixel15_equal(DP_pixel15_premultiply(DP_upixel8_to_15(up8)), pixel)) {
+        *out_bgra = up8.color;
+        return true;
+    }
+    else {
+        return false;
+    }
+}
+
+size_t DP_tile_compress(DP_Tile *tile, DP_Deflater *deflater_or_null,
+                        DP_Pixel8 *pixel_buffer,
                         unsigned char *(*get_output_buffer)(size_t, void *),
                         void *user)
 {
     DP_ASSERT(tile);
     DP_ASSERT(DP_atomic_get(&tile->refcount) > 0);
     DP_ASSERT(pixel_buffer);
+    uint32_t bgra;
+    if (tile->solid && solid_tile_to_bgra(tile, &bgra)) {
+        unsigned char *out = get_output_buffer(4, user);
+        if (!out) {
+            return 0;
+        }
+        DP_write_bigendian_uint32(bgra, out);
+        return 4;
+    }
+
     DP_pixels15_to_8(pixel_buffer, tile->pixels, DP_TILE_LENGTH);
-    return DP_compress_deflate((const unsigned char *)pixel_buffer,
-                               DP_TILE_COMPRESSED_BYTES, get_output_buffer,
-                               user);
+    if (deflater_or_null) {
+        return DP_deflater_deflate(
+            deflater_or_null, (const unsigned char *)pixel_buffer,
+            DP_TILE_COMPRESSED_BYTES, get_output_buffer, user);
+    }
+    else {
+        return DP_compress_deflate((const unsigned char *)pixel_buffer,
+                                   DP_TILE_COMPRESSED_BYTES, get_output_buffer,
+                                   user);
+    }
 }
 
 
@@ -401,9 +567,20 @@ void DP_tile_copy_to_image(DP_Tile *tile_or_null, DP_Image *img, int x, int y)
     if (tile_or_null) {
         DP_ASSERT(DP_atomic_get(&tile_or_null->refcount) > 0);
         DP_Pixel15 *src = tile_or_null->pixels;
-        for (int i = 0; i < height; ++i) {
-            DP_pixels15_to_8(dst + i * img_width, src + i * DP_TILE_SIZE,
-                             width);
+        if (tile_or_null->solid) {
+            DP_Pixel8 pixel = DP_pixel15_to_8(src[0]);
+            for (int i = 0; i < height; ++i) {
+                DP_Pixel8 *row = dst + i * img_width;
+                for (int j = 0; j < width; ++j) {
+                    row[j] = pixel;
+                }
+            }
+        }
+        else {
+            for (int i = 0; i < height; ++i) {
+                DP_pixels15_to_8(dst + i * img_width, src + i * DP_TILE_SIZE,
+                                 width);
+            }
         }
     }
     else {
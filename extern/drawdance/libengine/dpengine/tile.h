@@ -24,6 +24,7 @@
 #include "pixels.h"
 #include <dpcommon/common.h>
 
+typedef struct DP_Deflater DP_Deflater;
 typedef struct DP_DrawContext DP_DrawContext;
 typedef struct DP_Image DP_Image;
 
@@ -34,6 +35,13 @@ typedef struct DP_TileCounts {
     int x, y;
 } DP_TileCounts;
 
+typedef struct DP_TileMemoryStats {
+    int live;   // Tiles currently allocated.
+    int cached; // Free tiles sitting in per-thread caches.
+    int peak;   // Most tiles ever taken out of the shared pool, cached or not.
+    long long cross_thread_frees; // Tiles freed by a thread not allocating it.
+} DP_TileMemoryStats;
+
 #ifdef DP_NO_STRICT_ALIASING
 
 typedef struct DP_Tile DP_Tile;
@@ -79,6 +87,8 @@ DP_INLINE int DP_tile_total_round(int width, int height)
 
 const uint16_t *DP_tile_opaque_mask(void);
 
+DP_TileMemoryStats DP_tile_memory_stats(void);
+
 
 DP_Tile *DP_tile_new(unsigned int context_id);
 
@@ -134,7 +144,10 @@ bool DP_tile_opaque(DP_Tile *tile_or_null);
 bool DP_tile_same_pixel(DP_Tile *tile_or_null, DP_Pixel15 *out_pixel);
 
 
-size_t DP_tile_compress(DP_Tile *tile, DP_Pixel8 *pixel_buffer,
+// Uses the given deflater if there is one, otherwise compresses at the default
+// level with a fresh zlib stream.
+size_t DP_tile_compress(DP_Tile *tile, DP_Deflater *deflater_or_null,
+                        DP_Pixel8 *pixel_buffer,
                         unsigned char *(*get_output_buffer)(size_t, void *),
                         void *user);
 
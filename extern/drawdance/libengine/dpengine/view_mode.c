@@ -123,6 +123,45 @@ bool DP_view_mode_filter_excludes_everything(const DP_ViewModeFilter *vmf)
     return vmf->internal_type == TYPE_NOTHING;
 }
 
+static bool frame_layer_ids_subset(DP_Frame *a, DP_Frame *b)
+{
+    int count = DP_frame_layer_id_count(a);
+    for (int i = 0; i < count; ++i) {
+        if (!DP_frame_layer_ids_contain(b, DP_frame_layer_id_at(a, i))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool frames_equal(DP_Frame *a, DP_Frame *b)
+{
+    return a == b
+        || (frame_layer_ids_subset(a, b) && frame_layer_ids_subset(b, a));
+}
+
+bool DP_view_mode_filter_equal(const DP_ViewModeFilter *a,
+                               const DP_ViewModeFilter *b)
+{
+    DP_ASSERT(a);
+    DP_ASSERT(b);
+    if (a->internal_type != b->internal_type) {
+        return false;
+    }
+    switch (a->internal_type) {
+    case TYPE_NORMAL:
+    case TYPE_NOTHING:
+        return true;
+    case TYPE_LAYER:
+    case TYPE_FRAME_AUTOMATIC:
+        return a->layer_id == b->layer_id;
+    case TYPE_FRAME_MANUAL:
+        return frames_equal(a->frame, b->frame);
+    default:
+        DP_UNREACHABLE();
+    }
+}
+
 
 static DP_ViewModeFilterResult make_result(bool hidden_by_view_mode,
                                            DP_ViewModeFilter child_vmf)
@@ -196,6 +235,29 @@ DP_ViewModeFilterResult DP_view_mode_filter_apply(const DP_ViewModeFilter *vmf,
     }
 }
 
+bool DP_view_mode_filters_agree(const DP_ViewModeFilter *vmfs, int count,
+                                DP_LayerProps *lp)
+{
+    DP_ASSERT(vmfs || count == 0);
+    DP_ASSERT(lp);
+    if (count == 0) {
+        return true;
+    }
+    // We don't bother descending into visible groups whose children still get
+    // filtered, such as pass-through groups in a manual timeline frame. Those
+    // count as a disagreement even if the children would all agree, which is
+    // conservative, but still correct.
+    bool hidden = DP_view_mode_filter_apply(&vmfs[0], lp).hidden_by_view_mode;
+    for (int i = 0; i < count; ++i) {
+        DP_ViewModeFilterResult result = DP_view_mode_filter_apply(&vmfs[i], lp);
+        if (result.hidden_by_view_mode != hidden
+            || (!hidden && result.child_vmf.internal_type != TYPE_NORMAL)) {
+            return false;
+        }
+    }
+    return true;
+}
+
 
 struct DP_OnionSkins {
     int count_below;
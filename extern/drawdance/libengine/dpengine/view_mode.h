@@ -60,6 +60,16 @@ DP_ViewModeFilter DP_view_mode_filter_make(DP_ViewMode vm, DP_CanvasState *cs,
 
 bool DP_view_mode_filter_excludes_everything(const DP_ViewModeFilter *vmf);
 
+// Checks if both filters show exactly the same layers, e.g. two timeline frames
+// that contain the same set of layers.
+bool DP_view_mode_filter_equal(const DP_ViewModeFilter *a,
+                               const DP_ViewModeFilter *b);
+
+// Checks if all of the given filters show or hide the given layer alike. A
+// visible group only counts if none of the filters apply to its children.
+bool DP_view_mode_filters_agree(const DP_ViewModeFilter *vmfs, int count,
+                                DP_LayerProps *lp);
+
 DP_ViewModeFilterResult DP_view_mode_filter_apply(const DP_ViewModeFilter *vmf,
                                                   DP_LayerProps *lp);
 
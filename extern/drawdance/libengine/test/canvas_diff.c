@@ -0,0 +1,378 @@
+/*
+ * Copyright (c) 2022 askmeaboutloom
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
+#include <dpengine/canvas_diff.h>
+#include <dpengine/tile.h>
+#include <dptest_engine.h>
+
+
+// 50 by 30 tiles, enough to span more than one group of 32 by 32 tile bits.
+#define XTILES 50
+#define YTILES 30
+#define WIDTH  (XTILES * DP_TILE_SIZE)
+#define HEIGHT (YTILES * DP_TILE_SIZE)
+#define COUNT  (XTILES * YTILES)
+
+typedef struct TestDiff {
+    DP_CanvasDiff *diff;
+    int xtiles, count;
+    bool expected[COUNT];
+    bool seen[COUNT];
+    int last_seen;
+    bool in_order;
+    bool in_bounds;
+} TestDiff;
+
+static void begin(TestDiff *td, int old_xtiles, int old_ytiles, int xtiles,
+                  int ytiles)
+{
+    DP_canvas_diff_begin(td->diff, old_xtiles * DP_TILE_SIZE,
+                         old_ytiles * DP_TILE_SIZE, xtiles * DP_TILE_SIZE,
+                         ytiles * DP_TILE_SIZE, false);
+    td->xtiles = xtiles;
+    td->count = xtiles * ytiles;
+}
+
+static void expect_rect(TestDiff *td, int left, int top, int right, int bottom,
+                        bool value)
+{
+    int xtiles = td->xtiles;
+    int ytiles = td->count / xtiles;
+    for (int y = DP_max_int(top, 0); y <= DP_min_int(bottom, ytiles - 1); ++y) {
+        for (int x = DP_max_int(left, 0); x <= DP_min_int(right, xtiles - 1);
+             ++x) {
+            td->expected[y * xtiles + x] = value;
+        }
+    }
+}
+
+static void expect_all(TestDiff *td, bool value)
+{
+    for (int i = 0; i < COUNT; ++i) {
+        td->expected[i] = value && i < td->count;
+    }
+}
+
+static void see_index(void *data, int tile_index)
+{
+    TestDiff *td = data;
+    if (tile_index <= td->last_seen) {
+        td->in_order = false;
+    }
+    if (tile_index >= 0 && tile_index < td->count) {
+        td->seen[tile_index] = true;
+    }
+    else {
+        td->in_bounds = false;
+    }
+    td->last_seen = tile_index;
+}
+
+static void see_pos(void *data, int tile_x, int tile_y)
+{
+    TestDiff *td = data;
+    if (tile_x < 0 || tile_x >= td->xtiles) {
+        td->in_bounds = false;
+    }
+    else {
+        see_index(data, tile_y * td->xtiles + tile_x);
+    }
+}
+
+static void clear_seen(TestDiff *td)
+{
+    for (int i = 0; i < COUNT; ++i) {
+        td->seen[i] = false;
+    }
+    td->last_seen = -1;
+    td->in_order = true;
+    td->in_bounds = true;
+}
+
+static void seen_ok(TEST_PARAMS, TestDiff *td, const char *title)
+{
+    int mismatches = 0;
+    for (int i = 0; i < COUNT; ++i) {
+        if (td->seen[i] != td->expected[i]) {
+            if (mismatches++ < 5) {
+                DIAG("tile %d: expected %s, got %s", i,
+                     td->expected[i] ? "changed" : "unchanged",
+                     td->seen[i] ? "changed" : "unchanged");
+            }
+        }
+    }
+    OK(mismatches == 0, "%s: changed tiles match", title);
+    OK(td->in_order, "%s: tiles visited in order", title);
+    OK(td->in_bounds, "%s: tiles visited in bounds", title);
+}
+
+static void each_index_ok(TEST_PARAMS, TestDiff *td, bool reset,
+                          const char *title)
+{
+    clear_seen(td);
+    if (reset) {
+        DP_canvas_diff_each_index_reset(td->diff, see_index, td);
+    }
+    else {
+        DP_canvas_diff_each_index(td->diff, see_index, td);
+    }
+    seen_ok(TEST_ARGS, td, title);
+}
+
+static void each_pos_ok(TEST_PARAMS, TestDiff *td, bool reset,
+                        const char *title)
+{
+    clear_seen(td);
+    if (reset) {
+        DP_canvas_diff_each_pos_reset(td->diff, see_pos, td);
+    }
+    else {
+        DP_canvas_diff_each_pos(td->diff, see_pos, td);
+    }
+    seen_ok(TEST_ARGS, td, title);
+}
+
+static void nothing_changed_ok(TEST_PARAMS, TestDiff *td, const char *title)
+{
+    expect_all(td, false);
+    each_index_ok(TEST_ARGS, td, false, title);
+}
+
+static TestDiff *test_diff_new(void)
+{
+    TestDiff *td = DP_malloc_zeroed(sizeof(*td));
+    td->diff = DP_canvas_diff_new();
+    return td;
+}
+
+static void test_diff_free(TestDiff *td)
+{
+    DP_canvas_diff_free(td->diff);
+    DP_free(td);
+}
+
+
+static void canvas_diff_begin_marks_everything(TEST_PARAMS)
+{
+    TestDiff *td = test_diff_new();
+    begin(td, 0, 0, XTILES, YTILES);
+    OK(!DP_canvas_diff_layer_props_changed_reset(td->diff),
+       "layer props unchanged");
+
+    expect_all(td, true);
+    each_index_ok(TEST_ARGS, td, false, "new canvas");
+    each_pos_ok(TEST_ARGS, td, true, "new canvas reset");
+    nothing_changed_ok(TEST_ARGS, td, "after reset");
+
+    // Beginning again at the same size doesn't change anything.
+    DP_canvas_diff_begin(td->diff, WIDTH, HEIGHT, WIDTH, HEIGHT, true);
+    nothing_changed_ok(TEST_ARGS, td, "same size");
+    OK(DP_canvas_diff_layer_props_changed_reset(td->diff),
+       "layer props changed");
+    OK(!DP_canvas_diff_layer_props_changed_reset(td->diff),
+       "layer props changed was reset");
+
+    test_diff_free(td);
+}
+
+static void canvas_diff_tile_bounds(TEST_PARAMS)
+{
+    TestDiff *td = test_diff_new();
+    begin(td, 0, 0, XTILES, YTILES);
+    DP_canvas_diff_each_index_reset(td->diff, see_index, td);
+    expect_all(td, false);
+
+    // Tile indexes 30 through 33, across the first word boundary.
+    DP_canvas_diff_check_tile_bounds(td->diff, 30, 0, 33, 0);
+    expect_rect(td, 30, 0, 33, 0, true);
+    each_index_ok(TEST_ARGS, td, false, "across word boundary");
+
+    // Tile index 1024 is the first one in the second summary group.
+    DP_canvas_diff_check_tile_bounds(td->diff, 20, 19, 30, 21);
+    expect_rect(td, 20, 19, 30, 21, true);
+    each_index_ok(TEST_ARGS, td, false, "across summary group boundary");
+
+    // Bounds get clamped to the canvas.
+    DP_canvas_diff_check_tile_bounds(td->diff, -5, -5, 2, 1);
+    DP_canvas_diff_check_tile_bounds(td->diff, 45, 28, 60, 40);
+    expect_rect(td, 0, 0, 2, 1, true);
+    expect_rect(td, 45, 28, XTILES - 1, YTILES - 1, true);
+    each_index_ok(TEST_ARGS, td, false, "clamped bounds");
+
+    DP_canvas_diff_check_tile_bounds(td->diff, XTILES, 0, XTILES + 5, 5);
+    DP_canvas_diff_check_tile_bounds(td->diff, 0, YTILES, 5, YTILES + 5);
+    DP_canvas_diff_check_tile_bounds(td->diff, 10, 10, 5, 5);
+    each_pos_ok(TEST_ARGS, td, true, "bounds outside of canvas");
+    nothing_changed_ok(TEST_ARGS, td, "after reset");
+
+    // Marking the last tile doesn't spill into the unused bits after it.
+    DP_canvas_diff_check_tile_bounds(td->diff, XTILES - 1, YTILES - 1, XTILES,
+                                     YTILES);
+    expect_rect(td, XTILES - 1, YTILES - 1, XTILES - 1, YTILES - 1, true);
+    each_index_ok(TEST_ARGS, td, true, "last tile");
+
+    test_diff_free(td);
+}
+
+static bool check_multiple_of_seven(DP_UNUSED void *data, int tile_index)
+{
+    return tile_index % 7 == 0;
+}
+
+static bool check_even_words(void *data, int start, int end)
+{
+    TestDiff *td = data;
+    if (start % 32 != 0 || end <= start || end - start > 32
+        || (end - start != 32 && end != td->count)) {
+        td->in_bounds = false;
+    }
+    return start / 32 % 2 == 0;
+}
+
+static void canvas_diff_check(TEST_PARAMS)
+{
+    TestDiff *td = test_diff_new();
+    begin(td, 0, 0, XTILES, YTILES);
+    DP_canvas_diff_each_index_reset(td->diff, see_index, td);
+
+    DP_canvas_diff_check_tile_bounds(td->diff, 0, 0, 1, 0);
+    DP_canvas_diff_check(td->diff, check_multiple_of_seven, td);
+    expect_all(td, false);
+    for (int i = 0; i < COUNT; ++i) {
+        td->expected[i] = i < 2 || i % 7 == 0;
+    }
+    each_index_ok(TEST_ARGS, td, true, "check");
+
+    clear_seen(td);
+    DP_canvas_diff_check_ranges(td->diff, check_even_words,
+                                check_multiple_of_seven, td);
+    OK(td->in_bounds, "check ranges gets word ranges");
+    for (int i = 0; i < COUNT; ++i) {
+        td->expected[i] = i % 7 == 0 && i / 32 % 2 == 0;
+    }
+    each_index_ok(TEST_ARGS, td, true, "check ranges");
+
+    DP_canvas_diff_check_all(td->diff);
+    expect_all(td, true);
+    each_index_ok(TEST_ARGS, td, true, "check all");
+
+    test_diff_free(td);
+}
+
+static void canvas_diff_tile_bounds_reset(TEST_PARAMS)
+{
+    TestDiff *td = test_diff_new();
+    begin(td, 0, 0, XTILES, YTILES);
+
+    // Resets tiles across word and summary group boundaries, including whole
+    // words, leaving everything else around it alone.
+    clear_seen(td);
+    DP_canvas_diff_each_pos_tile_bounds_reset(td->diff, 10, 15, 45, 25,
+                                              see_pos, td);
+    expect_all(td, false);
+    expect_rect(td, 10, 15, 45, 25, true);
+    seen_ok(TEST_ARGS, td, "reset bounds");
+
+    expect_all(td, true);
+    expect_rect(td, 10, 15, 45, 25, false);
+    each_index_ok(TEST_ARGS, td, false, "rest after reset bounds");
+
+    clear_seen(td);
+    DP_canvas_diff_each_pos_tile_bounds_reset(td->diff, 10, 15, 45, 25,
+                                              see_pos, td);
+    expect_all(td, false);
+    seen_ok(TEST_ARGS, td, "reset bounds again");
+
+    // Clamped to the canvas.
+    clear_seen(td);
+    DP_canvas_diff_each_pos_tile_bounds_reset(td->diff, -10, -10, 100, 100,
+                                              see_pos, td);
+    expect_all(td, true);
+    expect_rect(td, 10, 15, 45, 25, false);
+    seen_ok(TEST_ARGS, td, "reset clamped bounds");
+    nothing_changed_ok(TEST_ARGS, td, "after resetting everything");
+
+    // Words emptied by the bounds reset must be picked up again.
+    DP_canvas_diff_check_tile_bounds(td->diff, 20, 20, 20, 20);
+    expect_rect(td, 20, 20, 20, 20, true);
+    each_pos_ok(TEST_ARGS, td, true, "mark after bounds reset");
+
+    test_diff_free(td);
+}
+
+static void canvas_diff_resize(TEST_PARAMS)
+{
+    TestDiff *td = test_diff_new();
+    begin(td, 0, 0, 0, 0);
+    nothing_changed_ok(TEST_ARGS, td, "empty canvas");
+
+    begin(td, 0, 0, 3, 2);
+    expect_all(td, true);
+    each_index_ok(TEST_ARGS, td, true, "small canvas");
+
+    // Growing reallocates, everything is changed.
+    begin(td, 3, 2, XTILES, YTILES);
+    expect_all(td, true);
+    each_index_ok(TEST_ARGS, td, false, "grown canvas");
+
+    // Shrinking keeps the allocation, but must clear out what's beyond the end
+    // of the new size. Marks some tiles at the end first to make sure.
+    DP_canvas_diff_check_tile_bounds(td->diff, 0, YTILES - 1, XTILES - 1,
+                                     YTILES - 1);
+    begin(td, XTILES, YTILES, 40, 20);
+    expect_all(td, true);
+    each_index_ok(TEST_ARGS, td, true, "shrunk canvas");
+
+    // Only changes the width, so all the tile positions shift.
+    begin(td, 40, 20, 33, 20);
+    DP_canvas_diff_each_index_reset(td->diff, see_index, td);
+    DP_canvas_diff_check_tile_bounds(td->diff, 32, 19, 32, 19);
+    expect_all(td, false);
+    expect_rect(td, 32, 19, 32, 19, true);
+    each_pos_ok(TEST_ARGS, td, false, "narrower canvas");
+
+    // Growing within the existing allocation.
+    begin(td, 33, 20, 45, 25);
+    expect_all(td, true);
+    each_pos_ok(TEST_ARGS, td, true, "regrown canvas");
+
+    begin(td, 45, 25, 0, 0);
+    nothing_changed_ok(TEST_ARGS, td, "canvas shrunk to nothing");
+
+    test_diff_free(td);
+}
+
+
+static void register_tests(REGISTER_PARAMS)
+{
+    REGISTER_TEST(canvas_diff_begin_marks_everything);
+    REGISTER_TEST(canvas_diff_tile_bounds);
+    REGISTER_TEST(canvas_diff_check);
+    REGISTER_TEST(canvas_diff_tile_bounds_reset);
+    REGISTER_TEST(canvas_diff_resize);
+}
+
+int main(int argc, char **argv)
+{
+    return DP_test_main(argc, argv, register_tests, NULL);
+}
@@ -0,0 +1,342 @@
+/*
+ * Copyright (c) 2022 askmeaboutloom
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
+#include <dpcommon/cpu.h>
+#include <dpengine/canvas_state.h>
+#include <dpengine/draw_context.h>
+#include <dpengine/flood_fill.h>
+#include <dpengine/image.h>
+#include <dpengine/pixels.h>
+#include <dpmsg/blend_mode.h>
+#include <dpmsg/message.h>
+#include <dpmsg/messages.h>
+#include <dptest_engine.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+
+
+// Picks which color matching kernels get used by going through the same
+// environment variable a user would.
+static void restrict_cpu_support(const char *value)
+{
+#ifdef _WIN32
+    _putenv_s("DP_CPU_SUPPORT", value ? value : "");
+#else
+    if (value) {
+        setenv("DP_CPU_SUPPORT", value, 1);
+    }
+    else {
+        unsetenv("DP_CPU_SUPPORT");
+    }
+#endif
+    DP_cpu_support_init();
+}
+
+// How flood fill compared colors before it had its own kernels.
+static bool expected_match(DP_Pixel15 pixel, DP_UPixelFloat reference,
+                           double tolerance_squared)
+{
+    DP_UPixelFloat color =
+        DP_upixel15_to_float(DP_pixel15_unpremultiply(pixel));
+    double b = color.b - reference.b;
+    double g = color.g - reference.g;
+    double r = color.r - reference.r;
+    double a = color.a - reference.a;
+    return b * b + g * g + r * r + a * a <= tolerance_squared;
+}
+
+static double distance_squared(DP_Pixel15 pixel, DP_UPixelFloat reference)
+{
+    DP_UPixelFloat color =
+        DP_upixel15_to_float(DP_pixel15_unpremultiply(pixel));
+    double b = color.b - reference.b;
+    double g = color.g - reference.g;
+    double r = color.r - reference.r;
+    double a = color.a - reference.a;
+    return b * b + g * g + r * r + a * a;
+}
+
+// Not a multiple of 4 or 8, so the scalar fallback gets some pixels too.
+#define KERNEL_PIXEL_COUNT 43
+
+static void init_kernel_pixels(DP_Pixel15 *pixels)
+{
+    DP_Pixel15 edge_cases[] = {
+        {0, 0, 0, 0},
+        {0, 0, 0, 1},
+        {1, 1, 1, 1},
+        {1, 0, 1, 1},
+        {0, 0, 0, 2},
+        {1, 2, 0, 3},
+        {DP_BIT15, DP_BIT15, DP_BIT15, DP_BIT15},
+        {0, 0, 0, DP_BIT15},
+        {DP_BIT15 - 1, 0, 1, DP_BIT15},
+        {DP_BIT15 - 1, DP_BIT15 - 1, DP_BIT15 - 1, DP_BIT15 - 1},
+        {DP_BIT15 - 2, 1, DP_BIT15 / 2, DP_BIT15 - 1},
+        {12345, 6789, 1011, 16384},
+        {16383, 16384, 0, 16385},
+        {3, 7, 11, 13},
+    };
+    int edge_case_count = (int)DP_ARRAY_LENGTH(edge_cases);
+    for (int i = 0; i < edge_case_count; ++i) {
+        pixels[i] = edge_cases[i];
+    }
+
+    // Fill the rest with valid premultiplied pixels from a simple LCG.
+    uint32_t state = 12345u;
+    for (int i = edge_case_count; i < KERNEL_PIXEL_COUNT; ++i) {
+        uint16_t channels[4];
+        for (int j = 0; j < 4; ++j) {
+            state = state * 1103515245u + 12345u;
+            channels[j] = (uint16_t)((state >> 8) % (DP_BIT15 + 1u));
+        }
+        uint16_t a = channels[3];
+        pixels[i] = (DP_Pixel15){
+            DP_uint_to_uint16(channels[0] * (uint32_t)a / DP_BIT15),
+            DP_uint_to_uint16(channels[1] * (uint32_t)a / DP_BIT15),
+            DP_uint_to_uint16(channels[2] * (uint32_t)a / DP_BIT15),
+            a,
+        };
+    }
+}
+
+static int count_mismatches(TEST_PARAMS, const DP_Pixel15 *pixels,
+                            DP_UPixelFloat reference, double tolerance_squared)
+{
+    unsigned char out[KERNEL_PIXEL_COUNT];
+    DP_pixels15_color_match(out, pixels, KERNEL_PIXEL_COUNT, reference,
+                            tolerance_squared);
+    int mismatches = 0;
+    for (int i = 0; i < KERNEL_PIXEL_COUNT; ++i) {
+        bool expected = expected_match(pixels[i], reference, tolerance_squared);
+        bool single =
+            DP_pixel15_color_match(pixels[i], reference, tolerance_squared);
+        if (out[i] != expected || single != expected) {
+            ++mismatches;
+            DIAG("pixel {%d, %d, %d, %d}, tolerance squared %.17g: expected "
+                 "%d, got %d from the row and %d from the single pixel",
+                 pixels[i].b, pixels[i].g, pixels[i].r, pixels[i].a,
+                 tolerance_squared, expected, out[i], single);
+        }
+    }
+    return mismatches;
+}
+
+static void color_match_kernels(TEST_PARAMS)
+{
+    DP_Pixel15 pixels[KERNEL_PIXEL_COUNT];
+    init_kernel_pixels(pixels);
+
+    const char *kernels[] = {"default", "sse42", "avx2"};
+    for (int k = 0; k < (int)DP_ARRAY_LENGTH(kernels); ++k) {
+        restrict_cpu_support(kernels[k]);
+        int mismatches = 0;
+        // Use every pixel as the reference color and set the tolerance right
+        // at the distance to every other pixel, once exactly on it and once
+        // just below it, which is where rounding differences would show up.
+        for (int i = 0; i < KERNEL_PIXEL_COUNT; ++i) {
+            DP_UPixelFloat reference =
+                DP_upixel15_to_float(DP_pixel15_unpremultiply(pixels[i]));
+            for (int j = 0; j < KERNEL_PIXEL_COUNT; ++j) {
+                double d = distance_squared(pixels[j], reference);
+                mismatches += count_mismatches(TEST_ARGS, pixels, reference, d);
+                mismatches += count_mismatches(TEST_ARGS, pixels, reference,
+                                               nextafter(d, 0.0));
+            }
+        }
+        INT_EQ_OK(mismatches, 0, "%s kernel matches like the original",
+                  kernels[k]);
+    }
+    restrict_cpu_support(NULL);
+}
+
+
+// A 100x80 canvas is 2x2 tiles, cut off at the right and bottom.
+#define WIDTH  100
+#define HEIGHT 80
+
+#define WHITE     0xffffffffu
+#define NEARWHITE 0xfffefefeu
+#define BLACK     0xff000000u
+
+static DP_CanvasState *handle(TEST_PARAMS, DP_CanvasState *cs,
+                              DP_DrawContext *dc, DP_Message *msg)
+{
+    DP_CanvasState *next = DP_canvas_state_handle(cs, dc, msg).cs;
+    FATAL(NOT_NULL_OK(next, "handled %s",
+                      DP_message_type_enum_name(DP_message_type(msg))));
+    DP_message_decref(msg);
+    DP_canvas_state_decref(cs);
+    return next;
+}
+
+static DP_CanvasState *fill_rect(TEST_PARAMS, DP_CanvasState *cs,
+                                 DP_DrawContext *dc, int x, int y, int w,
+                                 int h, uint32_t color)
+{
+    return handle(TEST_ARGS, cs, dc,
+                  DP_msg_fill_rect_new(
+                      1, 1, DP_BLEND_MODE_NORMAL, DP_int_to_uint32(x),
+                      DP_int_to_uint32(y), DP_int_to_uint32(w),
+                      DP_int_to_uint32(h), color));
+}
+
+// A white canvas with a black wall from top to bottom, left of which is a
+// slightly off-white square.
+static DP_CanvasState *new_walled_canvas(TEST_PARAMS, DP_DrawContext *dc,
+                                         int width, int height, int wall_x)
+{
+    DP_CanvasState *cs =
+        handle(TEST_ARGS, DP_canvas_state_new(), dc,
+               DP_msg_canvas_resize_new(1, 0, width, height, 0));
+    cs = handle(TEST_ARGS, cs, dc,
+                DP_msg_layer_tree_create_new(1, 1, 0, 0, 0, 0, "", 0));
+    cs = fill_rect(TEST_ARGS, cs, dc, 0, 0, width, height, WHITE);
+    cs = fill_rect(TEST_ARGS, cs, dc, wall_x, 0, 2, height, BLACK);
+    return fill_rect(TEST_ARGS, cs, dc, 10, 10, 10, 10, NEARWHITE);
+}
+
+static DP_Image *flood_fill_ok(TEST_PARAMS, DP_CanvasState *cs,
+                               double tolerance, int expand, int feather_radius,
+                               int *out_x, int *out_y)
+{
+    DP_UPixelFloat red = {0.0f, 0.0f, 1.0f, 1.0f};
+    DP_Image *img = NULL;
+    DP_FloodFillResult result =
+        DP_flood_fill(cs, 0, 0, red, tolerance, 1, false, INT_MAX, expand,
+                      feather_radius, &img, out_x, out_y);
+    FATAL(INT_EQ_OK(result, DP_FLOOD_FILL_SUCCESS, "flood fill succeeds"));
+    return img;
+}
+
+static DP_Image *expected_mask(int width, int height, bool fill_square)
+{
+    DP_Pixel8 red = {0};
+    red.r = 255;
+    red.a = 255;
+    DP_Image *img = DP_image_new(width, height);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            bool in_square = x >= 10 && x < 20 && y >= 10 && y < 20;
+            if (fill_square || !in_square) {
+                DP_image_pixel_at_set(img, x, y, red);
+            }
+        }
+    }
+    return img;
+}
+
+static void flood_fill_known_mask(TEST_PARAMS)
+{
+    DP_DrawContext *dc = DP_draw_context_new();
+    DP_CanvasState *cs = new_walled_canvas(TEST_ARGS, dc, WIDTH, HEIGHT, 40);
+
+    // The off-white square is about 0.0068 away from white.
+    int x, y;
+    DP_Image *img = flood_fill_ok(TEST_ARGS, cs, 0.005, 0, 0, &x, &y);
+    INT_EQ_OK(x, 0, "strict fill x");
+    INT_EQ_OK(y, 0, "strict fill y");
+    DP_Image *expected = expected_mask(40, HEIGHT, false);
+    IMAGE_EQ_OK(img, expected, "strict fill leaves out the square");
+    DP_image_free(expected);
+    DP_image_free(img);
+
+    img = flood_fill_ok(TEST_ARGS, cs, 0.01, 0, 0, &x, &y);
+    expected = expected_mask(40, HEIGHT, true);
+    IMAGE_EQ_OK(img, expected, "tolerant fill includes the square");
+    DP_image_free(expected);
+    DP_image_free(img);
+
+    // Expanding grows the mask into the wall, but not past the canvas.
+    img = flood_fill_ok(TEST_ARGS, cs, 0.01, 2, 0, &x, &y);
+    INT_EQ_OK(x, 0, "expanded fill x");
+    INT_EQ_OK(y, 0, "expanded fill y");
+    expected = expected_mask(42, HEIGHT, true);
+    IMAGE_EQ_OK(img, expected, "expanded fill covers the wall");
+    DP_image_free(expected);
+    DP_image_free(img);
+
+    DP_canvas_state_decref(cs);
+    DP_draw_context_free(dc);
+}
+
+static void flood_fill_feathered_bands(TEST_PARAMS)
+{
+    // Big enough that the mask gets processed in bands on multiple threads.
+    int width = 600;
+    int height = 400;
+    DP_DrawContext *dc = DP_draw_context_new();
+    DP_CanvasState *cs = new_walled_canvas(TEST_ARGS, dc, width, height, 300);
+
+    int feather_radius = 4;
+    int x, y;
+    DP_Image *img =
+        flood_fill_ok(TEST_ARGS, cs, 0.01, 3, feather_radius, &x, &y);
+    INT_EQ_OK(x, -feather_radius, "feathered fill x");
+    INT_EQ_OK(y, -feather_radius, "feathered fill y");
+    INT_EQ_OK(DP_image_width(img), 303 + feather_radius * 2,
+              "feathered fill width");
+    INT_EQ_OK(DP_image_height(img), height + feather_radius * 2,
+              "feathered fill height");
+
+    // The wall goes from top to bottom, so away from the top and bottom edges
+    // every row of the mask must come out the same, no matter which band of
+    // rows it ended up in.
+    int img_width = DP_image_width(img);
+    size_t row_size = DP_int_to_size(img_width) * sizeof(DP_Pixel8);
+    const DP_Pixel8 *middle =
+        DP_image_pixels(img) + (DP_image_height(img) / 2) * img_width;
+    int differing_rows = 0;
+    for (int row = feather_radius * 2; row < height; ++row) {
+        if (memcmp(DP_image_pixels(img) + row * img_width, middle, row_size)
+            != 0) {
+            ++differing_rows;
+        }
+    }
+    INT_EQ_OK(differing_rows, 0, "feathered rows are identical");
+    UINT_EQ_OK(middle[feather_radius * 2].a, 255u,
+               "feathered fill is opaque inside");
+    OK(middle[img_width - 1].a < middle[img_width - feather_radius].a,
+       "feathered fill fades out");
+    OK(middle[img_width - feather_radius * 2].a > 0
+           && middle[img_width - feather_radius * 2].a < 255,
+       "feathered fill edge is translucent");
+
+    DP_image_free(img);
+    DP_canvas_state_decref(cs);
+    DP_draw_context_free(dc);
+}
+
+
+static void register_tests(REGISTER_PARAMS)
+{
+    REGISTER_TEST(color_match_kernels);
+    REGISTER_TEST(flood_fill_known_mask);
+    REGISTER_TEST(flood_fill_feathered_bands);
+}
+
+int main(int argc, char **argv)
+{
+    return DP_test_main(argc, argv, register_tests, NULL);
+}
@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) 2022 askmeaboutloom
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
+#include <dpengine/canvas_state.h>
+#include <dpengine/draw_context.h>
+#include <dpengine/image.h>
+#include <dpengine/layer_group.h>
+#include <dpmsg/blend_mode.h>
+#include <dpmsg/message.h>
+#include <dpmsg/messages.h>
+#include <dptest_engine.h>
+
+
+// A 256x192 canvas is 4x3 tiles.
+#define WIDTH      256
+#define HEIGHT     192
+#define TILE_COUNT 12
+
+#define RED    0xffff0000u
+#define GREEN  0xff00ff00u
+#define BLUE   0xff0000ffu
+#define YELLOW 0xffffff00u
+
+static DP_CanvasState *handle(TEST_PARAMS, DP_CanvasState *cs,
+                              DP_DrawContext *dc, DP_Message *msg)
+{
+    DP_CanvasState *next = DP_canvas_state_handle(cs, dc, msg).cs;
+    FATAL(NOT_NULL_OK(next, "handled %s",
+                      DP_message_type_enum_name(DP_message_type(msg))));
+    DP_message_decref(msg);
+    DP_canvas_state_decref(cs);
+    return next;
+}
+
+static DP_CanvasState *new_canvas(TEST_PARAMS, DP_DrawContext *dc)
+{
+    return handle(TEST_ARGS, DP_canvas_state_new(), dc,
+                  DP_msg_canvas_resize_new(1, 0, WIDTH, HEIGHT, 0));
+}
+
+static DP_CanvasState *create_isolated_group(TEST_PARAMS, DP_CanvasState *cs,
+                                             DP_DrawContext *dc, int id)
+{
+    uint16_t layer_id = DP_int_to_uint16(id);
+    cs = handle(TEST_ARGS, cs, dc,
+                DP_msg_layer_tree_create_new(
+                    1, layer_id, 0, 0, 0, DP_MSG_LAYER_TREE_CREATE_FLAGS_GROUP,
+                    "", 0));
+    return handle(TEST_ARGS, cs, dc,
+                  DP_msg_layer_attributes_new(
+                      1, layer_id, 0, DP_MSG_LAYER_ATTRIBUTES_FLAGS_ISOLATED,
+                      255, DP_BLEND_MODE_NORMAL));
+}
+
+static DP_CanvasState *create_layer_in(TEST_PARAMS, DP_CanvasState *cs,
+                                       DP_DrawContext *dc, int id,
+                                       int group_id)
+{
+    return handle(TEST_ARGS, cs, dc,
+                  DP_msg_layer_tree_create_new(
+                      1, DP_int_to_uint16(id), 0, DP_int_to_uint16(group_id),
+                      0, DP_MSG_LAYER_TREE_CREATE_FLAGS_INTO, "", 0));
+}
+
+static DP_CanvasState *fill_rect(TEST_PARAMS, DP_CanvasState *cs,
+                                 DP_DrawContext *dc, int layer_id, int x, int y,
+                                 int w, int h, uint32_t color)
+{
+    return handle(TEST_ARGS, cs, dc,
+                  DP_msg_fill_rect_new(
+                      1, DP_int_to_uint16(layer_id), DP_BLEND_MODE_NORMAL,
+                      DP_int_to_uint32(x), DP_int_to_uint32(y),
+                      DP_int_to_uint32(w), DP_int_to_uint32(h), color));
+}
+
+static DP_Image *flatten(DP_CanvasState *cs)
+{
+    return DP_canvas_state_to_flat_image(cs, DP_FLAT_IMAGE_RENDER_FLAGS, NULL,
+                                         NULL);
+}
+
+static void pixel_ok(TEST_PARAMS, DP_Image *img, int x, int y, uint32_t color,
+                     const char *title)
+{
+    UINT_EQ_OK(DP_image_pixel_at(img, x, y).color, color, "%s at %d, %d",
+               title, x, y);
+}
+
+static void stats_ok(TEST_PARAMS, DP_LayerGroupCacheStats baseline, int tiles,
+                     int groups, int hits, const char *title)
+{
+    DP_LayerGroupCacheStats stats = DP_layer_group_cache_stats();
+    INT_EQ_OK(stats.tiles - baseline.tiles, tiles, "%s: cached tiles", title);
+    INT_EQ_OK(stats.groups - baseline.groups, groups, "%s: cached groups",
+              title);
+    INT_EQ_OK(stats.hits - baseline.hits, hits, "%s: cache hits", title);
+}
+
+static void flatten_eq_ok(TEST_PARAMS, DP_CanvasState *cs, DP_Image *expected,
+                          const char *title)
+{
+    DP_Image *img = flatten(cs);
+    IMAGE_EQ_OK(img, expected, "%s: flattened image matches", title);
+    DP_image_free(img);
+}
+
+
+static void cache_hits_and_invalidation(TEST_PARAMS)
+{
+    DP_DrawContext *dc = DP_draw_context_new();
+    DP_LayerGroupCacheStats baseline = DP_layer_group_cache_stats();
+
+    // Group 0x100 covers the left half of the canvas, 6 tiles. Group 0x200 is
+    // above it and only covers the bottom-right tile.
+    DP_CanvasState *cs = new_canvas(TEST_ARGS, dc);
+    cs = create_isolated_group(TEST_ARGS, cs, dc, 0x100);
+    cs = create_layer_in(TEST_ARGS, cs, dc, 0x101, 0x100);
+    cs = create_layer_in(TEST_ARGS, cs, dc, 0x102, 0x100);
+    cs = fill_rect(TEST_ARGS, cs, dc, 0x101, 0, 0, 128, HEIGHT, BLUE);
+    cs = fill_rect(TEST_ARGS, cs, dc, 0x102, 0, 0, 32, 32, RED);
+    cs = create_isolated_group(TEST_ARGS, cs, dc, 0x200);
+    cs = create_layer_in(TEST_ARGS, cs, dc, 0x201, 0x200);
+    cs = fill_rect(TEST_ARGS, cs, dc, 0x201, 192, 128, 64, 64, GREEN);
+    stats_ok(TEST_ARGS, baseline, 0, 0, 0, "before flattening");
+
+    // Tiles only get cached once they've been flattened a second time.
+    DP_Image *expected = flatten(cs);
+    pixel_ok(TEST_ARGS, expected, 10, 10, RED, "first group's top layer");
+    pixel_ok(TEST_ARGS, expected, 100, 100, BLUE, "first group's bottom layer");
+    pixel_ok(TEST_ARGS, expected, 200, 150, GREEN, "second group");
+    pixel_ok(TEST_ARGS, expected, 150, 10, 0, "outside of groups");
+    stats_ok(TEST_ARGS, baseline, 0, 0, 0, "first flatten");
+
+    flatten_eq_ok(TEST_ARGS, cs, expected, "second flatten");
+    stats_ok(TEST_ARGS, baseline, 7, 2, 0, "second flatten");
+
+    flatten_eq_ok(TEST_ARGS, cs, expected, "third flatten");
+    stats_ok(TEST_ARGS, baseline, 7, 2, TILE_COUNT * 2, "third flatten");
+
+    // Drawing in the first group replaces it. The replaced group keeps its
+    // cache for as long as it's around, but the new one starts out empty. The
+    // second group is untouched and keeps using its own.
+    DP_CanvasState *prev_cs = DP_canvas_state_incref(cs);
+    cs = fill_rect(TEST_ARGS, cs, dc, 0x102, 70, 70, 20, 20, YELLOW);
+    stats_ok(TEST_ARGS, baseline, 7, 2, TILE_COUNT * 2, "after change");
+
+    DP_Image *changed = flatten(cs);
+    pixel_ok(TEST_ARGS, changed, 75, 75, YELLOW, "changed tile");
+    pixel_ok(TEST_ARGS, changed, 10, 10, RED, "unchanged tile");
+    pixel_ok(TEST_ARGS, changed, 200, 150, GREEN, "second group after change");
+    stats_ok(TEST_ARGS, baseline, 7, 2, TILE_COUNT * 3,
+             "first flatten after change");
+
+    flatten_eq_ok(TEST_ARGS, cs, changed, "second flatten after change");
+    flatten_eq_ok(TEST_ARGS, cs, changed, "third flatten after change");
+    stats_ok(TEST_ARGS, baseline, 13, 3, TILE_COUNT * 6,
+             "third flatten after change");
+
+    // The replaced group is still around, e.g. in the undo history, and still
+    // flattens to what it was from its cache.
+    flatten_eq_ok(TEST_ARGS, prev_cs, expected, "previous state");
+    stats_ok(TEST_ARGS, baseline, 13, 3, TILE_COUNT * 8, "previous state");
+    DP_canvas_state_decref(prev_cs);
+
+    DP_canvas_state_decref(cs);
+    stats_ok(TEST_ARGS, baseline, 0, 0, TILE_COUNT * 8, "after freeing");
+
+    DP_image_free(changed);
+    DP_image_free(expected);
+    DP_draw_context_free(dc);
+}
+
+static void cache_props_change(TEST_PARAMS)
+{
+    DP_DrawContext *dc = DP_draw_context_new();
+    DP_LayerGroupCacheStats baseline = DP_layer_group_cache_stats();
+
+    DP_CanvasState *cs = new_canvas(TEST_ARGS, dc);
+    cs = create_isolated_group(TEST_ARGS, cs, dc, 0x100);
+    cs = create_layer_in(TEST_ARGS, cs, dc, 0x101, 0x100);
+    cs = create_layer_in(TEST_ARGS, cs, dc, 0x102, 0x100);
+    cs = fill_rect(TEST_ARGS, cs, dc, 0x101, 0, 0, WIDTH, HEIGHT, BLUE);
+    cs = fill_rect(TEST_ARGS, cs, dc, 0x102, 0, 0, 32, 32, RED);
+    DP_Image *expected = flatten(cs);
+    flatten_eq_ok(TEST_ARGS, cs, expected, "second flatten");
+    stats_ok(TEST_ARGS, baseline, TILE_COUNT, 1, 0, "second flatten");
+
+    // Making a layer in the group transparent only changes the props, the
+    // group itself stays the same. Its cache has to start over regardless.
+    cs = handle(TEST_ARGS, cs, dc,
+                DP_msg_layer_attributes_new(1, 0x102, 0, 0, 0,
+                                            DP_BLEND_MODE_NORMAL));
+    DP_Image *changed = flatten(cs);
+    pixel_ok(TEST_ARGS, changed, 10, 10, BLUE, "transparent layer");
+    stats_ok(TEST_ARGS, baseline, 0, 0, 0, "first flatten after change");
+
+    // The first tile is the one that started the cache over, so it only gets
+    // cached one flatten after all the others.
+    flatten_eq_ok(TEST_ARGS, cs, changed, "second flatten after change");
+    stats_ok(TEST_ARGS, baseline, TILE_COUNT - 1, 1, 0,
+             "second flatten after change");
+    flatten_eq_ok(TEST_ARGS, cs, changed, "third flatten after change");
+    stats_ok(TEST_ARGS, baseline, TILE_COUNT, 1, TILE_COUNT - 1,
+             "third flatten after change");
+
+    DP_canvas_state_decref(cs);
+    stats_ok(TEST_ARGS, baseline, 0, 0, TILE_COUNT - 1, "after freeing");
+
+    DP_image_free(changed);
+    DP_image_free(expected);
+    DP_draw_context_free(dc);
+}
+
+static DP_CanvasState *new_filled_group_canvas(TEST_PARAMS, DP_DrawContext *dc,
+                                               uint32_t color)
+{
+    DP_CanvasState *cs = new_canvas(TEST_ARGS, dc);
+    cs = create_isolated_group(TEST_ARGS, cs, dc, 0x100);
+    cs = create_layer_in(TEST_ARGS, cs, dc, 0x101, 0x100);
+    return fill_rect(TEST_ARGS, cs, dc, 0x101, 0, 0, WIDTH, HEIGHT, color);
+}
+
+static void cache_limit(TEST_PARAMS)
+{
+    DP_DrawContext *dc = DP_draw_context_new();
+    DP_LayerGroupCacheStats baseline = DP_layer_group_cache_stats();
+    DP_layer_group_cache_limit_set(10);
+
+    // A group that doesn't fit gets cached up to the limit.
+    DP_CanvasState *cs_a = new_filled_group_canvas(TEST_ARGS, dc, RED);
+    DP_Image *expected_a = flatten(cs_a);
+    flatten_eq_ok(TEST_ARGS, cs_a, expected_a, "second flatten of first group");
+    stats_ok(TEST_ARGS, baseline, 10, 1, 0, "second flatten of first group");
+    flatten_eq_ok(TEST_ARGS, cs_a, expected_a, "third flatten of first group");
+    stats_ok(TEST_ARGS, baseline, 10, 1, 10, "third flatten of first group");
+
+    // The first group is still alive, as if it was held by the undo history,
+    // but another group that's in use now gets to take its place.
+    DP_CanvasState *cs_b = new_filled_group_canvas(TEST_ARGS, dc, GREEN);
+    DP_Image *expected_b = flatten(cs_b);
+    stats_ok(TEST_ARGS, baseline, 10, 1, 10, "first flatten of second group");
+    flatten_eq_ok(TEST_ARGS, cs_b, expected_b,
+                  "second flatten of second group");
+    stats_ok(TEST_ARGS, baseline, 10, 1, 10, "second flatten of second group");
+    flatten_eq_ok(TEST_ARGS, cs_b, expected_b, "third flatten of second group");
+    stats_ok(TEST_ARGS, baseline, 10, 1, 20, "third flatten of second group");
+
+    // The first group lost its cached tiles, but still flattens correctly.
+    flatten_eq_ok(TEST_ARGS, cs_a, expected_a, "first group after eviction");
+    stats_ok(TEST_ARGS, baseline, 10, 1, 20, "first group after eviction");
+
+    DP_canvas_state_decref(cs_b);
+    DP_canvas_state_decref(cs_a);
+    stats_ok(TEST_ARGS, baseline, 0, 0, 20, "after freeing");
+
+    DP_layer_group_cache_limit_set(2048);
+    DP_image_free(expected_b);
+    DP_image_free(expected_a);
+    DP_draw_context_free(dc);
+}
+
+
+static void register_tests(REGISTER_PARAMS)
+{
+    REGISTER_TEST(cache_hits_and_invalidation);
+    REGISTER_TEST(cache_props_change);
+    REGISTER_TEST(cache_limit);
+}
+
+int main(int argc, char **argv)
+{
+    return DP_test_main(argc, argv, register_tests, NULL);
+}
@@ -0,0 +1,456 @@
+/*
+ * Copyright (c) 2022 askmeaboutloom
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
+#include <dpcommon/threading.h>
+#include <dpengine/canvas_state.h>
+#include <dpengine/draw_context.h>
+#include <dpengine/image.h>
+#include <dpengine/paint_engine.h>
+#include <dpengine/pixels.h>
+#include <dpengine/tile.h>
+#include <dpmsg/acl.h>
+#include <dpmsg/blend_mode.h>
+#include <dpmsg/message.h>
+#include <dpmsg/messages.h>
+#include <dpmsg/msg_internal.h>
+#include <dptest_engine.h>
+#include <string.h>
+
+
+typedef struct TestPaintEngine {
+    DP_DrawContext *main_dc;
+    DP_DrawContext *paint_dc;
+    DP_AclState *acls;
+    DP_Semaphore *sem;
+    DP_PaintEngine *pe;
+    DP_Image *img;
+    // Render threads only touch the entries for their own tiles.
+    bool rendered[16][16];
+} TestPaintEngine;
+
+static void playback_done(void *user, DP_UNUSED long long position)
+{
+    TestPaintEngine *tpe = user;
+    DP_SEMAPHORE_MUST_POST(tpe->sem);
+}
+
+static void test_paint_engine_init(TestPaintEngine *tpe)
+{
+    tpe->main_dc = DP_draw_context_new();
+    tpe->paint_dc = DP_draw_context_new();
+    tpe->acls = DP_acl_state_new();
+    tpe->sem = DP_semaphore_new(0);
+    tpe->pe = DP_paint_engine_new_inc(
+        tpe->main_dc, tpe->paint_dc, tpe->acls, NULL, NULL, NULL, false, NULL,
+        NULL, NULL, NULL, playback_done, NULL, tpe);
+    tpe->img = NULL;
+    memset(tpe->rendered, 0, sizeof(tpe->rendered));
+}
+
+static void test_paint_engine_dispose(TestPaintEngine *tpe)
+{
+    DP_paint_engine_free_join(tpe->pe);
+    DP_image_free(tpe->img);
+    DP_semaphore_free(tpe->sem);
+    DP_acl_state_free(tpe->acls);
+    DP_draw_context_free(tpe->paint_dc);
+    DP_draw_context_free(tpe->main_dc);
+}
+
+
+static void acls_changed(DP_UNUSED void *user, DP_UNUSED int flags)
+{
+    // Nothing to do.
+}
+
+static void laser_trail(DP_UNUSED void *user, DP_UNUSED unsigned int context_id,
+                        DP_UNUSED int persistence, DP_UNUSED uint32_t color)
+{
+    // Nothing to do.
+}
+
+static void move_pointer(DP_UNUSED void *user,
+                         DP_UNUSED unsigned int context_id, DP_UNUSED int x,
+                         DP_UNUSED int y)
+{
+    // Nothing to do.
+}
+
+// Pushes the given messages and takes ownership of them. Doesn't wait for
+// them to be handled by the paint engine.
+static void push_messages_local(TestPaintEngine *tpe, bool local, int count,
+                                DP_Message **msgs)
+{
+    DP_paint_engine_handle_inc(tpe->pe, local, true, count, msgs, acls_changed,
+                               laser_trail, move_pointer, tpe);
+    for (int i = 0; i < count; ++i) {
+        DP_message_decref(msgs[i]);
+    }
+}
+
+static void push_messages(TestPaintEngine *tpe, int count, DP_Message **msgs)
+{
+    push_messages_local(tpe, false, count, msgs);
+}
+
+// Pushes the given messages and waits until the paint engine handled them.
+static void handle_messages(TestPaintEngine *tpe, int count, DP_Message **msgs)
+{
+    push_messages(tpe, count, msgs);
+    DP_Message *msg = DP_msg_internal_playback_new(0, 0);
+    push_messages(tpe, 1, &msg);
+    DP_SEMAPHORE_MUST_WAIT(tpe->sem);
+}
+
+
+static void catchup(DP_UNUSED void *user, DP_UNUSED int progress)
+{
+    // Nothing to do.
+}
+
+static void recorder_state_changed(DP_UNUSED void *user, DP_UNUSED bool started)
+{
+    // Nothing to do.
+}
+
+static void resized(DP_UNUSED void *user, DP_UNUSED int offset_x,
+                    DP_UNUSED int offset_y, DP_UNUSED int prev_width,
+                    DP_UNUSED int prev_height)
+{
+    // Nothing to do.
+}
+
+static void tile_changed(DP_UNUSED void *user, DP_UNUSED int x,
+                         DP_UNUSED int y)
+{
+    // Nothing to do.
+}
+
+static void layer_props_changed(DP_UNUSED void *user,
+                                DP_UNUSED DP_LayerPropsList *lpl)
+{
+    // Nothing to do.
+}
+
+static void annotations_changed(DP_UNUSED void *user,
+                                DP_UNUSED DP_AnnotationList *al)
+{
+    // Nothing to do.
+}
+
+static void document_metadata_changed(DP_UNUSED void *user,
+                                      DP_UNUSED DP_DocumentMetadata *dm)
+{
+    // Nothing to do.
+}
+
+static void timeline_changed(DP_UNUSED void *user, DP_UNUSED DP_Timeline *tl)
+{
+    // Nothing to do.
+}
+
+static void cursor_moved(DP_UNUSED void *user,
+                         DP_UNUSED unsigned int context_id,
+                         DP_UNUSED int layer_id, DP_UNUSED int x,
+                         DP_UNUSED int y)
+{
+    // Nothing to do.
+}
+
+static void default_layer_set(DP_UNUSED void *user, DP_UNUSED int layer_id)
+{
+    // Nothing to do.
+}
+
+static void undo_depth_limit_set(DP_UNUSED void *user,
+                                 DP_UNUSED int undo_depth_limit)
+{
+    // Nothing to do.
+}
+
+static void render_size(void *user, int width, int height)
+{
+    TestPaintEngine *tpe = user;
+    if (!tpe->img || DP_image_width(tpe->img) != width
+        || DP_image_height(tpe->img) != height) {
+        DP_image_free(tpe->img);
+        tpe->img = DP_image_new(width, height);
+    }
+}
+
+static void render_tile(void *user, int x, int y, DP_Pixel8 *pixels,
+                        DP_UNUSED int thread_index)
+{
+    TestPaintEngine *tpe = user;
+    if (x < 16 && y < 16) {
+        tpe->rendered[y][x] = true;
+    }
+    int width = DP_image_width(tpe->img);
+    int height = DP_image_height(tpe->img);
+    int left = x * DP_TILE_SIZE;
+    int top = y * DP_TILE_SIZE;
+    int right = DP_min_int(left + DP_TILE_SIZE, width);
+    int bottom = DP_min_int(top + DP_TILE_SIZE, height);
+    DP_Pixel8 *dst = DP_image_pixels(tpe->img);
+    for (int py = top; py < bottom; ++py) {
+        for (int px = left; px < right; ++px) {
+            dst[py * width + px] =
+                pixels[(py - top) * DP_TILE_SIZE + (px - left)];
+        }
+    }
+}
+
+static void tick(TestPaintEngine *tpe)
+{
+    DP_paint_engine_tick(tpe->pe, catchup, recorder_state_changed, resized,
+                         tile_changed, layer_props_changed, annotations_changed,
+                         document_metadata_changed, timeline_changed,
+                         cursor_moved, default_layer_set, undo_depth_limit_set,
+                         tpe);
+}
+
+// Ticks the paint engine and renders the changed tiles into the test image.
+static void render_changes(TestPaintEngine *tpe)
+{
+    tick(tpe);
+    DP_paint_engine_prepare_render(tpe->pe, render_size, tpe);
+    DP_paint_engine_render_everything(tpe->pe, render_tile, tpe);
+}
+
+// Renders whatever is pending, then checks that exactly the tiles in the
+// given bounds got rendered and clears them for the next round.
+static void check_rendered(TEST_PARAMS, TestPaintEngine *tpe, int left,
+                           int top, int right, int bottom, const char *title)
+{
+    DP_paint_engine_render_everything(tpe->pe, render_tile, tpe);
+    int wrong = 0;
+    for (int y = 0; y < 16; ++y) {
+        for (int x = 0; x < 16; ++x) {
+            bool expected = x >= left && x <= right && y >= top && y <= bottom;
+            if (tpe->rendered[y][x] != expected) {
+                DIAG("Tile %d, %d %s", x, y,
+                     expected ? "not rendered" : "rendered unexpectedly");
+                ++wrong;
+            }
+            tpe->rendered[y][x] = false;
+        }
+    }
+    OK(wrong == 0, "%s", title);
+}
+
+static DP_Image *flatten_view(TestPaintEngine *tpe)
+{
+    DP_CanvasState *cs = DP_paint_engine_view_canvas_state_inc(tpe->pe);
+    DP_Image *img = DP_canvas_state_to_flat_image(
+        cs, DP_FLAT_IMAGE_RENDER_FLAGS, NULL, NULL);
+    DP_canvas_state_decref(cs);
+    return img;
+}
+
+#define RENDER_EQ_OK(TPE, ...)                          \
+    do {                                                \
+        render_changes(TPE);                            \
+        DP_Image *_expected = flatten_view(TPE);        \
+        IMAGE_EQ_OK((TPE)->img, _expected, __VA_ARGS__); \
+        DP_image_free(_expected);                       \
+    } while (0)
+
+static DP_Message *fill_rect(int layer_id, int x, int y, int size,
+                             uint32_t color, int blend_mode)
+{
+    return DP_msg_fill_rect_new(
+        1, DP_int_to_uint16(layer_id), DP_int_to_uint8(blend_mode),
+        DP_int_to_uint32(x), DP_int_to_uint32(y), DP_int_to_uint32(size),
+        DP_int_to_uint32(size), color);
+}
+
+static DP_Message *create_layer(int layer_id, uint32_t fill)
+{
+    return DP_msg_layer_create_new(1, DP_int_to_uint16(layer_id), 0, fill, 0,
+                                   "", 0);
+}
+
+static void init_layered_canvas(TestPaintEngine *tpe)
+{
+    DP_Message *msgs[] = {
+        DP_msg_canvas_resize_new(1, 0, 200, 200, 0),
+        // Opaque bottom layer, so there's no checkerboard in the render.
+        create_layer(0x101, 0xffffffffu),
+        create_layer(0x102, 0),
+        create_layer(0x103, 0),
+        create_layer(0x104, 0),
+        fill_rect(0x102, 10, 10, 120, 0x80ff0000u, DP_BLEND_MODE_NORMAL),
+        fill_rect(0x103, 50, 50, 120, 0xc000ff00u, DP_BLEND_MODE_NORMAL),
+        fill_rect(0x104, 30, 90, 100, 0xff8080ffu, DP_BLEND_MODE_NORMAL),
+    };
+    handle_messages(tpe, DP_size_to_int(DP_ARRAY_LENGTH(msgs)), msgs);
+}
+
+
+static void render_below_cache(TEST_PARAMS)
+{
+    TestPaintEngine tpe;
+    test_paint_engine_init(&tpe);
+    init_layered_canvas(&tpe);
+    RENDER_EQ_OK(&tpe, "initial render matches flattened canvas");
+
+    // Repeatedly drawing on the same layer moves the cache split up to it.
+    for (int i = 0; i < 4; ++i) {
+        DP_Message *msg = fill_rect(0x103, 20 + i * 30, 40, 50,
+                                    0x600000ffu, DP_BLEND_MODE_NORMAL);
+        handle_messages(&tpe, 1, &msg);
+        RENDER_EQ_OK(&tpe, "render %d on middle layer matches", i);
+    }
+
+    DP_Message *below_msg =
+        fill_rect(0x102, 0, 100, 90, 0xff00ffffu, DP_BLEND_MODE_MULTIPLY);
+    handle_messages(&tpe, 1, &below_msg);
+    RENDER_EQ_OK(&tpe, "render after change below the cached layers matches");
+
+    DP_Message *props_msg =
+        DP_msg_layer_attributes_new(1, 0x102, 0, 0, 100, DP_BLEND_MODE_SCREEN);
+    handle_messages(&tpe, 1, &props_msg);
+    RENDER_EQ_OK(&tpe, "render after changing props of a cached layer matches");
+
+    for (int i = 0; i < 3; ++i) {
+        DP_Message *msg = fill_rect(0x104, 130 - i * 40, 10 + i * 50, 60,
+                                    0x90ffff00u, DP_BLEND_MODE_NORMAL);
+        handle_messages(&tpe, 1, &msg);
+        RENDER_EQ_OK(&tpe, "render %d on top layer matches", i);
+    }
+
+    DP_Message *delete_msg = DP_msg_layer_delete_new(1, 0x103, false);
+    handle_messages(&tpe, 1, &delete_msg);
+    RENDER_EQ_OK(&tpe, "render after deleting a layer matches");
+
+    test_paint_engine_dispose(&tpe);
+}
+
+
+static void invalidate_tile_bounds(TEST_PARAMS)
+{
+    TestPaintEngine tpe;
+    test_paint_engine_init(&tpe);
+    init_layered_canvas(&tpe);
+    render_changes(&tpe);
+    memset(tpe.rendered, 0, sizeof(tpe.rendered));
+
+    // The canvas is 200x200 pixels, so it's 4x4 tiles.
+    check_rendered(TEST_ARGS, &tpe, 0, 0, -1, -1, "nothing rendered initially");
+
+    DP_paint_engine_invalidate_tile_bounds(tpe.pe, 1, 1, 2, 2);
+    check_rendered(TEST_ARGS, &tpe, 1, 1, 2, 2, "invalidated tiles rendered");
+
+    DP_paint_engine_invalidate_tile_bounds(tpe.pe, -3, -3, 0, 0);
+    check_rendered(TEST_ARGS, &tpe, 0, 0, 0, 0, "clamped to the top-left");
+
+    DP_paint_engine_invalidate_tile_bounds(tpe.pe, 3, 2, 50, 50);
+    check_rendered(TEST_ARGS, &tpe, 3, 2, 3, 3, "clamped to the bottom-right");
+
+    DP_paint_engine_invalidate_tile_bounds(tpe.pe, 10, 10, 20, 20);
+    check_rendered(TEST_ARGS, &tpe, 0, 0, -1, -1, "outside of canvas ignored");
+
+    // Invalidated tiles stay pending alongside actual changes.
+    DP_paint_engine_invalidate_tile_bounds(tpe.pe, 0, 0, 1, 0);
+    DP_Message *msg =
+        fill_rect(0x104, 140, 10, 20, 0xff00ff00u, DP_BLEND_MODE_NORMAL);
+    handle_messages(&tpe, 1, &msg);
+    tick(&tpe);
+    check_rendered(TEST_ARGS, &tpe, 0, 0, 2, 0, "invalidated and changed");
+
+    // Rendering only part of the invalidated area leaves the rest pending.
+    DP_paint_engine_invalidate_tile_bounds(tpe.pe, 0, 0, 3, 3);
+    DP_paint_engine_render_tile_bounds(tpe.pe, 0, 0, 1, 3, render_tile, &tpe);
+    memset(tpe.rendered, 0, sizeof(tpe.rendered));
+    check_rendered(TEST_ARGS, &tpe, 2, 0, 3, 3, "rest rendered afterwards");
+
+    RENDER_EQ_OK(&tpe, "render still matches flattened canvas");
+    test_paint_engine_dispose(&tpe);
+}
+
+static void set_big_dabs(int count, DP_ClassicDab *out,
+                         DP_UNUSED void *user)
+{
+    for (int i = 0; i < count; ++i) {
+        DP_classic_dab_init(out, i, 16, 8, UINT16_MAX, 128, 128);
+    }
+}
+
+static void push_big_dabs(TestPaintEngine *tpe, bool local, int offset,
+                          DP_Message *first_or_null)
+{
+    DP_Message *msgs[11];
+    int count = 0;
+    if (first_or_null) {
+        msgs[count++] = first_or_null;
+    }
+    for (int i = 0; i < 10; ++i) {
+        msgs[count++] = DP_msg_draw_dabs_classic_new(
+            1, DP_int_to_uint16(0x102 + i % 3), 0, 0,
+            0xff000000u | DP_int_to_uint32((offset + i) * 997),
+            DP_BLEND_MODE_NORMAL, set_big_dabs, 200, NULL);
+    }
+    push_messages_local(tpe, local, count, msgs);
+}
+
+static void shutdown_with_pending_messages(TEST_PARAMS)
+{
+    TestPaintEngine tpe;
+    test_paint_engine_init(&tpe);
+    init_layered_canvas(&tpe);
+
+    // Hand the paint thread a batch of slow local messages and wait until it
+    // took them in, so that the following messages pile up behind them.
+    push_big_dabs(&tpe, true, 0, DP_msg_internal_playback_new(0, 0));
+    DP_SEMAPHORE_MUST_WAIT(tpe.sem);
+
+    // The cleanup pulls the remote messages in front of it and moves the
+    // local messages behind it, like the preview, into the paint thread's
+    // remote queue. Wait until it's working through those.
+    push_big_dabs(&tpe, false, 10, DP_msg_internal_playback_new(0, 0));
+    DP_Message *cleanup_msg = DP_msg_internal_cleanup_new(0);
+    push_messages_local(&tpe, true, 1, &cleanup_msg);
+    DP_paint_engine_preview_cut(tpe.pe, 0x102, 0, 0, 50, 50, NULL);
+    DP_SEMAPHORE_MUST_WAIT(tpe.sem);
+
+    // Pile up some more in the inbox and then shut down in the middle of it.
+    for (int i = 2; i < 10; ++i) {
+        push_big_dabs(&tpe, i % 2 == 0, i * 10, NULL);
+        DP_paint_engine_preview_cut(tpe.pe, 0x102, i, i, 50, 50, NULL);
+    }
+    test_paint_engine_dispose(&tpe);
+    OK(true, "shut down with messages still pending");
+}
+
+
+static void register_tests(REGISTER_PARAMS)
+{
+    REGISTER_TEST(render_below_cache);
+    REGISTER_TEST(invalidate_tile_bounds);
+    REGISTER_TEST(shutdown_with_pending_messages);
+}
+
+int main(int argc, char **argv)
+{
+    return DP_test_main(argc, argv, register_tests, NULL);
+}
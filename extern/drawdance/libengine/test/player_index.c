@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2022 askmeaboutloom
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <dpcommon/conversions.h>
+#include <dpcommon/file.h>
+#include <dpcommon/input.h>
+#include <dpcommon/output.h>
+#include <dpengine/canvas_state.h>
+#include <dpengine/draw_context.h>
+#include <dpengine/image.h>
+#include <dpengine/player.h>
+#include <dpengine/recorder.h>
+#include <dpmsg/binary_writer.h>
+#include <dpmsg/blend_mode.h>
+#include <dpmsg/message.h>
+#include <dpmsg/messages.h>
+#include <parson.h>
+#include <dptest_engine.h>
+
+
+static bool never_snapshot(DP_UNUSED void *user)
+{
+    return false;
+}
+
+// Layers get created by user 0, which the player lets do anything, the
+// drawing and the undos come from user 1. Right after the first 60 messages,
+// user 1 undoes back into them and redoes some of it again.
+static bool write_messages(const char *path, int count)
+{
+    DP_Output *output = DP_file_output_new_from_path(path);
+    DP_BinaryWriter *writer = output ? DP_binary_writer_new(output) : NULL;
+    if (!writer) {
+        return false;
+    }
+
+    JSON_Value *header = DP_recorder_header_new(NULL);
+    bool ok = header
+           && DP_binary_writer_write_header(writer,
+                                            json_value_get_object(header));
+    json_value_free(header);
+
+    for (int i = 0; ok && i < count; ++i) {
+        DP_Message *msg;
+        if (i == 0) {
+            msg = DP_msg_canvas_resize_new(0, 0, 200, 200, 0);
+        }
+        else if (i < 4) {
+            msg = DP_msg_layer_create_new(0, DP_int_to_uint16(i), 0,
+                                          i == 1 ? 0xffffffffu : 0, 0, "", 0);
+        }
+        else if (i >= 60 && i < 65) {
+            msg = DP_msg_undo_new(1, 0, i == 63);
+        }
+        else if (i % 2 == 0) {
+            // Enough undo points to push the fills into the snapshot state.
+            msg = DP_msg_undo_point_new(1);
+        }
+        else {
+            uint32_t color = 0x80000000u | (DP_int_to_uint32(i) * 0x1f3d5bu);
+            msg = DP_msg_fill_rect_new(
+                1, DP_int_to_uint16(2 + i % 2), DP_BLEND_MODE_NORMAL,
+                DP_int_to_uint32(i * 7 % 150), DP_int_to_uint32(i * 13 % 150),
+                50, 50, color);
+        }
+        ok = DP_binary_writer_write_message(writer, msg);
+        DP_message_decref(msg);
+    }
+
+    DP_binary_writer_free(writer);
+    return ok;
+}
+
+static bool write_recording(const char *path, const void *buffer, size_t size)
+{
+    DP_Output *output = DP_file_output_new_from_path(path);
+    bool ok = output && DP_output_write(output, buffer, size)
+           && DP_output_flush(output);
+    DP_output_free(output);
+    return ok;
+}
+
+static DP_Player *open_player(const char *path)
+{
+    DP_Input *input = DP_file_input_new_from_path(path);
+    return input ? DP_player_new(DP_PLAYER_TYPE_BINARY, path, input, NULL)
+                 : NULL;
+}
+
+// Finds the offset in the recording after the given number of messages.
+static size_t offset_after(const char *path, int message_count)
+{
+    DP_Player *player = open_player(path);
+    if (!player) {
+        return 0;
+    }
+
+    for (int i = 0; i < message_count; ++i) {
+        DP_Message *msg;
+        if (DP_player_step(player, &msg) != DP_PLAYER_SUCCESS) {
+            DP_player_free(player);
+            return 0;
+        }
+        DP_message_decref(msg);
+    }
+
+    size_t offset = DP_player_tell(player);
+    DP_player_free(player);
+    return offset;
+}
+
+static bool build_index(const char *path, DP_DrawContext *dc, bool incremental)
+{
+    DP_Player *player = open_player(path);
+    bool ok = player
+           && DP_player_index_build(player, dc, incremental, never_snapshot,
+                                    NULL, NULL);
+    DP_player_free(player);
+    return ok;
+}
+
+static DP_Player *open_indexed_player(const char *path)
+{
+    DP_Player *player = open_player(path);
+    if (player && !DP_player_index_load(player)) {
+        DP_player_free(player);
+        return NULL;
+    }
+    return player;
+}
+
+static DP_PlayerIndexEntrySnapshot *load_last_entry(DP_Player *player,
+                                                    DP_DrawContext *dc)
+{
+    DP_PlayerIndexEntry entry = DP_player_index_entry_search(
+        player, DP_player_index_message_count(player), false);
+    return DP_player_index_entry_load(player, dc, entry);
+}
+
+static DP_Image *flatten_snapshot(DP_PlayerIndexEntrySnapshot *snapshot)
+{
+    DP_CanvasState *cs =
+        DP_player_index_entry_snapshot_canvas_state_inc(snapshot);
+    DP_Image *img = DP_canvas_state_to_flat_image(
+        cs, DP_FLAT_IMAGE_RENDER_FLAGS, NULL, NULL);
+    DP_canvas_state_decref(cs);
+    return img;
+}
+
+static void snapshot_messages_eq_ok(TEST_PARAMS,
+                                    DP_PlayerIndexEntrySnapshot *actual,
+                                    DP_PlayerIndexEntrySnapshot *expected)
+{
+    int count = DP_player_index_entry_snapshot_message_count(expected);
+    if (INT_EQ_OK(DP_player_index_entry_snapshot_message_count(actual), count,
+                  "snapshot message count matches")) {
+        for (int i = 0; i < count; ++i) {
+            DP_Message *a =
+                DP_player_index_entry_snapshot_message_at_inc(actual, i);
+            DP_Message *b =
+                DP_player_index_entry_snapshot_message_at_inc(expected, i);
+            OK(a == b || (a && b && DP_message_equals(a, b)),
+               "snapshot message %d matches", i);
+            DP_message_decref_nullable(a);
+            DP_message_decref_nullable(b);
+        }
+    }
+}
+
+
+static void index_append(TEST_PARAMS)
+{
+    const char *full_path = "test/tmp/player_index_full.dprec";
+    const char *path = "test/tmp/player_index_append.dprec";
+
+    FATAL(OK(write_messages(full_path, 120), "wrote %s", full_path));
+    size_t size;
+    void *buffer = DP_file_slurp(full_path, &size);
+    FATAL(NOT_NULL_OK(buffer, "read %s", full_path));
+
+    DP_DrawContext *dc = DP_draw_context_new();
+
+    // Index the whole recording in one go for reference.
+    FATAL(OK(build_index(full_path, dc, false), "built full index"));
+    DP_Player *full_player = open_indexed_player(full_path);
+    FATAL(NOT_NULL_OK(full_player, "loaded full index"));
+    UINT_EQ_OK(DP_player_index_message_count(full_player), 120u,
+               "full index has all messages");
+    INT_EQ_OK(DP_size_to_int(DP_player_index_entry_count(full_player)), 1,
+              "full index has only its final entry");
+    DP_PlayerIndexEntrySnapshot *expected =
+        load_last_entry(full_player, dc);
+    FATAL(NOT_NULL_OK(expected, "loaded final snapshot of full index"));
+    DP_Image *expected_img = flatten_snapshot(expected);
+    FATAL(NOT_NULL_OK(expected_img, "flattened final snapshot of full index"));
+
+    // Cut the recording off halfway through a message, as if it was still
+    // being written to, and index what's there.
+    size_t half_offset = offset_after(full_path, 60);
+    FATAL(OK(half_offset > 0 && half_offset + 3 < size,
+             "got offset after 60 messages"));
+    FATAL(OK(write_recording(path, buffer, half_offset + 3),
+             "wrote truncated %s", path));
+    OK(build_index(path, dc, false), "built index of truncated recording");
+
+    DP_Player *player = open_indexed_player(path);
+    FATAL(NOT_NULL_OK(player, "loaded truncated index"));
+    UINT_EQ_OK(DP_player_index_message_count(player), 60u,
+               "truncated index stops before the cut off message");
+    INT_EQ_OK(DP_size_to_int(DP_player_index_entry_count(player)), 1,
+              "truncated index has one entry");
+    DP_player_free(player);
+
+    // Now the rest of the recording comes in, starting with undos that reach
+    // back past where the index left off.
+    FATAL(OK(write_recording(path, buffer, size), "wrote full %s", path));
+    player = open_indexed_player(path);
+    FATAL(NOT_NULL_OK(player, "loaded outdated index"));
+    OK(DP_player_index_outdated(player), "index is outdated");
+    DP_player_free(player);
+
+    OK(build_index(path, dc, true), "appended to index");
+    player = open_indexed_player(path);
+    FATAL(NOT_NULL_OK(player, "loaded appended index"));
+    OK(!DP_player_index_outdated(player), "index is up to date");
+    UINT_EQ_OK(DP_player_index_message_count(player), 120u,
+               "appended index has all messages");
+    // Building from scratch would only leave the final entry.
+    INT_EQ_OK(DP_size_to_int(DP_player_index_entry_count(player)), 2,
+              "appended index kept the previous entry");
+
+    DP_PlayerIndexEntrySnapshot *actual = load_last_entry(player, dc);
+    if (NOT_NULL_OK(actual, "loaded final snapshot of appended index")) {
+        DP_Image *img = flatten_snapshot(actual);
+        if (NOT_NULL_OK(img, "flattened final snapshot of appended index")) {
+            IMAGE_EQ_OK(img, expected_img, "final snapshot images match");
+        }
+        snapshot_messages_eq_ok(TEST_ARGS, actual, expected);
+        DP_image_free(img);
+        DP_player_index_entry_snapshot_free(actual);
+    }
+    DP_player_free(player);
+
+    // Nothing new to index, appending should leave the entries alone.
+    OK(build_index(path, dc, true), "appended to up to date index");
+    player = open_indexed_player(path);
+    FATAL(NOT_NULL_OK(player, "loaded index again"));
+    UINT_EQ_OK(DP_player_index_message_count(player), 120u,
+               "index still has all messages");
+    INT_EQ_OK(DP_size_to_int(DP_player_index_entry_count(player)), 2,
+              "index still has two entries");
+    DP_player_free(player);
+
+    DP_image_free(expected_img);
+    DP_player_index_entry_snapshot_free(expected);
+    DP_player_free(full_player);
+    DP_draw_context_free(dc);
+    DP_free(buffer);
+}
+
+
+static void register_tests(REGISTER_PARAMS)
+{
+    REGISTER_TEST(index_append);
+}
+
+int main(int argc, char **argv)
+{
+    return DP_test_main(argc, argv, register_tests, NULL);
+}
@@ -0,0 +1,283 @@
+/*
+ * Copyright (c) 2022 askmeaboutloom
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <dpcommon/common.h>
+#include <dpengine/draw_context.h>
+#include <dpengine/image.h>
+#include <dpengine/layer_content.h>
+#include <dpengine/pixels.h>
+#include <dpengine/tile.h>
+#include <dpmsg/blend_mode.h>
+#include <dptest_engine.h>
+
+
+static bool pixel15_equal(DP_Pixel15 a, DP_Pixel15 b)
+{
+    return a.b == b.b && a.g == b.g && a.r == b.r && a.a == b.a;
+}
+
+// Builds a tile with every pixel set individually, so that it doesn't know
+// that it's a single color.
+static DP_Tile *new_pixelwise_tile(DP_Pixel15 pixel)
+{
+    DP_TransientTile *tt = DP_transient_tile_new_blank(0);
+    DP_Pixel15 *pixels = DP_transient_tile_pixels(tt);
+    for (int i = 0; i < DP_TILE_LENGTH; ++i) {
+        pixels[i] = pixel;
+    }
+    return DP_transient_tile_persist(tt);
+}
+
+static void tile_queries_ok(TEST_PARAMS, DP_Tile *actual, DP_Tile *expected,
+                            const char *title)
+{
+    OK(DP_tile_blank(actual) == DP_tile_blank(expected), "%s blank matches",
+       title);
+    OK(DP_tile_opaque(actual) == DP_tile_opaque(expected), "%s opaque matches",
+       title);
+    DP_Pixel15 actual_pixel, expected_pixel;
+    bool actual_same = DP_tile_same_pixel(actual, &actual_pixel);
+    bool expected_same = DP_tile_same_pixel(expected, &expected_pixel);
+    OK(actual_same == expected_same, "%s same pixel matches", title);
+    if (actual_same && expected_same) {
+        OK(pixel15_equal(actual_pixel, expected_pixel),
+           "%s same pixel value matches", title);
+    }
+}
+
+static unsigned char *get_compress_buffer(size_t size, void *user)
+{
+    unsigned char **buffer = user;
+    DP_free(*buffer);
+    *buffer = DP_malloc(size);
+    return *buffer;
+}
+
+static DP_Tile *compress_decompress(DP_DrawContext *dc, DP_Tile *tile,
+                                    size_t *out_size)
+{
+    unsigned char *buffer = NULL;
+    size_t size = DP_tile_compress(tile, NULL, DP_draw_context_tile8_buffer(dc),
+                                   get_compress_buffer, &buffer);
+    DP_Tile *result =
+        size == 0 ? NULL : DP_tile_new_from_compressed(dc, 0, buffer, size);
+    DP_free(buffer);
+    *out_size = size;
+    return result;
+}
+
+
+static void solid_tile_queries(TEST_PARAMS)
+{
+    uint32_t colors[] = {0x00000000u, 0xff3366ccu, 0x80336699u, 0x01ffffffu};
+    for (int i = 0; i < (int)DP_ARRAY_LENGTH(colors); ++i) {
+        DP_UPixel15 color = DP_upixel15_from_color(colors[i]);
+        DP_Tile *solid = DP_tile_new_from_upixel15(0, color);
+        DP_Tile *pixelwise = new_pixelwise_tile(DP_pixel15_premultiply(color));
+        tile_queries_ok(TEST_ARGS, solid, pixelwise, "solid tile");
+
+        // Drawing on a solid tile happens on a transient copy, which must not
+        // claim to be a single color anymore once a pixel differs.
+        DP_TransientTile *tt = DP_transient_tile_new(solid, 0);
+        DP_transient_tile_pixel_at_set(tt, 7, 9, (DP_Pixel15){1, 2, 3, 4});
+        DP_Tile *changed = DP_transient_tile_persist(tt);
+        tt = DP_transient_tile_new(pixelwise, 0);
+        DP_transient_tile_pixel_at_set(tt, 7, 9, (DP_Pixel15){1, 2, 3, 4});
+        DP_Tile *changed_pixelwise = DP_transient_tile_persist(tt);
+        tile_queries_ok(TEST_ARGS, changed, changed_pixelwise, "changed tile");
+        NOK(DP_tile_same_pixel(changed, NULL), "changed tile isn't solid");
+
+        DP_tile_decref(changed_pixelwise);
+        DP_tile_decref(changed);
+        DP_tile_decref(pixelwise);
+        DP_tile_decref(solid);
+    }
+}
+
+static void solid_tile_copy_to_image(TEST_PARAMS)
+{
+    DP_UPixel15 color = DP_upixel15_from_color(0x80336699u);
+    DP_Tile *solid = DP_tile_new_from_upixel15(0, color);
+    DP_Tile *pixelwise = new_pixelwise_tile(DP_pixel15_premultiply(color));
+    DP_Image *actual = DP_image_new(100, 100);
+    DP_Image *expected = DP_image_new(100, 100);
+    // Copying to the bottom-right corner cuts the tile off at the edges.
+    DP_tile_copy_to_image(solid, actual, 0, 0);
+    DP_tile_copy_to_image(solid, actual, 50, 60);
+    DP_tile_copy_to_image(pixelwise, expected, 0, 0);
+    DP_tile_copy_to_image(pixelwise, expected, 50, 60);
+    IMAGE_EQ_OK(actual, expected, "solid tile copies like a pixelwise one");
+    DP_image_free(expected);
+    DP_image_free(actual);
+    DP_tile_decref(pixelwise);
+    DP_tile_decref(solid);
+}
+
+static void solid_tile_compress(TEST_PARAMS)
+{
+    DP_DrawContext *dc = DP_draw_context_new();
+
+    DP_Tile *solid =
+        DP_tile_new_from_upixel15(0, DP_upixel15_from_color(0xff3366ccu));
+    size_t size;
+    DP_Tile *tile = compress_decompress(dc, solid, &size);
+    UINT_EQ_OK(size, 4u, "solid tile compresses to its color");
+    if (NOT_NULL_OK(tile, "decompressed solid tile")) {
+        OK(memcmp(DP_tile_pixels(tile), DP_tile_pixels(solid), DP_TILE_BYTES)
+               == 0,
+           "solid tile survives compression");
+        tile_queries_ok(TEST_ARGS, tile, solid, "decompressed solid tile");
+    }
+    DP_tile_decref_nullable(tile);
+    DP_tile_decref(solid);
+
+    // This color doesn't survive being turned into 8 bit unpremultiplied, so
+    // it has to be compressed as a whole tile.
+    DP_Pixel15 lossy_pixel = {1, 0, 0, 1};
+    solid = DP_tile_new_from_pixel15(0, lossy_pixel);
+    tile = compress_decompress(dc, solid, &size);
+    OK(size > 4, "lossy solid tile compresses to the full tile");
+    if (NOT_NULL_OK(tile, "decompressed lossy solid tile")) {
+        DP_Pixel15 pixel;
+        OK(DP_tile_same_pixel(tile, &pixel)
+               && pixel15_equal(pixel,
+                                DP_pixel8_to_15(DP_pixel15_to_8(lossy_pixel))),
+           "lossy solid tile decompresses to its 8 bit color");
+    }
+    DP_tile_decref_nullable(tile);
+    DP_tile_decref(solid);
+
+    DP_draw_context_free(dc);
+}
+
+
+// A 200x200 layer is 4x4 tiles, the last row and column being partial.
+#define LAYER_SIZE 200
+
+static DP_Pixel15 pixel_at(DP_LayerContent *lc, int x, int y)
+{
+    DP_Tile *tile = DP_layer_content_tile_at_noinc(lc, x / DP_TILE_SIZE,
+                                                   y / DP_TILE_SIZE);
+    return tile ? DP_tile_pixel_at(tile, x % DP_TILE_SIZE, y % DP_TILE_SIZE)
+                : DP_pixel15_zero();
+}
+
+static DP_Tile *tile_at(DP_LayerContent *lc, int tx, int ty)
+{
+    return DP_layer_content_tile_at_noinc(lc, tx, ty);
+}
+
+static DP_LayerContent *fill(DP_LayerContent *lc, int blend_mode, int left,
+                             int top, int right, int bottom, uint32_t color)
+{
+    DP_TransientLayerContent *tlc = DP_transient_layer_content_new(lc);
+    DP_layer_content_decref(lc);
+    DP_transient_layer_content_fill_rect(tlc, 0, blend_mode, left, top, right,
+                                         bottom,
+                                         DP_upixel15_from_color(color));
+    return DP_transient_layer_content_persist(tlc);
+}
+
+static void fill_rect_shares_solid_tiles(TEST_PARAMS)
+{
+    DP_LayerContent *lc = DP_transient_layer_content_persist(
+        DP_transient_layer_content_new_init(LAYER_SIZE, LAYER_SIZE, NULL));
+    lc = fill(lc, DP_BLEND_MODE_NORMAL, 0, 0, 100, 100, 0xff0000ffu);
+
+    // Covers tiles (1,1) through (2,2) entirely, the rest only partially.
+    lc = fill(lc, DP_BLEND_MODE_NORMAL, 10, 20, 195, 196, 0xff00ff00u);
+    DP_Tile *shared = tile_at(lc, 1, 1);
+    FATAL(NOT_NULL_OK(shared, "covered tile exists"));
+    OK(tile_at(lc, 2, 1) == shared && tile_at(lc, 1, 2) == shared
+           && tile_at(lc, 2, 2) == shared,
+       "covered tiles share one tile");
+    OK(DP_tile_same_pixel(shared, NULL), "shared tile is a single color");
+    OK(tile_at(lc, 0, 0) != shared && tile_at(lc, 3, 2) != shared
+           && tile_at(lc, 2, 3) != shared,
+       "partially covered tiles aren't shared");
+
+    DP_Pixel15 green =
+        DP_pixel15_premultiply(DP_upixel15_from_color(0xff00ff00u));
+    DP_Pixel15 blue =
+        DP_pixel15_premultiply(DP_upixel15_from_color(0xff0000ffu));
+    DP_Pixel15 zero = DP_pixel15_zero();
+    OK(pixel15_equal(pixel_at(lc, 10, 20), green), "top-left corner filled");
+    OK(pixel15_equal(pixel_at(lc, 194, 195), green),
+       "bottom-right corner filled");
+    OK(pixel15_equal(pixel_at(lc, 9, 20), blue), "left of fill untouched");
+    OK(pixel15_equal(pixel_at(lc, 10, 19), blue), "above fill untouched");
+    OK(pixel15_equal(pixel_at(lc, 195, 195), zero), "right of fill untouched");
+    OK(pixel15_equal(pixel_at(lc, 194, 196), zero), "below fill untouched");
+
+    // A translucent fill has to blend with each tile, so nothing is shared.
+    lc = fill(lc, DP_BLEND_MODE_NORMAL, 0, 0, LAYER_SIZE, LAYER_SIZE,
+              0x80ff0000u);
+    OK(tile_at(lc, 1, 1) != tile_at(lc, 2, 1),
+       "translucent fill doesn't share tiles");
+    OK(!pixel15_equal(pixel_at(lc, 5, 5), pixel_at(lc, 100, 100)),
+       "translucent fill blends with what's below");
+
+    DP_layer_content_decref(lc);
+}
+
+static void fill_rect_drops_erased_tiles(TEST_PARAMS)
+{
+    DP_LayerContent *lc = DP_transient_layer_content_persist(
+        DP_transient_layer_content_new_init(LAYER_SIZE, LAYER_SIZE, NULL));
+    lc = fill(lc, DP_BLEND_MODE_NORMAL, 0, 0, 150, LAYER_SIZE, 0xff0000ffu);
+
+    // Erases tiles (1,1) through (2,2) entirely. Tile (3,1) has never been
+    // drawn on, so it should stay empty too.
+    lc = fill(lc, DP_BLEND_MODE_REPLACE, 40, 64, LAYER_SIZE, 192, 0);
+    for (int ty = 1; ty <= 2; ++ty) {
+        for (int tx = 1; tx <= 3; ++tx) {
+            NULL_OK(tile_at(lc, tx, ty), "tile (%d, %d) erased", tx, ty);
+        }
+    }
+    NOT_NULL_OK(tile_at(lc, 0, 1), "partially erased tile kept");
+    NOT_NULL_OK(tile_at(lc, 1, 0), "tile above erased area kept");
+    NOT_NULL_OK(tile_at(lc, 1, 3), "tile below erased area kept");
+
+    DP_Pixel15 blue =
+        DP_pixel15_premultiply(DP_upixel15_from_color(0xff0000ffu));
+    DP_Pixel15 zero = DP_pixel15_zero();
+    OK(pixel15_equal(pixel_at(lc, 39, 64), blue), "left of erased area kept");
+    OK(pixel15_equal(pixel_at(lc, 40, 64), zero), "erased area is clear");
+    OK(pixel15_equal(pixel_at(lc, 40, 63), blue), "above erased area kept");
+    OK(pixel15_equal(pixel_at(lc, 40, 192), blue), "below erased area kept");
+
+    DP_layer_content_decref(lc);
+}
+
+
+static void register_tests(REGISTER_PARAMS)
+{
+    REGISTER_TEST(solid_tile_queries);
+    REGISTER_TEST(solid_tile_copy_to_image);
+    REGISTER_TEST(solid_tile_compress);
+    REGISTER_TEST(fill_rect_shares_solid_tiles);
+    REGISTER_TEST(fill_rect_drops_erased_tiles);
+}
+
+int main(int argc, char **argv)
+{
+    return DP_test_main(argc, argv, register_tests, NULL);
+}
@@ -24,20 +24,109 @@
 #include <dpcommon/atomic.h>
 #include <dpcommon/binary.h>
 #include <dpcommon/common.h>
+#include <dpcommon/threading.h>
+
+#define SLAB_SIZE            65536
+#define SLAB_MAX_ALLOCATION  (SLAB_SIZE / 16)
+#define SLAB_ALIGNMENT_MASK  (sizeof(DP_max_align_t) - 1)
 
 
 typedef DP_Message *(*DP_MessageDeserializeFn)(unsigned int context_id,
                                                const unsigned char *buffer,
                                                size_t length);
 
+typedef struct DP_MessageSlab {
+    DP_Atomic refcount;
+    size_t used;
+    alignas(DP_max_align_t) unsigned char data[];
+} DP_MessageSlab;
+
+struct DP_MessageArena {
+    DP_MessageSlab *slab;
+};
+
 struct DP_Message {
     DP_Atomic refcount;
     DP_MessageType type;
     unsigned int context_id;
     const DP_MessageMethods *methods;
+    DP_MessageSlab *slab;
     alignas(DP_max_align_t) unsigned char internal[];
 };
 
+static DP_THREAD_LOCAL DP_MessageArena *active_arena;
+
+
+static void slab_decref(DP_MessageSlab *slab)
+{
+    if (DP_atomic_dec(&slab->refcount)) {
+        DP_free(slab);
+    }
+}
+
+DP_MessageArena *DP_message_arena_new(void)
+{
+    DP_MessageArena *ma = DP_malloc(sizeof(*ma));
+    ma->slab = NULL;
+    return ma;
+}
+
+void DP_message_arena_free(DP_MessageArena *ma_or_null)
+{
+    if (ma_or_null) {
+        DP_ASSERT(active_arena != ma_or_null);
+        DP_MessageSlab *slab = ma_or_null->slab;
+        if (slab) {
+            slab_decref(slab);
+        }
+        DP_free(ma_or_null);
+    }
+}
+
+DP_MessageArena *DP_message_arena_activate(DP_MessageArena *ma_or_null)
+{
+    DP_MessageArena *prev = active_arena;
+    active_arena = ma_or_null;
+    return prev;
+}
+
+static DP_Message *alloc_from_arena(DP_MessageArena *ma, size_t size)
+{
+    size_t aligned_size = (size + SLAB_ALIGNMENT_MASK) & ~SLAB_ALIGNMENT_MASK;
+    DP_MessageSlab *slab = ma->slab;
+    if (!slab || SLAB_SIZE - slab->used < aligned_size) {
+        // The arena holds a reference to its current slab, the messages carved
+        // out of it hold one each. Let go of it and start a new one.
+        if (slab) {
+            slab_decref(slab);
+        }
+        slab = DP_malloc(sizeof(*slab) + SLAB_SIZE);
+        DP_atomic_set(&slab->refcount, 1);
+        slab->used = 0;
+        ma->slab = slab;
+    }
+
+    DP_Message *msg = (DP_Message *)(slab->data + slab->used);
+    slab->used += aligned_size;
+    DP_atomic_inc(&slab->refcount);
+    memset(msg, 0, size);
+    msg->slab = slab;
+    return msg;
+}
+
+static DP_Message *alloc_message(size_t size)
+{
+    DP_MessageArena *ma = active_arena;
+    if (ma && size <= SLAB_MAX_ALLOCATION) {
+        return alloc_from_arena(ma, size);
+    }
+    else {
+        DP_Message *msg = DP_malloc_zeroed(size);
+        msg->slab = NULL;
+        return msg;
+    }
+}
+
 DP_Message *DP_message_new(DP_MessageType type, unsigned int context_id,
                            const DP_MessageMethods *methods,
                            size_t internal_size)
@@ -51,7 +140,7 @@ DP_Message *DP_message_new(DP_MessageType type, unsigned int context_id,
     DP_ASSERT(methods->equals);
     DP_ASSERT(methods->write_payload_text);
     DP_ASSERT(internal_size <= SIZE_MAX - sizeof(DP_Message));
-    DP_Message *msg = DP_malloc_zeroed(sizeof(*msg) + internal_size);
+    DP_Message *msg = alloc_message(sizeof(*msg) + internal_size);
     DP_atomic_set(&msg->refcount, 1);
     msg->type = type;
     msg->context_id = context_id;
@@ -77,7 +166,13 @@ void DP_message_decref(DP_Message *msg)
     DP_ASSERT(msg);
     DP_ASSERT(DP_atomic_get(&msg->refcount) > 0);
     if (DP_atomic_dec(&msg->refcount)) {
-        DP_free(msg);
+        DP_MessageSlab *slab = msg->slab;
+        if (slab) {
+            slab_decref(slab);
+        }
+        else {
+            DP_free(msg);
+        }
     }
 }
 
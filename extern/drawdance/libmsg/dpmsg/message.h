@@ -32,10 +32,31 @@ typedef struct DP_TextWriter DP_TextWriter;
 #define DP_MESSAGE_MAX_PAYLOAD_LENGTH 65535
 
 typedef struct DP_Message DP_Message;
+typedef struct DP_MessageArena DP_MessageArena;
 
 typedef unsigned char *(*DP_GetMessageBufferFn)(void *user, size_t length);
 
 
+// While an arena is active on a thread, messages of up to 4 KiB created on that
+// thread are carved out of 64 KiB slabs instead of being allocated one by one.
+// This is meant for decoding lots of messages in bulk. Each slab gets freed
+// when the arena has moved past it and its last message is gone, on whichever
+// thread that happens. Freeing the arena itself doesn't affect existing
+// messages.
+//
+// The catch is that a single message that sticks around keeps its entire slab
+// alive. Messages that end up in the canvas history mostly get freed together
+// as it's truncated, but one that's held onto for the rest of the session can
+// pin up to 64 KiB for a few dozen bytes. Don't use an arena for messages that
+// are mostly thrown away with a few of them kept for a long time.
+DP_MessageArena *DP_message_arena_new(void);
+
+void DP_message_arena_free(DP_MessageArena *ma_or_null);
+
+// Returns the previously active arena, pass that back in when done.
+DP_MessageArena *DP_message_arena_activate(DP_MessageArena *ma_or_null);
+
+
 DP_Message *DP_message_new(DP_MessageType type, unsigned int context_id,
                            const DP_MessageMethods *methods,
                            size_t internal_size);
@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2022 askmeaboutloom
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
+#include <dpcommon/threading.h>
+#include <dpmsg/message.h>
+#include <dpmsg/messages.h>
+#include <dptest.h>
+
+// Messages from the same slab sit right next to each other, so their addresses
+// tell us whether a new slab got started or the slab got skipped entirely.
+#define SLAB_SIZE    65536
+#define MAX_MESSAGES 4096
+
+
+static uintptr_t address_of(DP_Message *msg)
+{
+    return (uintptr_t)DP_message_internal(msg);
+}
+
+static DP_Message *new_small_message(void)
+{
+    return DP_msg_undo_point_new(1);
+}
+
+static void decref_all(DP_Message **msgs, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        DP_message_decref(msgs[i]);
+    }
+}
+
+
+static void arena_starts_new_slab_when_full(TEST_PARAMS)
+{
+    static DP_Message *msgs[MAX_MESSAGES];
+    DP_MessageArena *ma = DP_message_arena_new();
+    DP_MessageArena *prev = DP_message_arena_activate(ma);
+
+    msgs[0] = new_small_message();
+    msgs[1] = new_small_message();
+    uintptr_t stride = address_of(msgs[1]) - address_of(msgs[0]);
+    OK(stride >= sizeof(void *) && stride % sizeof(DP_max_align_t) == 0,
+       "messages are packed and aligned");
+
+    int count = 2;
+    int per_slab = 0;
+    while (count < MAX_MESSAGES && per_slab == 0) {
+        msgs[count] = new_small_message();
+        if (address_of(msgs[count]) != address_of(msgs[count - 1]) + stride) {
+            per_slab = count;
+        }
+        ++count;
+    }
+    FATAL(OK(per_slab != 0, "new slab started after %d messages", per_slab));
+    OK(DP_int_to_size(per_slab) * stride <= SLAB_SIZE
+           && DP_int_to_size(per_slab + 1) * stride > SLAB_SIZE,
+       "first slab got filled up");
+
+    msgs[count] = new_small_message();
+    OK(address_of(msgs[count]) == address_of(msgs[count - 1]) + stride,
+       "next message comes from the new slab");
+    ++count;
+
+    DP_message_arena_activate(prev);
+    decref_all(msgs, count);
+    DP_message_arena_free(ma);
+}
+
+static void messages_outlive_arena(TEST_PARAMS)
+{
+    const char *text = "message text";
+    size_t text_len = strlen(text);
+
+    DP_MessageArena *ma = DP_message_arena_new();
+    DP_MessageArena *prev = DP_message_arena_activate(ma);
+    DP_Message *chat = DP_msg_chat_new(1, 0, 0, text, text_len);
+    DP_Message *point = new_small_message();
+    DP_message_arena_activate(prev);
+    DP_message_arena_free(ma);
+
+    // Same messages, but allocated on their own.
+    DP_Message *expected_chat = DP_msg_chat_new(1, 0, 0, text, text_len);
+    DP_Message *expected_point = new_small_message();
+
+    OK(DP_message_equals(chat, expected_chat), "chat message intact");
+    size_t len;
+    const char *actual_text =
+        DP_msg_chat_message(DP_msg_chat_cast(chat), &len);
+    STR_LEN_EQ_OK(actual_text, len, text, text_len, "chat text intact");
+    OK(DP_message_equals(point, expected_point), "undo point intact");
+
+    DP_message_decref(expected_point);
+    DP_message_decref(expected_chat);
+    DP_message_decref(point);
+    DP_message_decref(chat);
+}
+
+static void large_messages_bypass_arena(TEST_PARAMS)
+{
+    char text[5000];
+    memset(text, 'x', sizeof(text));
+
+    DP_MessageArena *ma = DP_message_arena_new();
+    DP_MessageArena *prev = DP_message_arena_activate(ma);
+    DP_Message *before = new_small_message();
+    DP_Message *between = new_small_message();
+    uintptr_t stride = address_of(between) - address_of(before);
+    DP_Message *large = DP_msg_chat_new(1, 0, 0, text, sizeof(text));
+    DP_Message *after = new_small_message();
+    DP_message_arena_activate(prev);
+
+    OK(address_of(after) == address_of(between) + stride,
+       "large message didn't take up space in the slab");
+    OK(DP_msg_chat_message_len(DP_msg_chat_cast(large)) == sizeof(text),
+       "large message has its text");
+
+    // Outliving the arena shouldn't matter for it either.
+    DP_message_arena_free(ma);
+    DP_message_decref(after);
+    DP_message_decref(between);
+    DP_message_decref(before);
+    OK(DP_msg_chat_message_len(DP_msg_chat_cast(large)) == sizeof(text),
+       "large message still has its text");
+    DP_message_decref(large);
+}
+
+struct DP_FreeMessagesParams {
+    DP_Message **msgs;
+    int count;
+};
+
+static void free_messages(void *data)
+{
+    struct DP_FreeMessagesParams *params = data;
+    decref_all(params->msgs, params->count);
+}
+
+static void free_messages_on_other_thread(TEST_PARAMS)
+{
+    static DP_Message *msgs[MAX_MESSAGES];
+    static DP_Message *more_msgs[MAX_MESSAGES];
+    DP_MessageArena *ma = DP_message_arena_new();
+    DP_MessageArena *prev = DP_message_arena_activate(ma);
+
+    // Spans several slabs, including the one that's still in use.
+    for (int i = 0; i < MAX_MESSAGES; ++i) {
+        msgs[i] = new_small_message();
+    }
+
+    // Keep allocating from the current slab while the other thread releases
+    // the messages sharing it.
+    struct DP_FreeMessagesParams params = {msgs, MAX_MESSAGES};
+    DP_Thread *thread = DP_thread_new(free_messages, &params);
+    FATAL(NOT_NULL_OK(thread, "started thread"));
+    for (int i = 0; i < MAX_MESSAGES; ++i) {
+        more_msgs[i] = new_small_message();
+    }
+    DP_thread_free_join(thread);
+    DP_message_arena_activate(prev);
+    DP_message_arena_free(ma);
+
+    OK(DP_message_equals(more_msgs[0], more_msgs[MAX_MESSAGES - 1]),
+       "messages allocated in the meantime are intact");
+    params = (struct DP_FreeMessagesParams){more_msgs, MAX_MESSAGES};
+    thread = DP_thread_new(free_messages, &params);
+    FATAL(NOT_NULL_OK(thread, "started thread again"));
+    DP_thread_free_join(thread);
+}
+
+
+static void register_tests(REGISTER_PARAMS)
+{
+    REGISTER_TEST(arena_starts_new_slab_when_full);
+    REGISTER_TEST(messages_outlive_arena);
+    REGISTER_TEST(large_messages_bypass_arena);
+    REGISTER_TEST(free_messages_on_other_thread);
+}
+
+int main(int argc, char **argv)
+{
+    return DP_test_main(argc, argv, register_tests, NULL);
+}
@@ -98,10 +98,14 @@ PlaybackDialog::PlaybackDialog(canvas::CanvasModel *canvas, QWidget *parent)
 	m_ui->prevSkipButton->setVisible(false);
 
 	loadIndex();
+	updateOutdatedIndex();
 }
 
 PlaybackDialog::~PlaybackDialog()
 {
+	if(m_indexer) {
+		m_indexer->cancel();
+	}
 	delete m_ui;
 }
 
@@ -169,11 +173,17 @@ void PlaybackDialog::onBuildIndexClicked()
 	m_ui->buildIndexProgress->show();
 	m_ui->buildIndexButton->setEnabled(false);
 
-	canvas::IndexBuilderRunnable *indexer =
-		new canvas::IndexBuilderRunnable(m_paintengine);
+	canvas::IndexBuilderRunnable *indexer = startIndexer(false);
 	connect(
 		indexer, &canvas::IndexBuilderRunnable::progress,
 		m_ui->buildIndexProgress, &QProgressBar::setValue);
+	connect(
+		indexer, &canvas::IndexBuilderRunnable::throughput, this,
+		[this](double messagesPerSecond) {
+			m_ui->noIndexReason->setText(
+				tr("Building index... (%1 messages per second)")
+					.arg(qRound64(messagesPerSecond)));
+		});
 	connect(
 		indexer, &canvas::IndexBuilderRunnable::indexingComplete, this,
 		[this](bool success, QString error) {
@@ -189,6 +199,43 @@ void PlaybackDialog::onBuildIndexClicked()
 	QThreadPool::globalInstance()->start(indexer);
 }
 
+// If the recording grew since it was indexed, e.g. because it's still being
+// recorded to, append the rest to the index in the background. The old index
+// stays usable until the update is done and gets swapped in.
+void PlaybackDialog::updateOutdatedIndex()
+{
+	if(!m_haveIndex || m_indexer || !m_paintengine->playbackIndexOutdated()) {
+		return;
+	}
+
+	canvas::IndexBuilderRunnable *indexer = startIndexer(true);
+	connect(
+		indexer, &canvas::IndexBuilderRunnable::indexingComplete, this,
+		[this](bool success, QString error) {
+			if(success) {
+				loadIndex();
+			} else {
+				qWarning("Error updating index: %s", qUtf8Printable(error));
+			}
+		});
+
+	QThreadPool::globalInstance()->start(indexer);
+}
+
+canvas::IndexBuilderRunnable *PlaybackDialog::startIndexer(bool incremental)
+{
+	canvas::IndexBuilderRunnable *indexer =
+		new canvas::IndexBuilderRunnable(m_paintengine, incremental);
+	// The dialog may go away while indexing is still running, so we hold on
+	// to the runnable ourselves and cancel it in the destructor instead.
+	indexer->setAutoDelete(false);
+	m_indexer = indexer;
+	connect(
+		indexer, &canvas::IndexBuilderRunnable::indexingComplete, indexer,
+		&QObject::deleteLater);
+	return indexer;
+}
+
 void PlaybackDialog::loadIndex()
 {
 	if(!m_paintengine->loadPlaybackIndex()) {
@@ -354,7 +401,9 @@ void PlaybackDialog::exportFrame(int count)
 	Q_ASSERT(m_exporter);
 	count = qMax(1, count);
 
-	const QImage image = m_paintengine->getPixmap().toImage();
+	// Flatten the canvas state directly, going through the view cache would
+	// render it at full resolution just to copy it out again.
+	const QImage image = m_paintengine->getLayerImage(0);
 	if(image.isNull()) {
 		qWarning("exportFrame: image is null!");
 		onExporterReady();
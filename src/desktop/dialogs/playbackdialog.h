@@ -13,6 +13,7 @@ extern "C" {
 
 namespace canvas {
 class CanvasModel;
+class IndexBuilderRunnable;
 class PaintEngine;
 }
 
@@ -54,6 +55,7 @@ private slots:
 	void loadIndex();
 
 	void onBuildIndexClicked();
+	void updateOutdatedIndex();
 #ifndef Q_OS_ANDROID
 	void onVideoExportClicked();
 #endif
@@ -61,6 +63,7 @@ private slots:
 	void exportFrame(int count = 1);
 
 private:
+	canvas::IndexBuilderRunnable *startIndexer(bool incremental);
 	void playbackCommand(std::function<DP_PlayerResult()> fn);
 	void updateButtons();
 	static bool isErrorResult(DP_PlayerResult result);
@@ -68,6 +71,7 @@ private:
 	Ui_PlaybackDialog *m_ui;
 	canvas::PaintEngine *m_paintengine;
 	QPointer<VideoExporter> m_exporter;
+	QPointer<canvas::IndexBuilderRunnable> m_indexer;
 
 	QTimer *m_playTimer;
 	QElapsedTimer m_lastFrameTime;
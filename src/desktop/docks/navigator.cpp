@@ -165,7 +165,16 @@ void NavigatorView::refreshCache()
 	if(!m_model)
 		return;
 
-	const QPixmap &canvas = m_model->paintEngine()->getPixmap();
+	// The navigator is small, so there's no point in rendering the canvas at
+	// full resolution just to scale it down again.
+	canvas::PaintEngine *pe = m_model->paintEngine();
+	const QSize canvasSize = pe->viewCanvasState().size();
+	if(canvasSize.isEmpty())
+		return;
+
+	const qreal scale = qMin(
+		qreal(width()) / canvasSize.width(), qreal(height()) / canvasSize.height());
+	const QPixmap canvas = pe->getPixmap(canvas::PaintEngine::levelOfDetailForScale(scale));
 	if(canvas.isNull())
 		return;
 
@@ -2306,7 +2306,11 @@ void MainWindow::resizeCanvas()
 
 	const QSize size = m_doc->canvas()->size();
 	dialogs::ResizeDialog *dlg = new dialogs::ResizeDialog(size, this);
-	dlg->setPreviewImage(m_doc->canvas()->paintEngine()->getPixmap().scaled(300, 300, Qt::KeepAspectRatio).toImage());
+	// The preview is only 300 pixels big, no need to render it at full size.
+	const qreal previewScale = size.isEmpty() ? 1.0 : qMin(
+		300.0 / size.width(), 300.0 / size.height());
+	const int levelOfDetail = canvas::PaintEngine::levelOfDetailForScale(previewScale);
+	dlg->setPreviewImage(m_doc->canvas()->paintEngine()->getPixmap(levelOfDetail).scaled(300, 300, Qt::KeepAspectRatio).toImage());
 	dlg->setAttribute(Qt::WA_DeleteOnClose);
 
 	// Preset crop from selection if one exists
@@ -65,7 +65,11 @@ void CanvasItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option
 {
 	if(m_image) {
 		QRect exposed = option->exposedRect.toAlignedRect();
-		painter->drawPixmap(exposed, m_image->getPixmapView(m_visibleArea), exposed);
+		// When zoomed out, draw from a downsampled level of the cache instead,
+		// that way far fewer pixels need to be pushed around.
+		int levelOfDetail = canvas::PaintEngine::levelOfDetailForScale(
+			QStyleOptionGraphicsItem::levelOfDetailFromTransform(painter->worldTransform()));
+		m_image->drawView(painter, m_visibleArea, exposed, levelOfDetail);
 	}
 }
 
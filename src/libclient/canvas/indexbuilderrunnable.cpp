@@ -2,21 +2,42 @@
 
 #include "libclient/canvas/indexbuilderrunnable.h"
 #include "libclient/canvas/paintengine.h"
+#include <QElapsedTimer>
 
 namespace canvas {
 
-IndexBuilderRunnable::IndexBuilderRunnable(PaintEngine *pe)
+IndexBuilderRunnable::IndexBuilderRunnable(PaintEngine *pe, bool incremental)
 	: QObject{}
 	, m_paintengine{pe}
+	, m_incremental{incremental}
+	, m_cancelled{0}
 {
 }
 
 void IndexBuilderRunnable::run()
 {
-	bool success = m_paintengine->buildPlaybackIndex([this](int percent) {
-		emit progress(percent);
-	});
-	emit indexingComplete(success, success ? QString{} : QString::fromUtf8(DP_error()));
+	QElapsedTimer timer;
+	timer.start();
+	int lastPercent = -1;
+	bool success = m_paintengine->buildPlaybackIndex(
+		m_incremental, [&](int percent, long long messageCount) {
+			if(percent != lastPercent) {
+				lastPercent = percent;
+				emit progress(percent);
+			}
+			qint64 elapsed = timer.elapsed();
+			if(elapsed > 0) {
+				emit throughput(double(messageCount) * 1000.0 / double(elapsed));
+			}
+			return m_cancelled.loadAcquire() == 0;
+		});
+	emit indexingComplete(
+		success, success ? QString{} : QString::fromUtf8(DP_error()));
+}
+
+void IndexBuilderRunnable::cancel()
+{
+	m_cancelled.storeRelease(1);
 }
 
 }
@@ -3,6 +3,7 @@
 #ifndef INDEXBUILDERRUNNABLE_H
 #define INDEXBUILDERRUNNABLE_H
 
+#include <QAtomicInt>
 #include <QRunnable>
 #include <QObject>
 
@@ -14,16 +15,24 @@ class IndexBuilderRunnable final : public QObject, public QRunnable
 {
 	Q_OBJECT
 public:
-	explicit IndexBuilderRunnable(PaintEngine *pe);
+	//! With incremental set, appends to an existing index if there is one
+	IndexBuilderRunnable(PaintEngine *pe, bool incremental);
 
 	void run() override;
 
+	//! Stop building the index as soon as possible, safe to call from any thread
+	void cancel();
+
 signals:
 	void progress(int percent);
+	//! Number of messages processed per second, emitted along with progress
+	void throughput(double messagesPerSecond);
 	void indexingComplete(bool success, const QString error);
 
 private:
 	PaintEngine *m_paintengine;
+	bool m_incremental;
+	QAtomicInt m_cancelled;
 };
 
 }
@@ -1,7 +1,6 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 
 extern "C" {
-#include <dpcommon/threading.h>
 #include <dpengine/layer_routes.h>
 #include <dpengine/paint_engine.h>
 #include <dpengine/recorder.h>
@@ -19,7 +18,9 @@ extern "C" {
 #include <QPainter>
 #include <QSet>
 #include <QTimer>
+#include <QVector>
 #include <QtEndian>
+#include <algorithm>
 
 #define DP_PERF_CONTEXT "paint_engine"
 
@@ -37,22 +38,21 @@ PaintEngine::PaintEngine(
 	, m_changedTileBounds{}
 	, m_lastRefreshAreaTileBounds{}
 	, m_lastRefreshAreaTileBoundsTouched{false}
-	, m_cache{}
-	, m_painter{}
-	, m_painterMutex{nullptr}
+	, m_viewCache{}
+	, m_viewCacheCanvasSize{}
+	, m_viewCacheBytes{0}
+	, m_viewCacheClock{0}
 	, m_sampleColorLastDiameter(-1)
 	, m_onionSkins{nullptr}
 	, m_enableOnionSkins{false}
 	, m_undoDepthLimit{DP_UNDO_DEPTH_DEFAULT}
 {
-	m_painterMutex = DP_mutex_new();
 	start();
 }
 
 PaintEngine::~PaintEngine()
 {
 	DP_onion_skins_free(m_onionSkins);
-	DP_mutex_free(m_painterMutex);
 }
 
 void PaintEngine::setFps(int fps)
@@ -94,7 +94,9 @@ void PaintEngine::reset(
 	m_paintEngine.reset(
 		m_acls, m_snapshotQueue, localUserId, PaintEngine::onPlayback,
 		PaintEngine::onDumpPlayback, this, canvasState, player);
-	m_cache = QPixmap{};
+	m_viewCache.clear();
+	m_viewCacheCanvasSize = QSize{};
+	m_viewCacheBytes = 0;
 	m_lastRefreshAreaTileBounds = QRect{};
 	m_lastRefreshAreaTileBoundsTouched = false;
 	m_undoDepthLimit = DP_UNDO_DEPTH_DEFAULT;
@@ -419,9 +421,9 @@ DP_PlayerResult PaintEngine::playPlayback(long long msecs)
 }
 
 bool PaintEngine::buildPlaybackIndex(
-	drawdance::PaintEngine::BuildIndexProgressFn progressFn)
+	bool incremental, drawdance::PaintEngine::BuildIndexProgressFn progressFn)
 {
-	return m_paintEngine.buildPlaybackIndex(progressFn);
+	return m_paintEngine.buildPlaybackIndex(incremental, progressFn);
 }
 
 bool PaintEngine::loadPlaybackIndex()
@@ -439,6 +441,11 @@ size_t PaintEngine::playbackIndexEntryCount()
 	return m_paintEngine.playbackIndexEntryCount();
 }
 
+bool PaintEngine::playbackIndexOutdated()
+{
+	return m_paintEngine.playbackIndexOutdated();
+}
+
 QImage PaintEngine::playbackIndexThumbnailAt(size_t index)
 {
 	return m_paintEngine.playbackIndexThumbnailAt(index);
@@ -524,8 +531,16 @@ void PaintEngine::clearDabsPreview()
 	m_paintEngine.clearDabsPreview();
 }
 
-const QPixmap &PaintEngine::getPixmapView(const QRect &refreshArea)
+void PaintEngine::drawView(
+	QPainter *painter, const QRect &refreshArea, const QRect &exposed,
+	int levelOfDetail)
 {
+	int level = qBound(0, levelOfDetail, LEVEL_OF_DETAIL_COUNT - 1);
+	quint64 stamp = ++m_viewCacheClock;
+	DP_paint_engine_prepare_render(
+		m_paintEngine.get(), &PaintEngine::onRenderSize, this);
+	bool blocksCreated = ensureViewCacheBlocks(level, refreshArea, stamp);
+
 	QRect refreshAreaTileBounds{
 		QPoint{
 			refreshArea.left() / DP_TILE_SIZE,
@@ -534,7 +549,7 @@ const QPixmap &PaintEngine::getPixmapView(const QRect &refreshArea)
 			refreshArea.right() / DP_TILE_SIZE,
 			refreshArea.bottom() / DP_TILE_SIZE}};
 	if(refreshAreaTileBounds == m_lastRefreshAreaTileBounds) {
-		if(m_lastRefreshAreaTileBoundsTouched) {
+		if(m_lastRefreshAreaTileBoundsTouched || blocksCreated) {
 			renderTileBounds(refreshAreaTileBounds);
 			m_lastRefreshAreaTileBoundsTouched = false;
 		}
@@ -543,40 +558,196 @@ const QPixmap &PaintEngine::getPixmapView(const QRect &refreshArea)
 		m_lastRefreshAreaTileBounds = refreshAreaTileBounds;
 		m_lastRefreshAreaTileBoundsTouched = false;
 	}
-	return m_cache;
+
+	QRect canvasRect{QPoint{0, 0}, m_viewCacheCanvasSize};
+	QRect area = exposed & canvasRect;
+	if(!area.isEmpty()) {
+		int blockCanvasSize = VIEW_CACHE_BLOCK_SIZE << level;
+		qreal divisor = 1 << level;
+		for(int by = area.top() / blockCanvasSize,
+				bottom = area.bottom() / blockCanvasSize;
+			by <= bottom; ++by) {
+			for(int bx = area.left() / blockCanvasSize,
+					right = area.right() / blockCanvasSize;
+				bx <= right; ++bx) {
+				QHash<quint64, ViewCacheBlock>::const_iterator it =
+					m_viewCache.constFind(viewCacheKey(level, bx, by));
+				if(it != m_viewCache.constEnd()) {
+					const QImage &image = it->image;
+					QPoint origin{bx * blockCanvasSize, by * blockCanvasSize};
+					QSize size{image.width() << level, image.height() << level};
+					QRect target = QRect{origin, size} & canvasRect;
+					QRectF source{
+						(target.x() - origin.x()) / divisor,
+						(target.y() - origin.y()) / divisor,
+						target.width() / divisor, target.height() / divisor};
+					painter->drawImage(QRectF{target}, image, source);
+				}
+			}
+		}
+	}
+
+	evictViewCacheBlocks(stamp);
 }
 
-const QPixmap &PaintEngine::getPixmap()
+QPixmap PaintEngine::getPixmap(int levelOfDetail)
 {
+	int level = qBound(0, levelOfDetail, LEVEL_OF_DETAIL_COUNT - 1);
+	quint64 stamp = ++m_viewCacheClock;
+	DP_paint_engine_prepare_render(
+		m_paintEngine.get(), &PaintEngine::onRenderSize, this);
+	QRect canvasRect{QPoint{0, 0}, m_viewCacheCanvasSize};
+	ensureViewCacheBlocks(level, canvasRect, stamp);
 	renderEverything();
 	m_lastRefreshAreaTileBoundsTouched = false;
-	return m_cache;
+
+	QSize levelSize = viewCacheLevelSize(level);
+	QPixmap pixmap;
+	if(!levelSize.isEmpty()) {
+		pixmap = QPixmap{levelSize};
+		QPainter painter{&pixmap};
+		painter.setCompositionMode(QPainter::CompositionMode_Source);
+		int xblocks = (levelSize.width() + VIEW_CACHE_BLOCK_SIZE - 1) /
+					  VIEW_CACHE_BLOCK_SIZE;
+		int yblocks = (levelSize.height() + VIEW_CACHE_BLOCK_SIZE - 1) /
+					  VIEW_CACHE_BLOCK_SIZE;
+		for(int by = 0; by < yblocks; ++by) {
+			for(int bx = 0; bx < xblocks; ++bx) {
+				QHash<quint64, ViewCacheBlock>::const_iterator it =
+					m_viewCache.constFind(viewCacheKey(level, bx, by));
+				if(it != m_viewCache.constEnd()) {
+					painter.drawImage(
+						bx * VIEW_CACHE_BLOCK_SIZE, by * VIEW_CACHE_BLOCK_SIZE,
+						it->image);
+				}
+			}
+		}
+	}
+
+	evictViewCacheBlocks(stamp);
+	return pixmap;
+}
+
+int PaintEngine::levelOfDetailForScale(qreal scale)
+{
+	int level = 0;
+	while(level < LEVEL_OF_DETAIL_COUNT - 1 && scale * (2 << level) <= 1.0) {
+		++level;
+	}
+	return level;
 }
 
 void PaintEngine::renderTileBounds(const QRect &tileBounds)
 {
-	DP_PaintEngine *pe = m_paintEngine.get();
-	DP_paint_engine_prepare_render(pe, &PaintEngine::onRenderSize, this);
-	if(!m_cache.isNull() && m_painter.begin(&m_cache)) {
-		m_painter.setCompositionMode(QPainter::CompositionMode_Source);
+	if(!m_viewCache.isEmpty()) {
 		DP_paint_engine_render_tile_bounds(
-			pe, tileBounds.left(), tileBounds.top(), tileBounds.right(),
-			tileBounds.bottom(), &PaintEngine::onRenderTile, this);
-		m_painter.end();
+			m_paintEngine.get(), tileBounds.left(), tileBounds.top(),
+			tileBounds.right(), tileBounds.bottom(), &PaintEngine::onRenderTile,
+			this);
 	}
 }
 
 void PaintEngine::renderEverything()
 {
-	DP_PaintEngine *pe = m_paintEngine.get();
-	DP_paint_engine_prepare_render(pe, &PaintEngine::onRenderSize, this);
-	if(!m_cache.isNull() && m_painter.begin(&m_cache)) {
-		m_painter.setCompositionMode(QPainter::CompositionMode_Source);
-		DP_paint_engine_render_everything(pe, &PaintEngine::onRenderTile, this);
-		m_painter.end();
+	if(!m_viewCache.isEmpty()) {
+		DP_paint_engine_render_everything(
+			m_paintEngine.get(), &PaintEngine::onRenderTile, this);
+	}
+}
+
+bool PaintEngine::ensureViewCacheBlocks(
+	int level, const QRect &area, quint64 stamp)
+{
+	QRect canvasArea = area & QRect{QPoint{0, 0}, m_viewCacheCanvasSize};
+	if(canvasArea.isEmpty()) {
+		return false;
+	}
+
+	QSize levelSize = viewCacheLevelSize(level);
+	int blockCanvasSize = VIEW_CACHE_BLOCK_SIZE << level;
+	int tilesPerBlock = blockCanvasSize / DP_TILE_SIZE;
+	bool created = false;
+	for(int by = canvasArea.top() / blockCanvasSize,
+			bottom = canvasArea.bottom() / blockCanvasSize;
+		by <= bottom; ++by) {
+		for(int bx = canvasArea.left() / blockCanvasSize,
+				right = canvasArea.right() / blockCanvasSize;
+			bx <= right; ++bx) {
+			quint64 key = viewCacheKey(level, bx, by);
+			QHash<quint64, ViewCacheBlock>::iterator it = m_viewCache.find(key);
+			if(it == m_viewCache.end()) {
+				QImage image{
+					qMin(
+						VIEW_CACHE_BLOCK_SIZE,
+						levelSize.width() - bx * VIEW_CACHE_BLOCK_SIZE),
+					qMin(
+						VIEW_CACHE_BLOCK_SIZE,
+						levelSize.height() - by * VIEW_CACHE_BLOCK_SIZE),
+					QImage::Format_RGB32};
+				if(image.isNull()) {
+					qWarning("Failed to allocate view cache block");
+					continue;
+				}
+				m_viewCacheBytes += qint64(image.bytesPerLine()) * image.height();
+				it = m_viewCache.insert(
+					key, ViewCacheBlock{std::move(image), nullptr, 0});
+				// Grab the pixel pointer only once the image is stored, since
+				// render threads can't call bits() without risking a detach.
+				it->bits = it->image.bits();
+				// The block starts out with garbage, so get the engine to
+				// render all of its tiles again.
+				int tileLeft = bx * tilesPerBlock;
+				int tileTop = by * tilesPerBlock;
+				DP_paint_engine_invalidate_tile_bounds(
+					m_paintEngine.get(), tileLeft, tileTop,
+					tileLeft + tilesPerBlock - 1, tileTop + tilesPerBlock - 1);
+				created = true;
+			}
+			it->lastUsed = stamp;
+		}
+	}
+	return created;
+}
+
+void PaintEngine::evictViewCacheBlocks(quint64 stamp)
+{
+	if(m_viewCacheBytes <= VIEW_CACHE_BUDGET) {
+		return;
+	}
+
+	// Blocks used in the current pass stay around, even if that means going
+	// over budget. Otherwise they'd get evicted right as they're displayed.
+	QVector<QPair<quint64, quint64>> candidates;
+	for(QHash<quint64, ViewCacheBlock>::const_iterator
+			it = m_viewCache.constBegin(),
+			end = m_viewCache.constEnd();
+		it != end; ++it) {
+		if(it->lastUsed < stamp) {
+			candidates.append({it->lastUsed, it.key()});
+		}
+	}
+	std::sort(candidates.begin(), candidates.end());
+
+	for(const QPair<quint64, quint64> &candidate : candidates) {
+		if(m_viewCacheBytes <= VIEW_CACHE_BUDGET) {
+			break;
+		}
+		QHash<quint64, ViewCacheBlock>::iterator it =
+			m_viewCache.find(candidate.second);
+		const QImage &image = it->image;
+		m_viewCacheBytes -= qint64(image.bytesPerLine()) * image.height();
+		m_viewCache.erase(it);
 	}
 }
 
+QSize PaintEngine::viewCacheLevelSize(int level) const
+{
+	int divisor = 1 << level;
+	return QSize{
+		(m_viewCacheCanvasSize.width() + divisor - 1) / divisor,
+		(m_viewCacheCanvasSize.height() + divisor - 1) / divisor};
+}
+
 int PaintEngine::frameCount() const
 {
 	return historyCanvasState().frameCount();
@@ -721,25 +892,97 @@ void PaintEngine::onRenderSize(void *user, int width, int height)
 {
 	PaintEngine *pe = static_cast<PaintEngine *>(user);
 	QSize size{width, height};
-	if(pe->m_cache.size() != size) {
-		pe->m_cache = QPixmap{size};
+	if(pe->m_viewCacheCanvasSize != size) {
+		pe->m_viewCache.clear();
+		pe->m_viewCacheCanvasSize = size;
+		pe->m_viewCacheBytes = 0;
 	}
 }
 
 void PaintEngine::onRenderTile(
 	void *user, int x, int y, DP_Pixel8 *pixels, int threadIndex)
 {
-	// My initial idea was to use an array of QPainters to spew pixels into the
-	// pixmap in parallel, but Qt doesn't support multiple painters on a single
-	// pixmap. So we have to use a single painter and lock its usage instead.
+	// Qt doesn't support multiple painters on a single pixmap, so instead each
+	// render thread copies its tiles straight into the view cache blocks. Tiles
+	// don't overlap, so this doesn't need any locking. The hash isn't modified
+	// while rendering, so looking things up in it concurrently is fine too.
 	Q_UNUSED(threadIndex);
-	QImage image{
-		reinterpret_cast<unsigned char *>(pixels), DP_TILE_SIZE, DP_TILE_SIZE,
-		QImage::Format_RGB32};
-	PaintEngine *pe = static_cast<PaintEngine *>(user);
-	DP_mutex_lock(pe->m_painterMutex);
-	pe->m_painter.drawImage(x * DP_TILE_SIZE, y * DP_TILE_SIZE, image);
-	DP_mutex_unlock(pe->m_painterMutex);
+	const PaintEngine *pe = static_cast<const PaintEngine *>(user);
+	const ViewCacheBlock *blocks[LEVEL_OF_DETAIL_COUNT];
+	int maxLevel = -1;
+	for(int i = 0; i < LEVEL_OF_DETAIL_COUNT; ++i) {
+		int blockTiles = (VIEW_CACHE_BLOCK_SIZE << i) / DP_TILE_SIZE;
+		QHash<quint64, ViewCacheBlock>::const_iterator it =
+			pe->m_viewCache.constFind(
+				viewCacheKey(i, x / blockTiles, y / blockTiles));
+		if(it == pe->m_viewCache.constEnd()) {
+			blocks[i] = nullptr;
+		} else {
+			blocks[i] = &*it;
+			maxLevel = i;
+		}
+	}
+
+	if(blocks[0]) {
+		copyTileToViewCacheBlock(*blocks[0], x, y, pixels, 0);
+	}
+	// Each further level is a 2x2 box filter of the one before, so a tile at
+	// level n is DP_TILE_SIZE >> n pixels wide.
+	DP_Pixel8 downsampled[2][DP_TILE_LENGTH / 4];
+	const DP_Pixel8 *src = pixels;
+	for(int i = 1; i <= maxLevel; ++i) {
+		DP_Pixel8 *dst = downsampled[i % 2];
+		downsampleTile(dst, src, DP_TILE_SIZE >> i);
+		if(blocks[i]) {
+			copyTileToViewCacheBlock(*blocks[i], x, y, dst, i);
+		}
+		src = dst;
+	}
+}
+
+void PaintEngine::copyTileToViewCacheBlock(
+	const ViewCacheBlock &block, int x, int y, const DP_Pixel8 *pixels,
+	int level)
+{
+	int tileSize = DP_TILE_SIZE >> level;
+	int left = (x * tileSize) % VIEW_CACHE_BLOCK_SIZE;
+	int top = (y * tileSize) % VIEW_CACHE_BLOCK_SIZE;
+	int width = qMin(tileSize, block.image.width() - left);
+	int height = qMin(tileSize, block.image.height() - top);
+	if(width > 0 && height > 0) {
+		size_t stride = size_t(block.image.bytesPerLine());
+		uchar *dst = block.bits + top * stride + left * 4;
+		size_t rowSize = size_t(width) * 4;
+		for(int i = 0; i < height; ++i) {
+			memcpy(dst + i * stride, pixels + i * tileSize, rowSize);
+		}
+	}
+}
+
+void PaintEngine::downsampleTile(
+	DP_Pixel8 *dst, const DP_Pixel8 *src, int dstSize)
+{
+	int srcSize = dstSize * 2;
+	for(int y = 0; y < dstSize; ++y) {
+		const DP_Pixel8 *row1 = src + y * 2 * srcSize;
+		const DP_Pixel8 *row2 = row1 + srcSize;
+		for(int x = 0; x < dstSize; ++x) {
+			DP_Pixel8 p1 = row1[x * 2];
+			DP_Pixel8 p2 = row1[x * 2 + 1];
+			DP_Pixel8 p3 = row2[x * 2];
+			DP_Pixel8 p4 = row2[x * 2 + 1];
+			DP_Pixel8 &out = dst[y * dstSize + x];
+			out.b = uint8_t((p1.b + p2.b + p3.b + p4.b + 2) / 4);
+			out.g = uint8_t((p1.g + p2.g + p3.g + p4.g + 2) / 4);
+			out.r = uint8_t((p1.r + p2.r + p3.r + p4.r + 2) / 4);
+			out.a = uint8_t((p1.a + p2.a + p3.a + p4.a + 2) / 4);
+		}
+	}
+}
+
+quint64 PaintEngine::viewCacheKey(int level, int blockX, int blockY)
+{
+	return quint64(level) << 48 | quint64(blockY) << 24 | quint64(blockX);
 }
 
 
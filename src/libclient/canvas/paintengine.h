@@ -7,6 +7,8 @@ extern "C" {
 #include <dpengine/draw_context.h>
 }
 
+#include <QHash>
+#include <QImage>
 #include <QObject>
 #include <QPainter>
 #include <QPixmap>
@@ -17,8 +19,6 @@ extern "C" {
 #include "libclient/drawdance/paintengine.h"
 #include "libclient/drawdance/snapshotqueue.h"
 
-struct DP_Mutex;
-
 namespace drawdance {
 class LayerPropsList;
 }
@@ -31,6 +31,14 @@ public:
 	static constexpr int DEFAULT_FPS = 60;
 	static constexpr int DEFAULT_SNAPSHOT_MAX_COUNT = 5;
 	static constexpr int DEFAULT_SNAPSHOT_MIN_DELAY_MS = 10000;
+	//! Number of view cache levels. Level 0 is full resolution, every level
+	//! after that is downsampled by another factor of two.
+	static constexpr int LEVEL_OF_DETAIL_COUNT = 4;
+	//! Width and height of a view cache block, in pixels of its own level.
+	static constexpr int VIEW_CACHE_BLOCK_SIZE = 256;
+	//! How many bytes of view cache blocks to keep around before evicting the
+	//! least recently used ones.
+	static constexpr qint64 VIEW_CACHE_BUDGET = 256 * 1024 * 1024;
 
 	PaintEngine(
 		int fps, int snapshotMaxCount, long long snapshotMinDelayMs,
@@ -51,17 +59,24 @@ public:
 		DP_Player *player = nullptr);
 
 	/**
-	 * @brief Get a reference to the view cache pixmap while makign sure at
-	 * least the given area has been refreshed
+	 * @brief Draw the exposed area of the canvas while making sure at least the
+	 * given refresh area has been refreshed
 	 *
 	 * Should only be called by the CanvasItem, since the last refresh area is
-	 * cached and shouldn't change much.
+	 * cached and shouldn't change much. Draws from the view cache level that's
+	 * downsampled by a factor of 2 to the power of the given level of detail.
 	 */
-	const QPixmap &getPixmapView(const QRect &refreshArea);
+	void drawView(
+		QPainter *painter, const QRect &refreshArea, const QRect &exposed,
+		int levelOfDetail);
+
+	//! Render the whole canvas into a pixmap, downsampled by a factor of 2 to
+	//! the power of the given level of detail
+	QPixmap getPixmap(int levelOfDetail = 0);
 
-	//! Get a reference to the view cache pixmap while making sure the whole
-	//! pixmap is refreshed
-	const QPixmap &getPixmap();
+	//! Get the coarsest level of detail that still has enough resolution to
+	//! be displayed at the given scale
+	static int levelOfDetailForScale(qreal scale);
 
 	//! Get the number of frames in an animated canvas
 	int frameCount() const;
@@ -190,11 +205,13 @@ public:
 	DP_PlayerResult jumpPlaybackTo(long long position);
 	DP_PlayerResult beginPlayback();
 	DP_PlayerResult playPlayback(long long msecs);
-	bool
-	buildPlaybackIndex(drawdance::PaintEngine::BuildIndexProgressFn progressFn);
+	bool buildPlaybackIndex(
+		bool incremental,
+		drawdance::PaintEngine::BuildIndexProgressFn progressFn);
 	bool loadPlaybackIndex();
 	unsigned int playbackIndexMessageCount();
 	size_t playbackIndexEntryCount();
+	bool playbackIndexOutdated();
 	QImage playbackIndexThumbnailAt(size_t index);
 	DP_PlayerResult stepDumpPlayback();
 	DP_PlayerResult jumpDumpPlaybackToPreviousReset();
@@ -236,6 +253,15 @@ protected:
 	void timerEvent(QTimerEvent *) override;
 
 private:
+	//! A block of the sparse view cache. Render threads write tiles into the
+	//! image without locking, since each one only touches its own disjoint
+	//! region. They go through the bits pointer to avoid detach checks.
+	struct ViewCacheBlock {
+		QImage image;
+		uchar *bits;
+		quint64 lastUsed;
+	};
+
 	static void onPlayback(void *user, long long position);
 	static void onDumpPlayback(
 		void *user, long long position, DP_CanvasHistorySnapshot *chs);
@@ -259,12 +285,18 @@ private:
 	static void onRenderSize(void *user, int width, int height);
 	static void
 	onRenderTile(void *user, int x, int y, DP_Pixel8 *pixels, int threadIndex);
+	static void copyTileToViewCacheBlock(
+		const ViewCacheBlock &block, int x, int y, const DP_Pixel8 *pixels,
+		int level);
+	static void downsampleTile(DP_Pixel8 *dst, const DP_Pixel8 *src, int dstSize);
+	static quint64 viewCacheKey(int level, int blockX, int blockY);
 
 	void start();
 	void renderTileBounds(const QRect &tileBounds);
 	void renderEverything();
-
-	void deletePainters();
+	bool ensureViewCacheBlocks(int level, const QRect &area, quint64 stamp);
+	void evictViewCacheBlocks(quint64 stamp);
+	QSize viewCacheLevelSize(int level) const;
 
 	drawdance::AclState m_acls;
 	drawdance::SnapshotQueue m_snapshotQueue;
@@ -274,9 +306,13 @@ private:
 	QRect m_changedTileBounds;
 	QRect m_lastRefreshAreaTileBounds;
 	bool m_lastRefreshAreaTileBoundsTouched;
-	QPixmap m_cache;
-	QPainter m_painter;
-	DP_Mutex *m_painterMutex;
+	//! Blocks of the view cache by level and position. Only blocks that were
+	//! looked at recently are kept around, so huge canvases don't need to fit
+	//! into memory all at once.
+	QHash<quint64, ViewCacheBlock> m_viewCache;
+	QSize m_viewCacheCanvasSize;
+	qint64 m_viewCacheBytes;
+	quint64 m_viewCacheClock;
 	uint16_t m_sampleColorStampBuffer[DP_DRAW_CONTEXT_STAMP_BUFFER_SIZE];
 	int m_sampleColorLastDiameter;
 	DP_OnionSkins *m_onionSkins;
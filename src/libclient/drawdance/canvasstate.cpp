@@ -152,7 +152,7 @@ QImage CanvasState::toFlatImage(
     if(rect) {
         area = DP_rect_make(rect->x(), rect->y(), rect->width(), rect->height());
     }
-    DP_Image *img = DP_canvas_state_to_flat_image(
+    DP_Image *img = DP_canvas_state_to_flat_image_parallel(
         m_data, flags, rect ? &area : nullptr, vmf);
     return wrapImage(img);
 }
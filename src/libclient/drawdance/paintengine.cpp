@@ -240,12 +240,13 @@ struct BuildIndexParams {
 
 }
 
-bool PaintEngine::buildPlaybackIndex(BuildIndexProgressFn progressFn)
+bool PaintEngine::buildPlaybackIndex(
+	bool incremental, BuildIndexProgressFn progressFn)
 {
 	DrawContext drawContext = DrawContextPool::acquire();
 	BuildIndexParams params = {progressFn, 0};
 	return DP_paint_engine_playback_index_build(
-		m_data, drawContext.get(), PaintEngine::shouldSnapshot,
+		m_data, drawContext.get(), incremental, PaintEngine::shouldSnapshot,
 		PaintEngine::indexProgress, &params);
 }
 
@@ -264,6 +265,11 @@ size_t PaintEngine::playbackIndexEntryCount()
 	return DP_paint_engine_playback_index_entry_count(m_data);
 }
 
+bool PaintEngine::playbackIndexOutdated()
+{
+	return DP_paint_engine_playback_index_outdated(m_data);
+}
+
 QImage PaintEngine::playbackIndexThumbnailAt(size_t index)
 {
 	bool error;
@@ -398,10 +404,11 @@ bool PaintEngine::shouldSnapshot(void *user)
 	}
 }
 
-void PaintEngine::indexProgress(void *user, int percent)
+bool PaintEngine::indexProgress(
+	void *user, int percent, long long messageCount)
 {
 	BuildIndexParams *params = static_cast<BuildIndexParams *>(user);
-	params->progressFn(percent);
+	return params->progressFn(percent, messageCount);
 }
 
 const DP_Pixel8 *PaintEngine::getTransformPreviewPixels(void *user)
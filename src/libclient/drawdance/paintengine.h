@@ -29,7 +29,7 @@ enum RecordStartResult {
 
 class PaintEngine {
 public:
-	using BuildIndexProgressFn = std::function<void (int)>;
+	using BuildIndexProgressFn = std::function<bool (int, long long)>;
 
 	PaintEngine(
 		AclState &acls, SnapshotQueue &sq, bool wantCanvasHistoryDump,
@@ -95,10 +95,11 @@ public:
 	DP_PlayerResult jumpPlaybackTo(long long position, MessageList &outMsgs);
 	DP_PlayerResult beginPlayback();
 	DP_PlayerResult playPlayback(long long msecs, MessageList &outMsgs);
-	bool buildPlaybackIndex(BuildIndexProgressFn progressFn);
+	bool buildPlaybackIndex(bool incremental, BuildIndexProgressFn progressFn);
 	bool loadPlaybackIndex();
 	unsigned int playbackIndexMessageCount();
 	size_t playbackIndexEntryCount();
+	bool playbackIndexOutdated();
 	QImage playbackIndexThumbnailAt(size_t index);
 	DP_PlayerResult stepDumpPlayback(MessageList &outMsgs);
 	DP_PlayerResult jumpDumpPlaybackToPreviousReset(MessageList &outMsgs);
@@ -129,7 +130,8 @@ private:
 	static long long getTimeMs(void *);
 	static void pushMessage(void *user, DP_Message *msg);
 	static bool shouldSnapshot(void *user);
-	static void indexProgress(void *user, int percent);
+	static bool
+	indexProgress(void *user, int percent, long long messageCount);
 
 	static const DP_Pixel8 *getTransformPreviewPixels(void *user);
 	static void disposeTransformPreviewPixels(void *user);
@@ -145,10 +145,17 @@ void FfmpegExporter::writeFrame(const QImage &image, int repeat)
 		return;
 	}
 
-	{
-		QBuffer buf(&m_writebuffer);
-		buf.open(QIODevice::ReadWrite);
-		image.save(&buf, "BMP");
+	// Runs of identical frames are common, reuse the last encoded one.
+	if(image == m_lastframe) {
+		m_writebuffer = m_lastframebuffer;
+	} else {
+		{
+			QBuffer buf(&m_writebuffer);
+			buf.open(QIODevice::ReadWrite);
+			image.save(&buf, "BMP");
+		}
+		m_lastframe = image;
+		m_lastframebuffer = m_writebuffer;
 	}
 
 	m_written = 0;
@@ -40,6 +40,8 @@ private:
 
 	QProcess *m_encoder;
 	QByteArray m_writebuffer;
+	QImage m_lastframe;
+	QByteArray m_lastframebuffer;
 	qint64 m_written;
 	int m_repeats;
 };
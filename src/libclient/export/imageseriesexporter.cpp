@@ -1,5 +1,6 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 
+#include <QFile>
 #include <QFileInfo>
 #include <QImageWriter>
 #include <QDir>
@@ -13,6 +14,9 @@ ImageSeriesExporter::ImageSeriesExporter(QObject *parent)
 
 void ImageSeriesExporter::writeFrame(const QImage &image, int repeat)
 {
+	// Identical frames only get encoded once, repeats are plain file copies.
+	const bool reuseLast = !_lastpath.isEmpty() && image == _lastimage;
+
 	for(int f=1;f<=repeat;++f) {
 		QString filename = _filepattern;
 		filename.replace(QStringLiteral("{F}"), QString("%1").arg(frame() + f, 5, 10, QChar('0')));
@@ -20,12 +24,22 @@ void ImageSeriesExporter::writeFrame(const QImage &image, int repeat)
 
 		QString fullpath = QFileInfo(QDir(_path), filename).absoluteFilePath();
 
+		if(f > 1 || reuseLast) {
+			QFile::remove(fullpath);
+			if(QFile::copy(_lastpath, fullpath)) {
+				continue;
+			}
+		}
+
 		QImageWriter writer(fullpath, _format);
 		if(!writer.write(image)) {
+			_lastpath.clear();
 			emit exporterError(writer.errorString());
 			return;
 		}
+		_lastpath = fullpath;
 	}
+	_lastimage = image;
 	emit exporterReady();
 }
 
@@ -25,6 +25,8 @@ private:
 	QString _path;
 	QString _filepattern;
 	QByteArray _format;
+	QImage _lastimage;
+	QString _lastpath;
 };
 
 #endif // IMAGESERIESEXPORTER_H
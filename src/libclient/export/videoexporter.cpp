@@ -38,25 +38,31 @@ void VideoExporter::saveFrame(const QImage &image, int count)
 	}
 
 	if(!isVariableSize() && image.size() != _targetsize) {
-		QImage newframe = QImage(_targetsize, QImage::Format_RGB32);
-		newframe.fill(Qt::black);
-
-		QSize newsize = image.size().scaled(_targetsize, Qt::KeepAspectRatio);
-
-		QRect rect(
-					QPoint(
-						_targetsize.width()/2 - newsize.width()/2,
-						_targetsize.height()/2 - newsize.height()/2
-					),
-					newsize
-		);
-
-		QPainter painter(&newframe);
-		painter.setRenderHint(QPainter::SmoothPixmapTransform);
-		painter.drawImage(rect, image, QRect(QPoint(), image.size()));
-		painter.end();
-
-		frameImage = newframe;
+		if(image == _lastimage) {
+			frameImage = _lastframe;
+		} else {
+			QImage newframe = QImage(_targetsize, QImage::Format_RGB32);
+			newframe.fill(Qt::black);
+
+			QSize newsize = image.size().scaled(_targetsize, Qt::KeepAspectRatio);
+
+			QRect rect(
+						QPoint(
+							_targetsize.width()/2 - newsize.width()/2,
+							_targetsize.height()/2 - newsize.height()/2
+						),
+						newsize
+			);
+
+			QPainter painter(&newframe);
+			painter.setRenderHint(QPainter::SmoothPixmapTransform);
+			painter.drawImage(rect, image, QRect(QPoint(), image.size()));
+			painter.end();
+
+			frameImage = newframe;
+			_lastimage = image;
+			_lastframe = newframe;
+		}
 	}
 
 	writeFrame(frameImage, count);
@@ -6,8 +6,7 @@
 #include <QThread>
 #include <QString>
 #include <QSize>
-
-class QImage;
+#include <QImage>
 
 class VideoExporter : public QObject
 {
@@ -124,6 +123,11 @@ private:
 	bool _variablesize;
 	int _frame;
 	QSize _targetsize;
+
+	// Playback tends to produce runs of identical frames, remember the last
+	// one so that it doesn't get scaled all over again.
+	QImage _lastimage;
+	QImage _lastframe;
 };
 
 // https://gcc.gnu.org/bugzilla/show_bug.cgi?id=69210
@@ -154,6 +154,37 @@ void Client::sendMessage(const drawdance::Message &msg)
 }
 
 void Client::sendMessages(int count, const drawdance::Message *msgs)
+{
+	if(m_heldMessages.isEmpty()) {
+		sendFilteredMessages(count, msgs);
+	} else {
+		drawdance::MessageList &held = m_heldMessages.last();
+		for(int i = 0; i < count; ++i) {
+			held.append(msgs[i]);
+		}
+	}
+}
+
+void Client::holdMessages()
+{
+	m_heldMessages.enqueue(drawdance::MessageList{});
+}
+
+void Client::sendMessagesBeforeHeld(int count, const drawdance::Message *msgs)
+{
+	sendFilteredMessages(count, msgs);
+}
+
+void Client::releaseMessages()
+{
+	Q_ASSERT(!m_heldMessages.isEmpty());
+	if(!m_heldMessages.isEmpty()) {
+		drawdance::MessageList held = m_heldMessages.dequeue();
+		sendFilteredMessages(held.count(), held.constData());
+	}
+}
+
+void Client::sendFilteredMessages(int count, const drawdance::Message *msgs)
 {
 	if(m_compatibilityMode) {
 		QVector<drawdance::Message> compatibleMsgs = filterCompatibleMessages(count, msgs);
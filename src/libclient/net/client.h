@@ -3,9 +3,11 @@
 #ifndef DP_NET_CLIENT_H
 #define DP_NET_CLIENT_H
 
+#include "libclient/drawdance/message.h"
 #include "libclient/net/server.h"
 
 #include <QObject>
+#include <QQueue>
 #include <QSslCertificate>
 #include <QUrl>
 
@@ -13,10 +15,6 @@ class QJsonObject;
 class QJsonArray;
 struct DP_MsgData;
 
-namespace drawdance {
-	class Message;
-}
-
 namespace utils {
 	class AndroidWakeLock;
 	class AndroidWifiLock;
@@ -166,6 +164,28 @@ public slots:
 	 */
 	void sendResetMessages(int count, const drawdance::Message *msgs);
 
+	/**
+	 * @brief Hold back messages until a stroke has been sent in full
+	 *
+	 * Freehand strokes are finished on a worker thread, so their last messages
+	 * come in a little after the stroke has ended. Anything sent through
+	 * sendMessages in the meantime is held back so that it can't overtake the
+	 * stroke. Every call must be matched by a call to releaseMessages.
+	 */
+	void holdMessages();
+
+	/**
+	 * @brief Send messages ahead of anything being held back
+	 *
+	 * This is for the messages of the stroke that is being waited on.
+	 */
+	void sendMessagesBeforeHeld(int count, const drawdance::Message *msgs);
+
+	/**
+	 * @brief Send what was held back since the oldest call to holdMessages
+	 */
+	void releaseMessages();
+
 signals:
 	void messagesReceived(int count, const drawdance::Message *msgs);
 	void drawingCommandsLocal(int count, const drawdance::Message *msgs);
@@ -201,6 +221,7 @@ private slots:
 	void handleDisconnect(const QString &message, const QString &errorcode, bool localDisconnect);
 
 private:
+	void sendFilteredMessages(int count, const drawdance::Message *msgs);
 	void sendCompatibleMessages(int count, const drawdance::Message *msgs);
 	void sendCompatibleResetMessages(int count, const drawdance::Message *msgs);
 	QVector<drawdance::Message> filterCompatibleMessages(int count, const drawdance::Message *msgs);
@@ -226,6 +247,9 @@ private:
 	int m_catchupTo = 0;
 	int m_caughtUp = 0;
 	int m_catchupProgress = 0;
+
+	// One list for each holdMessages call that hasn't been released yet.
+	QQueue<drawdance::MessageList> m_heldMessages;
 };
 
 }
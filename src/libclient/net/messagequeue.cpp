@@ -37,6 +37,7 @@ MessageQueue::MessageQueue(QTcpSocket *socket, QObject *parent)
 	m_recvbuffer = new char[MAX_BUF_LEN];
 	m_recvbytes = 0;
 	m_sentbytes = 0;
+	m_decodeArena = DP_message_arena_new();
 
 	m_idleTimer = new QTimer(this);
 	m_idleTimer->setTimerType(Qt::CoarseTimer);
@@ -96,6 +97,7 @@ void MessageQueue::setArtificialLagMs(int msecs)
 MessageQueue::~MessageQueue()
 {
 	delete [] m_recvbuffer;
+	DP_message_arena_free(m_decodeArena);
 }
 
 bool MessageQueue::isPending() const
@@ -278,9 +280,13 @@ void MessageQueue::readData() {
 				}
 
 			} else {
-				// The rest are normal messages
+				// The rest are normal messages. Catching up to a session means
+				// receiving a whole lot of them, so we allocate them in bulk.
+				DP_MessageArena *prevArena =
+					DP_message_arena_activate(m_decodeArena);
 				drawdance::Message msg = drawdance::Message::deserialize(
 					reinterpret_cast<unsigned char *>(m_recvbuffer), m_recvbytes);
+				DP_message_arena_activate(prevArena);
 				if(msg.isNull()) {
 					qWarning("Error deserializing message: %s", DP_error());
 					emit badData(messageLength, type, static_cast<unsigned char>(m_recvbuffer[3]));
@@ -184,6 +184,7 @@ private:
 	int m_recvbytes;    // number of bytes in reception buffer
 	int m_sentbytes;    // number of bytes in upload buffer already sent
 
+	DP_MessageArena *m_decodeArena; // bulk allocation for received messages
 	drawdance::MessageList m_inbox;  // received (complete) messages
 	QQueue<drawdance::Message> m_outbox; // messages to be sent
 
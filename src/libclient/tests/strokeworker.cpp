@@ -0,0 +1,168 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "libclient/drawdance/global.h"
+#include "libclient/net/client.h"
+#include "libclient/tools/strokeworker.h"
+
+#include <QDateTime>
+#include <QtTest/QtTest>
+
+using tools::StrokeWorker;
+
+class TestStrokeWorker final : public QObject
+{
+	Q_OBJECT
+private slots:
+	void initTestCase()
+	{
+		drawdance::initCpuSupport();
+	}
+
+	void init()
+	{
+		m_received.clear();
+	}
+
+	void testFillingTheRingBuffer()
+	{
+		net::Client client;
+		StrokeWorker worker;
+		connectClient(client, worker);
+
+		// Way more samples than fit into the ring buffer at once, so pushing
+		// has to wait for the worker to make room.
+		const int sampleCount = 5000;
+		beginStroke(worker, client);
+		for(int i = 0; i < sampleCount; ++i) {
+			worker.strokeTo(point(i), drawdance::CanvasState{});
+		}
+		worker.endStroke(
+			QDateTime::currentMSecsSinceEpoch(), drawdance::CanvasState{},
+			&client);
+
+		loopUntilReceived(DP_MSG_PEN_UP);
+		QCOMPARE(m_received.first(), DP_MSG_UNDO_POINT);
+		QCOMPARE(m_received.last(), DP_MSG_PEN_UP);
+		QCOMPARE(m_received.count(DP_MSG_PEN_UP), 1);
+		QVERIFY(m_received.count() > 2);
+	}
+
+	void testEndStrokeDoesNotWait()
+	{
+		net::Client client;
+		StrokeWorker worker;
+		connectClient(client, worker);
+
+		beginStroke(worker, client);
+		for(int i = 0; i < 1000; ++i) {
+			worker.strokeTo(point(i), drawdance::CanvasState{});
+		}
+		worker.endStroke(
+			QDateTime::currentMSecsSinceEpoch(), drawdance::CanvasState{},
+			&client);
+
+		// Nothing of the stroke can have been sent yet, since that only
+		// happens through the event loop. An undo right after the stroke must
+		// not overtake it.
+		client.sendMessage(drawdance::Message::makeUndo(1, 0, false));
+		QVERIFY(!m_received.contains(DP_MSG_UNDO));
+
+		loopUntilReceived(DP_MSG_UNDO);
+		QCOMPARE(m_received.first(), DP_MSG_UNDO_POINT);
+		QCOMPARE(m_received.last(), DP_MSG_UNDO);
+		QCOMPARE(m_received.indexOf(DP_MSG_PEN_UP), m_received.count() - 2);
+
+		// Once the stroke is through, messages aren't held back anymore.
+		client.sendMessage(drawdance::Message::makeUndo(1, 0, true));
+		QCOMPARE(m_received.count(DP_MSG_UNDO), 2);
+	}
+
+	void testMessagesBetweenStrokesStayBetweenThem()
+	{
+		net::Client client;
+		StrokeWorker worker;
+		connectClient(client, worker);
+
+		// Two strokes ended before the GUI gets to send any of them, with
+		// something sent after each one.
+		for(int stroke = 0; stroke < 2; ++stroke) {
+			beginStroke(worker, client);
+			for(int i = 0; i < 500; ++i) {
+				worker.strokeTo(point(i), drawdance::CanvasState{});
+			}
+			worker.endStroke(
+				QDateTime::currentMSecsSinceEpoch(), drawdance::CanvasState{},
+				&client);
+			client.sendMessage(drawdance::Message::makeUndo(1, 0, false));
+		}
+		QVERIFY(!m_received.contains(DP_MSG_UNDO));
+
+		loopUntil([this]() {
+			return m_received.count(DP_MSG_UNDO) == 2;
+		});
+
+		int firstUndo = m_received.indexOf(DP_MSG_UNDO);
+		int secondUndo = m_received.lastIndexOf(DP_MSG_UNDO);
+		QCOMPARE(m_received.at(firstUndo - 1), DP_MSG_PEN_UP);
+		QCOMPARE(m_received.at(firstUndo + 1), DP_MSG_UNDO_POINT);
+		QCOMPARE(m_received.at(secondUndo - 1), DP_MSG_PEN_UP);
+		QCOMPARE(secondUndo, m_received.count() - 1);
+		QCOMPARE(m_received.count(DP_MSG_PEN_UP), 2);
+	}
+
+private:
+	void connectClient(net::Client &client, StrokeWorker &worker)
+	{
+		// Without a server, the client hands sent messages right back.
+		connect(
+			&client, &net::Client::messagesReceived, this,
+			[this](int count, const drawdance::Message *msgs) {
+				for(int i = 0; i < count; ++i) {
+					m_received.append(msgs[i].type());
+				}
+			});
+		connect(
+			&worker, &StrokeWorker::messagesAvailable, &worker,
+			[&client, &worker]() {
+				worker.sendMessagesTo(&client);
+			});
+	}
+
+	static void beginStroke(StrokeWorker &worker, net::Client &client)
+	{
+		DP_StrokeParams stroke = {1, 0, false};
+		worker.beginStroke(
+			brushes::ActiveBrush{}, stroke, client.myId(), 1.0f);
+	}
+
+	static canvas::Point point(int i)
+	{
+		return canvas::Point{
+			QDateTime::currentMSecsSinceEpoch(), qreal(i % 100),
+			qreal(i / 100), 1.0};
+	}
+
+	void loopUntilReceived(DP_MessageType type)
+	{
+		loopUntil([this, type]() {
+			return m_received.contains(type);
+		});
+	}
+
+	template <typename Condition> void loopUntil(Condition condition)
+	{
+		const int timeout = 5000;
+		QElapsedTimer t;
+		t.start();
+		while(!condition() && t.elapsed() < timeout) {
+			QCoreApplication::processEvents();
+		}
+		QVERIFY(t.elapsed() < timeout);
+	}
+
+	QVector<DP_MessageType> m_received;
+};
+
+
+QTEST_MAIN(TestStrokeWorker)
+#include "strokeworker.moc"
@@ -1,10 +1,5 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 
-extern "C" {
-#include <dpcommon/queue.h>
-#include <dpmsg/message.h>
-}
-
 #include "libclient/canvas/canvasmodel.h"
 #include "libclient/canvas/paintengine.h"
 #include "libclient/net/client.h"
@@ -15,28 +10,21 @@ extern "C" {
 #include "libshared/net/undo.h"
 #include <QDateTime>
 
-using std::placeholders::_1;
-
 namespace tools {
 
 Freehand::Freehand(ToolController &owner, bool isEraser)
 	: Tool(owner, isEraser ? ERASER : FREEHAND, Qt::CrossCursor, true, true, false)
-	, m_pollTimer{}
-	, m_brushEngine{std::bind(&Freehand::pollControl, this, _1)}
+	, m_strokeWorker{}
+	, m_brush{}
+	, m_stroke{}
 	, m_drawing(false)
 {
-	m_pollTimer.setSingleShot(false);
-	m_pollTimer.setTimerType(Qt::PreciseTimer);
-	// Krita sets the intervals like this, so since our stabilizer is based
-	// on theirs, we'll do it too. Don't know why it's higher in Windows.
-#ifdef Q_OS_WIN
-	m_pollTimer.setInterval(50);
-#else
-	m_pollTimer.setInterval(15);
-#endif
-	QObject::connect(&m_pollTimer, &QTimer::timeout, [this](){
-		poll();
-	});
+	// Emitted from the worker thread, so this ends up as a queued connection.
+	QObject::connect(
+		&m_strokeWorker, &StrokeWorker::messagesAvailable, &m_strokeWorker,
+		[this]() {
+			m_strokeWorker.sendMessagesTo(m_owner.client());
+		});
 }
 
 Freehand::~Freehand()
@@ -53,7 +41,10 @@ void Freehand::begin(const canvas::Point& point, bool right, float zoom)
 	m_drawing = true;
 	m_firstPoint = true;
 
-	m_owner.setBrushEngineBrush(m_brushEngine);
+	// The brush may change before the stroke actually starts on the worker
+	// thread, so hang onto the one that was active at the time.
+	m_brush = m_owner.activeBrush();
+	m_stroke = m_owner.strokeParams();
 
 	// The pressure value of the first point is unreliable
 	// because it is (or was?) possible to get a synthetic MousePress event
@@ -73,13 +64,11 @@ void Freehand::motion(const canvas::Point& point, bool constrain, bool center)
 
 	if(m_firstPoint) {
 		m_firstPoint = false;
-		m_brushEngine.beginStroke(m_owner.client()->myId(), true, m_zoom);
 		m_start.setPressure(qMin(m_start.pressure(), point.pressure()));
-		m_brushEngine.strokeTo(m_start, canvasState);
+		beginStroke(canvasState);
 	}
 
-	m_brushEngine.strokeTo(point, canvasState);
-	m_brushEngine.sendMessagesTo(m_owner.client());
+	m_strokeWorker.strokeTo(point, canvasState);
 }
 
 void Freehand::end()
@@ -91,37 +80,26 @@ void Freehand::end()
 
 		if(m_firstPoint) {
 			m_firstPoint = false;
-			m_brushEngine.beginStroke(m_owner.client()->myId(), true, m_zoom);
-			m_brushEngine.strokeTo(m_start, canvasState);
+			beginStroke(canvasState);
 		}
 
-		m_brushEngine.endStroke(QDateTime::currentMSecsSinceEpoch(), canvasState, true);
-		m_brushEngine.sendMessagesTo(m_owner.client());
+		m_strokeWorker.endStroke(
+			QDateTime::currentMSecsSinceEpoch(), canvasState, m_owner.client());
 	}
 }
 
 void Freehand::offsetActiveTool(int x, int y)
 {
 	if(m_drawing) {
-		m_brushEngine.addOffset(x, y);
+		m_strokeWorker.addOffset(x, y);
 	}
 }
 
-void Freehand::pollControl(bool enable)
+void Freehand::beginStroke(const drawdance::CanvasState &canvasState)
 {
-	if(enable) {
-		m_pollTimer.start();
-	} else {
-		m_pollTimer.stop();
-	}
-}
-
-void Freehand::poll()
-{
-	drawdance::CanvasState canvasState = m_owner.model()->paintEngine()->sampleCanvasState();
-	m_brushEngine.poll(QDateTime::currentMSecsSinceEpoch(), canvasState);
-	m_brushEngine.sendMessagesTo(m_owner.client());
+	m_strokeWorker.beginStroke(
+		m_brush, m_stroke, m_owner.client()->myId(), m_zoom);
+	m_strokeWorker.strokeTo(m_start, canvasState);
 }
 
 }
-
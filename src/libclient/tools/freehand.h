@@ -4,9 +4,7 @@
 #define TOOLS_FREEHAND_H
 
 #include "libclient/tools/tool.h"
-#include "libclient/drawdance/brushengine.h"
-#include "libclient/drawdance/message.h"
-#include <QTimer>
+#include "libclient/tools/strokeworker.h"
 
 namespace tools {
 
@@ -26,11 +24,11 @@ public:
 	void offsetActiveTool(int x, int y) override;
 
 private:
-	void pollControl(bool enable);
-	void poll();
+	void beginStroke(const drawdance::CanvasState &canvasState);
 
-	QTimer m_pollTimer;
-	drawdance::BrushEngine m_brushEngine;
+	StrokeWorker m_strokeWorker;
+	brushes::ActiveBrush m_brush;
+	DP_StrokeParams m_stroke;
 	bool m_drawing;
 	bool m_firstPoint;
 	canvas::Point m_start;
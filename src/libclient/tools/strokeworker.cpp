@@ -0,0 +1,233 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "libclient/tools/strokeworker.h"
+#include "libclient/net/client.h"
+#include <QDateTime>
+#include <QMutexLocker>
+
+namespace tools {
+
+// Krita sets the intervals like this, so since our stabilizer is based
+// on theirs, we'll do it too. Don't know why it's higher in Windows.
+#ifdef Q_OS_WIN
+static constexpr long long POLL_INTERVAL_MSEC = 50;
+#else
+static constexpr long long POLL_INTERVAL_MSEC = 15;
+#endif
+
+StrokeWorker::StrokeWorker(QObject *parent)
+	: QThread{parent}
+	, m_ring{}
+	, m_ringHead{0}
+	, m_ringTail{0}
+	, m_samplesPushed{}
+	, m_slotsFree{int(RING_CAPACITY)}
+	, m_endedStrokeClient{}
+	, m_endedStrokesPending{0}
+	, m_brushEngine{[this](bool enable) {
+		m_polling = enable;
+		m_lastPollMsec = QDateTime::currentMSecsSinceEpoch();
+	}}
+	, m_canvasState{}
+	, m_polling{false}
+	, m_lastPollMsec{0}
+	, m_outboxMutex{}
+	, m_outbox{}
+	, m_outboxStrokeEnds{}
+{
+}
+
+StrokeWorker::~StrokeWorker()
+{
+	if(isRunning()) {
+		Sample sample;
+		sample.type = Sample::Quit;
+		push(std::move(sample));
+		wait();
+	}
+	// The queued messagesAvailable signal won't arrive anymore, so send the
+	// rest now instead of having the client hold back messages forever.
+	if(m_endedStrokeClient) {
+		sendMessagesTo(m_endedStrokeClient);
+	}
+}
+
+void StrokeWorker::beginStroke(
+	const brushes::ActiveBrush &brush, const DP_StrokeParams &stroke,
+	unsigned int contextId, float zoom)
+{
+	if(!isRunning()) {
+		start();
+	}
+	Sample sample;
+	sample.type = Sample::Begin;
+	sample.begin = new StrokeBegin{brush, stroke, contextId, zoom};
+	push(std::move(sample));
+}
+
+void StrokeWorker::strokeTo(
+	const canvas::Point &point, const drawdance::CanvasState &cs)
+{
+	Sample sample;
+	sample.type = Sample::Motion;
+	sample.point = point;
+	sample.canvasState = cs;
+	push(std::move(sample));
+}
+
+void StrokeWorker::addOffset(float x, float y)
+{
+	Sample sample;
+	sample.type = Sample::Offset;
+	sample.offsetX = x;
+	sample.offsetY = y;
+	push(std::move(sample));
+}
+
+void StrokeWorker::endStroke(
+	long long timeMsec, const drawdance::CanvasState &cs, net::Client *client)
+{
+	Q_ASSERT(isRunning());
+	Sample sample;
+	sample.type = Sample::End;
+	sample.canvasState = cs;
+	sample.timeMsec = timeMsec;
+	push(std::move(sample));
+	client->holdMessages();
+	m_endedStrokeClient = client;
+	++m_endedStrokesPending;
+}
+
+void StrokeWorker::sendMessagesTo(net::Client *client)
+{
+	Q_ASSERT(client);
+	drawdance::MessageList msgs;
+	QVector<int> strokeEnds;
+	{
+		QMutexLocker locker{&m_outboxMutex};
+		msgs.swap(m_outbox);
+		strokeEnds.swap(m_outboxStrokeEnds);
+	}
+
+	int start = 0;
+	for(int end : strokeEnds) {
+		if(end > start) {
+			client->sendMessagesBeforeHeld(end - start, msgs.constData() + start);
+			start = end;
+		}
+		Q_ASSERT(m_endedStrokesPending > 0);
+		--m_endedStrokesPending;
+		if(m_endedStrokeClient) {
+			m_endedStrokeClient->releaseMessages();
+		}
+	}
+	if(m_endedStrokesPending == 0) {
+		m_endedStrokeClient.clear();
+	}
+
+	int count = msgs.count();
+	if(count > start) {
+		client->sendMessagesBeforeHeld(count - start, msgs.constData() + start);
+	}
+}
+
+void StrokeWorker::run()
+{
+	while(true) {
+		bool haveSample;
+		if(m_polling) {
+			long long now = QDateTime::currentMSecsSinceEpoch();
+			long long untilPoll = m_lastPollMsec + POLL_INTERVAL_MSEC - now;
+			haveSample =
+				untilPoll > 0 && m_samplesPushed.tryAcquire(1, int(untilPoll));
+			if(!haveSample) {
+				m_lastPollMsec = QDateTime::currentMSecsSinceEpoch();
+				m_brushEngine.poll(m_lastPollMsec, m_canvasState);
+			}
+		} else {
+			m_samplesPushed.acquire();
+			haveSample = true;
+		}
+
+		if(haveSample) {
+			unsigned int head = m_ringHead.loadAcquire();
+			Sample &sample = m_ring[head % RING_CAPACITY];
+			bool keepRunning = handle(sample);
+			sample.canvasState = drawdance::CanvasState{};
+			m_ringHead.storeRelease(head + 1);
+			m_slotsFree.release();
+			if(!keepRunning) {
+				return;
+			}
+		}
+
+		// Batch up the messages while we're behind on input, sending a
+		// signal across threads for every single sample is pointless.
+		if(m_samplesPushed.available() == 0) {
+			flushMessages();
+		}
+	}
+}
+
+void StrokeWorker::push(Sample &&sample)
+{
+	// If the worker is way behind, this waits for it to make room.
+	m_slotsFree.acquire();
+	unsigned int tail = m_ringTail.loadAcquire();
+	Q_ASSERT(tail - m_ringHead.loadAcquire() < RING_CAPACITY);
+	m_ring[tail % RING_CAPACITY] = std::move(sample);
+	m_ringTail.storeRelease(tail + 1);
+	m_samplesPushed.release();
+}
+
+bool StrokeWorker::handle(Sample &sample)
+{
+	switch(sample.type) {
+	case Sample::Begin: {
+		StrokeBegin *begin = sample.begin;
+		begin->brush.setInBrushEngine(m_brushEngine, begin->stroke);
+		m_brushEngine.beginStroke(begin->contextId, true, begin->zoom);
+		delete begin;
+		sample.begin = nullptr;
+		return true;
+	}
+	case Sample::Motion:
+		m_canvasState = sample.canvasState;
+		m_brushEngine.strokeTo(sample.point, m_canvasState);
+		return true;
+	case Sample::Offset:
+		m_brushEngine.addOffset(sample.offsetX, sample.offsetY);
+		return true;
+	case Sample::End:
+		m_brushEngine.endStroke(sample.timeMsec, sample.canvasState, true);
+		m_canvasState = drawdance::CanvasState{};
+		flushMessages(true);
+		return true;
+	case Sample::Quit:
+		return false;
+	}
+	Q_UNREACHABLE();
+}
+
+void StrokeWorker::flushMessages(bool strokeEnded)
+{
+	m_brushEngine.flushDabs();
+	const drawdance::MessageList &msgs = m_brushEngine.messages();
+	if(strokeEnded || !msgs.isEmpty()) {
+		bool wasEmpty;
+		{
+			QMutexLocker locker{&m_outboxMutex};
+			wasEmpty = m_outbox.isEmpty() && m_outboxStrokeEnds.isEmpty();
+			m_outbox.append(msgs);
+			if(strokeEnded) {
+				m_outboxStrokeEnds.append(m_outbox.count());
+			}
+		}
+		m_brushEngine.clearMessages();
+		if(wasEmpty) {
+			emit messagesAvailable();
+		}
+	}
+}
+
+}
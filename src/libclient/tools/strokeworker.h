@@ -0,0 +1,130 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef TOOLS_STROKEWORKER_H
+#define TOOLS_STROKEWORKER_H
+
+extern "C" {
+#include <dpengine/brush_engine.h>
+}
+
+#include "libclient/brushes/brush.h"
+#include "libclient/canvas/point.h"
+#include "libclient/drawdance/brushengine.h"
+#include "libclient/drawdance/canvasstate.h"
+#include "libclient/drawdance/message.h"
+#include <QAtomicInteger>
+#include <QMutex>
+#include <QPointer>
+#include <QSemaphore>
+#include <QThread>
+#include <QVector>
+
+namespace net {
+	class Client;
+}
+
+namespace tools {
+
+/**
+ * @brief Runs the brush engine for freehand strokes on its own thread
+ *
+ * The GUI thread only pushes pointer samples into a single-producer,
+ * single-consumer ring buffer. If the worker falls so far behind that the
+ * buffer fills up, pushing waits for it to make room. The worker thread turns
+ * the samples into dabs, runs the stabilizer and polls it while the pen is
+ * held still. The resulting messages get handed back through
+ * messagesAvailable, which is emitted on the worker thread, so connect it with
+ * a receiver living on the GUI thread that calls sendMessagesTo.
+ *
+ * All public functions must be called from the same (GUI) thread.
+ */
+class StrokeWorker final : public QThread
+{
+	Q_OBJECT
+public:
+	explicit StrokeWorker(QObject *parent = nullptr);
+	~StrokeWorker() override;
+
+	void beginStroke(
+		const brushes::ActiveBrush &brush, const DP_StrokeParams &stroke,
+		unsigned int contextId, float zoom);
+
+	void strokeTo(const canvas::Point &point, const drawdance::CanvasState &cs);
+
+	void addOffset(float x, float y);
+
+	/**
+	 * @brief End the stroke without waiting for the worker to finish it
+	 *
+	 * The client holds back anything sent through it from here on until the
+	 * last messages of the stroke come in through messagesAvailable, so
+	 * nothing can overtake the stroke.
+	 */
+	void endStroke(
+		long long timeMsec, const drawdance::CanvasState &cs,
+		net::Client *client);
+
+	/**
+	 * @brief Send the messages the worker has produced so far to the client
+	 *
+	 * For every stroke that the worker has finished since the last call, this
+	 * also releases what the client was holding back for it.
+	 */
+	void sendMessagesTo(net::Client *client);
+
+signals:
+	void messagesAvailable();
+
+protected:
+	void run() override;
+
+private:
+	static constexpr unsigned int RING_CAPACITY = 1024;
+
+	struct StrokeBegin {
+		brushes::ActiveBrush brush;
+		DP_StrokeParams stroke;
+		unsigned int contextId;
+		float zoom;
+	};
+
+	struct Sample {
+		enum Type { Begin, Motion, Offset, End, Quit } type = Motion;
+		canvas::Point point;
+		drawdance::CanvasState canvasState;
+		StrokeBegin *begin = nullptr;
+		float offsetX = 0.0f;
+		float offsetY = 0.0f;
+		long long timeMsec = 0;
+	};
+
+	void push(Sample &&sample);
+	bool handle(Sample &sample);
+	void flushMessages(bool strokeEnded = false);
+
+	Sample m_ring[RING_CAPACITY];
+	QAtomicInteger<unsigned int> m_ringHead;
+	QAtomicInteger<unsigned int> m_ringTail;
+	QSemaphore m_samplesPushed;
+	QSemaphore m_slotsFree;
+
+	// The client that's holding back messages for the strokes that have been
+	// ended, but whose last messages haven't been sent yet.
+	QPointer<net::Client> m_endedStrokeClient;
+	int m_endedStrokesPending;
+
+	// Only touched by the worker thread while it's running.
+	drawdance::BrushEngine m_brushEngine;
+	drawdance::CanvasState m_canvasState;
+	bool m_polling;
+	long long m_lastPollMsec;
+
+	QMutex m_outboxMutex;
+	drawdance::MessageList m_outbox;
+	// Positions in the outbox where a stroke ends.
+	QVector<int> m_outboxStrokeEnds;
+};
+
+}
+
+#endif
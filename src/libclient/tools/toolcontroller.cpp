@@ -382,15 +382,19 @@ void ToolController::offsetActiveTool(int xOffset, int yOffset)
 	m_smoother.addOffset(QPointF(xOffset, yOffset));
 }
 
-void ToolController::setBrushEngineBrush(drawdance::BrushEngine &be)
+DP_StrokeParams ToolController::strokeParams() const
 {
 	const brushes::ActiveBrush &brush = activeBrush();
-	DP_StrokeParams stroke = {
+	return {
 		activeLayer(),
 		m_stabilizerUseBrushSampleCount ? brush.stabilizerSampleCount() : m_stabilizerSampleCount,
 		m_stabilizerFinishStrokes,
 	};
-	brush.setInBrushEngine(be, stroke);
+}
+
+void ToolController::setBrushEngineBrush(drawdance::BrushEngine &be)
+{
+	activeBrush().setInBrushEngine(be, strokeParams());
 }
 
 }
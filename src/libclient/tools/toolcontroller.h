@@ -91,6 +91,9 @@ public:
 	 */
 	void offsetActiveTool(int xOffset, int yOffset);
 
+	//! Stroke parameters to go along with the active brush
+	DP_StrokeParams strokeParams() const;
+
 	/**
 	 * Set the active brush in the Drawdance brush engine.
 	 *
@@ -95,6 +95,8 @@ QJsonObject Client::description(bool includeSession) const
 	u["muted"] = isMuted();
 	u["mod"] = isModerator();
 	u["tls"] = isSecure();
+	u["messagesSent"] = d->msgqueue->messagesWritten();
+	u["socketWrites"] = d->msgqueue->socketWrites();
 	if(includeSession && d->session)
 		u["session"] = d->session->id();
 	return u;
@@ -263,6 +265,11 @@ void Client::setConnectionTimeout(int timeout)
 	d->msgqueue->setIdleTimeout(timeout);
 }
 
+void Client::setWriteBatchSize(int bytes)
+{
+	d->msgqueue->setWriteBatchSize(bytes);
+}
+
 #ifndef NDEBUG
 void Client::setRandomLag(uint lag)
 {
@@ -139,6 +139,12 @@ public:
 	 */
 	void setConnectionTimeout(int timeout);
 
+	/**
+	 * @brief Set the size at which batched outgoing messages are flushed
+	 * @param bytes batch size in bytes, or 0 to disable batching
+	 */
+	void setWriteBatchSize(int bytes);
+
 	/**
 	 * Get the timestamp of this client's last activity (i.e. non-keepalive message received)
 	 *
@@ -568,10 +568,13 @@ std::tuple<protocol::MessageList, int> FiledHistory::getBatch(int after) const
 
 void FiledHistory::historyAdd(const protocol::MessagePtr &msg)
 {
+	// History messages may stay in memory for a long while, so serialize
+	// straight into the file instead of caching the wire data with them
 	QVarLengthArray<char> buf(msg->length());
 	const int len = msg->serialize(buf.data());
 	Q_ASSERT(len == buf.length());
 	m_recording->write(buf.data(), len);
+	msg->clearWireData();
 
 	Block &b = m_blocks.last();
 	b.count++;
@@ -60,7 +60,8 @@ namespace config {
 		AutoresetThreshold(21, "autoResetThreshold", "15mb", ConfigKey::SIZE), // Default autoreset threshold in bytes
 		AllowCustomAvatars(22, "customAvatars", "true", ConfigKey::BOOL),      // Allow users to set a custom avatar when logging in
 		ExtAuthAvatars(23, "extAuthAvatars", "true", ConfigKey::BOOL),         // Use avatars received from ext-auth server (unless a custom avatar has been set)
-		ForceNsfm(24, "forceNsfm", "false", ConfigKey::BOOL)                   // Force NSFM flag to be set on all sessions
+		ForceNsfm(24, "forceNsfm", "false", ConfigKey::BOOL),                  // Force NSFM flag to be set on all sessions
+		WriteBatchSize(25, "writeBatchSize", "64kb", ConfigKey::SIZE)          // Size at which batched outgoing messages are flushed to a client's socket
 		;
 }
 
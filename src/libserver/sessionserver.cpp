@@ -24,6 +24,7 @@ SessionServer::SessionServer(ServerConfig *config, QObject *parent)
 	m_useFiledSessions(false)
 {
 	m_announcements = new sessionlisting::Announcements(config, this);
+	connect(m_config, &ServerConfig::configValueChanged, this, &SessionServer::onConfigValueChanged);
 
 	QTimer *cleanupTimer = new QTimer(this);
 	connect(cleanupTimer, &QTimer::timeout, this, &SessionServer::cleanupSessions);
@@ -35,6 +36,15 @@ SessionServer::SessionServer(ServerConfig *config, QObject *parent)
 #endif
 }
 
+void SessionServer::onConfigValueChanged(const ConfigKey &key)
+{
+	if(key.index == config::WriteBatchSize.index) {
+		const int writeBatchSize = m_config->getConfigSize(config::WriteBatchSize);
+		for(ThinServerClient *c : m_clients)
+			c->setWriteBatchSize(writeBatchSize);
+	}
+}
+
 void SessionServer::setSessionDir(const QDir &dir)
 {
 	if(dir.isReadable()) {
@@ -116,6 +126,9 @@ std::tuple<Session*, QString> SessionServer::createSession(const QString &id, co
 		return std::tuple<Session*, QString> { nullptr, "badProtocol" };
 	}
 
+	// TODO sessions, their clients and their history all run on this thread.
+	// Spreading them over a thread pool needs ServerConfig, Announcements,
+	// the ban lists and the JSON API to be made safe to call across threads.
 	Session *session = new ThinSession(initHistory(id, idAlias, protocolVersion, founder), m_config, m_announcements, this);
 
 	initSession(session);
@@ -212,6 +225,7 @@ void SessionServer::addClient(ThinServerClient *client)
 {
 	client->setParent(this);
 	client->setConnectionTimeout(m_config->getConfigTime(config::ClientTimeout) * 1000);
+	client->setWriteBatchSize(m_config->getConfigSize(config::WriteBatchSize));
 
 #ifndef NDEBUG
 	client->setRandomLag(m_randomlag);
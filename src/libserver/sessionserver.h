@@ -17,6 +17,7 @@ class Session;
 class SessionHistory;
 class ThinServerClient;
 class ServerConfig;
+class ConfigKey;
 class TemplateLoader;
 
 /**
@@ -170,6 +171,7 @@ private slots:
 	void removeClient(QObject *client);
 	void onSessionAttributeChanged(Session *session);
 	void cleanupSessions();
+	void onConfigValueChanged(const ConfigKey &key);
 
 private:
 	SessionHistory *initHistory(const QString &id, const QString alias, const protocol::ProtocolVersion &protocolVersion, const QString &founder);
@@ -211,6 +211,7 @@ bool DrawDabsClassic::extend(const DrawDabs &dabs)
 		qAbs(offsetY) > ClassicBrushDab::MAX_XY_DELTA)
 		return false;
 
+	clearWireData();
 	m_dabs.reserve(newLength);
 
 	dab.x = offsetX;
@@ -423,6 +424,7 @@ bool DrawDabsPixel::extend(const DrawDabs &dabs)
 		qAbs(offsetY) > ClassicBrushDab::MAX_XY_DELTA)
 		return false;
 
+	clearWireData();
 	m_dabs.reserve(newLength);
 
 	dab.x = offsetX;
@@ -129,7 +129,11 @@ public:
 	bool isIndirect() const override { return (m_color & 0xff000000) > 0; }
 
 	const ClassicBrushDabVector &dabs() const { return m_dabs; }
-	ClassicBrushDabVector &dabs() { return m_dabs; }
+	ClassicBrushDabVector &dabs()
+	{
+		clearWireData();
+		return m_dabs;
+	}
 
 	QString toString() const override;
 	QString messageName() const override { return QStringLiteral("classicdabs"); }
@@ -195,7 +199,11 @@ public:
 	bool isIndirect() const override { return (m_color & 0xff000000) > 0; }
 
 	const PixelBrushDabVector &dabs() const { return m_dabs; }
-	PixelBrushDabVector &dabs() { return m_dabs; }
+	PixelBrushDabVector &dabs()
+	{
+		clearWireData();
+		return m_dabs;
+	}
 
 	QString toString() const override;
 	QString messageName() const override { return isSquare() ? QStringLiteral("squarepixeldabs") : QStringLiteral("pixeldabs"); }
@@ -36,6 +36,15 @@ int Message::serialize(char *data) const
 	return HEADER_LEN + written;
 }
 
+QByteArray Message::wireData() const
+{
+	if(m_wire.isNull()) {
+		m_wire = QByteArray(length(), Qt::Uninitialized);
+		serialize(m_wire.data());
+	}
+	return m_wire;
+}
+
 bool Message::equals(const Message &m) const
 {
 	if(type() != m.type() || contextId() != m.contextId())
@@ -4,6 +4,7 @@
 #define DP_NET_MESSAGE_H
 
 #include <Qt>
+#include <QByteArray>
 #include <QMap>
 #include <QString>
 #include <QList>
@@ -91,7 +92,7 @@ public:
 	//! Length of the fixed message header
 	static const int HEADER_LEN = 4;
 
-	Message(MessageType type, uint8_t ctx): m_type(type), _undone(DONE), m_refcount(0), m_contextid(ctx) {}
+	Message(MessageType type, uint8_t ctx): m_type(type), _undone(DONE), m_refcount(0), m_contextid(ctx), m_queuedCount(0) {}
 	Message(Message &other) = delete;
 	Message(Message &&other) = delete;
 	Message &operator=(Message &other) = delete;
@@ -165,7 +166,13 @@ public:
 	 *
 	 * @param userid the new user id
 	 */
-	void setContextId(uint8_t userid) { m_contextid = userid; }
+	void setContextId(uint8_t userid)
+	{
+		if(userid != m_contextid) {
+			m_contextid = userid;
+			clearWireData();
+		}
+	}
 
 	/**
 	 * @brief Get the ID of the layer this command affects
@@ -218,6 +225,47 @@ public:
 	 */
 	int serialize(char *data) const;
 
+	/**
+	 * @brief Get the serialized form of this message
+	 *
+	 * The message is serialized on the first call and the result is cached,
+	 * so a message that is sent to many clients is only serialized once.
+	 * The returned array is implicitly shared with the cache.
+	 *
+	 * @return length() bytes of wire data
+	 */
+	QByteArray wireData() const;
+
+	/**
+	 * @brief Drop the cached serialized form of this message
+	 *
+	 * Anything that changes the payload must call this. Messages that are
+	 * kept in memory for a long time can also call it to avoid holding on
+	 * to a serialized copy of themselves.
+	 */
+	void clearWireData() const { m_wire.clear(); }
+
+	/**
+	 * @brief Note that this message was put into a send queue
+	 *
+	 * The cached wire data is dropped once every queue the message was put
+	 * into has called unqueued(). Messages that stick around after being
+	 * sent, like the ones in the session history, don't keep a serialized
+	 * copy of themselves that way.
+	 */
+	void queued() const { ++m_queuedCount; }
+
+	//! Note that a send queue is done with this message, see queued()
+	void unqueued() const
+	{
+		Q_ASSERT(m_queuedCount > 0);
+		if(--m_queuedCount == 0)
+			m_wire.clear();
+	}
+
+	//! Get the length of the cached wire data, 0 if there is none
+	int cachedWireLength() const { return m_wire.length(); }
+
 	/**
 	 * @brief get the length of the message from the given data
 	 *
@@ -307,6 +355,8 @@ private:
 	MessageUndoState _undone;
 	int m_refcount;
 	uint8_t m_contextid;
+	mutable int m_queuedCount;
+	mutable QByteArray m_wire;
 };
 
 // https://gcc.gnu.org/bugzilla/show_bug.cgi?id=69210
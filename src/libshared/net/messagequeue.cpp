@@ -18,12 +18,21 @@ namespace protocol {
 // Reserve enough buffer space for one complete message
 static const int MAX_BUF_LEN = 1024*64 + protocol::Message::HEADER_LEN;
 
+// Default upload buffer size at which batched messages are flushed
+static const int DEFAULT_WRITE_BATCH_SIZE = 1024*64;
+
+// Maximum number of bytes to read and decode in one go. When a client sends
+// more than this, the rest is processed on the next event loop iteration so
+// one busy connection can't starve the others sharing the same thread.
+static const int MAX_READ_PER_CALL = MAX_BUF_LEN * 4;
+
 MessageQueue::MessageQueue(QTcpSocket *socket, QObject *parent)
 	: QObject(parent), m_socket(socket),
 	  m_pingTimer(nullptr),
 	  m_lastRecvTime(0),
 	  m_idleTimeout(0), m_pingSent(0), m_closeWhenReady(false),
 	  m_ignoreIncoming(false),
+	  m_readScheduled(false),
 	  m_decodeOpaque(false)
 {
 	connect(socket, SIGNAL(readyRead()), this, SLOT(readData()));
@@ -34,10 +43,13 @@ MessageQueue::MessageQueue(QTcpSocket *socket, QObject *parent)
 	}
 
 	m_recvbuffer = new char[MAX_BUF_LEN];
-	m_sendbuffer = new char[MAX_BUF_LEN];
 	m_recvbytes = 0;
 	m_sentbytes = 0;
 	m_sendbuflen = 0;
+	m_sendingBatch = false;
+	m_writeBatchSize = DEFAULT_WRITE_BATCH_SIZE;
+	m_messagesWritten = 0;
+	m_socketWrites = 0;
 
 	m_idleTimer = new QTimer(this);
 	connect(m_idleTimer, &QTimer::timeout, this, &MessageQueue::checkIdleTimeout);
@@ -86,8 +98,8 @@ void MessageQueue::setPingInterval(int msecs)
 
 MessageQueue::~MessageQueue()
 {
+	clearOutbox();
 	delete [] m_recvbuffer;
-	delete [] m_sendbuffer;
 }
 
 bool MessageQueue::isPending() const
@@ -103,6 +115,7 @@ MessagePtr MessageQueue::getPending()
 void MessageQueue::send(const MessagePtr &message)
 {
 	if(!m_closeWhenReady) {
+		message->queued();
 		m_outbox.enqueue(message);
 		if(m_sendbuflen==0)
 			writeData();
@@ -112,6 +125,8 @@ void MessageQueue::send(const MessagePtr &message)
 void MessageQueue::send(const MessageList &messages)
 {
 	if(!m_closeWhenReady) {
+		for(const MessagePtr &msg : messages)
+			msg->queued();
 		m_outbox << messages;
 		if(m_sendbuflen==0)
 			writeData();
@@ -121,6 +136,7 @@ void MessageQueue::send(const MessageList &messages)
 void MessageQueue::sendNow(MessagePtr msg)
 {
 	if(!m_closeWhenReady) {
+		msg->queued();
 		m_outbox.prepend(msg);
 		if(m_sendbuflen==0)
 			writeData();
@@ -228,7 +244,17 @@ void MessageQueue::readData() {
 		// All messages extracted from buffer (if there were any):
 		// see if there are more bytes in the socket buffer
 		totalread += read;
-	} while(read>0);
+	} while(read>0 && totalread < MAX_READ_PER_CALL);
+
+	if(totalread >= MAX_READ_PER_CALL && !m_readScheduled && m_socket->bytesAvailable() > 0) {
+		// There's more data buffered, but readyRead won't be emitted again
+		// for it, so we have to come back for it ourselves.
+		m_readScheduled = true;
+		QTimer::singleShot(0, this, [this]() {
+			m_readScheduled = false;
+			readData();
+		});
+	}
 
 	if(totalread) {
 		m_lastRecvTime = QDateTime::currentMSecsSinceEpoch();
@@ -252,6 +278,60 @@ void MessageQueue::dataWritten(qint64 bytes)
 	}
 }
 
+void MessageQueue::fillSendBuffer()
+{
+	Q_ASSERT(m_sendbuflen == 0 && m_sentbytes == 0);
+	Q_ASSERT(!m_outbox.isEmpty());
+
+	MessagePtr msg = m_outbox.dequeue();
+	int count = 1;
+
+	if(m_outbox.isEmpty() || msg->length() >= m_writeBatchSize || msg->type() == protocol::MSG_DISCONNECT) {
+		// Nothing to batch: upload the message's wire data as is. The data
+		// is cached in the message and shared between all the queues the
+		// message is sent through.
+		m_sendbuffer = msg->wireData();
+		msg->unqueued();
+		m_sendingBatch = false;
+		m_sendbuflen = m_sendbuffer.length();
+
+	} else {
+		// Pack queued messages into one buffer until it's full enough.
+		// A disconnect notification always ends the batch. The buffer is
+		// kept around between batches, so it's only allocated once.
+		const int capacity = m_writeBatchSize + MAX_BUF_LEN;
+		if(m_batchbuffer.capacity() < capacity)
+			m_batchbuffer.reserve(capacity);
+		m_batchbuffer.resize(0);
+		m_batchbuffer.append(msg->wireData());
+		msg->unqueued();
+		while(!m_outbox.isEmpty() && m_batchbuffer.length() < m_writeBatchSize && msg->type() != protocol::MSG_DISCONNECT) {
+			msg = m_outbox.dequeue();
+			m_batchbuffer.append(msg->wireData());
+			msg->unqueued();
+			++count;
+		}
+		m_sendingBatch = true;
+		m_sendbuflen = m_batchbuffer.length();
+	}
+
+	m_messagesWritten += count;
+	Q_ASSERT(m_sendbuflen>0);
+
+	if(msg->type() == protocol::MSG_DISCONNECT) {
+		// Automatically disconnect after Disconnect notification is sent
+		m_closeWhenReady = true;
+		clearOutbox();
+	}
+}
+
+void MessageQueue::clearOutbox()
+{
+	for(const MessagePtr &msg : m_outbox)
+		msg->unqueued();
+	m_outbox.clear();
+}
+
 void MessageQueue::writeData() {
 	int sentBatch = 0;
 	bool sendMore = true;
@@ -260,18 +340,7 @@ void MessageQueue::writeData() {
 		sendMore = false;
 		if(m_sendbuflen==0 && !m_outbox.isEmpty()) {
 			// Upload buffer is empty, but there are messages in the outbox
-			Q_ASSERT(m_sentbytes == 0);
-
-			MessagePtr msg = m_outbox.dequeue();
-			m_sendbuflen = msg->serialize(m_sendbuffer);
-			Q_ASSERT(m_sendbuflen>0);
-			Q_ASSERT(m_sendbuflen <= MAX_BUF_LEN);
-
-			if(msg->type() == protocol::MSG_DISCONNECT) {
-				// Automatically disconnect after Disconnect notification is sent
-				m_closeWhenReady = true;
-				m_outbox.clear();
-			}
+			fillSendBuffer();
 		}
 
 		if(m_sentbytes < m_sendbuflen) {
@@ -282,7 +351,8 @@ void MessageQueue::writeData() {
 			}
 #endif
 
-			const int sent = m_socket->write(m_sendbuffer+m_sentbytes, m_sendbuflen-m_sentbytes);
+			const char *senddata = m_sendingBatch ? m_batchbuffer.constData() : m_sendbuffer.constData();
+			const int sent = m_socket->write(senddata+m_sentbytes, m_sendbuflen-m_sentbytes);
 			if(sent<0) {
 				// Error
 				emit socketError(m_socket->errorString());
@@ -290,10 +360,12 @@ void MessageQueue::writeData() {
 			}
 			m_sentbytes += sent;
 			sentBatch += sent;
+			++m_socketWrites;
 
 			Q_ASSERT(m_sentbytes <= m_sendbuflen);
 			if(m_sentbytes >= m_sendbuflen) {
-				// Complete message sent
+				// Complete batch sent
+				m_sendbuffer.clear();
 				m_sendbuflen=0;
 				m_sentbytes=0;
 				if(m_closeWhenReady) {
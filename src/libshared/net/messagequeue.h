@@ -104,6 +104,29 @@ public:
 	 */
 	void setPingInterval(int msecs);
 
+	/**
+	 * @brief Set the upload batch size in bytes
+	 *
+	 * Queued messages are packed into one upload buffer until it reaches
+	 * this size, then written to the socket in a single call. A batch
+	 * size of 0 disables batching.
+	 *
+	 * @param bytes flush threshold
+	 */
+	void setWriteBatchSize(int bytes) { m_writeBatchSize = qMax(1, bytes); }
+
+	/**
+	 * @brief Get the total number of messages written to the socket
+	 */
+	qint64 messagesWritten() const { return m_messagesWritten; }
+
+	/**
+	 * @brief Get the total number of socket write calls made
+	 *
+	 * Compare with messagesWritten() to see how well messages are batched.
+	 */
+	qint64 socketWrites() const { return m_socketWrites; }
+
 #ifndef NDEBUG
 	void setRandomLag(uint lag) { m_randomlag = lag; }
 #endif
@@ -166,15 +189,23 @@ private slots:
 private:
 	void sendNow(MessagePtr msg);
 
+	void fillSendBuffer();
+	void clearOutbox();
 	void writeData();
 
 	QTcpSocket *m_socket;
 
 	char *m_recvbuffer; // raw message reception buffer
-	char *m_sendbuffer; // raw message upload buffer
+	QByteArray m_sendbuffer; // wire data of a lone message being uploaded
+	QByteArray m_batchbuffer; // reused upload buffer for batched messages
+	bool m_sendingBatch; // uploading from the batch buffer
 	int m_recvbytes;    // number of bytes in reception buffer
 	int m_sentbytes;    // number of bytes in upload buffer already sent
 	int m_sendbuflen;   // length of the data in the upload buffer
+	int m_writeBatchSize; // upload buffer flush threshold
+
+	qint64 m_messagesWritten;
+	qint64 m_socketWrites;
 
 	QQueue<MessagePtr> m_inbox;  // pending messages
 	QQueue<MessagePtr> m_outbox; // messages to be sent
@@ -187,6 +218,7 @@ private:
 
 	bool m_closeWhenReady;
 	bool m_ignoreIncoming;
+	bool m_readScheduled;
 
 	bool m_decodeOpaque;
 
@@ -86,7 +86,11 @@ public:
 	static SessionOwner *fromText(uint8_t ctx, const Kwargs &kwargs);
 
 	QList<uint8_t> ids() const { return m_ids; }
-	void setIds(const QList<uint8_t> ids) { m_ids = ids; }
+	void setIds(const QList<uint8_t> ids)
+	{
+		m_ids = ids;
+		clearWireData();
+	}
 
 	QString messageName() const override { return "owner"; }
 
@@ -120,7 +124,11 @@ public:
 	static TrustedUsers *fromText(uint8_t ctx, const Kwargs &kwargs);
 
 	QList<uint8_t> ids() const { return m_ids; }
-	void setIds(const QList<uint8_t> ids) { m_ids = ids; }
+	void setIds(const QList<uint8_t> ids)
+	{
+		m_ids = ids;
+		clearWireData();
+	}
 
 	QString messageName() const override { return "trusted"; }
 
@@ -173,6 +173,174 @@ private slots:
 		loopUntil(allReceived);
 	}
 
+	void testBatchedSend()
+	{
+		auto mq = getMsgQueue();
+
+		const int sendCount = 100;
+
+		int countReceived = 0;
+		bool allReceived = false;
+
+		connect(mq.get(), &MessageQueue::messageAvailable, [&]() {
+			while(mq->isPending()) {
+				MessagePtr got = mq->getPending();
+				QCOMPARE(got->type(), MSG_CHAT);
+				QCOMPARE(got.cast<Chat>().message(), QString::number(countReceived));
+				if(++countReceived == sendCount)
+					allReceived = true;
+			}
+		});
+
+		// Messages enqueued all at once should be packed into few writes
+		MessageList msgs;
+		for(int i=0;i<sendCount;++i)
+			msgs << MessagePtr(new Chat(0, 0, 0, QByteArray::number(i)));
+		mq->send(msgs);
+
+		loopUntil(allReceived);
+		QCOMPARE(mq->messagesWritten(), qint64(sendCount));
+		QCOMPARE(mq->socketWrites(), qint64(1));
+	}
+
+	void testChangeBatchSizeWhileConnected()
+	{
+		auto mq = getMsgQueue();
+
+		const int sendCount = 20;
+
+		int countReceived = 0;
+		int expectReceived = sendCount;
+		bool allReceived = false;
+
+		connect(mq.get(), &MessageQueue::messageAvailable, [&]() {
+			while(mq->isPending()) {
+				mq->getPending();
+				if(++countReceived == expectReceived)
+					allReceived = true;
+			}
+		});
+
+		auto sendRound = [&]() {
+			MessageList msgs;
+			for(int i=0;i<sendCount;++i)
+				msgs << MessagePtr(new Chat(0, 0, 0, QByteArray::number(i)));
+			allReceived = false;
+			mq->send(msgs);
+			loopUntil(allReceived);
+			expectReceived += sendCount;
+		};
+
+		sendRound();
+		QCOMPARE(mq->socketWrites(), qint64(1));
+
+		// Shrinking the batch size must apply to the existing queue
+		mq->setWriteBatchSize(0);
+		sendRound();
+		QCOMPARE(mq->socketWrites(), qint64(1 + sendCount));
+
+		// And batching again reuses the upload buffer
+		mq->setWriteBatchSize(1024*64);
+		sendRound();
+		QCOMPARE(mq->socketWrites(), qint64(2 + sendCount));
+		QCOMPARE(mq->messagesWritten(), qint64(3 * sendCount));
+	}
+
+	void testLargeClientDoesNotStarveOthers()
+	{
+		const int floodCount = 32;
+		const QByteArray payload(60000, 'x');
+
+		auto big = getConnection();
+		auto small = getConnection();
+		QVERIFY(big->waitForConnected());
+		QVERIFY(small->waitForConnected());
+
+		QByteArray flood;
+		for(int i=0;i<floodCount;++i)
+			flood.append(Chat(0, 0, 0, payload).wireData());
+		const QByteArray single = Chat(0, 0, 0, QByteArray("hi")).wireData();
+		big->write(flood);
+		small->write(single);
+
+		// Let the echoes pile up in the sockets before anyone reads them
+		waitForBuffered(big.get(), flood.length());
+		waitForBuffered(small.get(), single.length());
+
+		MessageQueue bigQueue(big.get());
+		MessageQueue smallQueue(small.get());
+
+		int bigReceived = 0;
+		int bigReceivedBeforeSmall = -1;
+		bool allReceived = false;
+
+		connect(&bigQueue, &MessageQueue::messageAvailable, [&]() {
+			while(bigQueue.isPending()) {
+				bigQueue.getPending();
+				++bigReceived;
+			}
+			allReceived = bigReceived == floodCount && bigReceivedBeforeSmall >= 0;
+		});
+		connect(&smallQueue, &MessageQueue::messageAvailable, [&]() {
+			while(smallQueue.isPending()) {
+				smallQueue.getPending();
+				bigReceivedBeforeSmall = bigReceived;
+			}
+			allReceived = bigReceived == floodCount;
+		});
+
+		// The data is already buffered, so no more readyRead signals will come
+		// for it. Kick off reading the way the event loop would.
+		QMetaObject::invokeMethod(&bigQueue, "readData", Qt::QueuedConnection);
+		QMetaObject::invokeMethod(&smallQueue, "readData", Qt::QueuedConnection);
+
+		loopUntil(allReceived);
+
+		// The small client must have gotten its turn while the big one was
+		// still working through its backlog
+		QVERIFY(bigReceivedBeforeSmall >= 0);
+		QVERIFY(bigReceivedBeforeSmall < floodCount);
+	}
+
+	void testSentMessagesDontKeepWireData()
+	{
+		// Like the session history being sent to two clients. Once they've
+		// both gotten it, the messages shouldn't hold onto their wire data.
+		auto mq1 = getMsgQueue();
+		auto mq2 = getMsgQueue();
+
+		const int sendCount = 100;
+		MessageList history;
+		for(int i=0;i<sendCount;++i)
+			history << MessagePtr(new Chat(0, 0, 0, QByteArray(1000, 'x')));
+
+		int received1 = 0;
+		int received2 = 0;
+		bool allReceived = false;
+		auto receive = [&](MessageQueue *mq, int &received) {
+			while(mq->isPending()) {
+				mq->getPending();
+				++received;
+			}
+			allReceived = received1 == sendCount && received2 == sendCount;
+		};
+		connect(mq1.get(), &MessageQueue::messageAvailable, [&]() {
+			receive(mq1.get(), received1);
+		});
+		connect(mq2.get(), &MessageQueue::messageAvailable, [&]() {
+			receive(mq2.get(), received2);
+		});
+
+		mq1->send(history);
+		mq2->send(history);
+		loopUntil(allReceived);
+
+		int cachedBytes = 0;
+		for(const MessagePtr &msg : history)
+			cachedBytes += msg->cachedWireLength();
+		QCOMPARE(cachedBytes, 0);
+	}
+
 	void testSendDisconnect()
 	{
 		auto s = getConnection();
@@ -208,6 +376,13 @@ private:
 		return q;
 	}
 
+	void waitForBuffered(QTcpSocket *s, qint64 bytes)
+	{
+		while(s->bytesAvailable() < bytes && s->waitForReadyRead(3000)) {
+		}
+		QCOMPARE(s->bytesAvailable(), bytes);
+	}
+
 	void loopUntil(bool &condition) {
 		const int timeout = 3000;
 		QElapsedTimer t;
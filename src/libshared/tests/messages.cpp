@@ -108,6 +108,41 @@ private slots:
 		}
 	}
 
+	void testWireDataCaching()
+	{
+		MessagePtr msg = MessagePtr(new Chat(7, 0x01, 0x04, QByteArray("Test")));
+
+		QByteArray expected(msg->length(), 0);
+		msg->serialize(expected.data());
+
+		// Wire data should be serialized once and then shared
+		const QByteArray wire = msg->wireData();
+		QCOMPARE(wire, expected);
+		QCOMPARE(msg->wireData().constData(), wire.constData());
+
+		// Changing the context ID must invalidate the cached data
+		msg->setContextId(8);
+		const QByteArray rewired = msg->wireData();
+		QCOMPARE(rewired.at(3), char(8));
+		QCOMPARE(rewired.mid(4), expected.mid(4));
+	}
+
+	void testWireDataInvalidatedByPayloadChange()
+	{
+		SessionOwner owner(1, QList<uint8_t>() << 1 << 2);
+		const QByteArray before = owner.wireData();
+		owner.setIds(QList<uint8_t>() << 3);
+		QByteArray expected(owner.length(), 0);
+		owner.serialize(expected.data());
+		QVERIFY(owner.wireData() != before);
+		QCOMPARE(owner.wireData(), expected);
+
+		TrustedUsers trusted(1, QList<uint8_t>() << 1 << 2);
+		trusted.wireData();
+		trusted.setIds(QList<uint8_t>());
+		QCOMPARE(trusted.wireData().length(), trusted.length());
+	}
+
 	void testFilteredWrapping()
 	{
 		MessagePtr original = MessagePtr(new CanvasResize(1, 2, 3, 4, 5));
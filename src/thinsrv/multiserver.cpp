@@ -377,6 +377,7 @@ JsonApiResult MultiServer::serverJsonApi(JsonApiMethod method, const QStringList
 		config::AbuseReport,
 		config::ReportToken,
 		config::ForceNsfm,
+		config::WriteBatchSize,
 	};
 	const int settingCount = sizeof(settings) / sizeof(settings[0]);
 